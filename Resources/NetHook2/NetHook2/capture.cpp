@@ -0,0 +1,17 @@
+
+#include "capture.h"
+
+#include <chrono>
+
+
+uint64 CaptureTimestamp() noexcept
+{
+	return static_cast<uint64>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+uint64 CaptureWallClock() noexcept
+{
+	return static_cast<uint64>( std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch() ).count() );
+}
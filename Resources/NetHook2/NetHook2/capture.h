@@ -0,0 +1,92 @@
+
+#ifndef NETHOOK_CAPTURE_H_
+#define NETHOOK_CAPTURE_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Platform-neutral types shared by the capture pipeline: the hooks hand frames to a
+// CCaptureWriter, which drains them on its own thread into one or more ICaptureSinks.
+// Nothing in here (or in the capture*.h files) may depend on windows.h, and the capture*.cpp
+// files keep any OS specific code behind _WIN32, so the whole pipeline can be built and
+// driven with synthetic frames on Linux.
+
+#include <cstring>
+
+#include "steam/steamtypes.h"
+#include "steam/emsg.h"
+
+
+enum class ENetDirection
+{
+	k_eNetIncoming,
+	k_eNetOutgoing,
+};
+
+
+struct CaptureFrame_t
+{
+	// monotonically increasing per writer, assigned when the hook submits the frame
+	uint64 m_ullSequence;
+	// CaptureTimestamp() at submission time
+	uint64 m_ullTimestamp;
+	// opaque identifier of the connection the frame belongs to, 0 if unknown
+	uint64 m_ullConnection;
+
+	ENetDirection m_eDirection;
+
+	const uint8 *m_pubData;
+	uint32 m_cubData;
+};
+
+
+class ICaptureSink
+{
+
+public:
+	virtual ~ICaptureSink() {}
+
+	// called on the writer thread only, the frame data is only valid for the duration of the call
+	virtual void WriteFrame( const CaptureFrame_t &frame ) = 0;
+
+	// called on the writer thread whenever the queue has been drained
+	virtual void Flush() {}
+
+	// called on the writer thread when everything written so far has to survive a crash,
+	// see CCaptureWriter::RequestCommit
+	virtual void Commit() { Flush(); }
+
+};
+
+
+constexpr uint32 k_EMsgProtoMask = 0x80000000;
+
+inline uint32 CaptureGetRawEMsg( const uint8 *pubData, uint32 cubData ) noexcept
+{
+	uint32 unRawEMsg = 0;
+
+	if ( cubData >= sizeof( unRawEMsg ) )
+		memcpy( &unRawEMsg, pubData, sizeof( unRawEMsg ) );
+
+	return unRawEMsg;
+}
+
+inline EMsg CaptureGetEMsg( const uint8 *pubData, uint32 cubData ) noexcept
+{
+	return static_cast<EMsg>( CaptureGetRawEMsg( pubData, cubData ) & ~k_EMsgProtoMask );
+}
+
+inline bool CaptureIsProto( const uint8 *pubData, uint32 cubData ) noexcept
+{
+	return ( CaptureGetRawEMsg( pubData, cubData ) & k_EMsgProtoMask ) != 0;
+}
+
+
+// monotonic clock in nanoseconds, unrelated to wall clock time
+uint64 CaptureTimestamp() noexcept;
+
+// wall clock in microseconds since the unix epoch
+uint64 CaptureWallClock() noexcept;
+
+
+#endif // !NETHOOK_CAPTURE_H_
@@ -0,0 +1,258 @@
+
+#include "captureconfig.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "capturefile.h"
+#include "capturering.h"
+
+
+static char *TrimWhitespace( char *szValue ) noexcept
+{
+	while ( isspace( static_cast<unsigned char>( *szValue ) ) )
+		szValue++;
+
+	char *szEnd = szValue + strlen( szValue );
+
+	while ( szEnd > szValue && isspace( static_cast<unsigned char>( szEnd[ -1 ] ) ) )
+		*--szEnd = '\0';
+
+	return szValue;
+}
+
+static bool EqualsIgnoreCase( const char *szLeft, const char *szRight ) noexcept
+{
+	for ( ; *szLeft != '\0' && *szRight != '\0'; szLeft++, szRight++ )
+	{
+		if ( tolower( static_cast<unsigned char>( *szLeft ) ) != tolower( static_cast<unsigned char>( *szRight ) ) )
+			return false;
+	}
+
+	return *szLeft == *szRight;
+}
+
+static bool ParseBool( const char *szValue, bool *pbValue ) noexcept
+{
+	if ( EqualsIgnoreCase( szValue, "on" ) || EqualsIgnoreCase( szValue, "true" ) || EqualsIgnoreCase( szValue, "1" ) )
+		*pbValue = true;
+	else if ( EqualsIgnoreCase( szValue, "off" ) || EqualsIgnoreCase( szValue, "false" ) || EqualsIgnoreCase( szValue, "0" ) )
+		*pbValue = false;
+	else
+		return false;
+
+	return true;
+}
+
+
+CCaptureConfig::CCaptureConfig() noexcept
+	: m_eFormat( ECaptureFormat::k_eCaptureFormatSegmented ),
+	  m_cubSegmentMax( k_cubCaptureDefaultSegmentMax ),
+	  m_eCompression( k_ECaptureCodecDeflate ),
+	  m_cubBlock( k_cubCaptureDefaultBlock ),
+	  m_cCommitRecords( 0 ),
+	  m_cCommitIntervalMs( 1000 ),
+	  m_bCommitSync( true ),
+	  m_cubRing( k_cubCaptureDefaultRing ),
+	  m_eLogLevel( k_ELogLevelInfo ),
+	  m_cLatencyReportSeconds( 60 ),
+	  m_eInflateBackend( CZip::GetBackend()->GetType() ),
+	  m_bExpandMultis( true ),
+	  m_cMultiMaxDepth( CCaptureMultiExpander::k_cDefaultMaxDepth ),
+	  m_cubMultiMaxExpanded( CCaptureMultiExpander::k_cubDefaultMaxExpanded )
+{
+}
+
+bool CCaptureConfig::Load( const char *szPath )
+{
+	FILE *pFile = fopen( szPath, "r" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	char szLine[ 1024 ];
+	uint32 unLine = 0;
+
+	while ( fgets( szLine, sizeof( szLine ), pFile ) != nullptr )
+	{
+		unLine++;
+
+		char *szKey = TrimWhitespace( szLine );
+
+		if ( *szKey == '\0' || *szKey == '#' || *szKey == ';' )
+			continue;
+
+		char *szSeparator = strchr( szKey, '=' );
+
+		if ( szSeparator != nullptr )
+		{
+			*szSeparator = '\0';
+
+			if ( ApplySetting( TrimWhitespace( szKey ), TrimWhitespace( szSeparator + 1 ) ) )
+				continue;
+		}
+
+		NETHOOK_LOG_WARNING( "%s:%u: ignoring invalid setting '%s'\n", szPath, unLine, szKey );
+	}
+
+	fclose( pFile );
+	return true;
+}
+
+bool CCaptureConfig::ApplySetting( const char *szKey, const char *szValue )
+{
+	if ( EqualsIgnoreCase( szKey, "format" ) )
+	{
+		if ( EqualsIgnoreCase( szValue, "bin" ) )
+			m_eFormat = ECaptureFormat::k_eCaptureFormatDump;
+		else if ( EqualsIgnoreCase( szValue, "nhcap" ) )
+			m_eFormat = ECaptureFormat::k_eCaptureFormatSegmented;
+		else if ( EqualsIgnoreCase( szValue, "ring" ) )
+			m_eFormat = ECaptureFormat::k_eCaptureFormatRing;
+		else
+			return false;
+
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "segment_size" ) )
+	{
+		uint64 cubSegmentMax = 0;
+
+		if ( !CaptureParseSize( szValue, &cubSegmentMax ) || cubSegmentMax < 1024 * 1024 )
+			return false;
+
+		m_cubSegmentMax = cubSegmentMax;
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "compression" ) )
+	{
+		ECaptureCodec eCompression;
+
+		if ( EqualsIgnoreCase( szValue, "none" ) )
+			eCompression = k_ECaptureCodecNone;
+		else if ( EqualsIgnoreCase( szValue, "deflate" ) )
+			eCompression = k_ECaptureCodecDeflate;
+		else if ( EqualsIgnoreCase( szValue, "zstd" ) )
+			eCompression = k_ECaptureCodecZstd;
+		else
+			return false;
+
+		// zstd is optional at build time
+		if ( !CaptureCodecAvailable( eCompression ) )
+			return false;
+
+		m_eCompression = eCompression;
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "inflate_backend" ) )
+	{
+		EZipBackend eBackend;
+
+		if ( EqualsIgnoreCase( szValue, "zlib" ) )
+			eBackend = k_EZipBackendZlib;
+		else if ( EqualsIgnoreCase( szValue, "zlib-ng" ) )
+			eBackend = k_EZipBackendZlibNg;
+		else if ( EqualsIgnoreCase( szValue, "libdeflate" ) )
+			eBackend = k_EZipBackendLibdeflate;
+		else
+			return false;
+
+		// everything but zlib is optional at build time
+		if ( !CZip::IsBackendAvailable( eBackend ) )
+			return false;
+
+		m_eInflateBackend = eBackend;
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "expand_multis" ) )
+		return ParseBool( szValue, &m_bExpandMultis );
+
+	if ( EqualsIgnoreCase( szKey, "multi_max_depth" ) )
+	{
+		uint32 cMaxDepth = 0;
+
+		if ( !CaptureParseCount( szValue, &cMaxDepth ) || cMaxDepth == 0 )
+			return false;
+
+		m_cMultiMaxDepth = cMaxDepth;
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "multi_max_size" ) )
+	{
+		uint64 cubMaxExpanded = 0;
+
+		if ( !CaptureParseSize( szValue, &cubMaxExpanded ) || cubMaxExpanded == 0 )
+			return false;
+
+		m_cubMultiMaxExpanded = cubMaxExpanded;
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "block_size" ) )
+	{
+		uint64 cubBlock = 0;
+
+		if ( !CaptureParseSize( szValue, &cubBlock ) || cubBlock < 4 * 1024 || cubBlock > k_cubCaptureMaxBlock )
+			return false;
+
+		m_cubBlock = static_cast<uint32>( cubBlock );
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "commit_records" ) )
+		return CaptureParseCount( szValue, &m_cCommitRecords );
+
+	if ( EqualsIgnoreCase( szKey, "commit_interval" ) )
+		return CaptureParseCount( szValue, &m_cCommitIntervalMs );
+
+	if ( EqualsIgnoreCase( szKey, "commit_sync" ) )
+		return ParseBool( szValue, &m_bCommitSync );
+
+	if ( EqualsIgnoreCase( szKey, "log_level" ) )
+	{
+		if ( EqualsIgnoreCase( szValue, "debug" ) )
+			m_eLogLevel = k_ELogLevelDebug;
+		else if ( EqualsIgnoreCase( szValue, "info" ) )
+			m_eLogLevel = k_ELogLevelInfo;
+		else if ( EqualsIgnoreCase( szValue, "warning" ) )
+			m_eLogLevel = k_ELogLevelWarning;
+		else if ( EqualsIgnoreCase( szValue, "error" ) )
+			m_eLogLevel = k_ELogLevelError;
+		else
+			return false;
+
+		return true;
+	}
+
+	if ( EqualsIgnoreCase( szKey, "latency_report" ) )
+		return CaptureParseCount( szValue, &m_cLatencyReportSeconds );
+
+	if ( EqualsIgnoreCase( szKey, "filter_allow" ) )
+		return m_FilterRules.Add( szValue, true );
+
+	if ( EqualsIgnoreCase( szKey, "filter_deny" ) )
+		return m_FilterRules.Add( szValue, false );
+
+	if ( EqualsIgnoreCase( szKey, "ring_size" ) )
+	{
+		uint64 cubRing = 0;
+
+		// the whole ring has to fit in a single mapping, a larger size would also be cut short
+		// converting it to a size_t in a 32 bit process
+		if ( !CaptureParseSize( szValue, &cubRing ) || cubRing < 1024 * 1024 || cubRing > k_cubCaptureMaxRing )
+			return false;
+
+		m_cubRing = cubRing;
+		return true;
+	}
+
+	return false;
+}
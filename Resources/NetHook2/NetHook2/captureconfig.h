@@ -0,0 +1,62 @@
+
+#ifndef NETHOOK_CAPTURECONFIG_H_
+#define NETHOOK_CAPTURECONFIG_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "capture.h"
+#include "capturefile.h"
+#include "capturefilter.h"
+#include "capturemulti.h"
+#include "log.h"
+#include "zip.h"
+
+
+enum class ECaptureFormat
+{
+	// one NNN_<in|out>_<emsg>_<name>.bin file per message
+	k_eCaptureFormatDump,
+	// append-only segmented .nhcap capture, see capturefile.h
+	k_eCaptureFormatSegmented,
+	// fixed-size flight recorder ring holding the most recent traffic, see capturering.h
+	k_eCaptureFormatRing,
+};
+
+
+// Capture settings read from nethook.cfg in the nethook root directory when NetHook is
+// injected. The file is a list of "key = value" lines, blank lines and lines starting
+// with '#' or ';' are ignored. A missing file leaves every setting at its default.
+class CCaptureConfig
+{
+
+public:
+	CCaptureConfig() noexcept;
+
+	// returns false if the file could not be opened, malformed lines are logged and skipped
+	bool Load( const char *szPath );
+
+public:
+	ECaptureFormat m_eFormat;
+	uint64 m_cubSegmentMax;
+	ECaptureCodec m_eCompression;
+	uint32 m_cubBlock;
+	uint32 m_cCommitRecords;
+	uint32 m_cCommitIntervalMs;
+	bool m_bCommitSync;
+	uint64 m_cubRing;
+	ELogLevel m_eLogLevel;
+	uint32 m_cLatencyReportSeconds;
+	EZipBackend m_eInflateBackend;
+	bool m_bExpandMultis;
+	uint32 m_cMultiMaxDepth;
+	uint64 m_cubMultiMaxExpanded;
+	CCaptureFilterRules m_FilterRules;
+
+private:
+	bool ApplySetting( const char *szKey, const char *szValue );
+
+};
+
+
+#endif // !NETHOOK_CAPTURECONFIG_H_
@@ -0,0 +1,652 @@
+
+#include "capturefile.h"
+#include "captureindex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "zlib.h"
+
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+#ifdef NETHOOK_CAPTURE_ZSTD
+	#include "zstd.h"
+#endif
+
+#ifdef _WIN32
+	#define CaptureFileSeek _fseeki64
+	#define CaptureFileTell _ftelli64
+#else
+	#define CaptureFileSeek fseeko
+	#define CaptureFileTell ftello
+#endif
+
+
+// records are buffered in user space and written out in large sequential chunks
+constexpr size_t k_cubWriteBuffer = 1024 * 1024;
+
+
+std::string CaptureSegmentPath( const char *szBasePath, uint32 unSegment )
+{
+	char szSuffix[ 32 ];
+	snprintf( szSuffix, sizeof( szSuffix ), ".%04u.nhcap", unSegment );
+
+	return std::string( szBasePath ) + szSuffix;
+}
+
+bool CaptureBasePathFromSegment( const char *szSegmentPath, std::string *pBasePath )
+{
+	const size_t cchPath = strlen( szSegmentPath );
+	const size_t cchSuffix = strlen( ".0000.nhcap" );
+
+	if ( cchPath <= cchSuffix || strcmp( szSegmentPath + cchPath - 6, ".nhcap" ) != 0 || szSegmentPath[ cchPath - cchSuffix ] != '.' )
+		return false;
+
+	for ( size_t ich = cchPath - cchSuffix + 1; ich < cchPath - 6; ich++ )
+	{
+		if ( szSegmentPath[ ich ] < '0' || szSegmentPath[ ich ] > '9' )
+			return false;
+	}
+
+	pBasePath->assign( szSegmentPath, cchPath - cchSuffix );
+	return true;
+}
+
+bool CaptureParseCount( const char *szValue, uint32 *punValue ) noexcept
+{
+	char *szEnd = nullptr;
+
+	// strtoull takes a minus sign and wraps around
+	if ( *szValue < '0' || *szValue > '9' )
+		return false;
+
+	errno = 0;
+	const unsigned long long ullValue = strtoull( szValue, &szEnd, 10 );
+
+	if ( *szEnd != '\0' || errno == ERANGE || ullValue > UINT32_MAX )
+		return false;
+
+	*punValue = static_cast<uint32>( ullValue );
+	return true;
+}
+
+bool CaptureParseSize( const char *szValue, uint64 *pcubValue ) noexcept
+{
+	char *szSuffix = nullptr;
+
+	if ( *szValue < '0' || *szValue > '9' )
+		return false;
+
+	errno = 0;
+	const unsigned long long ullValue = strtoull( szValue, &szSuffix, 10 );
+
+	if ( errno == ERANGE )
+		return false;
+
+	uint64 ullMultiplier = 1;
+
+	switch ( *szSuffix )
+	{
+	case '\0':
+		break;
+
+	case 'K':
+	case 'k':
+		ullMultiplier = 1024ull;
+		break;
+
+	case 'M':
+	case 'm':
+		ullMultiplier = 1024ull * 1024;
+		break;
+
+	case 'G':
+	case 'g':
+		ullMultiplier = 1024ull * 1024 * 1024;
+		break;
+
+	default:
+		return false;
+	}
+
+	if ( ullMultiplier != 1 && szSuffix[ 1 ] != '\0' )
+		return false;
+
+	if ( ullValue > UINT64_MAX / ullMultiplier )
+		return false;
+
+	*pcubValue = ullValue * ullMultiplier;
+	return true;
+}
+
+uint32 CaptureCRC( const uint8 *pubData, uint32 cubData ) noexcept
+{
+	return static_cast<uint32>( crc32( crc32( 0L, Z_NULL, 0 ), pubData, cubData ) );
+}
+
+bool CaptureCodecAvailable( ECaptureCodec eCodec ) noexcept
+{
+	switch ( eCodec )
+	{
+	case k_ECaptureCodecNone:
+	case k_ECaptureCodecDeflate:
+		return true;
+
+#ifdef NETHOOK_CAPTURE_ZSTD
+	case k_ECaptureCodecZstd:
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+// false if the codec failed or the block didn't get any smaller
+static bool CompressBlock( ECaptureCodec eCodec, const uint8 *pubData, uint32 cubData, std::vector<uint8> *pCompressed )
+{
+	switch ( eCodec )
+	{
+	case k_ECaptureCodecDeflate:
+	{
+		uLongf cubCompressed = compressBound( cubData );
+		pCompressed->resize( cubCompressed );
+
+		if ( compress2( pCompressed->data(), &cubCompressed, pubData, cubData, Z_DEFAULT_COMPRESSION ) != Z_OK )
+			return false;
+
+		pCompressed->resize( cubCompressed );
+		break;
+	}
+
+#ifdef NETHOOK_CAPTURE_ZSTD
+	case k_ECaptureCodecZstd:
+	{
+		pCompressed->resize( ZSTD_compressBound( cubData ) );
+
+		const size_t cubCompressed = ZSTD_compress( pCompressed->data(), pCompressed->size(), pubData, cubData, ZSTD_CLEVEL_DEFAULT );
+
+		if ( ZSTD_isError( cubCompressed ) )
+			return false;
+
+		pCompressed->resize( cubCompressed );
+		break;
+	}
+#endif
+
+	default:
+		return false;
+	}
+
+	return pCompressed->size() < cubData;
+}
+
+static bool DecompressBlock( ECaptureCodec eCodec, const uint8 *pubCompressed, uint32 cubCompressed, uint8 *pubData, uint32 cubData )
+{
+	switch ( eCodec )
+	{
+	case k_ECaptureCodecNone:
+		if ( cubCompressed != cubData )
+			return false;
+
+		memcpy( pubData, pubCompressed, cubData );
+		return true;
+
+	case k_ECaptureCodecDeflate:
+	{
+		uLongf cubUncompressed = cubData;
+		return uncompress( pubData, &cubUncompressed, pubCompressed, cubCompressed ) == Z_OK && cubUncompressed == cubData;
+	}
+
+#ifdef NETHOOK_CAPTURE_ZSTD
+	case k_ECaptureCodecZstd:
+		return ZSTD_decompress( pubData, cubData, pubCompressed, cubCompressed ) == cubData;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+
+CCaptureFileWriter::CCaptureFileWriter( const char *szBasePath, uint64 cubSegmentMax )
+	: m_BasePath( szBasePath ),
+	  m_cubSegmentMax( cubSegmentMax ),
+	  m_pFile( nullptr ),
+	  m_unSegment( 0 ),
+	  m_cubSegment( 0 ),
+	  m_ullOffset( 0 ),
+	  m_eCodec( k_ECaptureCodecNone ),
+	  m_eSegmentCodec( k_ECaptureCodecNone ),
+	  m_cubBlock( k_cubCaptureDefaultBlock ),
+	  m_ullBlockOffset( 0 ),
+	  m_ullTimestampBase( 0 ),
+	  m_ullWallClockBase( 0 ),
+	  m_pIndex( new CCaptureIndexBuilder() )
+{
+}
+
+CCaptureFileWriter::~CCaptureFileWriter()
+{
+	Close();
+
+	delete m_pIndex;
+}
+
+bool CCaptureFileWriter::SetCompression( ECaptureCodec eCodec, uint32 cubBlock )
+{
+	if ( !CaptureCodecAvailable( eCodec ) || cubBlock == 0 || cubBlock > k_cubCaptureMaxBlock )
+		return false;
+
+	m_eCodec = eCodec;
+	m_cubBlock = cubBlock;
+
+	return true;
+}
+
+bool CCaptureFileWriter::Open()
+{
+	return Open( CaptureTimestamp(), CaptureWallClock() );
+}
+
+bool CCaptureFileWriter::Open( uint64 ullTimestampBase, uint64 ullWallClockBase )
+{
+	m_ullTimestampBase = ullTimestampBase;
+	m_ullWallClockBase = ullWallClockBase;
+
+	return OpenSegment( 0 );
+}
+
+void CCaptureFileWriter::Close()
+{
+	if ( m_pFile == nullptr )
+		return;
+
+	WriteBlock();
+
+	fclose( m_pFile );
+	m_pFile = nullptr;
+
+	// a missing index only costs readers a scan, so failing to write one isn't fatal
+	m_pIndex->Save( CaptureIndexPath( m_BasePath.c_str(), m_unSegment ).c_str(), m_cubSegment );
+}
+
+bool CCaptureFileWriter::OpenSegment( uint32 unSegment )
+{
+	Close();
+
+	const std::string segmentPath = CaptureSegmentPath( m_BasePath.c_str(), unSegment );
+
+	m_pFile = fopen( segmentPath.c_str(), "wb" );
+
+	if ( m_pFile == nullptr )
+		return false;
+
+	setvbuf( m_pFile, nullptr, _IOFBF, k_cubWriteBuffer );
+
+	m_pIndex->Reset( m_ullTimestampBase, m_ullWallClockBase );
+
+	CaptureFileHeader_t header = { };
+	header.m_unMagic = k_unCaptureFileMagic;
+	header.m_usVersion = k_usCaptureFileVersion;
+	header.m_cubHeader = sizeof( header );
+	header.m_unSegment = unSegment;
+	header.m_unFlags = ( m_eCodec != k_ECaptureCodecNone ? k_ECaptureFileFlagCompressed : 0 );
+	header.m_ullTimestampBase = m_ullTimestampBase;
+	header.m_ullWallClockBase = m_ullWallClockBase;
+
+	m_unSegment = unSegment;
+	m_cubSegment = fwrite( &header, 1, sizeof( header ), m_pFile );
+	m_ullOffset = m_cubSegment;
+
+	m_eSegmentCodec = m_eCodec;
+	m_Block.clear();
+
+	return m_cubSegment == sizeof( header );
+}
+
+bool CCaptureFileWriter::WriteRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint32 cubData )
+{
+	if ( m_pFile == nullptr || cubData > k_cubCaptureMaxRecord )
+		return false;
+
+	// for compressed segments this assumes the pending block won't compress at all
+	if ( m_ullOffset > sizeof( CaptureFileHeader_t ) && m_cubSegment + m_Block.size() + sizeof( header ) + cubData > m_cubSegmentMax )
+	{
+		if ( !OpenSegment( m_unSegment + 1 ) )
+			return false;
+	}
+
+	CaptureRecordHeader_t record = header;
+	record.m_unMagic = k_unCaptureRecordMagic;
+	record.m_cubData = cubData;
+	record.m_unCRC = CaptureCRC( pubData, cubData );
+
+	const uint64 ullOffset = m_ullOffset;
+
+	if ( m_eSegmentCodec != k_ECaptureCodecNone )
+	{
+		if ( !m_Block.empty() && m_Block.size() + sizeof( record ) + cubData > m_cubBlock && !WriteBlock() )
+			return false;
+
+		if ( m_Block.empty() )
+			m_ullBlockOffset = m_ullOffset;
+
+		m_Block.insert( m_Block.end(), reinterpret_cast<const uint8 *>( &record ), reinterpret_cast<const uint8 *>( &record + 1 ) );
+		m_Block.insert( m_Block.end(), pubData, pubData + cubData );
+
+		m_ullOffset += sizeof( record ) + cubData;
+
+		if ( m_Block.size() >= m_cubBlock && !WriteBlock() )
+			return false;
+	}
+	else
+	{
+		size_t cubWritten = fwrite( &record, 1, sizeof( record ), m_pFile );
+		cubWritten += fwrite( pubData, 1, cubData, m_pFile );
+
+		m_cubSegment += cubWritten;
+		m_ullOffset = m_cubSegment;
+
+		if ( cubWritten != sizeof( record ) + cubData )
+			return false;
+	}
+
+	m_pIndex->AddRecord( record, pubData, ullOffset );
+	return true;
+}
+
+bool CCaptureFileWriter::WriteBlock()
+{
+	if ( m_Block.empty() )
+		return true;
+
+	const uint32 cubBlock = static_cast<uint32>( m_Block.size() );
+
+	CaptureBlockHeader_t block = { };
+	block.m_unMagic = k_unCaptureBlockMagic;
+	block.m_eCodec = static_cast<uint8>( m_eSegmentCodec );
+	block.m_cubUncompressed = cubBlock;
+	block.m_ullOffset = m_ullBlockOffset;
+
+	const uint8 *pubBlock = nullptr;
+
+	// incompressible blocks are stored as they are
+	if ( !CompressBlock( m_eSegmentCodec, m_Block.data(), cubBlock, &m_Compressed ) )
+	{
+		block.m_eCodec = k_ECaptureCodecNone;
+		pubBlock = m_Block.data();
+		block.m_cubCompressed = cubBlock;
+	}
+	else
+	{
+		pubBlock = m_Compressed.data();
+		block.m_cubCompressed = static_cast<uint32>( m_Compressed.size() );
+	}
+
+	block.m_unCRC = CaptureCRC( pubBlock, block.m_cubCompressed );
+
+	CaptureBlockEntry_t entry;
+	entry.m_ullFileOffset = m_cubSegment;
+	entry.m_ullOffset = m_ullBlockOffset;
+
+	size_t cubWritten = fwrite( &block, 1, sizeof( block ), m_pFile );
+	cubWritten += fwrite( pubBlock, 1, block.m_cubCompressed, m_pFile );
+
+	m_cubSegment += cubWritten;
+	m_Block.clear();
+
+	if ( cubWritten != sizeof( block ) + block.m_cubCompressed )
+		return false;
+
+	m_pIndex->AddBlock( entry );
+	return true;
+}
+
+void CCaptureFileWriter::Flush() noexcept
+{
+	if ( m_pFile != nullptr )
+		fflush( m_pFile );
+}
+
+bool CCaptureFileWriter::Commit( bool bSync )
+{
+	if ( m_pFile == nullptr )
+		return false;
+
+	if ( !WriteBlock() || fflush( m_pFile ) != 0 )
+		return false;
+
+	if ( !bSync )
+		return true;
+
+#ifdef _WIN32
+	return _commit( _fileno( m_pFile ) ) == 0;
+#else
+	return fsync( fileno( m_pFile ) ) == 0;
+#endif
+}
+
+
+CCaptureFileReader::CCaptureFileReader() noexcept
+	: m_pFile( nullptr ),
+	  m_Header(),
+	  m_bCompressed( false ),
+	  m_ullBlockOffset( 0 ),
+	  m_ubBlockPosition( 0 )
+{
+}
+
+CCaptureFileReader::~CCaptureFileReader()
+{
+	Close();
+}
+
+bool CCaptureFileReader::Open( const char *szPath )
+{
+	Close();
+
+	m_pFile = fopen( szPath, "rb" );
+
+	if ( m_pFile == nullptr )
+		return false;
+
+	if ( fread( &m_Header, 1, sizeof( m_Header ), m_pFile ) != sizeof( m_Header ) ||
+		m_Header.m_unMagic != k_unCaptureFileMagic ||
+		m_Header.m_cubHeader < sizeof( m_Header ) )
+	{
+		Close();
+		return false;
+	}
+
+	m_bCompressed = ( m_Header.m_unFlags & k_ECaptureFileFlagCompressed ) != 0;
+	m_Blocks.clear();
+	m_Block.clear();
+
+	// newer writers may append fields to the header
+	return Seek( m_Header.m_cubHeader );
+}
+
+void CCaptureFileReader::Close() noexcept
+{
+	if ( m_pFile == nullptr )
+		return;
+
+	fclose( m_pFile );
+	m_pFile = nullptr;
+}
+
+ECaptureReadResult CCaptureFileReader::ReadRecord( CaptureRecordHeader_t *pHeader, std::vector<uint8> *pPayload )
+{
+	if ( m_bCompressed )
+	{
+		if ( m_ubBlockPosition >= m_Block.size() )
+		{
+			const ECaptureReadResult eResult = ReadBlock();
+
+			if ( eResult != ECaptureReadResult::k_eCaptureReadOK )
+				return eResult;
+		}
+
+		const size_t cubRemaining = m_Block.size() - m_ubBlockPosition;
+
+		if ( cubRemaining < sizeof( *pHeader ) )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		const uint8 *pubRecord = m_Block.data() + m_ubBlockPosition;
+		memcpy( pHeader, pubRecord, sizeof( *pHeader ) );
+
+		if ( pHeader->m_unMagic != k_unCaptureRecordMagic || pHeader->m_cubData > cubRemaining - sizeof( *pHeader ) )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		pPayload->assign( pubRecord + sizeof( *pHeader ), pubRecord + sizeof( *pHeader ) + pHeader->m_cubData );
+		m_ubBlockPosition += sizeof( *pHeader ) + pHeader->m_cubData;
+
+		if ( CaptureCRC( pPayload->data(), pHeader->m_cubData ) != pHeader->m_unCRC )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		return ECaptureReadResult::k_eCaptureReadOK;
+	}
+
+	const size_t cubHeader = fread( pHeader, 1, sizeof( *pHeader ), m_pFile );
+
+	if ( cubHeader == 0 && feof( m_pFile ) )
+		return ECaptureReadResult::k_eCaptureReadEnd;
+
+	// the length isn't covered by the CRC, a damaged one mustn't turn into a huge allocation
+	if ( cubHeader != sizeof( *pHeader ) || pHeader->m_unMagic != k_unCaptureRecordMagic || pHeader->m_cubData > k_cubCaptureMaxRecord )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	pPayload->resize( pHeader->m_cubData );
+
+	if ( pHeader->m_cubData != 0 && fread( pPayload->data(), 1, pHeader->m_cubData, m_pFile ) != pHeader->m_cubData )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	if ( CaptureCRC( pPayload->data(), pHeader->m_cubData ) != pHeader->m_unCRC )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	return ECaptureReadResult::k_eCaptureReadOK;
+}
+
+uint64 CCaptureFileReader::Tell() const noexcept
+{
+	if ( m_bCompressed )
+		return m_ullBlockOffset + m_ubBlockPosition;
+
+	return static_cast<uint64>( CaptureFileTell( m_pFile ) );
+}
+
+bool CCaptureFileReader::Seek( uint64 ullOffset )
+{
+	if ( !m_bCompressed )
+		return CaptureFileSeek( m_pFile, static_cast<int64>( ullOffset ), SEEK_SET ) == 0;
+
+	// most seeks stay within the block we already have
+	if ( !m_Block.empty() && ullOffset >= m_ullBlockOffset && ullOffset - m_ullBlockOffset <= m_Block.size() )
+	{
+		m_ubBlockPosition = static_cast<size_t>( ullOffset - m_ullBlockOffset );
+		return true;
+	}
+
+	if ( ullOffset == m_Header.m_cubHeader )
+	{
+		m_Block.clear();
+		m_ullBlockOffset = ullOffset;
+		m_ubBlockPosition = 0;
+
+		return CaptureFileSeek( m_pFile, static_cast<int64>( m_Header.m_cubHeader ), SEEK_SET ) == 0;
+	}
+
+	if ( m_Blocks.empty() && !BuildBlockTable() )
+		return false;
+
+	auto itBlock = std::upper_bound( m_Blocks.begin(), m_Blocks.end(), ullOffset,
+		[]( uint64 ullValue, const CaptureBlockEntry_t &block ) { return ullValue < block.m_ullOffset; } );
+
+	if ( itBlock == m_Blocks.begin() )
+		return false;
+
+	--itBlock;
+
+	if ( CaptureFileSeek( m_pFile, static_cast<int64>( itBlock->m_ullFileOffset ), SEEK_SET ) != 0 || ReadBlock() != ECaptureReadResult::k_eCaptureReadOK )
+		return false;
+
+	if ( ullOffset - m_ullBlockOffset > m_Block.size() )
+		return false;
+
+	m_ubBlockPosition = static_cast<size_t>( ullOffset - m_ullBlockOffset );
+	return true;
+}
+
+void CCaptureFileReader::SetBlockTable( const CaptureBlockEntry_t *pBlocks, uint32 cBlocks )
+{
+	m_Blocks.assign( pBlocks, pBlocks + cBlocks );
+}
+
+ECaptureReadResult CCaptureFileReader::ReadBlock()
+{
+	CaptureBlockHeader_t block;
+	const size_t cubHeader = fread( &block, 1, sizeof( block ), m_pFile );
+
+	if ( cubHeader == 0 && feof( m_pFile ) )
+		return ECaptureReadResult::k_eCaptureReadEnd;
+
+	if ( cubHeader != sizeof( block ) || block.m_unMagic != k_unCaptureBlockMagic )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	// the sizes aren't covered by the CRC. A block is at most cubBlock or a single record, and
+	// blocks that don't compress are stored as they are.
+	const uint32 cubMaxBlock = std::max<uint32>( k_cubCaptureMaxBlock, sizeof( CaptureRecordHeader_t ) + k_cubCaptureMaxRecord );
+
+	if ( block.m_cubUncompressed > cubMaxBlock || block.m_cubCompressed > block.m_cubUncompressed )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	m_Compressed.resize( block.m_cubCompressed );
+
+	if ( block.m_cubCompressed != 0 && fread( m_Compressed.data(), 1, block.m_cubCompressed, m_pFile ) != block.m_cubCompressed )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	if ( CaptureCRC( m_Compressed.data(), block.m_cubCompressed ) != block.m_unCRC )
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+	m_Block.resize( block.m_cubUncompressed );
+	m_ullBlockOffset = block.m_ullOffset;
+	m_ubBlockPosition = 0;
+
+	if ( !DecompressBlock( static_cast<ECaptureCodec>( block.m_eCodec ), m_Compressed.data(), block.m_cubCompressed, m_Block.data(), block.m_cubUncompressed ) )
+	{
+		m_Block.clear();
+		return ECaptureReadResult::k_eCaptureReadCorrupt;
+	}
+
+	return ECaptureReadResult::k_eCaptureReadOK;
+}
+
+// walks the block headers, skipping over the compressed data
+bool CCaptureFileReader::BuildBlockTable()
+{
+	uint64 ullFileOffset = m_Header.m_cubHeader;
+	CaptureBlockHeader_t block;
+
+	while ( CaptureFileSeek( m_pFile, static_cast<int64>( ullFileOffset ), SEEK_SET ) == 0 &&
+		fread( &block, 1, sizeof( block ), m_pFile ) == sizeof( block ) &&
+		block.m_unMagic == k_unCaptureBlockMagic )
+	{
+		CaptureBlockEntry_t entry;
+		entry.m_ullFileOffset = ullFileOffset;
+		entry.m_ullOffset = block.m_ullOffset;
+
+		m_Blocks.push_back( entry );
+
+		ullFileOffset += sizeof( block ) + block.m_cubCompressed;
+	}
+
+	return !m_Blocks.empty();
+}
@@ -0,0 +1,291 @@
+
+#ifndef NETHOOK_CAPTUREFILE_H_
+#define NETHOOK_CAPTUREFILE_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Segmented capture format (.nhcap)
+//
+// A capture is a series of segment files named <base>.0000.nhcap, <base>.0001.nhcap, ...
+// Every segment starts with a CaptureFileHeader_t followed by records, each record being a
+// CaptureRecordHeader_t immediately followed by m_cubData bytes of payload. Records are only
+// ever appended, so a segment that was cut short by a crash is still valid up to its last
+// complete record; readers detect the torn tail through the record magic and CRC.
+//
+// Compressed segments (k_ECaptureFileFlagCompressed) hold the same stream of records, cut into
+// blocks of whole records that are compressed one at a time. Each block is a
+// CaptureBlockHeader_t followed by m_cubCompressed bytes. Record offsets, as returned by
+// CCaptureFileReader::Tell and stored in the index, are offsets into the uncompressed stream,
+// which starts right after the file header just like in an uncompressed segment. Any record
+// can be read by decompressing only the block that holds it.
+//
+// Every finished segment also gets a sidecar index, see captureindex.h.
+//
+// All fields are little endian.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+
+constexpr uint32 k_unCaptureFileMagic = 0x5043484E; // "NHCP"
+constexpr uint32 k_unCaptureRecordMagic = 0x5243484E; // "NHCR"
+constexpr uint32 k_unCaptureBlockMagic = 0x4243484E; // "NHCB"
+constexpr uint16 k_usCaptureFileVersion = 1;
+
+constexpr uint64 k_cubCaptureDefaultSegmentMax = 256ull * 1024 * 1024;
+constexpr uint32 k_cubCaptureDefaultBlock = 256 * 1024;
+// the most cubBlock can be set to
+constexpr uint32 k_cubCaptureMaxBlock = 64 * 1024 * 1024;
+// the largest payload a record may have. Far more than any message Steam sends, it is there so
+// readers can tell a damaged length from a real one before allocating for it.
+constexpr uint32 k_cubCaptureMaxRecord = 256 * 1024 * 1024;
+
+
+class CCaptureIndexBuilder;
+
+
+enum ECaptureRecordType
+{
+	// payload is a network message
+	k_ECaptureRecordMessage = 0,
+	// payload is the name of m_unEMsg, written once before its first message
+	k_ECaptureRecordMsgName = 1,
+	// filler up to the end of a flight recorder ring, see capturering.h
+	k_ECaptureRecordPadding = 2,
+};
+
+enum ECaptureRecordFlags
+{
+	k_ECaptureRecordFlagProto = 1 << 0,
+};
+
+enum ECaptureFileFlags
+{
+	k_ECaptureFileFlagCompressed = 1 << 0,
+};
+
+enum ECaptureCodec
+{
+	k_ECaptureCodecNone = 0,
+	k_ECaptureCodecDeflate = 1,
+	// only available when built with NETHOOK_CAPTURE_ZSTD
+	k_ECaptureCodecZstd = 2,
+};
+
+
+#pragma pack( push, 1 )
+
+struct CaptureFileHeader_t
+{
+	uint32 m_unMagic;
+	uint16 m_usVersion;
+	uint16 m_cubHeader;
+	uint32 m_unSegment;
+	uint32 m_unFlags;
+
+	// the same instant expressed as CaptureTimestamp() and as microseconds since the unix epoch,
+	// lets readers turn record timestamps into wall clock time
+	uint64 m_ullTimestampBase;
+	uint64 m_ullWallClockBase;
+};
+
+struct CaptureRecordHeader_t
+{
+	uint32 m_unMagic;
+	uint32 m_cubData;
+
+	uint64 m_ullSequence;
+	uint64 m_ullTimestamp;
+	uint64 m_ullConnection;
+
+	// without the proto mask, see k_ECaptureRecordFlagProto
+	uint32 m_unEMsg;
+
+	uint8 m_eType;			// ECaptureRecordType
+	uint8 m_eDirection;		// ENetDirection
+	uint8 m_unFlags;		// ECaptureRecordFlags
+	uint8 m_unReserved;
+
+	// crc32 of the payload
+	uint32 m_unCRC;
+	uint32 m_unReserved2;
+};
+
+struct CaptureBlockHeader_t
+{
+	uint32 m_unMagic;
+	uint8 m_eCodec;			// ECaptureCodec, k_ECaptureCodecNone if the block didn't compress
+	uint8 m_unReserved[ 3 ];
+
+	uint32 m_cubCompressed;
+	uint32 m_cubUncompressed;
+
+	// offset of the block's first record in the uncompressed stream
+	uint64 m_ullOffset;
+
+	// crc32 of the compressed bytes
+	uint32 m_unCRC;
+	uint32 m_unReserved2;
+};
+
+// where a block starts in the segment file, and in the uncompressed stream
+struct CaptureBlockEntry_t
+{
+	uint64 m_ullFileOffset;
+	uint64 m_ullOffset;
+};
+
+#pragma pack( pop )
+
+static_assert( sizeof( CaptureFileHeader_t ) == 32, "Wrong size of CaptureFileHeader_t" );
+static_assert( sizeof( CaptureRecordHeader_t ) == 48, "Wrong size of CaptureRecordHeader_t" );
+static_assert( sizeof( CaptureBlockHeader_t ) == 32, "Wrong size of CaptureBlockHeader_t" );
+
+
+std::string CaptureSegmentPath( const char *szBasePath, uint32 unSegment );
+// the other way round, "dir/capture.0003.nhcap" -> "dir/capture". false for anything that isn't
+// named like a segment.
+bool CaptureBasePathFromSegment( const char *szSegmentPath, std::string *pBasePath );
+
+// settings and tool options: a decimal count that fits a uint32, and a byte count optionally
+// followed by K, M or G
+bool CaptureParseCount( const char *szValue, uint32 *punValue ) noexcept;
+bool CaptureParseSize( const char *szValue, uint64 *pcubValue ) noexcept;
+
+uint32 CaptureCRC( const uint8 *pubData, uint32 cubData ) noexcept;
+
+bool CaptureCodecAvailable( ECaptureCodec eCodec ) noexcept;
+
+
+// Appends records to a segmented capture, rolling over to a new segment once the current
+// one reaches cubSegmentMax bytes. The index of a segment is written when the writer moves
+// on from it or is closed.
+//
+// With compression enabled records are collected until they fill a block of cubBlock bytes,
+// which is then compressed and written on the calling thread. Records are never split across
+// blocks, a record larger than cubBlock gets a block of its own. A partially filled block
+// is only written out by Commit. Records over k_cubCaptureMaxRecord are refused.
+class CCaptureFileWriter
+{
+
+public:
+	CCaptureFileWriter( const char *szBasePath, uint64 cubSegmentMax = k_cubCaptureDefaultSegmentMax );
+	~CCaptureFileWriter();
+
+	CCaptureFileWriter( const CCaptureFileWriter & ) = delete;
+	CCaptureFileWriter &operator=( const CCaptureFileWriter & ) = delete;
+
+	// takes effect from the next segment, k_ECaptureCodecNone writes plain segments
+	bool SetCompression( ECaptureCodec eCodec, uint32 cubBlock = k_cubCaptureDefaultBlock );
+
+	bool Open();
+	// for rewriting existing records, keeps their original clock bases
+	bool Open( uint64 ullTimestampBase, uint64 ullWallClockBase );
+	void Close();
+
+	// m_unMagic, m_cubData and m_unCRC are filled in from the payload
+	bool WriteRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint32 cubData );
+
+	// hands buffered records to the OS
+	void Flush() noexcept;
+	// writes out the pending block and hands everything to the OS, with bSync also waits
+	// for it to reach the disk. A crash loses at most the records written after the last
+	// commit, the segment stays readable up to there.
+	bool Commit( bool bSync );
+
+	bool IsOpen() const noexcept { return m_pFile != nullptr; }
+	uint32 GetSegment() const noexcept { return m_unSegment; }
+	uint64 GetSegmentSize() const noexcept { return m_cubSegment; }
+
+private:
+	bool OpenSegment( uint32 unSegment );
+	bool WriteBlock();
+
+private:
+	std::string m_BasePath;
+	uint64 m_cubSegmentMax;
+
+	FILE *m_pFile;
+	uint32 m_unSegment;
+	uint64 m_cubSegment;
+
+	// offset into the uncompressed stream, the same as m_cubSegment for plain segments
+	uint64 m_ullOffset;
+
+	ECaptureCodec m_eCodec;
+	ECaptureCodec m_eSegmentCodec;
+	uint32 m_cubBlock;
+
+	std::vector<uint8> m_Block;
+	std::vector<uint8> m_Compressed;
+	uint64 m_ullBlockOffset;
+
+	uint64 m_ullTimestampBase;
+	uint64 m_ullWallClockBase;
+
+	CCaptureIndexBuilder *m_pIndex;
+
+};
+
+
+enum class ECaptureReadResult
+{
+	k_eCaptureReadOK,
+	k_eCaptureReadEnd,
+	// torn or damaged record, everything before it is intact
+	k_eCaptureReadCorrupt,
+};
+
+
+// Reads the records of a single segment front to back.
+class CCaptureFileReader
+{
+
+public:
+	CCaptureFileReader() noexcept;
+	~CCaptureFileReader();
+
+	CCaptureFileReader( const CCaptureFileReader & ) = delete;
+	CCaptureFileReader &operator=( const CCaptureFileReader & ) = delete;
+
+	bool Open( const char *szPath );
+	void Close() noexcept;
+
+	const CaptureFileHeader_t &GetHeader() const noexcept { return m_Header; }
+
+	ECaptureReadResult ReadRecord( CaptureRecordHeader_t *pHeader, std::vector<uint8> *pPayload );
+
+	// offsets are relative to the start of the segment file, or of the uncompressed stream
+	// for compressed segments
+	uint64 Tell() const noexcept;
+	bool Seek( uint64 ullOffset );
+
+	// block table of a compressed segment, usually from its index. Without one the first
+	// Seek walks the block headers to build it.
+	void SetBlockTable( const CaptureBlockEntry_t *pBlocks, uint32 cBlocks );
+
+private:
+	ECaptureReadResult ReadBlock();
+	bool BuildBlockTable();
+
+private:
+	FILE *m_pFile;
+	CaptureFileHeader_t m_Header;
+
+	bool m_bCompressed;
+	std::vector<CaptureBlockEntry_t> m_Blocks;
+
+	// the block we're reading records from
+	std::vector<uint8> m_Block;
+	std::vector<uint8> m_Compressed;
+	uint64 m_ullBlockOffset;
+	size_t m_ubBlockPosition;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREFILE_H_
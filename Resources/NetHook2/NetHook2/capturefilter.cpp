@@ -0,0 +1,286 @@
+
+#include "capturefilter.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "captureproto.h"
+
+
+static bool IsMethodChar( char ch ) noexcept
+{
+	return isalnum( static_cast<unsigned char>( ch ) ) || ch == '.' || ch == '_' || ch == '#' || ch == '*' || ch == '?';
+}
+
+static bool ParseEMsg( const char *szValue, const char **pszEnd, uint32 *punEMsg ) noexcept
+{
+	char *szEnd = nullptr;
+	const unsigned long ulValue = strtoul( szValue, &szEnd, 10 );
+
+	if ( szEnd == szValue || ulValue > ~k_EMsgProtoMask )
+		return false;
+
+	*pszEnd = szEnd;
+	*punEMsg = static_cast<uint32>( ulValue );
+	return true;
+}
+
+// '*' matches any run of characters, '?' any single one
+static bool MatchWildcard( const char *szPattern, const char *szValue ) noexcept
+{
+	const char *szStar = nullptr;
+	const char *szStarValue = nullptr;
+
+	while ( *szValue != '\0' )
+	{
+		if ( *szPattern == '*' )
+		{
+			szStar = szPattern++;
+			szStarValue = szValue;
+		}
+		else if ( *szPattern == '?' || *szPattern == *szValue )
+		{
+			szPattern++;
+			szValue++;
+		}
+		else if ( szStar != nullptr )
+		{
+			szPattern = szStar + 1;
+			szValue = ++szStarValue;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while ( *szPattern == '*' )
+		szPattern++;
+
+	return *szPattern == '\0';
+}
+
+static uint32 JobSlot( JobID_t jobID ) noexcept
+{
+	static_assert( ( CCaptureFilter::k_cJobSlots & ( CCaptureFilter::k_cJobSlots - 1 ) ) == 0, "k_cJobSlots must be a power of two" );
+
+	return static_cast<uint32>( ( jobID * 0x9E3779B97F4A7C15ull ) >> 32 ) & ( CCaptureFilter::k_cJobSlots - 1 );
+}
+
+
+bool CCaptureFilterRules::Add( const char *szRules, bool bAllow )
+{
+	std::vector<EMsgRange_t> emsgRanges;
+	std::vector<MethodRule_t> methods;
+
+	const char *szCursor = szRules;
+
+	for ( ;; )
+	{
+		while ( *szCursor == ',' || isspace( static_cast<unsigned char>( *szCursor ) ) )
+			szCursor++;
+
+		if ( *szCursor == '\0' )
+			break;
+
+		if ( isdigit( static_cast<unsigned char>( *szCursor ) ) )
+		{
+			EMsgRange_t range;
+			range.m_bAllow = bAllow;
+
+			if ( !ParseEMsg( szCursor, &szCursor, &range.m_unFirst ) )
+				return false;
+
+			range.m_unLast = range.m_unFirst;
+
+			if ( *szCursor == '-' && !ParseEMsg( szCursor + 1, &szCursor, &range.m_unLast ) )
+				return false;
+
+			if ( range.m_unLast < range.m_unFirst || ( *szCursor != '\0' && *szCursor != ',' && !isspace( static_cast<unsigned char>( *szCursor ) ) ) )
+				return false;
+
+			emsgRanges.push_back( range );
+		}
+		else
+		{
+			const char *szStart = szCursor;
+
+			while ( IsMethodChar( *szCursor ) )
+				szCursor++;
+
+			if ( szCursor == szStart || ( *szCursor != '\0' && *szCursor != ',' && !isspace( static_cast<unsigned char>( *szCursor ) ) ) )
+				return false;
+
+			MethodRule_t method;
+			method.m_Pattern.assign( szStart, szCursor );
+			method.m_bAllow = bAllow;
+
+			methods.push_back( method );
+		}
+	}
+
+	m_EMsgRanges.insert( m_EMsgRanges.end(), emsgRanges.begin(), emsgRanges.end() );
+	m_Methods.insert( m_Methods.end(), methods.begin(), methods.end() );
+
+	return true;
+}
+
+
+CCaptureFilter::CCaptureFilter( const CCaptureFilterRules &rules )
+	: m_EMsgRanges( rules.m_EMsgRanges ),
+	  m_bHasAllowRules( false )
+{
+	for ( const CCaptureFilterRules::EMsgRange_t &range : rules.m_EMsgRanges )
+		m_bHasAllowRules |= range.m_bAllow;
+
+	for ( const CCaptureFilterRules::MethodRule_t &method : rules.m_Methods )
+	{
+		m_bHasAllowRules |= method.m_bAllow;
+
+		// exact names are a hash lookup, only patterns are tried one by one
+		const bool bPattern = ( method.m_Pattern.find_first_of( "*?" ) != std::string::npos );
+
+		if ( method.m_bAllow )
+		{
+			if ( bPattern )
+				m_AllowedMethodPatterns.push_back( method.m_Pattern );
+			else
+				m_AllowedMethods.insert( method.m_Pattern );
+		}
+		else
+		{
+			if ( bPattern )
+				m_DeniedMethodPatterns.push_back( method.m_Pattern );
+			else
+				m_DeniedMethods.insert( method.m_Pattern );
+		}
+	}
+
+	memset( m_rgullVerdicts, 0, sizeof( m_rgullVerdicts ) );
+
+	for ( uint32 unEMsg = 0; unEMsg < k_cDenseEMsgs; unEMsg++ )
+		m_rgullVerdicts[ unEMsg / 32 ] |= static_cast<uint64>( GetEMsgVerdict( unEMsg ) ) << ( ( unEMsg % 32 ) * 2 );
+
+	for ( uint32 iSlot = 0; iSlot < k_cJobSlots; iSlot++ )
+	{
+		m_rgCapturedJobs[ iSlot ].store( k_GIDNil, std::memory_order_relaxed );
+		m_rgRejectedJobs[ iSlot ].store( k_GIDNil, std::memory_order_relaxed );
+	}
+}
+
+CCaptureFilter::EVerdict CCaptureFilter::GetEMsgVerdict( uint32 unEMsg ) const noexcept
+{
+	bool bAllowed = false;
+
+	for ( const CCaptureFilterRules::EMsgRange_t &range : m_EMsgRanges )
+	{
+		if ( unEMsg < range.m_unFirst || unEMsg > range.m_unLast )
+			continue;
+
+		// deny rules win over allow rules
+		if ( !range.m_bAllow )
+			return k_EVerdictReject;
+
+		bAllowed = true;
+	}
+
+	if ( bAllowed || unEMsg == static_cast<uint32>( EMsg::k_EMsgMulti ) )
+		return k_EVerdictCapture;
+
+	if ( IsServiceMethod( unEMsg ) && ( !m_AllowedMethods.empty() || !m_DeniedMethods.empty() || !m_AllowedMethodPatterns.empty() || !m_DeniedMethodPatterns.empty() ) )
+		return k_EVerdictInspect;
+
+	return ( m_bHasAllowRules ? k_EVerdictReject : k_EVerdictCapture );
+}
+
+bool CCaptureFilter::ShouldCaptureSlow( const uint8 *pubData, uint32 cubData )
+{
+	const uint32 unEMsg = CaptureGetRawEMsg( pubData, cubData ) & ~k_EMsgProtoMask;
+
+	// the dense table only sends service methods this way
+	const EVerdict eVerdict = ( unEMsg < k_cDenseEMsgs ? k_EVerdictInspect : GetEMsgVerdict( unEMsg ) );
+
+	if ( eVerdict != k_EVerdictInspect )
+		return eVerdict == k_EVerdictCapture;
+
+	return ShouldCaptureMethod( pubData, cubData );
+}
+
+bool CCaptureFilter::ShouldCaptureMethod( const uint8 *pubData, uint32 cubData )
+{
+	CaptureProtoHeader_t header;
+
+	if ( !CaptureParseMessageProtoHeader( pubData, cubData, k_EProtoHeaderFieldJobs, &header ) )
+		return !m_bHasAllowRules;
+
+	if ( ( header.m_unPresent & k_EProtoHeaderFieldTargetJobName ) != 0 )
+	{
+		// the hash lookups want a std::string, one per thread keeps its buffer between calls
+		static thread_local std::string t_MethodName;
+		t_MethodName.assign( header.m_pchTargetJobName, header.m_cchTargetJobName );
+
+		const bool bCapture = !MatchMethod( t_MethodName, false ) && ( !m_bHasAllowRules || MatchMethod( t_MethodName, true ) );
+
+		// so the response follows the request
+		if ( header.m_jobIDSource != k_GIDNil )
+		{
+			std::atomic<uint64> *rgJobs = ( bCapture ? m_rgCapturedJobs : m_rgRejectedJobs );
+			rgJobs[ JobSlot( header.m_jobIDSource ) ].store( header.m_jobIDSource, std::memory_order_relaxed );
+		}
+
+		return bCapture;
+	}
+
+	const JobID_t jobIDTarget = header.m_jobIDTarget;
+
+	if ( jobIDTarget != k_GIDNil )
+	{
+		const uint32 iSlot = JobSlot( jobIDTarget );
+		uint64 ullJobID = jobIDTarget;
+
+		if ( m_rgCapturedJobs[ iSlot ].compare_exchange_strong( ullJobID, k_GIDNil, std::memory_order_relaxed ) )
+			return true;
+
+		ullJobID = jobIDTarget;
+
+		if ( m_rgRejectedJobs[ iSlot ].compare_exchange_strong( ullJobID, k_GIDNil, std::memory_order_relaxed ) )
+			return false;
+	}
+
+	return !m_bHasAllowRules;
+}
+
+bool CCaptureFilter::MatchMethod( const std::string &methodName, bool bAllow ) const
+{
+	const std::unordered_set<std::string> &methods = ( bAllow ? m_AllowedMethods : m_DeniedMethods );
+
+	if ( methods.find( methodName ) != methods.end() )
+		return true;
+
+	for ( const std::string &pattern : ( bAllow ? m_AllowedMethodPatterns : m_DeniedMethodPatterns ) )
+	{
+		if ( MatchWildcard( pattern.c_str(), methodName.c_str() ) )
+			return true;
+	}
+
+	return false;
+}
+
+bool CCaptureFilter::IsServiceMethod( uint32 unEMsg ) noexcept
+{
+	switch ( static_cast<EMsg>( unEMsg ) )
+	{
+	case EMsg::k_EMsgServiceMethod:
+	case EMsg::k_EMsgServiceMethodResponse:
+	case EMsg::k_EMsgServiceMethodCallFromClient:
+	case EMsg::k_EMsgServiceMethodSendToClient:
+	case EMsg::k_EMsgClientServiceMethodLegacy:
+	case EMsg::k_EMsgClientServiceMethodLegacyResponse:
+	case EMsg::k_EMsgServiceMethodCallFromClientNonAuthed:
+		return true;
+
+	default:
+		return false;
+	}
+}
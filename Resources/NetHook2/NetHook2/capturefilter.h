@@ -0,0 +1,131 @@
+
+#ifndef NETHOOK_CAPTUREFILTER_H_
+#define NETHOOK_CAPTUREFILTER_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Capture filter
+//
+// Rules come from the filter_allow and filter_deny settings, each a list of EMsg numbers,
+// EMsg ranges ("700-799") and service method names, which may use '*' and '?' wildcards
+// ("Player.*", "Econ.GetInventoryItemsWithDescriptions#1"). A message is captured unless it
+// matches a deny rule, and, once there is any allow rule, only if it matches an allow rule.
+// Multis are always let through so their children can be filtered individually, unless
+// EMsg 1 is denied explicitly.
+//
+// Method names only apply to the service method EMsgs. Their responses carry no name, they
+// follow the decision made for the request with the same job ID.
+
+#include <atomic>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "capture.h"
+
+
+// The rules as read from the config, see CCaptureFilter for the compiled form.
+class CCaptureFilterRules
+{
+
+public:
+	// adds a comma or whitespace separated list of rules, nothing is added if any of them is
+	// malformed
+	bool Add( const char *szRules, bool bAllow );
+
+	bool IsEmpty() const noexcept { return m_EMsgRanges.empty() && m_Methods.empty(); }
+
+public:
+	struct EMsgRange_t
+	{
+		uint32 m_unFirst;
+		uint32 m_unLast;
+		bool m_bAllow;
+	};
+
+	struct MethodRule_t
+	{
+		std::string m_Pattern;
+		bool m_bAllow;
+	};
+
+	std::vector<EMsgRange_t> m_EMsgRanges;
+	std::vector<MethodRule_t> m_Methods;
+
+};
+
+
+// CCaptureFilterRules compiled so the common case, a message whose EMsg alone decides, costs a
+// single load from a table of two bits per EMsg. Only service method messages covered by a
+// method rule, and EMsgs past the table, take the slow path.
+//
+// ShouldCapture may be called from any number of threads at once.
+class CCaptureFilter
+{
+
+public:
+	explicit CCaptureFilter( const CCaptureFilterRules &rules );
+
+	CCaptureFilter( const CCaptureFilter & ) = delete;
+	CCaptureFilter &operator=( const CCaptureFilter & ) = delete;
+
+	inline bool ShouldCapture( const uint8 *pubData, uint32 cubData );
+
+public:
+	static constexpr uint32 k_cDenseEMsgs = 16384;
+	// remembered decisions on method calls, a response whose request has been pushed out
+	// by a later one is treated like one whose request wasn't seen at all
+	static constexpr uint32 k_cJobSlots = 1024;
+
+private:
+	enum EVerdict
+	{
+		k_EVerdictReject = 0,
+		k_EVerdictCapture = 1,
+		// a service method EMsg that is decided by the method name
+		k_EVerdictInspect = 2,
+	};
+
+	EVerdict GetEMsgVerdict( uint32 unEMsg ) const noexcept;
+	bool ShouldCaptureSlow( const uint8 *pubData, uint32 cubData );
+	bool ShouldCaptureMethod( const uint8 *pubData, uint32 cubData );
+	bool MatchMethod( const std::string &methodName, bool bAllow ) const;
+
+	static bool IsServiceMethod( uint32 unEMsg ) noexcept;
+
+private:
+	// two bits per EMsg
+	uint64 m_rgullVerdicts[ k_cDenseEMsgs / 32 ];
+
+	std::vector<CCaptureFilterRules::EMsgRange_t> m_EMsgRanges;
+	bool m_bHasAllowRules;
+
+	std::unordered_set<std::string> m_AllowedMethods;
+	std::unordered_set<std::string> m_DeniedMethods;
+	std::vector<std::string> m_AllowedMethodPatterns;
+	std::vector<std::string> m_DeniedMethodPatterns;
+
+	std::atomic<uint64> m_rgCapturedJobs[ k_cJobSlots ];
+	std::atomic<uint64> m_rgRejectedJobs[ k_cJobSlots ];
+
+};
+
+
+bool CCaptureFilter::ShouldCapture( const uint8 *pubData, uint32 cubData )
+{
+	const uint32 unEMsg = CaptureGetRawEMsg( pubData, cubData ) & ~k_EMsgProtoMask;
+
+	if ( unEMsg < k_cDenseEMsgs )
+	{
+		const uint32 unVerdict = static_cast<uint32>( m_rgullVerdicts[ unEMsg / 32 ] >> ( ( unEMsg % 32 ) * 2 ) ) & 3;
+
+		if ( unVerdict != k_EVerdictInspect )
+			return unVerdict == k_EVerdictCapture;
+	}
+
+	return ShouldCaptureSlow( pubData, cubData );
+}
+
+
+#endif // !NETHOOK_CAPTUREFILTER_H_
@@ -0,0 +1,369 @@
+
+#include "captureindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+
+static void AppendVarint( std::vector<uint8> *pVarints, uint32 unValue )
+{
+	while ( unValue >= 0x80 )
+	{
+		pVarints->push_back( static_cast<uint8>( unValue | 0x80 ) );
+		unValue >>= 7;
+	}
+
+	pVarints->push_back( static_cast<uint8>( unValue ) );
+}
+
+static bool ReadVarint( const uint8 **ppubCursor, const uint8 *pubEnd, uint32 *punValue ) noexcept
+{
+	uint32 unValue = 0;
+
+	for ( uint32 unShift = 0; unShift < 35; unShift += 7 )
+	{
+		if ( *ppubCursor == pubEnd )
+			return false;
+
+		const uint8 ubByte = *( *ppubCursor )++;
+		unValue |= static_cast<uint32>( ubByte & 0x7F ) << unShift;
+
+		if ( ( ubByte & 0x80 ) == 0 )
+		{
+			*punValue = unValue;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+std::string CaptureIndexPath( const char *szBasePath, uint32 unSegment )
+{
+	char szSuffix[ 32 ];
+	snprintf( szSuffix, sizeof( szSuffix ), ".%04u.nhidx", unSegment );
+
+	return std::string( szBasePath ) + szSuffix;
+}
+
+
+CCaptureIndexBuilder::CCaptureIndexBuilder() noexcept
+	: m_ullTimestampBase( 0 ),
+	  m_ullWallClockBase( 0 )
+{
+}
+
+void CCaptureIndexBuilder::Reset( uint64 ullTimestampBase, uint64 ullWallClockBase )
+{
+	m_ullTimestampBase = ullTimestampBase;
+	m_ullWallClockBase = ullWallClockBase;
+
+	m_Entries.clear();
+	m_Blocks.clear();
+	m_Postings.clear();
+}
+
+void CCaptureIndexBuilder::AddRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint64 ullOffset )
+{
+	if ( header.m_eType == k_ECaptureRecordMsgName )
+	{
+		// names only show up once per capture, keep them across segments
+		m_Names[ header.m_unEMsg ].assign( reinterpret_cast<const char *>( pubData ), header.m_cubData );
+		return;
+	}
+
+	if ( header.m_eType != k_ECaptureRecordMessage )
+		return;
+
+	CaptureIndexEntry_t entry = { };
+	entry.m_ullSequence = header.m_ullSequence;
+	entry.m_ullTimestamp = header.m_ullTimestamp;
+	entry.m_ullOffset = ullOffset;
+	entry.m_unEMsg = header.m_unEMsg;
+	entry.m_cubData = header.m_cubData;
+	entry.m_eDirection = header.m_eDirection;
+	entry.m_unFlags = header.m_unFlags;
+
+	// producers take their timestamp right before they queue, so neighbours can be a few
+	// nanoseconds out of order. Clamping keeps the entries searchable by time.
+	if ( !m_Entries.empty() && entry.m_ullTimestamp < m_Entries.back().m_ullTimestamp )
+		entry.m_ullTimestamp = m_Entries.back().m_ullTimestamp;
+
+	const uint32 iEntry = static_cast<uint32>( m_Entries.size() );
+	m_Entries.push_back( entry );
+
+	auto insert = m_Postings.insert( std::make_pair( header.m_unEMsg, Postings_t() ) );
+	Postings_t &postings = insert.first->second;
+
+	if ( insert.second )
+	{
+		postings.m_cPostings = 0;
+		postings.m_iLastEntry = 0;
+	}
+
+	AppendVarint( &postings.m_Varints, iEntry - postings.m_iLastEntry );
+
+	postings.m_cPostings++;
+	postings.m_iLastEntry = iEntry;
+}
+
+void CCaptureIndexBuilder::AddBlock( const CaptureBlockEntry_t &block )
+{
+	m_Blocks.push_back( block );
+}
+
+bool CCaptureIndexBuilder::Save( const char *szPath, uint64 cubSegment ) const
+{
+	std::vector<uint32> msgs;
+	msgs.reserve( m_Postings.size() );
+
+	for ( const auto &postings : m_Postings )
+		msgs.push_back( postings.first );
+
+	std::sort( msgs.begin(), msgs.end() );
+
+	std::vector<CaptureIndexMsg_t> msgTable( msgs.size() );
+
+	uint32 cubPostings = 0;
+	uint32 cubNames = 0;
+
+	for ( size_t iMsg = 0; iMsg < msgs.size(); iMsg++ )
+	{
+		const Postings_t &postings = m_Postings.at( msgs[ iMsg ] );
+		const auto name = m_Names.find( msgs[ iMsg ] );
+
+		CaptureIndexMsg_t &msg = msgTable[ iMsg ];
+		msg.m_unEMsg = msgs[ iMsg ];
+		msg.m_cPostings = postings.m_cPostings;
+		msg.m_ubPostings = cubPostings;
+		msg.m_cubPostings = static_cast<uint32>( postings.m_Varints.size() );
+		msg.m_ubName = cubNames;
+		msg.m_cchName = name != m_Names.end() ? static_cast<uint32>( name->second.size() ) : 0;
+
+		cubPostings += msg.m_cubPostings;
+		cubNames += msg.m_cchName;
+	}
+
+	CaptureIndexHeader_t header = { };
+	header.m_unMagic = k_unCaptureIndexMagic;
+	header.m_usVersion = k_usCaptureIndexVersion;
+	header.m_cubHeader = sizeof( header );
+	header.m_cubSegment = cubSegment;
+	header.m_ullTimestampBase = m_ullTimestampBase;
+	header.m_ullWallClockBase = m_ullWallClockBase;
+	header.m_cEntries = static_cast<uint32>( m_Entries.size() );
+	header.m_cMsgs = static_cast<uint32>( msgTable.size() );
+	header.m_cubPostings = cubPostings;
+	header.m_cubNames = cubNames;
+	header.m_cBlocks = static_cast<uint32>( m_Blocks.size() );
+
+	// written under a temporary name so readers never pick up half an index
+	const std::string tempPath = std::string( szPath ) + ".tmp";
+
+	FILE *pFile = fopen( tempPath.c_str(), "wb" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	bool bWritten = fwrite( &header, sizeof( header ), 1, pFile ) == 1;
+
+	if ( !m_Entries.empty() )
+		bWritten = bWritten && fwrite( m_Entries.data(), sizeof( CaptureIndexEntry_t ), m_Entries.size(), pFile ) == m_Entries.size();
+
+	if ( !msgTable.empty() )
+		bWritten = bWritten && fwrite( msgTable.data(), sizeof( CaptureIndexMsg_t ), msgTable.size(), pFile ) == msgTable.size();
+
+	if ( !m_Blocks.empty() )
+		bWritten = bWritten && fwrite( m_Blocks.data(), sizeof( CaptureBlockEntry_t ), m_Blocks.size(), pFile ) == m_Blocks.size();
+
+	for ( uint32 unEMsg : msgs )
+	{
+		const std::vector<uint8> &varints = m_Postings.at( unEMsg ).m_Varints;
+		bWritten = bWritten && fwrite( varints.data(), 1, varints.size(), pFile ) == varints.size();
+	}
+
+	for ( uint32 unEMsg : msgs )
+	{
+		const auto name = m_Names.find( unEMsg );
+
+		if ( name != m_Names.end() )
+			bWritten = bWritten && fwrite( name->second.data(), 1, name->second.size(), pFile ) == name->second.size();
+	}
+
+	bWritten = fclose( pFile ) == 0 && bWritten;
+
+	// rename won't replace an existing file on windows
+	remove( szPath );
+
+	if ( !bWritten || rename( tempPath.c_str(), szPath ) != 0 )
+	{
+		remove( tempPath.c_str() );
+		return false;
+	}
+
+	return true;
+}
+
+
+CCaptureIndex::CCaptureIndex() noexcept
+	: m_Header(),
+	  m_pEntries( nullptr ),
+	  m_pMsgs( nullptr ),
+	  m_pBlocks( nullptr ),
+	  m_pubPostings( nullptr ),
+	  m_pchNames( nullptr )
+{
+}
+
+bool CCaptureIndex::Load( const char *szPath )
+{
+	m_Header = CaptureIndexHeader_t();
+	m_Data.clear();
+
+	FILE *pFile = fopen( szPath, "rb" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	CaptureIndexHeader_t header;
+
+	if ( fread( &header, sizeof( header ), 1, pFile ) != 1 ||
+		header.m_unMagic != k_unCaptureIndexMagic ||
+		header.m_cubHeader < sizeof( header ) )
+	{
+		fclose( pFile );
+		return false;
+	}
+
+	const uint64 cubData =
+		static_cast<uint64>( header.m_cEntries ) * sizeof( CaptureIndexEntry_t ) +
+		static_cast<uint64>( header.m_cMsgs ) * sizeof( CaptureIndexMsg_t ) +
+		static_cast<uint64>( header.m_cBlocks ) * sizeof( CaptureBlockEntry_t ) +
+		header.m_cubPostings + header.m_cubNames;
+
+	m_Data.resize( static_cast<size_t>( cubData ) );
+
+	const bool bRead = fseek( pFile, header.m_cubHeader, SEEK_SET ) == 0 &&
+		( m_Data.empty() || fread( m_Data.data(), 1, m_Data.size(), pFile ) == m_Data.size() );
+
+	fclose( pFile );
+
+	if ( !bRead )
+	{
+		m_Data.clear();
+		return false;
+	}
+
+	m_pEntries = reinterpret_cast<const CaptureIndexEntry_t *>( m_Data.data() );
+	m_pMsgs = reinterpret_cast<const CaptureIndexMsg_t *>( m_pEntries + header.m_cEntries );
+	m_pBlocks = reinterpret_cast<const CaptureBlockEntry_t *>( m_pMsgs + header.m_cMsgs );
+	m_pubPostings = reinterpret_cast<const uint8 *>( m_pBlocks + header.m_cBlocks );
+	m_pchNames = reinterpret_cast<const char *>( m_pubPostings + header.m_cubPostings );
+
+	for ( uint32 iMsg = 0; iMsg < header.m_cMsgs; iMsg++ )
+	{
+		const CaptureIndexMsg_t &msg = m_pMsgs[ iMsg ];
+
+		if ( static_cast<uint64>( msg.m_ubPostings ) + msg.m_cubPostings > header.m_cubPostings ||
+			static_cast<uint64>( msg.m_ubName ) + msg.m_cchName > header.m_cubNames )
+		{
+			m_Data.clear();
+			return false;
+		}
+	}
+
+	m_Header = header;
+	return true;
+}
+
+uint32 CCaptureIndex::LowerBoundSequence( uint64 ullSequence ) const noexcept
+{
+	const CaptureIndexEntry_t *pEnd = m_pEntries + m_Header.m_cEntries;
+
+	const CaptureIndexEntry_t *pEntry = std::lower_bound( m_pEntries, pEnd, ullSequence,
+		[]( const CaptureIndexEntry_t &entry, uint64 ullValue ) { return entry.m_ullSequence < ullValue; } );
+
+	return static_cast<uint32>( pEntry - m_pEntries );
+}
+
+uint32 CCaptureIndex::LowerBoundTimestamp( uint64 ullTimestamp ) const noexcept
+{
+	const CaptureIndexEntry_t *pEnd = m_pEntries + m_Header.m_cEntries;
+
+	const CaptureIndexEntry_t *pEntry = std::lower_bound( m_pEntries, pEnd, ullTimestamp,
+		[]( const CaptureIndexEntry_t &entry, uint64 ullValue ) { return entry.m_ullTimestamp < ullValue; } );
+
+	return static_cast<uint32>( pEntry - m_pEntries );
+}
+
+void CCaptureIndex::FindMsg( uint32 unEMsg, uint32 iFirstEntry, uint32 iEndEntry, std::vector<uint32> *pEntries ) const
+{
+	pEntries->clear();
+
+	const CaptureIndexMsg_t *pMsg = FindMsgEntry( unEMsg );
+
+	if ( pMsg == nullptr )
+		return;
+
+	const uint8 *pubCursor = m_pubPostings + pMsg->m_ubPostings;
+	const uint8 *pubEnd = pubCursor + pMsg->m_cubPostings;
+
+	uint32 iEntry = 0;
+
+	for ( uint32 iPosting = 0; iPosting < pMsg->m_cPostings; iPosting++ )
+	{
+		uint32 unDelta = 0;
+
+		if ( !ReadVarint( &pubCursor, pubEnd, &unDelta ) )
+			return;
+
+		iEntry += unDelta;
+
+		if ( iEntry >= iEndEntry || iEntry >= m_Header.m_cEntries )
+			return;
+
+		if ( iEntry >= iFirstEntry )
+			pEntries->push_back( iEntry );
+	}
+}
+
+const char *CCaptureIndex::GetMsgName( uint32 unEMsg, uint32 *pcchName ) const noexcept
+{
+	const CaptureIndexMsg_t *pMsg = FindMsgEntry( unEMsg );
+
+	if ( pMsg == nullptr || pMsg->m_cchName == 0 )
+		return nullptr;
+
+	*pcchName = pMsg->m_cchName;
+	return m_pchNames + pMsg->m_ubName;
+}
+
+uint32 CCaptureIndex::FindMsgByName( const char *szName ) const noexcept
+{
+	const size_t cchName = strlen( szName );
+
+	for ( uint32 iMsg = 0; iMsg < m_Header.m_cMsgs; iMsg++ )
+	{
+		const CaptureIndexMsg_t &msg = m_pMsgs[ iMsg ];
+
+		if ( msg.m_cchName == cchName && memcmp( m_pchNames + msg.m_ubName, szName, cchName ) == 0 )
+			return msg.m_unEMsg;
+	}
+
+	return 0;
+}
+
+const CaptureIndexMsg_t *CCaptureIndex::FindMsgEntry( uint32 unEMsg ) const noexcept
+{
+	const CaptureIndexMsg_t *pEnd = m_pMsgs + m_Header.m_cMsgs;
+
+	const CaptureIndexMsg_t *pMsg = std::lower_bound( m_pMsgs, pEnd, unEMsg,
+		[]( const CaptureIndexMsg_t &msg, uint32 unValue ) { return msg.m_unEMsg < unValue; } );
+
+	if ( pMsg == pEnd || pMsg->m_unEMsg != unEMsg )
+		return nullptr;
+
+	return pMsg;
+}
@@ -0,0 +1,177 @@
+
+#ifndef NETHOOK_CAPTUREINDEX_H_
+#define NETHOOK_CAPTUREINDEX_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Sidecar index for .nhcap segments (.nhidx)
+//
+// Every segment <base>.NNNN.nhcap gets a <base>.NNNN.nhidx next to it once the segment is
+// complete. The index is laid out as
+//
+//   CaptureIndexHeader_t
+//   CaptureIndexEntry_t[ m_cEntries ]       one per message record, in file order
+//   CaptureIndexMsg_t[ m_cMsgs ]            one per EMsg, sorted by EMsg
+//   CaptureBlockEntry_t[ m_cBlocks ]        block table of a compressed segment
+//   posting lists                           per EMsg, entry numbers as delta-encoded varints
+//   names                                   EMsg names referenced by CaptureIndexMsg_t
+//
+// Entries are sorted by sequence and by offset by construction, and their timestamps are
+// clamped to be non-decreasing, so sequence, time and EMsg queries are all binary searches
+// that never touch the capture itself. Offsets of records in compressed segments are offsets
+// into the uncompressed stream, see capturefile.h.
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.h"
+#include "capturefile.h"
+
+
+constexpr uint32 k_unCaptureIndexMagic = 0x5849484E; // "NHIX"
+constexpr uint16 k_usCaptureIndexVersion = 1;
+
+
+#pragma pack( push, 1 )
+
+struct CaptureIndexHeader_t
+{
+	uint32 m_unMagic;
+	uint16 m_usVersion;
+	uint16 m_cubHeader;
+
+	// size of the segment when the index was written, a mismatch means the index is stale
+	uint64 m_cubSegment;
+	uint64 m_ullTimestampBase;
+	uint64 m_ullWallClockBase;
+
+	uint32 m_cEntries;
+	uint32 m_cMsgs;
+	uint32 m_cubPostings;
+	uint32 m_cubNames;
+
+	uint32 m_cBlocks;
+	uint32 m_unReserved;
+};
+
+struct CaptureIndexEntry_t
+{
+	uint64 m_ullSequence;
+	uint64 m_ullTimestamp;
+	uint64 m_ullOffset;
+
+	uint32 m_unEMsg;
+	uint32 m_cubData;
+
+	uint8 m_eDirection;
+	uint8 m_unFlags;
+	uint16 m_usReserved;
+	uint32 m_unReserved;
+};
+
+struct CaptureIndexMsg_t
+{
+	uint32 m_unEMsg;
+	uint32 m_cPostings;
+
+	uint32 m_ubPostings;
+	uint32 m_cubPostings;
+
+	uint32 m_ubName;
+	uint32 m_cchName;
+};
+
+#pragma pack( pop )
+
+static_assert( sizeof( CaptureIndexEntry_t ) == 40, "Wrong size of CaptureIndexEntry_t" );
+
+
+std::string CaptureIndexPath( const char *szBasePath, uint32 unSegment );
+
+
+// Builds the index of one segment as its records are written.
+class CCaptureIndexBuilder
+{
+
+public:
+	CCaptureIndexBuilder() noexcept;
+
+	void Reset( uint64 ullTimestampBase, uint64 ullWallClockBase );
+
+	// ullOffset is where the record header starts in the segment
+	void AddRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint64 ullOffset );
+	void AddBlock( const CaptureBlockEntry_t &block );
+
+	bool Save( const char *szPath, uint64 cubSegment ) const;
+
+	uint32 GetNumEntries() const noexcept { return static_cast<uint32>( m_Entries.size() ); }
+
+private:
+	struct Postings_t
+	{
+		std::vector<uint8> m_Varints;
+		uint32 m_cPostings;
+		uint32 m_iLastEntry;
+	};
+
+	uint64 m_ullTimestampBase;
+	uint64 m_ullWallClockBase;
+
+	std::vector<CaptureIndexEntry_t> m_Entries;
+	std::vector<CaptureBlockEntry_t> m_Blocks;
+	std::unordered_map<uint32, Postings_t> m_Postings;
+	std::unordered_map<uint32, std::string> m_Names;
+
+};
+
+
+// Loads an index and answers queries against it.
+class CCaptureIndex
+{
+
+public:
+	CCaptureIndex() noexcept;
+
+	bool Load( const char *szPath );
+
+	const CaptureIndexHeader_t &GetHeader() const noexcept { return m_Header; }
+
+	uint32 GetNumEntries() const noexcept { return m_Header.m_cEntries; }
+	const CaptureIndexEntry_t &GetEntry( uint32 iEntry ) const noexcept { return m_pEntries[ iEntry ]; }
+
+	// for CCaptureFileReader::SetBlockTable, empty for uncompressed segments
+	uint32 GetNumBlocks() const noexcept { return m_Header.m_cBlocks; }
+	const CaptureBlockEntry_t *GetBlocks() const noexcept { return m_pBlocks; }
+
+	// first entry with a sequence, or timestamp, not less than the given one.
+	// GetNumEntries() if there is none.
+	uint32 LowerBoundSequence( uint64 ullSequence ) const noexcept;
+	uint32 LowerBoundTimestamp( uint64 ullTimestamp ) const noexcept;
+
+	// entries of unEMsg within [ iFirstEntry, iEndEntry ), in file order
+	void FindMsg( uint32 unEMsg, uint32 iFirstEntry, uint32 iEndEntry, std::vector<uint32> *pEntries ) const;
+
+	// nullptr if the name of unEMsg is unknown
+	const char *GetMsgName( uint32 unEMsg, uint32 *pcchName ) const noexcept;
+	// 0 if no EMsg by that name was indexed
+	uint32 FindMsgByName( const char *szName ) const noexcept;
+
+private:
+	const CaptureIndexMsg_t *FindMsgEntry( uint32 unEMsg ) const noexcept;
+
+private:
+	std::vector<uint8> m_Data;
+	CaptureIndexHeader_t m_Header;
+
+	const CaptureIndexEntry_t *m_pEntries;
+	const CaptureIndexMsg_t *m_pMsgs;
+	const CaptureBlockEntry_t *m_pBlocks;
+	const uint8 *m_pubPostings;
+	const char *m_pchNames;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREINDEX_H_
@@ -0,0 +1,431 @@
+
+#include "capturejobs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "captureproto.h"
+
+
+// layouts of MsgHdr_t and ExtendedClientMsgHdr_t, steam/udppkt.h itself pulls in CSteamID which
+// only builds against the MSVC CRT
+constexpr uint32 k_cubMsgHdr = 20;
+constexpr uint32 k_ubMsgHdrJobIDTarget = 4;
+constexpr uint32 k_ubMsgHdrJobIDSource = 12;
+
+constexpr uint32 k_cubExtendedMsgHdr = 36;
+constexpr uint32 k_ubExtendedMsgHdrCubHdr = 4;
+constexpr uint32 k_ubExtendedMsgHdrJobIDTarget = 7;
+constexpr uint32 k_ubExtendedMsgHdrJobIDSource = 15;
+constexpr uint32 k_ubExtendedMsgHdrCanary = 23;
+// m_nHdrCanary of a well formed ExtendedClientMsgHdr_t
+constexpr uint8 k_unExtendedMsgHdrCanary = 239;
+
+
+static uint32 HighestBit( uint64 ullValue ) noexcept
+{
+	uint32 unBit = 0;
+
+	for ( uint32 unShift = 32; unShift != 0; unShift >>= 1 )
+	{
+		if ( ullValue >= ( 1ull << unShift ) )
+		{
+			ullValue >>= unShift;
+			unBit += unShift;
+		}
+	}
+
+	return unBit;
+}
+
+// pulls the job IDs (and for service method calls the method name) out of a message header
+static bool GetJobInfo( const uint8 *pubData, uint32 cubData, JobID_t *pJobIDSource, JobID_t *pJobIDTarget, const char **ppchJobName, uint32 *pcchJobName ) noexcept
+{
+	if ( CaptureIsProto( pubData, cubData ) )
+	{
+		CaptureProtoHeader_t header;
+
+		if ( !CaptureParseMessageProtoHeader( pubData, cubData, k_EProtoHeaderFieldJobs, &header ) )
+			return false;
+
+		*pJobIDSource = header.m_jobIDSource;
+		*pJobIDTarget = header.m_jobIDTarget;
+		*ppchJobName = header.m_pchTargetJobName;
+		*pcchJobName = header.m_cchTargetJobName;
+		return true;
+	}
+
+	*pcchJobName = 0;
+
+	if ( cubData >= k_cubExtendedMsgHdr && pubData[ k_ubExtendedMsgHdrCubHdr ] == k_cubExtendedMsgHdr
+		&& pubData[ k_ubExtendedMsgHdrCanary ] == k_unExtendedMsgHdrCanary )
+	{
+		memcpy( pJobIDSource, pubData + k_ubExtendedMsgHdrJobIDSource, sizeof( JobID_t ) );
+		memcpy( pJobIDTarget, pubData + k_ubExtendedMsgHdrJobIDTarget, sizeof( JobID_t ) );
+		return true;
+	}
+
+	if ( cubData >= k_cubMsgHdr )
+	{
+		memcpy( pJobIDSource, pubData + k_ubMsgHdrJobIDSource, sizeof( JobID_t ) );
+		memcpy( pJobIDTarget, pubData + k_ubMsgHdrJobIDTarget, sizeof( JobID_t ) );
+		return true;
+	}
+
+	return false;
+}
+
+
+CLatencyHistogram::CLatencyHistogram() noexcept
+	: m_cSamples( 0 ),
+	  m_ullSum( 0 ),
+	  m_ullMax( 0 )
+{
+	for ( std::atomic<uint32> &cBucket : m_rgcBuckets )
+		cBucket.store( 0, std::memory_order_relaxed );
+}
+
+void CLatencyHistogram::Record( uint64 ullMicroseconds ) noexcept
+{
+	m_rgcBuckets[ BucketIndex( ullMicroseconds ) ].fetch_add( 1, std::memory_order_relaxed );
+
+	m_cSamples.fetch_add( 1, std::memory_order_relaxed );
+	m_ullSum.fetch_add( ullMicroseconds, std::memory_order_relaxed );
+
+	uint64 ullMax = m_ullMax.load( std::memory_order_relaxed );
+
+	while ( ullMicroseconds > ullMax && !m_ullMax.compare_exchange_weak( ullMax, ullMicroseconds, std::memory_order_relaxed ) )
+	{
+	}
+}
+
+uint64 CLatencyHistogram::GetPercentile( double flPercentile ) const noexcept
+{
+	uint32 rgcBuckets[ k_cBuckets ];
+	uint64 cSamples = 0;
+
+	// count from the same copy we search, the counters may move on while we read them
+	for ( uint32 iBucket = 0; iBucket < k_cBuckets; iBucket++ )
+	{
+		rgcBuckets[ iBucket ] = m_rgcBuckets[ iBucket ].load( std::memory_order_relaxed );
+		cSamples += rgcBuckets[ iBucket ];
+	}
+
+	if ( cSamples == 0 )
+		return 0;
+
+	const double flRank = std::min( std::max( flPercentile, 0.0 ), 100.0 ) / 100.0 * cSamples;
+	const uint64 cRank = std::max<uint64>( static_cast<uint64>( flRank + 0.999999 ), 1 );
+
+	uint64 cSeen = 0;
+
+	for ( uint32 iBucket = 0; iBucket < k_cBuckets; iBucket++ )
+	{
+		cSeen += rgcBuckets[ iBucket ];
+
+		if ( cSeen < cRank )
+			continue;
+
+		if ( iBucket == k_cBuckets - 1 )
+			return GetMax();
+
+		return std::min( BucketLowerBound( iBucket + 1 ) - 1, GetMax() );
+	}
+
+	return GetMax();
+}
+
+uint32 CLatencyHistogram::BucketIndex( uint64 ullValue ) noexcept
+{
+	if ( ullValue < k_cSubBuckets )
+		return static_cast<uint32>( ullValue );
+
+	const uint32 unBit = HighestBit( ullValue );
+	const uint32 iBucket = ( unBit - k_cSubBucketBits + 1 ) * k_cSubBuckets + static_cast<uint32>( ( ullValue >> ( unBit - k_cSubBucketBits ) ) & ( k_cSubBuckets - 1 ) );
+
+	return std::min( iBucket, k_cBuckets - 1 );
+}
+
+uint64 CLatencyHistogram::BucketLowerBound( uint32 iBucket ) noexcept
+{
+	if ( iBucket < k_cSubBuckets )
+		return iBucket;
+
+	const uint32 unBit = iBucket / k_cSubBuckets + k_cSubBucketBits - 1;
+	const uint64 ullSubBucket = iBucket % k_cSubBuckets;
+
+	return ( k_cSubBuckets + ullSubBucket ) << ( unBit - k_cSubBucketBits );
+}
+
+
+CJobLatencySink::CJobLatencySink( ICaptureSink *pNext, const char *szReportPath, CaptureMsgNameFn pfnMsgName )
+	: m_pNext( pNext ),
+	  m_ReportPath( szReportPath ),
+	  m_pfnMsgName( pfnMsgName ),
+	  m_ullReportInterval( 0 ),
+	  m_ullLastReport( CaptureTimestamp() ),
+	  m_ullStarted( m_ullLastReport ),
+	  m_rgpRequestTypes(),
+	  m_cRequestTypes( 0 )
+{
+	this->AddRequestType( "(other)" );
+}
+
+CJobLatencySink::~CJobLatencySink()
+{
+	const uint32 cRequestTypes = m_cRequestTypes.load();
+
+	for ( uint32 iRequestType = 0; iRequestType < cRequestTypes; iRequestType++ )
+		delete m_rgpRequestTypes[ iRequestType ];
+}
+
+void CJobLatencySink::SetReportInterval( uint32 cSeconds ) noexcept
+{
+	// any uint32 count of seconds fits in nanoseconds
+	m_ullReportInterval = cSeconds * 1000000000ull;
+}
+
+void CJobLatencySink::WriteFrame( const CaptureFrame_t &frame )
+{
+	this->ExpireJobs( frame.m_ullTimestamp );
+
+	JobID_t jobIDSource = k_GIDNil;
+	JobID_t jobIDTarget = k_GIDNil;
+	const char *pchJobName = "";
+	uint32 cchJobName = 0;
+
+	if ( GetJobInfo( frame.m_pubData, frame.m_cubData, &jobIDSource, &jobIDTarget, &pchJobName, &cchJobName ) )
+	{
+		if ( frame.m_eDirection == ENetDirection::k_eNetOutgoing && jobIDSource != k_GIDNil )
+		{
+			PendingJob_t job;
+			job.m_ullTimestamp = frame.m_ullTimestamp;
+
+			// reuses the buffer of the previous name
+			m_JobName.assign( pchJobName, cchJobName );
+			job.m_iRequestType = this->FindOrAddRequestType( CaptureGetRawEMsg( frame.m_pubData, frame.m_cubData ) & ~k_EMsgProtoMask, m_JobName );
+
+			// a resend keeps the time of the first attempt
+			if ( m_PendingJobs.emplace( jobIDSource, job ).second )
+				m_PendingOrder.emplace_back( frame.m_ullTimestamp, jobIDSource );
+		}
+		else if ( frame.m_eDirection == ENetDirection::k_eNetIncoming && jobIDTarget != k_GIDNil )
+		{
+			const auto itJob = m_PendingJobs.find( jobIDTarget );
+
+			if ( itJob != m_PendingJobs.end() )
+			{
+				const uint64 ullElapsed = ( frame.m_ullTimestamp > itJob->second.m_ullTimestamp ? frame.m_ullTimestamp - itJob->second.m_ullTimestamp : 0 );
+
+				m_rgpRequestTypes[ itJob->second.m_iRequestType ]->m_Latency.Record( ullElapsed / 1000 );
+				m_PendingJobs.erase( itJob );
+			}
+		}
+	}
+
+	m_pNext->WriteFrame( frame );
+}
+
+void CJobLatencySink::Flush()
+{
+	const uint64 ullNow = CaptureTimestamp();
+
+	if ( m_ullReportInterval != 0 && ullNow - m_ullLastReport >= m_ullReportInterval )
+	{
+		this->ExpireJobs( ullNow );
+		this->WriteReport();
+
+		m_ullLastReport = ullNow;
+	}
+
+	m_pNext->Flush();
+}
+
+void CJobLatencySink::Commit()
+{
+	m_pNext->Commit();
+}
+
+bool CJobLatencySink::WriteReport()
+{
+	struct ReportRow_t
+	{
+		const char *m_szName;
+		uint64 m_cAnswered;
+		uint64 m_cUnanswered;
+		uint64 m_ullSum;
+		uint64 m_ullP50;
+		uint64 m_ullP90;
+		uint64 m_ullP99;
+		uint64 m_ullMax;
+	};
+
+	std::lock_guard<std::mutex> lock( m_ReportMutex );
+
+	const uint32 cRequestTypes = m_cRequestTypes.load( std::memory_order_acquire );
+
+	std::vector<ReportRow_t> rows;
+	rows.reserve( cRequestTypes );
+
+	uint64 cAnswered = 0;
+	uint64 cUnanswered = 0;
+
+	for ( uint32 iRequestType = 0; iRequestType < cRequestTypes; iRequestType++ )
+	{
+		const RequestType_t *pRequestType = m_rgpRequestTypes[ iRequestType ];
+
+		ReportRow_t row;
+		row.m_szName = pRequestType->m_szName;
+		row.m_cAnswered = pRequestType->m_Latency.GetCount();
+		row.m_cUnanswered = pRequestType->m_cUnanswered.load( std::memory_order_relaxed );
+
+		if ( row.m_cAnswered == 0 && row.m_cUnanswered == 0 )
+			continue;
+
+		row.m_ullSum = pRequestType->m_Latency.GetSum();
+		row.m_ullP50 = pRequestType->m_Latency.GetPercentile( 50.0 );
+		row.m_ullP90 = pRequestType->m_Latency.GetPercentile( 90.0 );
+		row.m_ullP99 = pRequestType->m_Latency.GetPercentile( 99.0 );
+		row.m_ullMax = pRequestType->m_Latency.GetMax();
+
+		cAnswered += row.m_cAnswered;
+		cUnanswered += row.m_cUnanswered;
+
+		rows.push_back( row );
+	}
+
+	std::sort( rows.begin(), rows.end(), []( const ReportRow_t &left, const ReportRow_t &right )
+	{
+		return left.m_ullP99 > right.m_ullP99;
+	} );
+
+	const std::string tempPath = m_ReportPath + ".tmp";
+	FILE *pFile = fopen( tempPath.c_str(), "w" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	fprintf( pFile, "# %llu requests answered, %llu unanswered after %llu s, over %llu s of capture\n",
+		static_cast<unsigned long long>( cAnswered ), static_cast<unsigned long long>( cUnanswered ),
+		static_cast<unsigned long long>( k_ullJobTimeout / 1000000000ull ),
+		static_cast<unsigned long long>( ( CaptureTimestamp() - m_ullStarted ) / 1000000000ull ) );
+	fprintf( pFile, "# latencies in milliseconds, sorted by p99\n" );
+	fprintf( pFile, "%-56s %10s %10s %10s %10s %10s %10s %10s\n", "request", "count", "unanswered", "mean", "p50", "p90", "p99", "max" );
+
+	for ( const ReportRow_t &row : rows )
+	{
+		const double flMean = ( row.m_cAnswered != 0 ? static_cast<double>( row.m_ullSum ) / row.m_cAnswered : 0.0 );
+
+		fprintf( pFile, "%-56s %10llu %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+			row.m_szName, static_cast<unsigned long long>( row.m_cAnswered ), static_cast<unsigned long long>( row.m_cUnanswered ),
+			flMean / 1000.0, row.m_ullP50 / 1000.0, row.m_ullP90 / 1000.0, row.m_ullP99 / 1000.0, row.m_ullMax / 1000.0 );
+	}
+
+	const bool bWritten = ( ferror( pFile ) == 0 );
+	fclose( pFile );
+
+	// rename won't replace an existing file on windows
+	remove( m_ReportPath.c_str() );
+
+	if ( !bWritten || rename( tempPath.c_str(), m_ReportPath.c_str() ) != 0 )
+	{
+		remove( tempPath.c_str() );
+		return false;
+	}
+
+	return true;
+}
+
+uint32 CJobLatencySink::FindOrAddRequestType( uint32 unEMsg, const std::string &jobName )
+{
+	if ( !jobName.empty() )
+	{
+		const auto itRequestType = m_NamedRequestTypes.find( jobName );
+
+		if ( itRequestType != m_NamedRequestTypes.end() )
+			return itRequestType->second;
+
+		const uint32 iRequestType = this->AddRequestType( jobName.c_str() );
+		m_NamedRequestTypes.emplace( jobName, iRequestType );
+
+		return iRequestType;
+	}
+
+	const auto itRequestType = m_EMsgRequestTypes.find( unEMsg );
+
+	if ( itRequestType != m_EMsgRequestTypes.end() )
+		return itRequestType->second;
+
+	const char *szMsgName = ( m_pfnMsgName != nullptr ? m_pfnMsgName( static_cast<EMsg>( unEMsg ) ) : nullptr );
+
+	char szName[ k_cchMaxRequestName ];
+
+	if ( szMsgName != nullptr )
+		snprintf( szName, sizeof( szName ), "%s (%u)", szMsgName, unEMsg );
+	else
+		snprintf( szName, sizeof( szName ), "EMsg %u", unEMsg );
+
+	const uint32 iRequestType = this->AddRequestType( szName );
+	m_EMsgRequestTypes.emplace( unEMsg, iRequestType );
+
+	return iRequestType;
+}
+
+uint32 CJobLatencySink::AddRequestType( const char *szName )
+{
+	const uint32 cRequestTypes = m_cRequestTypes.load( std::memory_order_relaxed );
+
+	if ( cRequestTypes == k_cMaxRequestTypes )
+		return 0;
+
+	RequestType_t *pRequestType = new RequestType_t;
+	snprintf( pRequestType->m_szName, sizeof( pRequestType->m_szName ), "%s", szName );
+	pRequestType->m_cUnanswered.store( 0, std::memory_order_relaxed );
+
+	m_rgpRequestTypes[ cRequestTypes ] = pRequestType;
+	m_cRequestTypes.store( cRequestTypes + 1, std::memory_order_release );
+
+	return cRequestTypes;
+}
+
+void CJobLatencySink::ExpireJobs( uint64 ullNow )
+{
+	while ( !m_PendingOrder.empty() )
+	{
+		const std::pair<uint64, JobID_t> &pending = m_PendingOrder.front();
+		const auto itJob = m_PendingJobs.find( pending.second );
+
+		// answered, or answered and the ID reused since
+		if ( itJob == m_PendingJobs.end() || itJob->second.m_ullTimestamp != pending.first )
+		{
+			m_PendingOrder.pop_front();
+			continue;
+		}
+
+		if ( ullNow < pending.first || ullNow - pending.first < k_ullJobTimeout )
+			break;
+
+		m_rgpRequestTypes[ itJob->second.m_iRequestType ]->m_cUnanswered.fetch_add( 1, std::memory_order_relaxed );
+
+		m_PendingJobs.erase( itJob );
+		m_PendingOrder.pop_front();
+	}
+
+	// a request that is still waiting at the front holds back every answered one behind it
+	if ( m_PendingOrder.size() > 2 * m_PendingJobs.size() + 1024 )
+	{
+		std::deque<std::pair<uint64, JobID_t>> pendingOrder;
+
+		for ( const std::pair<uint64, JobID_t> &pending : m_PendingOrder )
+		{
+			const auto itJob = m_PendingJobs.find( pending.second );
+
+			if ( itJob != m_PendingJobs.end() && itJob->second.m_ullTimestamp == pending.first )
+				pendingOrder.push_back( pending );
+		}
+
+		m_PendingOrder.swap( pendingOrder );
+	}
+}
@@ -0,0 +1,152 @@
+
+#ifndef NETHOOK_CAPTUREJOBS_H_
+#define NETHOOK_CAPTUREJOBS_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Job correlation
+//
+// Requests carry the sender's job ID in jobid_source (m_JobIDSource for non-proto messages)
+// and the reply names it again in jobid_target. CJobLatencySink pairs outgoing requests
+// with the incoming replies by that ID and records the round trip, measured between the
+// capture timestamps of the two frames, per EMsg or per service method (target_job_name).
+// Since it runs behind CMultiExpandSink it also sees the replies batched inside Multis.
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "capture.h"
+#include "capturesink.h"
+
+
+// Log-linear histogram of latencies in microseconds: every power of two is split into
+// k_cSubBuckets linear buckets, which keeps the error of any percentile below 1 / k_cSubBuckets
+// of the value from a microsecond up to several days.
+//
+// Recording is a handful of relaxed atomic increments, so any thread can read a histogram
+// while another one records into it. A reader may see a sample in one counter before the
+// others, which is fine for reporting.
+class CLatencyHistogram
+{
+
+public:
+	CLatencyHistogram() noexcept;
+
+	CLatencyHistogram( const CLatencyHistogram & ) = delete;
+	CLatencyHistogram &operator=( const CLatencyHistogram & ) = delete;
+
+	void Record( uint64 ullMicroseconds ) noexcept;
+
+	uint64 GetCount() const noexcept { return m_cSamples.load( std::memory_order_relaxed ); }
+	uint64 GetSum() const noexcept { return m_ullSum.load( std::memory_order_relaxed ); }
+	uint64 GetMax() const noexcept { return m_ullMax.load( std::memory_order_relaxed ); }
+
+	// upper bound of the bucket holding the given percentile (0-100), 0 when empty
+	uint64 GetPercentile( double flPercentile ) const noexcept;
+
+public:
+	static constexpr uint32 k_cSubBucketBits = 4;
+	static constexpr uint32 k_cSubBuckets = 1u << k_cSubBucketBits;
+	// exact buckets for values below k_cSubBuckets, then k_cSubBuckets per power of two up
+	// to 2^40 us (about 12 days), anything larger lands in the last bucket
+	static constexpr uint32 k_cBuckets = ( 40 - k_cSubBucketBits + 1 ) * k_cSubBuckets;
+
+	static uint32 BucketIndex( uint64 ullValue ) noexcept;
+	static uint64 BucketLowerBound( uint32 iBucket ) noexcept;
+
+private:
+	std::atomic<uint32> m_rgcBuckets[ k_cBuckets ];
+
+	std::atomic<uint64> m_cSamples;
+	std::atomic<uint64> m_ullSum;
+	std::atomic<uint64> m_ullMax;
+
+};
+
+
+// Passes every frame on to the next sink untouched and keeps a latency histogram per
+// request type, see the top of this file. Requests that go unanswered for k_ullJobTimeout
+// are counted separately rather than recorded.
+//
+// WriteReport() writes a plain text summary, sorted by 99th percentile, to szReportPath. It
+// is safe to call from any thread, the sink also calls it from Flush() every report interval.
+class CJobLatencySink : public ICaptureSink
+{
+
+public:
+	CJobLatencySink( ICaptureSink *pNext, const char *szReportPath, CaptureMsgNameFn pfnMsgName = nullptr );
+	~CJobLatencySink();
+
+	CJobLatencySink( const CJobLatencySink & ) = delete;
+	CJobLatencySink &operator=( const CJobLatencySink & ) = delete;
+
+	// 0 only writes the report when WriteReport() is called
+	void SetReportInterval( uint32 cSeconds ) noexcept;
+
+	void WriteFrame( const CaptureFrame_t &frame ) override;
+	void Flush() override;
+	void Commit() override;
+
+	bool WriteReport();
+
+public:
+	// further request types share the first, "(other)", histogram
+	static constexpr uint32 k_cMaxRequestTypes = 1024;
+	static constexpr uint32 k_cchMaxRequestName = 128;
+
+	// in capture timestamp nanoseconds
+	static constexpr uint64 k_ullJobTimeout = 60ull * 1000 * 1000 * 1000;
+
+private:
+	struct RequestType_t
+	{
+		char m_szName[ k_cchMaxRequestName ];
+
+		CLatencyHistogram m_Latency;
+		std::atomic<uint64> m_cUnanswered;
+	};
+
+	struct PendingJob_t
+	{
+		uint64 m_ullTimestamp;
+		uint32 m_iRequestType;
+	};
+
+	uint32 FindOrAddRequestType( uint32 unEMsg, const std::string &jobName );
+	uint32 AddRequestType( const char *szName );
+	void ExpireJobs( uint64 ullNow );
+
+private:
+	ICaptureSink *m_pNext;
+
+	std::string m_ReportPath;
+	CaptureMsgNameFn m_pfnMsgName;
+
+	uint64 m_ullReportInterval;
+	uint64 m_ullLastReport;
+	uint64 m_ullStarted;
+
+	std::mutex m_ReportMutex;
+
+	// request types are only ever appended, readers load the count and can then use every
+	// entry below it
+	RequestType_t *m_rgpRequestTypes[ k_cMaxRequestTypes ];
+	std::atomic<uint32> m_cRequestTypes;
+
+	// below here only touched on the writer thread
+	std::unordered_map<uint32, uint32> m_EMsgRequestTypes;
+	std::unordered_map<std::string, uint32> m_NamedRequestTypes;
+	std::string m_JobName;
+
+	std::unordered_map<JobID_t, PendingJob_t> m_PendingJobs;
+	// in the order the requests were sent, may still hold jobs that have since been answered
+	std::deque<std::pair<uint64, JobID_t>> m_PendingOrder;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREJOBS_H_
@@ -0,0 +1,389 @@
+
+#include "capturemulti.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "captureproto.h"
+
+
+constexpr uint32 k_unMultiFieldSizeUnzipped = 1;
+constexpr uint32 k_unMultiFieldMessageBody = 2;
+
+
+bool CaptureParseMulti( const uint8 *pubData, uint32 cubData, CaptureMulti_t *pMulti ) noexcept
+{
+	pMulti->m_cubUnzipped = 0;
+	pMulti->m_pubBody = pubData;
+	pMulti->m_cubBody = 0;
+
+	const uint8 *pubCursor = pubData;
+	const uint8 *pubEnd = pubData + cubData;
+
+	while ( pubCursor != pubEnd )
+	{
+		uint32 unField = 0;
+		EWireType eWireType = k_EWireTypeVarint;
+
+		if ( !CaptureReadTag( &pubCursor, pubEnd, &unField, &eWireType ) )
+			return false;
+
+		uint64 ullValue = 0;
+
+		if ( unField == k_unMultiFieldSizeUnzipped && eWireType == k_EWireTypeVarint )
+		{
+			if ( !CaptureReadVarint( &pubCursor, pubEnd, &ullValue ) )
+				return false;
+
+			// uint32 fields keep the low bits, like the generated parser does
+			pMulti->m_cubUnzipped = static_cast<uint32>( ullValue );
+		}
+		else if ( unField == k_unMultiFieldMessageBody && eWireType == k_EWireTypeLengthDelimited )
+		{
+			if ( !CaptureReadVarint( &pubCursor, pubEnd, &ullValue ) || ullValue > static_cast<uint64>( pubEnd - pubCursor ) )
+				return false;
+
+			// last one wins, again like the generated parser
+			pMulti->m_pubBody = pubCursor;
+			pMulti->m_cubBody = static_cast<uint32>( ullValue );
+
+			pubCursor += ullValue;
+		}
+		else if ( !CaptureSkipField( &pubCursor, pubEnd, eWireType ) )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+CCaptureMultiReader::CCaptureMultiReader( const uint8 *pubData, uint32 cubData ) noexcept
+	: m_pubCursor( pubData ),
+	  m_pubEnd( pubData + cubData ),
+	  m_bTruncated( false )
+{
+}
+
+bool CCaptureMultiReader::Next( const uint8 **ppubChild, uint32 *pcubChild ) noexcept
+{
+	uint32 cubChild = 0;
+
+	if ( GetSizeLeft() < sizeof( cubChild ) )
+	{
+		// the body ended in the middle of a length prefix
+		m_bTruncated = ( GetSizeLeft() != 0 );
+		return false;
+	}
+
+	memcpy( &cubChild, m_pubCursor, sizeof( cubChild ) );
+
+	if ( cubChild > GetSizeLeft() - sizeof( cubChild ) )
+	{
+		m_bTruncated = true;
+		return false;
+	}
+
+	*ppubChild = m_pubCursor + sizeof( cubChild );
+	*pcubChild = cubChild;
+
+	m_pubCursor += sizeof( cubChild ) + cubChild;
+	return true;
+}
+
+
+CCaptureMultiInflater::CCaptureMultiInflater( uint32 cubWindow, uint32 cubMaxChild )
+	: m_cubMaxChild( cubMaxChild ),
+	  m_Window( std::max<uint32>( cubWindow, 64 ) ),
+	  m_ubStart( 0 ),
+	  m_ubEnd( 0 ),
+	  m_cubSkip( 0 ),
+	  m_cSkippedChildren( 0 ),
+	  m_bStreamEnd( true ),
+	  m_bTruncated( false ),
+	  m_bCorrupt( false )
+{
+}
+
+bool CCaptureMultiInflater::Begin( const uint8 *pubCompressed, uint32 cubCompressed, uint32 cubUnzipped )
+{
+	m_ubStart = 0;
+	m_ubEnd = 0;
+	m_cubSkip = 0;
+	m_cSkippedChildren = 0;
+
+	m_bStreamEnd = false;
+	m_bTruncated = false;
+	m_bCorrupt = false;
+
+	// a size_unzipped that is too small fails here, streaming then finds out how much is really there
+	if ( cubUnzipped != 0 && cubUnzipped <= m_cubMaxChild && CZip::GetBackend()->PrefersWholeBuffer()
+		&& this->InflateWhole( pubCompressed, cubCompressed, cubUnzipped ) )
+	{
+		return true;
+	}
+
+	if ( !m_Zip.Begin( pubCompressed, cubCompressed ) )
+	{
+		m_bStreamEnd = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool CCaptureMultiInflater::Next( const uint8 **ppubChild, uint32 *pcubChild )
+{
+	for ( ;; )
+	{
+		if ( m_cubSkip != 0 )
+		{
+			const uint32 cubDropped = std::min( m_cubSkip, m_ubEnd - m_ubStart );
+
+			m_ubStart += cubDropped;
+			m_cubSkip -= cubDropped;
+		}
+
+		const uint32 cubAvailable = m_ubEnd - m_ubStart;
+		uint32 cubChild = 0;
+
+		if ( m_cubSkip == 0 && cubAvailable >= sizeof( cubChild ) )
+		{
+			memcpy( &cubChild, &m_Window[ m_ubStart ], sizeof( cubChild ) );
+
+			if ( cubChild > m_cubMaxChild )
+			{
+				m_ubStart += sizeof( cubChild );
+				m_cubSkip = cubChild;
+				m_cSkippedChildren++;
+				continue;
+			}
+
+			if ( cubChild <= cubAvailable - sizeof( cubChild ) )
+			{
+				*ppubChild = &m_Window[ m_ubStart + sizeof( cubChild ) ];
+				*pcubChild = cubChild;
+
+				m_ubStart += sizeof( cubChild ) + cubChild;
+				return true;
+			}
+		}
+
+		if ( m_bStreamEnd )
+		{
+			if ( cubAvailable != 0 || m_cubSkip != 0 )
+				m_bTruncated = true;
+
+			return false;
+		}
+
+		// only a partial child is left, move it to the front and make room for all of it
+		if ( m_ubStart != 0 )
+		{
+			memmove( &m_Window[ 0 ], &m_Window[ m_ubStart ], cubAvailable );
+
+			m_ubStart = 0;
+			m_ubEnd = cubAvailable;
+		}
+
+		if ( m_cubSkip == 0 && sizeof( cubChild ) + static_cast<size_t>( cubChild ) > m_Window.size() )
+			m_Window.resize( sizeof( cubChild ) + cubChild );
+
+		if ( !this->InflateMore() )
+			m_bStreamEnd = true;
+	}
+}
+
+bool CCaptureMultiInflater::InflateWhole( const uint8 *pubCompressed, uint32 cubCompressed, uint32 cubUnzipped )
+{
+	if ( cubUnzipped > m_Window.size() )
+		m_Window.resize( cubUnzipped );
+
+	uint32 cubInflated = 0;
+
+	if ( !CZip::GetBackend()->Inflate( pubCompressed, cubCompressed, &m_Window[ 0 ], cubUnzipped, &cubInflated ) )
+		return false;
+
+	m_ubEnd = cubInflated;
+	m_bStreamEnd = true;
+
+	return true;
+}
+
+bool CCaptureMultiInflater::InflateMore()
+{
+	uint32 cubInflated = 0;
+	const EZipStatus eStatus = m_Zip.Inflate( &m_Window[ m_ubEnd ], static_cast<uint32>( m_Window.size() ) - m_ubEnd, &cubInflated );
+
+	m_ubEnd += cubInflated;
+
+	if ( eStatus == k_EZipStatusMore )
+		return true;
+
+	if ( eStatus == k_EZipStatusTruncated )
+		m_bTruncated = true;
+	else if ( eStatus == k_EZipStatusCorrupt )
+		m_bCorrupt = true;
+
+	return false;
+}
+
+
+CCaptureMultiExpander::CCaptureMultiExpander( uint32 cMaxDepth, uint64 cubMaxExpanded, CCaptureFilter *pFilter )
+	: m_cMaxDepth( cMaxDepth ),
+	  m_cubMaxExpanded( cubMaxExpanded ),
+	  m_pFilter( pFilter ),
+	  m_cDepth( 0 ),
+	  m_Frame(),
+	  m_cubExpanded( 0 ),
+	  m_Stats()
+{
+}
+
+void CCaptureMultiExpander::SetLimits( uint32 cMaxDepth, uint64 cubMaxExpanded ) noexcept
+{
+	m_cMaxDepth = cMaxDepth;
+	m_cubMaxExpanded = cubMaxExpanded;
+}
+
+bool CCaptureMultiExpander::Begin( const CaptureFrame_t &frame )
+{
+	while ( m_cDepth != 0 )
+		this->PopLevel();
+
+	m_Frame = frame;
+	m_cubExpanded = 0;
+	m_Stats = CaptureMultiStats_t();
+
+	return this->PushMulti( frame.m_pubData, frame.m_cubData );
+}
+
+bool CCaptureMultiExpander::Next( CaptureFrame_t *pChild )
+{
+	*pChild = m_Frame;
+
+	while ( m_cDepth != 0 )
+	{
+		Level_t &level = m_Levels[ m_cDepth - 1 ];
+
+		const bool bChild = ( level.m_bCompressed
+			? level.m_pInflater->Next( &pChild->m_pubData, &pChild->m_cubData )
+			: level.m_Reader.Next( &pChild->m_pubData, &pChild->m_cubData ) );
+
+		if ( !bChild )
+		{
+			this->PopLevel();
+			continue;
+		}
+
+		m_cubExpanded += pChild->m_cubData;
+
+		if ( m_cubExpanded > m_cubMaxExpanded )
+		{
+			m_Stats.m_bBudgetExceeded = true;
+
+			while ( m_cDepth != 0 )
+				this->PopLevel();
+
+			return false;
+		}
+
+		if ( m_pFilter != nullptr && !m_pFilter->ShouldCapture( pChild->m_pubData, pChild->m_cubData ) )
+			continue;
+
+		if ( CaptureGetEMsg( pChild->m_pubData, pChild->m_cubData ) != EMsg::k_EMsgMulti )
+			return true;
+
+		if ( m_cDepth >= m_cMaxDepth )
+		{
+			m_Stats.m_cTooDeep++;
+			continue;
+		}
+
+		// malformed nested Multis are counted and skipped, the parent goes on
+		this->PushMulti( pChild->m_pubData, pChild->m_cubData );
+	}
+
+	return false;
+}
+
+bool CCaptureMultiExpander::PushMulti( const uint8 *pubData, uint32 cubData )
+{
+	struct ProtoHdr
+	{
+		uint32 msg;
+		int headerLength;
+	};
+
+	ProtoHdr protoHdr;
+
+	if ( cubData < sizeof( ProtoHdr ) )
+	{
+		m_Stats.m_cMalformed++;
+		return false;
+	}
+
+	memcpy( &protoHdr, pubData, sizeof( protoHdr ) );
+
+	if ( protoHdr.headerLength < 0 || static_cast<uint32>( protoHdr.headerLength ) > cubData - sizeof( ProtoHdr ) )
+	{
+		m_Stats.m_cMalformed++;
+		return false;
+	}
+
+	const uint32 cubHeader = sizeof( ProtoHdr ) + protoHdr.headerLength;
+
+	CaptureMulti_t multi;
+
+	if ( !CaptureParseMulti( pubData + cubHeader, cubData - cubHeader, &multi ) )
+	{
+		m_Stats.m_cMalformed++;
+		return false;
+	}
+
+	if ( m_Levels.size() <= m_cDepth )
+		m_Levels.resize( m_cDepth + 1 );
+
+	Level_t &level = m_Levels[ m_cDepth ];
+	level.m_bCompressed = ( multi.m_cubUnzipped != 0 );
+
+	if ( !level.m_bCompressed )
+	{
+		// uncompressed children are handed on as views into the Multi itself
+		level.m_Reader = CCaptureMultiReader( multi.m_pubBody, multi.m_cubBody );
+	}
+	else
+	{
+		if ( !level.m_pInflater )
+			level.m_pInflater.reset( new CCaptureMultiInflater );
+
+		if ( !level.m_pInflater->Begin( multi.m_pubBody, multi.m_cubBody, multi.m_cubUnzipped ) )
+		{
+			m_Stats.m_cMalformed++;
+			return false;
+		}
+	}
+
+	m_cDepth++;
+	return true;
+}
+
+void CCaptureMultiExpander::PopLevel() noexcept
+{
+	const Level_t &level = m_Levels[ --m_cDepth ];
+
+	if ( level.m_bCompressed )
+	{
+		if ( level.m_pInflater->IsCorrupt() )
+			m_Stats.m_cCorrupt++;
+		else if ( level.m_pInflater->IsTruncated() )
+			m_Stats.m_cTruncated++;
+
+		m_Stats.m_cSkippedChildren += level.m_pInflater->GetSkippedChildren();
+	}
+	else if ( level.m_Reader.IsTruncated() )
+	{
+		m_Stats.m_cTruncated++;
+	}
+}
@@ -0,0 +1,209 @@
+
+#ifndef NETHOOK_CAPTUREMULTI_H_
+#define NETHOOK_CAPTUREMULTI_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// CMsgMulti demultiplexing without copies
+//
+// A Multi body is a CMsgMulti: size_unzipped (field 1, varint) and message_body (field 2,
+// bytes), the latter holding a run of uint32 length prefixed child messages, gzipped when
+// size_unzipped is set. Going through the generated CMsgMulti copies message_body into a
+// std::string, so instead the two fields are located straight in the wire bytes and every
+// view handed out here points into the caller's buffer.
+//
+// Compressed bodies are inflated by CCaptureMultiInflater in a small window, a child at a time.
+// Only the whole buffer path libdeflate takes sizes its window from size_unzipped, up to
+// cubMaxChild for every nesting level being expanded; a body that claims more is streamed.
+
+#include <memory>
+#include <vector>
+
+#include "capture.h"
+#include "capturefilter.h"
+#include "zip.h"
+
+
+struct CaptureMulti_t
+{
+	// 0 when message_body is not compressed
+	uint32 m_cubUnzipped;
+
+	// view of message_body within the parsed buffer
+	const uint8 *m_pubBody;
+	uint32 m_cubBody;
+};
+
+// pubData is the serialized CMsgMulti, that is the frame past the proto header. Fails on
+// malformed input, unknown fields are skipped.
+bool CaptureParseMulti( const uint8 *pubData, uint32 cubData, CaptureMulti_t *pMulti ) noexcept;
+
+
+// Walks the children of an uncompressed (or already inflated) message_body.
+class CCaptureMultiReader
+{
+
+public:
+	CCaptureMultiReader( const uint8 *pubData, uint32 cubData ) noexcept;
+
+	// false once the children are exhausted, or when the body ends inside the next one or
+	// inside its length prefix, see IsTruncated()
+	bool Next( const uint8 **ppubChild, uint32 *pcubChild ) noexcept;
+
+	bool IsTruncated() const noexcept { return m_bTruncated; }
+	uint32 GetSizeLeft() const noexcept { return static_cast<uint32>( m_pubEnd - m_pubCursor ); }
+
+private:
+	const uint8 *m_pubCursor;
+	const uint8 *m_pubEnd;
+
+	bool m_bTruncated;
+
+};
+
+
+// Streams the children out of a gzipped message_body. Only as much is inflated as it takes to
+// complete the next child, so the first child is available before the rest has been
+// decompressed and memory stays at k_cubDefaultWindow, or the size of the largest child when
+// that is bigger. Children over cubMaxChild are skipped rather than buffered.
+//
+// The inflate stream is taken from CZip's pool once and reset for every body. When the selected
+// backend decodes whole buffers faster than it streams (libdeflate), bodies up to cubMaxChild
+// are instead inflated in one go into a window sized from size_unzipped.
+class CCaptureMultiInflater
+{
+
+public:
+	CCaptureMultiInflater( uint32 cubWindow = k_cubDefaultWindow, uint32 cubMaxChild = k_cubDefaultMaxChild );
+
+	CCaptureMultiInflater( const CCaptureMultiInflater & ) = delete;
+	CCaptureMultiInflater &operator=( const CCaptureMultiInflater & ) = delete;
+
+	// the compressed data has to stay valid until Next() returns false, cubUnzipped is only a
+	// hint and may be 0
+	bool Begin( const uint8 *pubCompressed, uint32 cubCompressed, uint32 cubUnzipped = 0 );
+
+	// see CCaptureMultiReader::Next, a child is only valid until the next call
+	bool Next( const uint8 **ppubChild, uint32 *pcubChild );
+
+	// the body ended in the middle of a child
+	bool IsTruncated() const noexcept { return m_bTruncated; }
+	// the body is not valid gzip data, children before the damage have been handed out
+	bool IsCorrupt() const noexcept { return m_bCorrupt; }
+	uint32 GetSkippedChildren() const noexcept { return m_cSkippedChildren; }
+
+public:
+	static constexpr uint32 k_cubDefaultWindow = 64 * 1024;
+	static constexpr uint32 k_cubDefaultMaxChild = 32 * 1024 * 1024;
+
+private:
+	// false once the stream has ended or failed
+	bool InflateMore();
+	bool InflateWhole( const uint8 *pubCompressed, uint32 cubCompressed, uint32 cubUnzipped );
+
+private:
+	CZipInflater m_Zip;
+
+	uint32 m_cubMaxChild;
+
+	std::vector<uint8> m_Window;
+	// inflated but not yet handed out
+	uint32 m_ubStart;
+	uint32 m_ubEnd;
+
+	// left of a child that is being skipped
+	uint32 m_cubSkip;
+	uint32 m_cSkippedChildren;
+
+	bool m_bStreamEnd;
+	bool m_bTruncated;
+	bool m_bCorrupt;
+
+};
+
+
+// What went wrong while expanding a frame, see CCaptureMultiExpander::GetStats.
+struct CaptureMultiStats_t
+{
+	// Multis whose header or CMsgMulti could not be parsed, or whose body could not be inflated
+	uint32 m_cMalformed;
+	uint32 m_cTruncated;
+	uint32 m_cCorrupt;
+	// children over the inflater's cubMaxChild
+	uint32 m_cSkippedChildren;
+	// Multis nested deeper than the depth limit, dropped whole
+	uint32 m_cTooDeep;
+	// the byte budget ran out and the rest of the frame was dropped
+	bool m_bBudgetExceeded;
+};
+
+// Expands a Multi into the frames it holds, however deeply nested, without recursion.
+//
+// Every Multi being expanded is a level on an explicit stack. Next() pulls the next child off
+// the innermost level, a child that is a Multi itself becomes a new level and is expanded in
+// place, so children come out in wire order. Children of compressed Multis are views into
+// their level's inflate window, which is why nested Multis are finished before their parent
+// goes on rather than being queued for later.
+//
+// Levels past cMaxDepth are dropped, as is everything after cubMaxExpanded bytes of children
+// (at any level) have come out of one frame, which bounds the work a single crafted frame can
+// cause. Instances share nothing, tools can run one per thread over the frames of a capture.
+class CCaptureMultiExpander
+{
+
+public:
+	CCaptureMultiExpander( uint32 cMaxDepth = k_cDefaultMaxDepth, uint64 cubMaxExpanded = k_cubDefaultMaxExpanded, CCaptureFilter *pFilter = nullptr );
+
+	CCaptureMultiExpander( const CCaptureMultiExpander & ) = delete;
+	CCaptureMultiExpander &operator=( const CCaptureMultiExpander & ) = delete;
+
+	void SetLimits( uint32 cMaxDepth, uint64 cubMaxExpanded ) noexcept;
+
+	// frame has to be a Multi and stay valid until Next() returns false, false if it is malformed
+	bool Begin( const CaptureFrame_t &frame );
+
+	// the next frame that isn't a Multi, valid until the next call. Children take the sequence,
+	// timestamp, connection and direction of the frame they came in. With a filter, children it
+	// rejects are skipped, Multis included.
+	bool Next( CaptureFrame_t *pChild );
+
+	// for the frame last passed to Begin()
+	const CaptureMultiStats_t &GetStats() const noexcept { return m_Stats; }
+
+public:
+	static constexpr uint32 k_cDefaultMaxDepth = 8;
+	static constexpr uint64 k_cubDefaultMaxExpanded = 256 * 1024 * 1024;
+
+private:
+	struct Level_t
+	{
+		Level_t() noexcept : m_Reader( nullptr, 0 ), m_bCompressed( false ) {}
+
+		CCaptureMultiReader m_Reader;
+		// created the first time this depth sees a compressed Multi
+		std::unique_ptr<CCaptureMultiInflater> m_pInflater;
+		bool m_bCompressed;
+	};
+
+	bool PushMulti( const uint8 *pubData, uint32 cubData );
+	void PopLevel() noexcept;
+
+private:
+	uint32 m_cMaxDepth;
+	uint64 m_cubMaxExpanded;
+	CCaptureFilter *m_pFilter;
+
+	// indexed by depth, only the first m_cDepth are in use
+	std::vector<Level_t> m_Levels;
+	uint32 m_cDepth;
+
+	CaptureFrame_t m_Frame;
+	uint64 m_cubExpanded;
+
+	CaptureMultiStats_t m_Stats;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREMULTI_H_
@@ -0,0 +1,270 @@
+
+#include "captureproto.h"
+
+
+// field numbers in CMsgProtoBufHeader
+enum EProtoHeaderFieldNumber
+{
+	k_unFieldSteamID = 1,
+	k_unFieldClientSessionID = 2,
+	k_unFieldRoutingAppID = 3,
+	k_unFieldJobIDSource = 10,
+	k_unFieldJobIDTarget = 11,
+	k_unFieldTargetJobName = 12,
+	k_unFieldEResult = 13,
+};
+
+// CMsgProtoBufHeader's default for eresult, k_EResultFail
+constexpr int32 k_nProtoHeaderDefaultEResult = 2;
+
+
+bool CaptureReadTag( const uint8 **ppubCursor, const uint8 *pubEnd, uint32 *punField, EWireType *peWireType ) noexcept
+{
+	const uint8 *pubCursor = *ppubCursor;
+	uint32 unTag = 0;
+
+	if ( pubCursor != pubEnd && *pubCursor < 0x80 )
+	{
+		// fields 1 to 15, which is almost all of them
+		unTag = *pubCursor++;
+	}
+	else
+	{
+		bool bComplete = false;
+
+		// like the generated parser, at most 5 bytes of which the bits past 32 are dropped
+		for ( uint32 unShift = 0; unShift < 35 && !bComplete; unShift += 7 )
+		{
+			if ( pubCursor == pubEnd )
+				return false;
+
+			const uint8 ubByte = *pubCursor++;
+			unTag |= static_cast<uint32>( ubByte & 0x7F ) << unShift;
+
+			bComplete = ( ( ubByte & 0x80 ) == 0 );
+		}
+
+		if ( !bComplete )
+			return false;
+	}
+
+	*ppubCursor = pubCursor;
+
+	if ( unTag < 8 )
+		return false;
+
+	switch ( unTag & 7 )
+	{
+	case k_EWireTypeVarint:
+	case k_EWireTypeFixed64:
+	case k_EWireTypeLengthDelimited:
+	case k_EWireTypeFixed32:
+		break;
+
+	default:
+		return false;
+	}
+
+	*punField = unTag >> 3;
+	*peWireType = static_cast<EWireType>( unTag & 7 );
+	return true;
+}
+
+bool CaptureSkipField( const uint8 **ppubCursor, const uint8 *pubEnd, EWireType eWireType ) noexcept
+{
+	uint64 ullValue = 0;
+
+	switch ( eWireType )
+	{
+	case k_EWireTypeVarint:
+		return CaptureReadVarint( ppubCursor, pubEnd, &ullValue );
+
+	case k_EWireTypeFixed64:
+		if ( pubEnd - *ppubCursor < 8 )
+			return false;
+
+		*ppubCursor += 8;
+		return true;
+
+	case k_EWireTypeLengthDelimited:
+		if ( !CaptureReadVarint( ppubCursor, pubEnd, &ullValue ) || ullValue > static_cast<uint64>( pubEnd - *ppubCursor ) )
+			return false;
+
+		*ppubCursor += ullValue;
+		return true;
+
+	case k_EWireTypeFixed32:
+		if ( pubEnd - *ppubCursor < 4 )
+			return false;
+
+		*ppubCursor += 4;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+static bool ReadFixed64( const uint8 **ppubCursor, const uint8 *pubEnd, uint64 *pullValue ) noexcept
+{
+	if ( pubEnd - *ppubCursor < 8 )
+		return false;
+
+	memcpy( pullValue, *ppubCursor, sizeof( *pullValue ) );
+	*ppubCursor += 8;
+
+	return true;
+}
+
+bool CaptureParseProtoHeader( const uint8 *pubHeader, uint32 cubHeader, uint32 unFields, CaptureProtoHeader_t *pHeader ) noexcept
+{
+	pHeader->m_unPresent = 0;
+	pHeader->m_ullSteamID = 0;
+	pHeader->m_nClientSessionID = 0;
+	pHeader->m_unRoutingAppID = 0;
+	pHeader->m_jobIDSource = k_GIDNil;
+	pHeader->m_jobIDTarget = k_GIDNil;
+	pHeader->m_eResult = k_nProtoHeaderDefaultEResult;
+	pHeader->m_pchTargetJobName = "";
+	pHeader->m_cchTargetJobName = 0;
+
+	const uint8 *pubCursor = pubHeader;
+	const uint8 *pubEnd = pubHeader + cubHeader;
+
+	while ( pubCursor != pubEnd )
+	{
+		uint32 unField = 0;
+		EWireType eWireType = k_EWireTypeVarint;
+
+		if ( !CaptureReadTag( &pubCursor, pubEnd, &unField, &eWireType ) )
+			return false;
+
+		EProtoHeaderField eField;
+		EWireType eExpectedWireType;
+
+		switch ( unField )
+		{
+		case k_unFieldSteamID:
+			eField = k_EProtoHeaderFieldSteamID;
+			eExpectedWireType = k_EWireTypeFixed64;
+			break;
+
+		case k_unFieldClientSessionID:
+			eField = k_EProtoHeaderFieldClientSessionID;
+			eExpectedWireType = k_EWireTypeVarint;
+			break;
+
+		case k_unFieldRoutingAppID:
+			eField = k_EProtoHeaderFieldRoutingAppID;
+			eExpectedWireType = k_EWireTypeVarint;
+			break;
+
+		case k_unFieldJobIDSource:
+			eField = k_EProtoHeaderFieldJobIDSource;
+			eExpectedWireType = k_EWireTypeFixed64;
+			break;
+
+		case k_unFieldJobIDTarget:
+			eField = k_EProtoHeaderFieldJobIDTarget;
+			eExpectedWireType = k_EWireTypeFixed64;
+			break;
+
+		case k_unFieldTargetJobName:
+			eField = k_EProtoHeaderFieldTargetJobName;
+			eExpectedWireType = k_EWireTypeLengthDelimited;
+			break;
+
+		case k_unFieldEResult:
+			eField = k_EProtoHeaderFieldEResult;
+			eExpectedWireType = k_EWireTypeVarint;
+			break;
+
+		default:
+			eField = static_cast<EProtoHeaderField>( 0 );
+			eExpectedWireType = eWireType;
+			break;
+		}
+
+		// not requested, or with a wire type the generated parser would keep as an unknown field
+		if ( ( unFields & eField ) == 0 || eWireType != eExpectedWireType )
+		{
+			if ( !CaptureSkipField( &pubCursor, pubEnd, eWireType ) )
+				return false;
+
+			continue;
+		}
+
+		uint64 ullValue = 0;
+
+		switch ( eField )
+		{
+		case k_EProtoHeaderFieldSteamID:
+			if ( !ReadFixed64( &pubCursor, pubEnd, &pHeader->m_ullSteamID ) )
+				return false;
+
+			break;
+
+		case k_EProtoHeaderFieldJobIDSource:
+			if ( !ReadFixed64( &pubCursor, pubEnd, &pHeader->m_jobIDSource ) )
+				return false;
+
+			break;
+
+		case k_EProtoHeaderFieldJobIDTarget:
+			if ( !ReadFixed64( &pubCursor, pubEnd, &pHeader->m_jobIDTarget ) )
+				return false;
+
+			break;
+
+		case k_EProtoHeaderFieldTargetJobName:
+			if ( !CaptureReadVarint( &pubCursor, pubEnd, &ullValue ) || ullValue > static_cast<uint64>( pubEnd - pubCursor ) )
+				return false;
+
+			// last one wins, like in the generated parser
+			pHeader->m_pchTargetJobName = reinterpret_cast<const char *>( pubCursor );
+			pHeader->m_cchTargetJobName = static_cast<uint32>( ullValue );
+
+			pubCursor += ullValue;
+			break;
+
+		default:
+			if ( !CaptureReadVarint( &pubCursor, pubEnd, &ullValue ) )
+				return false;
+
+			// 32 bit fields keep the low bits
+			if ( eField == k_EProtoHeaderFieldClientSessionID )
+				pHeader->m_nClientSessionID = static_cast<int32>( ullValue );
+			else if ( eField == k_EProtoHeaderFieldRoutingAppID )
+				pHeader->m_unRoutingAppID = static_cast<uint32>( ullValue );
+			else
+				pHeader->m_eResult = static_cast<int32>( ullValue );
+
+			break;
+		}
+
+		pHeader->m_unPresent |= eField;
+	}
+
+	return true;
+}
+
+bool CaptureParseMessageProtoHeader( const uint8 *pubData, uint32 cubData, uint32 unFields, CaptureProtoHeader_t *pHeader ) noexcept
+{
+	struct ProtoHdr
+	{
+		uint32 msg;
+		int headerLength;
+	};
+
+	if ( cubData < sizeof( ProtoHdr ) )
+		return false;
+
+	ProtoHdr protoHdr;
+	memcpy( &protoHdr, pubData, sizeof( protoHdr ) );
+
+	if ( ( protoHdr.msg & k_EMsgProtoMask ) == 0 || protoHdr.headerLength < 0 || static_cast<uint32>( protoHdr.headerLength ) > cubData - sizeof( ProtoHdr ) )
+		return false;
+
+	return CaptureParseProtoHeader( pubData + sizeof( ProtoHdr ), protoHdr.headerLength, unFields, pHeader );
+}
@@ -0,0 +1,188 @@
+
+#ifndef NETHOOK_CAPTUREPROTO_H_
+#define NETHOOK_CAPTUREPROTO_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Protobuf wire format helpers, and a CMsgProtoBufHeader decoder that works straight on the
+// wire bytes
+//
+// The generated CMsgProtoBufHeader allocates the message and a std::string for every string
+// field it comes across, while everything in here only ever looks at a handful of fields.
+// CaptureParseProtoHeader scans the header once, keeps the requested fields and skips the rest,
+// without allocating. It depends on nothing but the capture types, so the tools can use it too.
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "capture.h"
+
+
+enum EWireType
+{
+	k_EWireTypeVarint = 0,
+	k_EWireTypeFixed64 = 1,
+	k_EWireTypeLengthDelimited = 2,
+	k_EWireTypeFixed32 = 5,
+};
+
+// index of the lowest set bit, ullValue must not be 0
+inline uint32 CaptureLowestBit( uint64 ullValue ) noexcept
+{
+#if defined( _MSC_VER ) && defined( _WIN64 )
+	unsigned long ulIndex;
+	_BitScanForward64( &ulIndex, ullValue );
+	return ulIndex;
+#elif defined( _MSC_VER )
+	unsigned long ulIndex;
+
+	if ( _BitScanForward( &ulIndex, static_cast<unsigned long>( ullValue ) ) )
+		return ulIndex;
+
+	_BitScanForward( &ulIndex, static_cast<unsigned long>( ullValue >> 32 ) );
+	return ulIndex + 32;
+#else
+	return static_cast<uint32>( __builtin_ctzll( ullValue ) );
+#endif
+}
+
+// Decodes a varint from at least 10 readable bytes at pubData, returning its size or 0 when it
+// is longer than 10 bytes. The first 8 bytes are handled as one 64 bit word: the first clear
+// high bit ends the varint, and the 7 bit groups are packed together pairwise in three steps
+// rather than one byte at a time, so there is no branch per byte to mispredict.
+inline uint32 CaptureDecodeVarint10( const uint8 *pubData, uint64 *pullValue ) noexcept
+{
+	uint64 ullWord;
+	memcpy( &ullWord, pubData, sizeof( ullWord ) );
+
+	const uint64 ullStops = ~ullWord & 0x8080808080808080ull;
+
+	// everything up to and including the first stop bit, all of it when there is none
+	if ( ullStops != 0 )
+		ullWord &= ullStops ^ ( ullStops - 1 );
+
+	ullWord &= 0x7F7F7F7F7F7F7F7Full;
+	ullWord = ( ullWord & 0x007F007F007F007Full ) | ( ( ullWord & 0x7F007F007F007F00ull ) >> 1 );
+	ullWord = ( ullWord & 0x00003FFF00003FFFull ) | ( ( ullWord & 0x3FFF00003FFF0000ull ) >> 2 );
+	ullWord = ( ullWord & 0x000000000FFFFFFFull ) | ( ( ullWord & 0x0FFFFFFF00000000ull ) >> 4 );
+
+	if ( ullStops != 0 )
+	{
+		*pullValue = ullWord;
+		return ( CaptureLowestBit( ullStops ) >> 3 ) + 1;
+	}
+
+	// 9 and 10 byte varints, negative int32s and most 64 bit ids
+	ullWord |= static_cast<uint64>( pubData[ 8 ] & 0x7F ) << 56;
+
+	if ( pubData[ 8 ] < 0x80 )
+	{
+		*pullValue = ullWord;
+		return 9;
+	}
+
+	ullWord |= static_cast<uint64>( pubData[ 9 ] & 0x7F ) << 63;
+
+	if ( pubData[ 9 ] < 0x80 )
+	{
+		*pullValue = ullWord;
+		return 10;
+	}
+
+	return 0;
+}
+
+// false on a varint running past pubEnd or past 10 bytes
+inline bool CaptureReadVarint( const uint8 **ppubCursor, const uint8 *pubEnd, uint64 *pullValue ) noexcept
+{
+	const uint8 *pubCursor = *ppubCursor;
+
+	// most varints in headers are lengths and small numbers
+	if ( pubCursor != pubEnd && *pubCursor < 0x80 )
+	{
+		*pullValue = *pubCursor;
+		*ppubCursor = pubCursor + 1;
+		return true;
+	}
+
+	if ( pubEnd - pubCursor >= 10 )
+	{
+		const uint32 cubVarint = CaptureDecodeVarint10( pubCursor, pullValue );
+
+		*ppubCursor = pubCursor + cubVarint;
+		return ( cubVarint != 0 );
+	}
+
+	// only near the end of the data
+	uint64 ullValue = 0;
+
+	for ( uint32 unShift = 0; unShift < 64; unShift += 7 )
+	{
+		if ( pubCursor == pubEnd )
+			return false;
+
+		const uint8 ubByte = *pubCursor++;
+		ullValue |= static_cast<uint64>( ubByte & 0x7F ) << unShift;
+
+		if ( ( ubByte & 0x80 ) == 0 )
+		{
+			*pullValue = ullValue;
+			*ppubCursor = pubCursor;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Reads the next tag, false at the end of the data or on a malformed tag. Field 0 is invalid, as
+// are groups, which are long deprecated and never sent by Steam.
+bool CaptureReadTag( const uint8 **ppubCursor, const uint8 *pubEnd, uint32 *punField, EWireType *peWireType ) noexcept;
+
+// skips the value of a field whose tag has just been read
+bool CaptureSkipField( const uint8 **ppubCursor, const uint8 *pubEnd, EWireType eWireType ) noexcept;
+
+
+// The fields of CMsgProtoBufHeader CaptureParseProtoHeader knows about, as a mask.
+enum EProtoHeaderField
+{
+	k_EProtoHeaderFieldSteamID = 1 << 0,
+	k_EProtoHeaderFieldClientSessionID = 1 << 1,
+	k_EProtoHeaderFieldRoutingAppID = 1 << 2,
+	k_EProtoHeaderFieldJobIDSource = 1 << 3,
+	k_EProtoHeaderFieldJobIDTarget = 1 << 4,
+	k_EProtoHeaderFieldTargetJobName = 1 << 5,
+	k_EProtoHeaderFieldEResult = 1 << 6,
+
+	k_EProtoHeaderFieldJobs = k_EProtoHeaderFieldJobIDSource | k_EProtoHeaderFieldJobIDTarget | k_EProtoHeaderFieldTargetJobName,
+	k_EProtoHeaderFieldAll = ( 1 << 7 ) - 1,
+};
+
+struct CaptureProtoHeader_t
+{
+	// the requested fields that were present, the others hold the protobuf defaults
+	uint32 m_unPresent;
+
+	uint64 m_ullSteamID;
+	int32 m_nClientSessionID;
+	uint32 m_unRoutingAppID;
+	JobID_t m_jobIDSource;
+	JobID_t m_jobIDTarget;
+	int32 m_eResult;
+
+	// view into the parsed buffer, not terminated
+	const char *m_pchTargetJobName;
+	uint32 m_cchTargetJobName;
+};
+
+// pubHeader is the serialized CMsgProtoBufHeader, unFields a mask of EProtoHeaderField. Fails
+// wherever the generated parser would, even in fields that weren't requested, groups aside.
+bool CaptureParseProtoHeader( const uint8 *pubHeader, uint32 cubHeader, uint32 unFields, CaptureProtoHeader_t *pHeader ) noexcept;
+
+// the same for a whole message, false if it isn't a protobuf message
+bool CaptureParseMessageProtoHeader( const uint8 *pubData, uint32 cubData, uint32 unFields, CaptureProtoHeader_t *pHeader ) noexcept;
+
+
+#endif // !NETHOOK_CAPTUREPROTO_H_
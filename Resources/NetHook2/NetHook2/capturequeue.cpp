@@ -0,0 +1,263 @@
+
+#include "capturequeue.h"
+
+#include <cstring>
+#include <new>
+#include <thread>
+#include <utility>
+
+
+// oversized buffers carry their capacity in front of the data
+constexpr size_t k_cubOversizedHeader = 16;
+// what buffers over k_cubMaxCachedBuffer are rounded up to
+constexpr uint32 k_cubLargeBufferStep = 1024 * 1024;
+
+static uint8 *AllocOversized( uint32 cubCapacity ) noexcept
+{
+	uint8 *pubBuffer = new ( std::nothrow ) uint8[ k_cubOversizedHeader + cubCapacity ];
+
+	if ( pubBuffer == nullptr )
+		return nullptr;
+
+	memcpy( pubBuffer, &cubCapacity, sizeof( cubCapacity ) );
+	return pubBuffer + k_cubOversizedHeader;
+}
+
+static uint32 GetOversizedCapacity( const uint8 *pubData ) noexcept
+{
+	uint32 cubCapacity = 0;
+	memcpy( &cubCapacity, pubData - k_cubOversizedHeader, sizeof( cubCapacity ) );
+
+	return cubCapacity;
+}
+
+static void FreeOversized( uint8 *pubData ) noexcept
+{
+	delete [] ( pubData - k_cubOversizedHeader );
+}
+
+
+CCaptureQueue::CCaptureQueue( uint32 cSlots, uint32 cubSlot )
+{
+	// round up to a power of two so the slot index is a mask rather than a division
+	m_cSlots = 1;
+	while ( m_cSlots < cSlots )
+		m_cSlots <<= 1;
+
+	m_cubSlot = cubSlot;
+
+	m_pSlots = new Slot_t[ m_cSlots ];
+	m_pubArena = new uint8[ static_cast<size_t>( m_cSlots ) * m_cubSlot ];
+
+	for ( uint32 i = 0; i < m_cSlots; i++ )
+	{
+		Slot_t &slot = m_pSlots[ i ];
+
+		slot.m_ullTurn.store( i, std::memory_order_relaxed );
+		slot.m_pubData = m_pubArena + static_cast<size_t>( i ) * m_cubSlot;
+		slot.m_cubData = 0;
+		slot.m_bOversized = false;
+	}
+
+	m_ullHead.store( 0, std::memory_order_relaxed );
+	m_ullTail = 0;
+
+	m_cStalls.store( 0, std::memory_order_relaxed );
+	m_cOversized.store( 0, std::memory_order_relaxed );
+	m_cOversizedAllocations.store( 0, std::memory_order_relaxed );
+
+	for ( std::atomic<uint8 *> &pCachedBuffer : m_rgpCachedBuffers )
+		pCachedBuffer.store( nullptr, std::memory_order_relaxed );
+
+	m_pubLargeBuffer.store( nullptr, std::memory_order_relaxed );
+}
+
+CCaptureQueue::~CCaptureQueue()
+{
+	for ( uint32 i = 0; i < m_cSlots; i++ )
+	{
+		if ( m_pSlots[ i ].m_bOversized )
+			FreeOversized( m_pSlots[ i ].m_pubData );
+	}
+
+	for ( std::atomic<uint8 *> &pCachedBuffer : m_rgpCachedBuffers )
+	{
+		if ( pCachedBuffer.load( std::memory_order_relaxed ) != nullptr )
+			FreeOversized( pCachedBuffer.load( std::memory_order_relaxed ) );
+	}
+
+	if ( m_pubLargeBuffer.load( std::memory_order_relaxed ) != nullptr )
+		FreeOversized( m_pubLargeBuffer.load( std::memory_order_relaxed ) );
+
+	delete [] m_pSlots;
+	delete [] m_pubArena;
+}
+
+uint64 CCaptureQueue::Push( ENetDirection eDirection, uint64 ullConnection, const uint8 *pubData, uint32 cubData ) noexcept
+{
+	const uint64 ullTicket = m_ullHead.fetch_add( 1, std::memory_order_relaxed );
+	Slot_t &slot = m_pSlots[ ullTicket & ( m_cSlots - 1 ) ];
+
+	if ( slot.m_ullTurn.load( std::memory_order_acquire ) != ullTicket )
+	{
+		// the writer is a full lap behind, wait for it to release this slot
+		m_cStalls.fetch_add( 1, std::memory_order_relaxed );
+
+		while ( slot.m_ullTurn.load( std::memory_order_acquire ) != ullTicket )
+			std::this_thread::yield();
+	}
+
+	slot.m_ullTimestamp = CaptureTimestamp();
+	slot.m_ullConnection = ullConnection;
+	slot.m_eDirection = eDirection;
+	slot.m_cubData = cubData;
+
+	if ( cubData > m_cubSlot )
+	{
+		uint8 *pubOversized = this->AcquireOversized( cubData );
+
+		if ( pubOversized != nullptr )
+		{
+			m_cOversized.fetch_add( 1, std::memory_order_relaxed );
+
+			slot.m_pubData = pubOversized;
+			slot.m_bOversized = true;
+		}
+		else
+		{
+			// out of memory, keep what fits rather than losing the frame entirely
+			slot.m_cubData = m_cubSlot;
+		}
+	}
+
+	memcpy( slot.m_pubData, pubData, slot.m_cubData );
+
+	slot.m_ullTurn.store( ullTicket + 1, std::memory_order_release );
+
+	return ullTicket;
+}
+
+bool CCaptureQueue::Peek( CaptureFrame_t *pFrame ) noexcept
+{
+	const Slot_t &slot = m_pSlots[ m_ullTail & ( m_cSlots - 1 ) ];
+
+	if ( slot.m_ullTurn.load( std::memory_order_acquire ) != m_ullTail + 1 )
+		return false;
+
+	pFrame->m_ullSequence = m_ullTail;
+	pFrame->m_ullTimestamp = slot.m_ullTimestamp;
+	pFrame->m_ullConnection = slot.m_ullConnection;
+	pFrame->m_eDirection = slot.m_eDirection;
+	pFrame->m_pubData = slot.m_pubData;
+	pFrame->m_cubData = slot.m_cubData;
+
+	return true;
+}
+
+void CCaptureQueue::Pop() noexcept
+{
+	const uint32 iSlot = m_ullTail & ( m_cSlots - 1 );
+	Slot_t &slot = m_pSlots[ iSlot ];
+
+	if ( slot.m_bOversized )
+	{
+		this->ReleaseOversized( slot.m_pubData );
+
+		slot.m_pubData = m_pubArena + static_cast<size_t>( iSlot ) * m_cubSlot;
+		slot.m_bOversized = false;
+	}
+
+	slot.m_ullTurn.store( m_ullTail + m_cSlots, std::memory_order_release );
+	m_ullTail++;
+}
+
+bool CCaptureQueue::IsEmpty() const noexcept
+{
+	const Slot_t &slot = m_pSlots[ m_ullTail & ( m_cSlots - 1 ) ];
+
+	return slot.m_ullTurn.load( std::memory_order_acquire ) != m_ullTail + 1;
+}
+
+uint8 *CCaptureQueue::AcquireOversized( uint32 cubData ) noexcept
+{
+	if ( cubData > k_cubMaxCachedBuffer )
+	{
+		uint8 *pubBuffer = m_pubLargeBuffer.exchange( nullptr, std::memory_order_acquire );
+
+		if ( pubBuffer != nullptr )
+		{
+			if ( GetOversizedCapacity( pubBuffer ) >= cubData )
+				return pubBuffer;
+
+			// the one made for this frame replaces it once released
+			FreeOversized( pubBuffer );
+		}
+	}
+
+	for ( std::atomic<uint8 *> &pCachedBuffer : m_rgpCachedBuffers )
+	{
+		if ( pCachedBuffer.load( std::memory_order_relaxed ) == nullptr )
+			continue;
+
+		// only a buffer we own may be looked at, the consumer frees what it can't cache
+		uint8 *pubBuffer = pCachedBuffer.exchange( nullptr, std::memory_order_acquire );
+
+		if ( pubBuffer == nullptr )
+			continue;
+
+		if ( GetOversizedCapacity( pubBuffer ) >= cubData )
+			return pubBuffer;
+
+		// too small for this frame, leave it for another one
+		uint8 *pubEmpty = nullptr;
+
+		if ( !pCachedBuffer.compare_exchange_strong( pubEmpty, pubBuffer, std::memory_order_release ) )
+			FreeOversized( pubBuffer );
+	}
+
+	// powers of two so buffers fit more than the exact size they were made for, up to the
+	// largest size the cache takes. Past that whole megabytes, so the large buffer doesn't have
+	// to be replaced for every frame a little bigger than the last.
+	uint32 cubCapacity = 4096;
+
+	while ( cubCapacity < cubData && cubCapacity < k_cubMaxCachedBuffer )
+		cubCapacity <<= 1;
+
+	if ( cubCapacity < cubData )
+		cubCapacity = cubData <= UINT32_MAX - k_cubLargeBufferStep ? ( cubData + k_cubLargeBufferStep - 1 ) & ~( k_cubLargeBufferStep - 1 ) : cubData;
+
+	m_cOversizedAllocations.fetch_add( 1, std::memory_order_relaxed );
+
+	return AllocOversized( cubCapacity );
+}
+
+void CCaptureQueue::ReleaseOversized( uint8 *pubData ) noexcept
+{
+	if ( GetOversizedCapacity( pubData ) <= k_cubMaxCachedBuffer )
+	{
+		for ( std::atomic<uint8 *> &pCachedBuffer : m_rgpCachedBuffers )
+		{
+			uint8 *pubEmpty = nullptr;
+
+			if ( pCachedBuffer.compare_exchange_strong( pubEmpty, pubData, std::memory_order_release ) )
+				return;
+		}
+
+		FreeOversized( pubData );
+		return;
+	}
+
+	// keep whichever of this one and the current large buffer is bigger
+	uint8 *pubLarge = m_pubLargeBuffer.exchange( nullptr, std::memory_order_acquire );
+
+	if ( pubLarge != nullptr && GetOversizedCapacity( pubLarge ) > GetOversizedCapacity( pubData ) )
+		std::swap( pubLarge, pubData );
+
+	if ( pubLarge != nullptr )
+		FreeOversized( pubLarge );
+
+	uint8 *pubEmpty = nullptr;
+
+	if ( !m_pubLargeBuffer.compare_exchange_strong( pubEmpty, pubData, std::memory_order_release ) )
+		FreeOversized( pubData );
+}
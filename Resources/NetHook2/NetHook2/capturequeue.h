@@ -0,0 +1,98 @@
+
+#ifndef NETHOOK_CAPTUREQUEUE_H_
+#define NETHOOK_CAPTUREQUEUE_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <atomic>
+
+#include "capture.h"
+
+
+// Bounded multi-producer single-consumer ring of pre-sized slots.
+//
+// Any number of hook threads may Push() concurrently; a single writer thread drains the
+// queue with Peek()/Pop(). Pushing only claims a slot with one atomic increment and copies
+// the frame into the slot's preallocated buffer, frames larger than a slot fall back to a
+// heap buffer. Those are handed back to a small cache once the writer has consumed them and
+// reused by later oversized frames, so a steady stream of large Multis doesn't allocate.
+// Buffers over k_cubMaxCachedBuffer don't go in the cache, only the largest of them seen so far
+// is kept, so repeated huge frames reuse it while there is never more than one of them around.
+class CCaptureQueue
+{
+
+public:
+	CCaptureQueue( uint32 cSlots, uint32 cubSlot );
+	~CCaptureQueue();
+
+	CCaptureQueue( const CCaptureQueue & ) = delete;
+	CCaptureQueue &operator=( const CCaptureQueue & ) = delete;
+
+	// producer side, safe to call from any thread. spins while the ring is full.
+	uint64 Push( ENetDirection eDirection, uint64 ullConnection, const uint8 *pubData, uint32 cubData ) noexcept;
+
+	// consumer side, writer thread only. Peek() exposes the oldest frame without
+	// removing it, Pop() releases its slot back to the producers.
+	bool Peek( CaptureFrame_t *pFrame ) noexcept;
+	void Pop() noexcept;
+
+	bool IsEmpty() const noexcept;
+
+	uint32 GetNumSlots() const noexcept { return m_cSlots; }
+	uint64 GetNumStalls() const noexcept { return m_cStalls.load( std::memory_order_relaxed ); }
+	uint64 GetNumOversized() const noexcept { return m_cOversized.load( std::memory_order_relaxed ); }
+	// oversized frames that needed a new buffer rather than a cached one
+	uint64 GetNumOversizedAllocations() const noexcept { return m_cOversizedAllocations.load( std::memory_order_relaxed ); }
+
+public:
+	static constexpr uint32 k_cubCacheLine = 64;
+	static constexpr uint32 k_cCachedBuffers = 16;
+	// larger buffers are sized to their frame and kept in m_pubLargeBuffer instead
+	static constexpr uint32 k_cubMaxCachedBuffer = 4 * 1024 * 1024;
+
+private:
+	struct Slot_t
+	{
+		// equals the ticket of the producer allowed to fill it, ticket + 1 once filled
+		std::atomic<uint64> m_ullTurn;
+
+		uint64 m_ullTimestamp;
+		uint64 m_ullConnection;
+		ENetDirection m_eDirection;
+
+		uint8 *m_pubData;
+		uint32 m_cubData;
+		bool m_bOversized;
+	};
+
+	uint8 *AcquireOversized( uint32 cubData ) noexcept;
+	void ReleaseOversized( uint8 *pubData ) noexcept;
+
+	Slot_t *m_pSlots;
+	uint8 *m_pubArena;
+
+	uint32 m_cSlots;
+	uint32 m_cubSlot;
+
+	// producers and the consumer live on different cache lines. Padded apart rather than
+	// alignas( 64 ), which plain new doesn't honour before C++17 and CCaptureWriter, which holds
+	// the queue, lives on the heap.
+	uint8 m_rgubHeadPadding[ k_cubCacheLine ];
+	std::atomic<uint64> m_ullHead;
+	uint8 m_rgubTailPadding[ k_cubCacheLine - sizeof( std::atomic<uint64> ) ];
+	uint64 m_ullTail;
+
+	std::atomic<uint64> m_cStalls;
+	std::atomic<uint64> m_cOversized;
+	std::atomic<uint64> m_cOversizedAllocations;
+
+	// empty entries are null, taken by producers and refilled by the consumer
+	std::atomic<uint8 *> m_rgpCachedBuffers[ k_cCachedBuffers ];
+	// the largest buffer over k_cubMaxCachedBuffer released so far, the same way
+	std::atomic<uint8 *> m_pubLargeBuffer;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREQUEUE_H_
@@ -0,0 +1,334 @@
+
+#include "capturering.h"
+
+#include <atomic>
+#include <cstring>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+
+// a plain 64 bit store is two 32 bit ones on x86, which a reader could see half done
+static void StoreRingOffset( uint64 *pullOffset, uint64 ullValue ) noexcept
+{
+#ifdef _WIN32
+	InterlockedExchange64( reinterpret_cast<volatile LONG64 *>( pullOffset ), static_cast<LONG64>( ullValue ) );
+#else
+	__atomic_store_n( pullOffset, ullValue, __ATOMIC_RELEASE );
+#endif
+}
+
+
+CCaptureRing::CCaptureRing() noexcept
+	: m_pHeader( nullptr ),
+	  m_pubData( nullptr ),
+	  m_cubData( 0 ),
+	  m_ullHead( 0 ),
+	  m_ullTail( 0 ),
+#ifdef _WIN32
+	  m_hFile( INVALID_HANDLE_VALUE ),
+	  m_hMapping( nullptr ),
+#else
+	  m_iFile( -1 ),
+#endif
+	  m_cubMapping( 0 )
+{
+}
+
+CCaptureRing::~CCaptureRing()
+{
+	Close();
+}
+
+bool CCaptureRing::Open( const char *szPath, uint64 cubRing )
+{
+	Close();
+
+	m_cubData = cubRing & ~7ull;
+	m_cubMapping = static_cast<size_t>( k_cubCaptureRingHeader + m_cubData );
+
+	if ( m_cubData < CaptureRingRecordSpan( 0 ) || cubRing > k_cubCaptureMaxRing )
+		return false;
+
+	void *pvMapping = nullptr;
+
+#ifdef _WIN32
+	// other processes may open and read the ring while we have it mapped
+	m_hFile = CreateFileA( szPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+
+	if ( m_hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER cubFile;
+	cubFile.QuadPart = static_cast<LONGLONG>( m_cubMapping );
+
+	m_hMapping = CreateFileMappingA( m_hFile, nullptr, PAGE_READWRITE, cubFile.HighPart, cubFile.LowPart, nullptr );
+
+	if ( m_hMapping == nullptr )
+	{
+		Close();
+		return false;
+	}
+
+	pvMapping = MapViewOfFile( m_hMapping, FILE_MAP_WRITE, 0, 0, m_cubMapping );
+#else
+	m_iFile = open( szPath, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+	if ( m_iFile < 0 )
+		return false;
+
+	// reserve the blocks up front, running out of space later would fault inside the mapping
+	if ( ftruncate( m_iFile, static_cast<off_t>( m_cubMapping ) ) != 0 || posix_fallocate( m_iFile, 0, static_cast<off_t>( m_cubMapping ) ) != 0 )
+	{
+		Close();
+		return false;
+	}
+
+	pvMapping = mmap( nullptr, m_cubMapping, PROT_READ | PROT_WRITE, MAP_SHARED, m_iFile, 0 );
+
+	if ( pvMapping == MAP_FAILED )
+		pvMapping = nullptr;
+#endif
+
+	if ( pvMapping == nullptr )
+	{
+		Close();
+		return false;
+	}
+
+	m_pHeader = static_cast<CaptureRingHeader_t *>( pvMapping );
+	m_pubData = static_cast<uint8 *>( pvMapping ) + k_cubCaptureRingHeader;
+
+	m_ullHead = 0;
+	m_ullTail = 0;
+
+	m_pHeader->m_usVersion = k_usCaptureRingVersion;
+	m_pHeader->m_cubHeader = sizeof( CaptureRingHeader_t );
+	m_pHeader->m_cubData = m_cubData;
+	m_pHeader->m_ullTimestampBase = CaptureTimestamp();
+	m_pHeader->m_ullWallClockBase = CaptureWallClock();
+	m_pHeader->m_ullHead = 0;
+	m_pHeader->m_ullTail = 0;
+
+	// readers ignore the ring until the magic shows up
+	std::atomic_thread_fence( std::memory_order_release );
+	m_pHeader->m_unMagic = k_unCaptureRingMagic;
+
+	return true;
+}
+
+void CCaptureRing::Close() noexcept
+{
+#ifdef _WIN32
+	if ( m_pHeader != nullptr )
+		UnmapViewOfFile( m_pHeader );
+
+	if ( m_hMapping != nullptr )
+		CloseHandle( m_hMapping );
+
+	if ( m_hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( m_hFile );
+
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if ( m_pHeader != nullptr )
+		munmap( m_pHeader, m_cubMapping );
+
+	if ( m_iFile >= 0 )
+		close( m_iFile );
+
+	m_iFile = -1;
+#endif
+
+	m_pHeader = nullptr;
+	m_pubData = nullptr;
+}
+
+bool CCaptureRing::WriteRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint32 cubData ) noexcept
+{
+	const uint64 cubSpan = CaptureRingRecordSpan( cubData );
+
+	if ( m_pHeader == nullptr || cubSpan > m_cubData )
+		return false;
+
+	const uint64 cubToEnd = m_cubData - m_ullHead % m_cubData;
+
+	if ( cubToEnd < cubSpan )
+	{
+		// doesn't fit before the end, cover the rest of the ring and start over at the front
+		EvictUntil( m_ullHead + cubToEnd );
+
+		if ( cubToEnd >= sizeof( CaptureRecordHeader_t ) )
+		{
+			CaptureRecordHeader_t padding = { };
+			padding.m_unMagic = k_unCaptureRecordMagic;
+			padding.m_cubData = static_cast<uint32>( cubToEnd - sizeof( CaptureRecordHeader_t ) );
+			padding.m_eType = k_ECaptureRecordPadding;
+
+			memcpy( GetPhysical( m_ullHead ), &padding, sizeof( padding ) );
+		}
+
+		m_ullHead += cubToEnd;
+	}
+
+	EvictUntil( m_ullHead + cubSpan );
+
+	CaptureRecordHeader_t record = header;
+	record.m_unMagic = k_unCaptureRecordMagic;
+	record.m_cubData = cubData;
+	record.m_unCRC = CaptureCRC( pubData, cubData );
+
+	uint8 *pubRecord = GetPhysical( m_ullHead );
+	memcpy( pubRecord, &record, sizeof( record ) );
+	memcpy( pubRecord + sizeof( record ), pubData, cubData );
+
+	m_ullHead += cubSpan;
+
+	StoreRingOffset( &m_pHeader->m_ullHead, m_ullHead );
+
+	return true;
+}
+
+void CCaptureRing::EvictUntil( uint64 ullEnd ) noexcept
+{
+	if ( ullEnd - m_ullTail <= m_cubData )
+		return;
+
+	while ( ullEnd - m_ullTail > m_cubData )
+	{
+		const uint64 cubToEnd = m_cubData - m_ullTail % m_cubData;
+
+		if ( cubToEnd < sizeof( CaptureRecordHeader_t ) )
+		{
+			m_ullTail += cubToEnd;
+			continue;
+		}
+
+		const CaptureRecordHeader_t *pRecord = reinterpret_cast<const CaptureRecordHeader_t *>( GetPhysical( m_ullTail ) );
+
+		if ( pRecord->m_eType == k_ECaptureRecordPadding )
+			m_ullTail += cubToEnd;
+		else
+			m_ullTail += CaptureRingRecordSpan( pRecord->m_cubData );
+	}
+
+	// the tail has to be visible before we start overwriting what used to be there
+	StoreRingOffset( &m_pHeader->m_ullTail, m_ullTail );
+	std::atomic_thread_fence( std::memory_order_release );
+}
+
+
+CCaptureRingReader::CCaptureRingReader() noexcept
+	: m_Header(),
+	  m_ullPosition( 0 ),
+	  m_ullEnd( 0 )
+{
+}
+
+bool CCaptureRingReader::Snapshot( const char *szPath, uint32 cAttempts )
+{
+	FILE *pFile = fopen( szPath, "rb" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	bool bSnapshot = false;
+
+	for ( uint32 iAttempt = 0; iAttempt < cAttempts && !bSnapshot; iAttempt++ )
+		bSnapshot = TrySnapshot( pFile );
+
+	fclose( pFile );
+	return bSnapshot;
+}
+
+bool CCaptureRingReader::TrySnapshot( FILE *pFile )
+{
+	CaptureRingHeader_t before;
+	CaptureRingHeader_t after;
+
+	rewind( pFile );
+
+	if ( fread( &before, 1, sizeof( before ), pFile ) != sizeof( before ) || before.m_unMagic != k_unCaptureRingMagic )
+		return false;
+
+	m_Data.resize( static_cast<size_t>( before.m_cubData ) );
+
+	if ( fseek( pFile, k_cubCaptureRingHeader, SEEK_SET ) != 0 || fread( m_Data.data(), 1, m_Data.size(), pFile ) != m_Data.size() )
+		return false;
+
+	rewind( pFile );
+
+	if ( fread( &after, 1, sizeof( after ), pFile ) != sizeof( after ) || after.m_unMagic != k_unCaptureRingMagic )
+		return false;
+
+	// the file is read with a plain copy, so an offset caught halfway through an update on a
+	// 32 bit system would be nonsense. Offsets only grow and stay within a ring of each other.
+	auto consistent = []( const CaptureRingHeader_t &header )
+	{
+		return header.m_ullTail <= header.m_ullHead && header.m_ullHead - header.m_ullTail <= header.m_cubData;
+	};
+
+	if ( !consistent( before ) || !consistent( after ) || after.m_cubData != before.m_cubData || after.m_ullHead < before.m_ullHead || after.m_ullTail < before.m_ullTail )
+		return false;
+
+	// anything the writer evicted while we were copying may have been overwritten, and
+	// anything it added after our first look may be incomplete
+	if ( after.m_ullTail > before.m_ullHead )
+		return false;
+
+	m_Header = before;
+	m_ullPosition = after.m_ullTail;
+	m_ullEnd = before.m_ullHead;
+
+	return true;
+}
+
+ECaptureReadResult CCaptureRingReader::ReadRecord( CaptureRecordHeader_t *pHeader, std::vector<uint8> *pPayload )
+{
+	const uint64 cubRing = m_Data.size();
+
+	while ( m_ullPosition < m_ullEnd )
+	{
+		const uint64 cubToEnd = cubRing - m_ullPosition % cubRing;
+
+		if ( cubToEnd < sizeof( CaptureRecordHeader_t ) )
+		{
+			m_ullPosition += cubToEnd;
+			continue;
+		}
+
+		const uint8 *pubRecord = m_Data.data() + m_ullPosition % cubRing;
+		memcpy( pHeader, pubRecord, sizeof( *pHeader ) );
+
+		if ( pHeader->m_unMagic != k_unCaptureRecordMagic )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		if ( pHeader->m_eType == k_ECaptureRecordPadding )
+		{
+			m_ullPosition += cubToEnd;
+			continue;
+		}
+
+		const uint64 cubSpan = CaptureRingRecordSpan( pHeader->m_cubData );
+
+		if ( cubSpan > cubToEnd || m_ullPosition + cubSpan > m_ullEnd )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		pPayload->assign( pubRecord + sizeof( *pHeader ), pubRecord + sizeof( *pHeader ) + pHeader->m_cubData );
+		m_ullPosition += cubSpan;
+
+		if ( CaptureCRC( pPayload->data(), pHeader->m_cubData ) != pHeader->m_unCRC )
+			return ECaptureReadResult::k_eCaptureReadCorrupt;
+
+		return ECaptureReadResult::k_eCaptureReadOK;
+	}
+
+	return ECaptureReadResult::k_eCaptureReadEnd;
+}
@@ -0,0 +1,147 @@
+
+#ifndef NETHOOK_CAPTURERING_H_
+#define NETHOOK_CAPTURERING_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Flight recorder ring (.nhring)
+//
+// A fixed-size, preallocated, memory-mapped file holding only the most recent records. The
+// file is a CaptureRingHeader_t padded to k_cubCaptureRingHeader, followed by m_cubData
+// bytes of ring. Records use the .nhcap record layout (see capturefile.h) and start on
+// 8 byte boundaries. A record never wraps: when it doesn't fit before the end of the ring
+// the remainder is covered by a k_ECaptureRecordPadding record, or skipped implicitly if
+// not even a record header fits.
+//
+// m_ullHead and m_ullTail are logical byte offsets that only ever grow, the physical
+// position is the offset modulo m_cubData. The writer moves the tail past the records it
+// is about to overwrite before touching them and publishes the head once a record is
+// complete. A reader that copies the file between two reads of the header can therefore
+// trust [ tail from the second read, head from the first read ) and nothing else; see
+// CCaptureRingReader::Snapshot().
+//
+// Both offsets are 8 byte aligned and only ever stored with a single 64 bit atomic write, so
+// a 32 bit writer never leaves half of one behind for a reader to see.
+//
+// Once opened the writer does no file system operations at all, it only stores into the
+// mapping and leaves write back to the OS.
+
+#include <vector>
+
+#include "capture.h"
+#include "capturefile.h"
+
+
+constexpr uint32 k_unCaptureRingMagic = 0x4252484E; // "NHRB"
+constexpr uint16 k_usCaptureRingVersion = 1;
+
+constexpr uint32 k_cubCaptureRingHeader = 4096;
+constexpr uint64 k_cubCaptureDefaultRing = 64ull * 1024 * 1024;
+// the ring is mapped whole, a 32 bit process won't find much more address space in one piece
+constexpr uint64 k_cubCaptureMaxRing = sizeof( void * ) < 8 ? 1024ull * 1024 * 1024 : 64ull * 1024 * 1024 * 1024;
+
+
+// every field is naturally aligned, the layout is the same with or without packing
+struct CaptureRingHeader_t
+{
+	uint32 m_unMagic;
+	uint16 m_usVersion;
+	uint16 m_cubHeader;
+
+	uint64 m_cubData;
+
+	// see CaptureFileHeader_t
+	uint64 m_ullTimestampBase;
+	uint64 m_ullWallClockBase;
+
+	alignas( 8 ) uint64 m_ullHead;
+	alignas( 8 ) uint64 m_ullTail;
+};
+
+static_assert( sizeof( CaptureRingHeader_t ) == 48, "Wrong size of CaptureRingHeader_t" );
+
+
+class CCaptureRing
+{
+
+public:
+	CCaptureRing() noexcept;
+	~CCaptureRing();
+
+	CCaptureRing( const CCaptureRing & ) = delete;
+	CCaptureRing &operator=( const CCaptureRing & ) = delete;
+
+	// creates or truncates szPath, allocates cubRing bytes of ring and maps it
+	bool Open( const char *szPath, uint64 cubRing = k_cubCaptureDefaultRing );
+	void Close() noexcept;
+
+	// m_unMagic, m_cubData and m_unCRC are filled in from the payload. fails only for
+	// records too large to ever fit the ring.
+	bool WriteRecord( const CaptureRecordHeader_t &header, const uint8 *pubData, uint32 cubData ) noexcept;
+
+	bool IsOpen() const noexcept { return m_pHeader != nullptr; }
+	uint64 GetHead() const noexcept { return m_ullHead; }
+	uint64 GetTail() const noexcept { return m_ullTail; }
+
+private:
+	void EvictUntil( uint64 ullEnd ) noexcept;
+	uint8 *GetPhysical( uint64 ullOffset ) const noexcept { return m_pubData + ullOffset % m_cubData; }
+
+private:
+	CaptureRingHeader_t *m_pHeader;
+	uint8 *m_pubData;
+	uint64 m_cubData;
+
+	// writer side copies of the header offsets
+	uint64 m_ullHead;
+	uint64 m_ullTail;
+
+#ifdef _WIN32
+	void *m_hFile;
+	void *m_hMapping;
+#else
+	int m_iFile;
+#endif
+	size_t m_cubMapping;
+
+};
+
+
+// Reads a flight recorder ring, which may be written to concurrently by a live NetHook.
+class CCaptureRingReader
+{
+
+public:
+	CCaptureRingReader() noexcept;
+
+	// copies the ring out of the file and works out which records are intact. retries if
+	// the writer lapped the whole ring while we were copying.
+	bool Snapshot( const char *szPath, uint32 cAttempts = 8 );
+
+	const CaptureRingHeader_t &GetHeader() const noexcept { return m_Header; }
+
+	// walks the snapshot from the oldest to the newest record, skipping padding
+	ECaptureReadResult ReadRecord( CaptureRecordHeader_t *pHeader, std::vector<uint8> *pPayload );
+
+private:
+	bool TrySnapshot( FILE *pFile );
+
+private:
+	CaptureRingHeader_t m_Header;
+	std::vector<uint8> m_Data;
+
+	uint64 m_ullPosition;
+	uint64 m_ullEnd;
+
+};
+
+
+// space a record with cubData bytes of payload takes up in a ring
+inline uint64 CaptureRingRecordSpan( uint32 cubData ) noexcept
+{
+	return ( sizeof( CaptureRecordHeader_t ) + static_cast<uint64>( cubData ) + 7 ) & ~7ull;
+}
+
+
+#endif // !NETHOOK_CAPTURERING_H_
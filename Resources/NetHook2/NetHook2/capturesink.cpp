@@ -0,0 +1,264 @@
+
+#include "capturesink.h"
+
+#include <cstdio>
+
+#include "capturemulti.h"
+#include "log.h"
+
+
+CMultiExpandSink::CMultiExpandSink( ICaptureSink *pNext, CCaptureFilter *pFilter ) noexcept
+	: m_pNext( pNext ),
+	  m_Expander( CCaptureMultiExpander::k_cDefaultMaxDepth, CCaptureMultiExpander::k_cubDefaultMaxExpanded, pFilter )
+{
+}
+
+void CMultiExpandSink::WriteFrame( const CaptureFrame_t &frame )
+{
+	if ( CaptureGetEMsg( frame.m_pubData, frame.m_cubData ) == EMsg::k_EMsgMulti )
+	{
+		this->ExpandMulti( frame );
+		return;
+	}
+
+	m_pNext->WriteFrame( frame );
+}
+
+void CMultiExpandSink::Flush()
+{
+	m_pNext->Flush();
+}
+
+void CMultiExpandSink::Commit()
+{
+	m_pNext->Commit();
+}
+
+void CMultiExpandSink::ExpandMulti( const CaptureFrame_t &frame )
+{
+	NETHOOK_LOG_DEBUG( "Multi: %u bytes\n", frame.m_cubData );
+
+	if ( m_Expander.Begin( frame ) )
+	{
+		CaptureFrame_t child;
+
+		while ( m_Expander.Next( &child ) )
+			m_pNext->WriteFrame( child );
+	}
+
+	const CaptureMultiStats_t &stats = m_Expander.GetStats();
+
+	if ( stats.m_cMalformed != 0 )
+		NETHOOK_LOG_WARNING( "Unable to parse %u Multi(s)\n", stats.m_cMalformed );
+
+	if ( stats.m_cCorrupt != 0 )
+		NETHOOK_LOG_WARNING( "Unable to decompress buffer\n" );
+
+	if ( stats.m_cTruncated != 0 )
+		NETHOOK_LOG_WARNING( "Truncated Multi\n" );
+
+	if ( stats.m_cSkippedChildren != 0 )
+		NETHOOK_LOG_WARNING( "Skipped %u oversized Multi children\n", stats.m_cSkippedChildren );
+
+	if ( stats.m_cTooDeep != 0 )
+		NETHOOK_LOG_WARNING( "Dropped %u Multi(s) nested too deeply\n", stats.m_cTooDeep );
+
+	if ( stats.m_bBudgetExceeded )
+		NETHOOK_LOG_WARNING( "Multi expanded to too much data, dropped the rest of it\n" );
+}
+
+CDumpDirectorySink::CDumpDirectorySink( const char *szDirectory, CaptureMsgNameFn pfnMsgName )
+	: m_Directory( szDirectory ),
+	  m_pfnMsgName( pfnMsgName ),
+	  m_uiMsgNum( 0 )
+{
+}
+
+void CDumpDirectorySink::WriteFrame( const CaptureFrame_t &frame )
+{
+	const EMsg eMsg = CaptureGetEMsg( frame.m_pubData, frame.m_cubData );
+	const char *szMsgName = ( m_pfnMsgName != nullptr ? m_pfnMsgName( eMsg ) : nullptr );
+
+	char szFileName[ 260 ];
+
+	snprintf(
+		szFileName, sizeof( szFileName ),
+		"%03u_%s_%d_%s",
+		++m_uiMsgNum,
+		( frame.m_eDirection == ENetDirection::k_eNetIncoming ? "in" : "out" ),
+		static_cast<int>( eMsg ),
+		( szMsgName != nullptr ? szMsgName : "" )
+	);
+
+	std::string fullFile = m_Directory;
+	fullFile += szFileName;
+
+	const std::string fullFileTmp = fullFile + ".tmp";
+	const std::string fullFileFinal = fullFile + ".bin";
+
+	FILE *pFile = fopen( fullFileTmp.c_str(), "wb" );
+
+	if ( pFile == nullptr )
+		return;
+
+	const size_t cubWritten = fwrite( frame.m_pubData, 1, frame.m_cubData, pFile );
+	fclose( pFile );
+
+	rename( fullFileTmp.c_str(), fullFileFinal.c_str() );
+
+	NETHOOK_LOG_DEBUG( "Wrote %u bytes to %s\n", static_cast<uint32>( cubWritten ), szFileName );
+}
+
+
+CCaptureFileSink::CCaptureFileSink( const char *szBasePath, uint64 cubSegmentMax, CaptureMsgNameFn pfnMsgName )
+	: m_Writer( szBasePath, cubSegmentMax ),
+	  m_pfnMsgName( pfnMsgName ),
+	  m_ullRecordNum( 0 ),
+	  m_unLastSegment( 0 ),
+	  m_cCommitRecords( 0 ),
+	  m_ullCommitInterval( 0 ),
+	  m_bCommitSync( false ),
+	  m_cUncommitted( 0 ),
+	  m_ullFirstUncommitted( 0 )
+{
+}
+
+bool CCaptureFileSink::SetCompression( ECaptureCodec eCodec, uint32 cubBlock )
+{
+	return m_Writer.SetCompression( eCodec, cubBlock );
+}
+
+void CCaptureFileSink::SetCommitPolicy( uint32 cRecords, uint32 cMillisecondsInterval, bool bSync ) noexcept
+{
+	m_cCommitRecords = cRecords;
+	m_ullCommitInterval = cMillisecondsInterval * 1000000ull;
+	m_bCommitSync = bSync;
+}
+
+bool CCaptureFileSink::Open()
+{
+	return m_Writer.Open();
+}
+
+void CCaptureFileSink::WriteFrame( const CaptureFrame_t &frame )
+{
+	const uint32 unRawEMsg = CaptureGetRawEMsg( frame.m_pubData, frame.m_cubData );
+	const uint32 unEMsg = unRawEMsg & ~k_EMsgProtoMask;
+
+	if ( m_NamedMsgs.find( unEMsg ) == m_NamedMsgs.end() )
+		this->WriteMsgName( frame, unEMsg );
+
+	CaptureRecordHeader_t header = { };
+	header.m_ullSequence = ++m_ullRecordNum;
+	header.m_ullTimestamp = frame.m_ullTimestamp;
+	header.m_ullConnection = frame.m_ullConnection;
+	header.m_unEMsg = unEMsg;
+	header.m_eType = k_ECaptureRecordMessage;
+	header.m_eDirection = static_cast<uint8>( frame.m_eDirection );
+	header.m_unFlags = ( ( unRawEMsg & k_EMsgProtoMask ) != 0 ? k_ECaptureRecordFlagProto : 0 );
+
+	if ( !m_Writer.WriteRecord( header, frame.m_pubData, frame.m_cubData ) )
+		NETHOOK_LOG_ERROR( "Unable to write capture record\n" );
+
+	if ( m_cUncommitted++ == 0 )
+		m_ullFirstUncommitted = frame.m_ullTimestamp;
+
+	if ( ( m_cCommitRecords != 0 && m_cUncommitted >= m_cCommitRecords ) || IsCommitDue( frame.m_ullTimestamp ) )
+		this->Commit();
+
+	if ( m_Writer.GetSegment() != m_unLastSegment )
+		NETHOOK_LOG_INFO( "Started capture segment %04u\n", m_Writer.GetSegment() );
+
+	m_unLastSegment = m_Writer.GetSegment();
+}
+
+void CCaptureFileSink::Flush()
+{
+	if ( IsCommitDue( CaptureTimestamp() ) )
+		this->Commit();
+	else
+		m_Writer.Flush();
+}
+
+void CCaptureFileSink::Commit()
+{
+	if ( !m_Writer.Commit( m_bCommitSync ) && m_Writer.IsOpen() )
+		NETHOOK_LOG_ERROR( "Unable to commit capture records\n" );
+
+	m_cUncommitted = 0;
+}
+
+bool CCaptureFileSink::IsCommitDue( uint64 ullNow ) const noexcept
+{
+	return m_cUncommitted != 0 && m_ullCommitInterval != 0 && ullNow - m_ullFirstUncommitted >= m_ullCommitInterval;
+}
+
+void CCaptureFileSink::WriteMsgName( const CaptureFrame_t &frame, uint32 unEMsg )
+{
+	const char *szMsgName = ( m_pfnMsgName != nullptr ? m_pfnMsgName( static_cast<EMsg>( unEMsg ) ) : nullptr );
+
+	if ( szMsgName == nullptr )
+		return;
+
+	CaptureRecordHeader_t header = { };
+	header.m_ullTimestamp = frame.m_ullTimestamp;
+	header.m_unEMsg = unEMsg;
+	header.m_eType = k_ECaptureRecordMsgName;
+
+	if ( m_Writer.WriteRecord( header, reinterpret_cast<const uint8 *>( szMsgName ), static_cast<uint32>( strlen( szMsgName ) ) ) )
+		m_NamedMsgs.insert( unEMsg );
+}
+
+
+CCaptureRingSink::CCaptureRingSink( const char *szPath, uint64 cubRing, CaptureMsgNameFn pfnMsgName ) noexcept
+	: m_Path( szPath ),
+	  m_cubRing( cubRing ),
+	  m_pfnMsgName( pfnMsgName ),
+	  m_ullRecordNum( 0 )
+{
+}
+
+bool CCaptureRingSink::Open()
+{
+	return m_Ring.Open( m_Path.c_str(), m_cubRing );
+}
+
+void CCaptureRingSink::WriteFrame( const CaptureFrame_t &frame )
+{
+	const uint32 unRawEMsg = CaptureGetRawEMsg( frame.m_pubData, frame.m_cubData );
+	const uint32 unEMsg = unRawEMsg & ~k_EMsgProtoMask;
+
+	const auto itName = m_MsgNameOffsets.find( unEMsg );
+
+	if ( itName == m_MsgNameOffsets.end() || itName->second < m_Ring.GetTail() )
+		this->WriteMsgName( frame, unEMsg );
+
+	CaptureRecordHeader_t header = { };
+	header.m_ullSequence = ++m_ullRecordNum;
+	header.m_ullTimestamp = frame.m_ullTimestamp;
+	header.m_ullConnection = frame.m_ullConnection;
+	header.m_unEMsg = unEMsg;
+	header.m_eType = k_ECaptureRecordMessage;
+	header.m_eDirection = static_cast<uint8>( frame.m_eDirection );
+	header.m_unFlags = ( ( unRawEMsg & k_EMsgProtoMask ) != 0 ? k_ECaptureRecordFlagProto : 0 );
+
+	m_Ring.WriteRecord( header, frame.m_pubData, frame.m_cubData );
+}
+
+void CCaptureRingSink::WriteMsgName( const CaptureFrame_t &frame, uint32 unEMsg )
+{
+	const char *szMsgName = ( m_pfnMsgName != nullptr ? m_pfnMsgName( static_cast<EMsg>( unEMsg ) ) : nullptr );
+
+	if ( szMsgName == nullptr )
+		return;
+
+	CaptureRecordHeader_t header = { };
+	header.m_ullTimestamp = frame.m_ullTimestamp;
+	header.m_unEMsg = unEMsg;
+	header.m_eType = k_ECaptureRecordMsgName;
+
+	const uint64 ullOffset = m_Ring.GetHead();
+
+	if ( m_Ring.WriteRecord( header, reinterpret_cast<const uint8 *>( szMsgName ), static_cast<uint32>( strlen( szMsgName ) ) ) )
+		m_MsgNameOffsets[ unEMsg ] = ullOffset;
+}
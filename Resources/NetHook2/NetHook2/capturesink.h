@@ -0,0 +1,149 @@
+
+#ifndef NETHOOK_CAPTURESINK_H_
+#define NETHOOK_CAPTURESINK_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "capture.h"
+#include "capturefile.h"
+#include "capturefilter.h"
+#include "capturemulti.h"
+#include "capturering.h"
+
+
+typedef const char *(*CaptureMsgNameFn)( EMsg eMsg );
+
+
+// Expands EMsg::k_EMsgMulti frames into their children before handing them to the next
+// sink, every other frame is passed through untouched. With a filter, children it rejects are
+// dropped, the top level frames are expected to have been filtered before they were queued.
+class CMultiExpandSink : public ICaptureSink
+{
+
+public:
+	CMultiExpandSink( ICaptureSink *pNext, CCaptureFilter *pFilter = nullptr ) noexcept;
+
+	// see CCaptureMultiExpander
+	void SetLimits( uint32 cMaxDepth, uint64 cubMaxExpanded ) noexcept { m_Expander.SetLimits( cMaxDepth, cubMaxExpanded ); }
+
+	void WriteFrame( const CaptureFrame_t &frame ) override;
+	void Flush() override;
+	void Commit() override;
+
+private:
+	void ExpandMulti( const CaptureFrame_t &frame );
+
+private:
+	ICaptureSink *m_pNext;
+
+	CCaptureMultiExpander m_Expander;
+
+};
+
+
+// Writes every frame to its own NNN_<in|out>_<emsg>_<name>.bin file in a directory, the
+// layout NetHookAnalyzer2 loads.
+class CDumpDirectorySink : public ICaptureSink
+{
+
+public:
+	// szDirectory must end with a path separator
+	CDumpDirectorySink( const char *szDirectory, CaptureMsgNameFn pfnMsgName = nullptr );
+
+	void WriteFrame( const CaptureFrame_t &frame ) override;
+
+private:
+	std::string m_Directory;
+
+	CaptureMsgNameFn m_pfnMsgName;
+
+	uint32 m_uiMsgNum;
+
+};
+
+
+// Appends every frame to a segmented .nhcap capture. The first time an EMsg is seen its name
+// is recorded alongside, so offline tools don't need steamclient to name messages.
+//
+// Records are committed in groups, see SetCommitPolicy, so the cost of getting them onto the
+// disk is paid once per batch rather than once per message.
+class CCaptureFileSink : public ICaptureSink
+{
+
+public:
+	CCaptureFileSink( const char *szBasePath, uint64 cubSegmentMax = k_cubCaptureDefaultSegmentMax, CaptureMsgNameFn pfnMsgName = nullptr );
+
+	// see CCaptureFileWriter::SetCompression, call before Open
+	bool SetCompression( ECaptureCodec eCodec, uint32 cubBlock );
+	// commit once cRecords records are pending, or once the oldest pending record is
+	// cMillisecondsInterval old, 0 disables either. bSync waits for every commit to reach the disk.
+	void SetCommitPolicy( uint32 cRecords, uint32 cMillisecondsInterval, bool bSync ) noexcept;
+	bool Open();
+
+	void WriteFrame( const CaptureFrame_t &frame ) override;
+	void Flush() override;
+	void Commit() override;
+
+private:
+	void WriteMsgName( const CaptureFrame_t &frame, uint32 unEMsg );
+	bool IsCommitDue( uint64 ullNow ) const noexcept;
+
+private:
+	CCaptureFileWriter m_Writer;
+
+	CaptureMsgNameFn m_pfnMsgName;
+
+	uint64 m_ullRecordNum;
+	uint32 m_unLastSegment;
+
+	uint32 m_cCommitRecords;
+	uint64 m_ullCommitInterval;
+	bool m_bCommitSync;
+
+	uint32 m_cUncommitted;
+	uint64 m_ullFirstUncommitted;
+
+	std::unordered_set<uint32> m_NamedMsgs;
+
+};
+
+
+// Flight recorder: keeps only the most recent records in a fixed-size memory-mapped ring.
+// EMsg names are written again whenever their previous name record has been overwritten.
+class CCaptureRingSink : public ICaptureSink
+{
+
+public:
+	CCaptureRingSink( const char *szPath, uint64 cubRing = k_cubCaptureDefaultRing, CaptureMsgNameFn pfnMsgName = nullptr ) noexcept;
+
+	bool Open();
+
+	void WriteFrame( const CaptureFrame_t &frame ) override;
+
+private:
+	void WriteMsgName( const CaptureFrame_t &frame, uint32 unEMsg );
+
+private:
+	CCaptureRing m_Ring;
+
+	std::string m_Path;
+	uint64 m_cubRing;
+
+	CaptureMsgNameFn m_pfnMsgName;
+
+	uint64 m_ullRecordNum;
+
+	// ring offset of the most recent name record of every EMsg
+	std::unordered_map<uint32, uint64> m_MsgNameOffsets;
+
+};
+
+
+#endif // !NETHOOK_CAPTURESINK_H_
@@ -0,0 +1,175 @@
+
+#include "capturewriter.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#endif
+
+
+// maximum number of frames handed to the sink before the writer looks at the stop flag again
+constexpr uint32 k_cFramesPerDrain = 256;
+
+
+CCaptureWriter::CCaptureWriter( ICaptureSink *pSink, uint32 cSlots, uint32 cubSlot )
+	: m_Queue( cSlots, cubSlot ),
+	  m_pSink( pSink ),
+	  m_hModule( nullptr ),
+	  m_bRunning( false ),
+	  m_bWriterIdle( false ),
+	  m_bCommitRequested( false ),
+	  m_bStopped( false )
+{
+}
+
+CCaptureWriter::~CCaptureWriter()
+{
+	Stop();
+}
+
+void CCaptureWriter::Start()
+{
+	if ( m_Thread.joinable() )
+		return;
+
+	m_bStopped = false;
+	m_bRunning.store( true );
+
+#ifdef _WIN32
+	// the thread holds its own reference on the module and drops it with its last instruction,
+	// so a FreeLibrary can never unmap the code it is running
+	HMODULE hModule = nullptr;
+	GetModuleHandleExA( GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCSTR>( &k_cFramesPerDrain ), &hModule );
+
+	m_hModule = hModule;
+#endif
+
+	m_Thread = std::thread( &CCaptureWriter::ThreadMain, this );
+}
+
+void CCaptureWriter::Stop( bool bProcessExit ) noexcept
+{
+	if ( m_bStopped )
+		return;
+
+	m_bStopped = true;
+
+	if ( m_Thread.joinable() )
+	{
+		if ( !bProcessExit )
+		{
+			m_bRunning.store( false );
+
+			{
+				std::lock_guard<std::mutex> lock( m_Mutex );
+				m_WakeCond.notify_one();
+			}
+
+			// the thread drains and commits everything before it exits
+			m_Thread.join();
+			return;
+		}
+
+		// every other thread is gone by the time the process detaches us, waiting would only
+		// stall the exit. whatever the writer didn't get to is drained here.
+		m_Thread.detach();
+	}
+
+	while ( Drain() )
+		;
+
+	m_pSink->Commit();
+}
+
+uint64 CCaptureWriter::Submit( ENetDirection eDirection, uint64 ullConnection, const uint8 *pubData, uint32 cubData ) noexcept
+{
+	const uint64 ullSequence = m_Queue.Push( eDirection, ullConnection, pubData, cubData );
+
+	// pairs with the fence in ThreadMain, either we see the writer idle or it sees our frame
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+
+	if ( m_bWriterIdle.load( std::memory_order_relaxed ) )
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_WakeCond.notify_one();
+	}
+
+	return ullSequence;
+}
+
+void CCaptureWriter::RequestCommit() noexcept
+{
+	m_bCommitRequested.store( true );
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	m_WakeCond.notify_one();
+}
+
+void CCaptureWriter::ThreadMain() noexcept
+{
+	bool bUnflushed = false;
+
+	for ( ;; )
+	{
+		if ( Drain() )
+		{
+			bUnflushed = true;
+			continue;
+		}
+
+		if ( m_bCommitRequested.exchange( false ) )
+		{
+			m_pSink->Commit();
+			bUnflushed = false;
+		}
+		else if ( bUnflushed )
+		{
+			m_pSink->Flush();
+			bUnflushed = false;
+		}
+
+		if ( !m_bRunning.load() )
+			break;
+
+		std::unique_lock<std::mutex> lock( m_Mutex );
+
+		m_bWriterIdle.store( true, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+
+		// the timeout is mostly a safety net, producers wake us when they see us idle. It also
+		// lets the sink commit on its interval while there is no traffic.
+		if ( m_Queue.IsEmpty() && m_bRunning.load() && !m_bCommitRequested.load() && m_WakeCond.wait_for( lock, std::chrono::milliseconds( 100 ) ) == std::cv_status::timeout )
+			bUnflushed = true;
+
+		m_bWriterIdle.store( false, std::memory_order_relaxed );
+	}
+
+	while ( Drain() )
+		;
+
+	m_pSink->Commit();
+
+#ifdef _WIN32
+	// this can be the last reference on the module, nothing of ours may run after it is released
+	if ( m_hModule != nullptr )
+		FreeLibraryAndExitThread( static_cast<HMODULE>( m_hModule ), 0 );
+#endif
+}
+
+bool CCaptureWriter::Drain() noexcept
+{
+	CaptureFrame_t frame;
+	uint32 cFrames = 0;
+
+	while ( cFrames < k_cFramesPerDrain && m_Queue.Peek( &frame ) )
+	{
+		m_pSink->WriteFrame( frame );
+		m_Queue.Pop();
+
+		cFrames++;
+	}
+
+	return cFrames != 0;
+}
@@ -0,0 +1,73 @@
+
+#ifndef NETHOOK_CAPTUREWRITER_H_
+#define NETHOOK_CAPTUREWRITER_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "capture.h"
+#include "capturequeue.h"
+
+
+// Owns the capture queue and the thread draining it.
+//
+// Submit() is what the hooks call: it copies the frame into the queue and returns, all
+// disk I/O, Multi expansion and console output happens on the writer thread.
+class CCaptureWriter
+{
+
+public:
+	CCaptureWriter( ICaptureSink *pSink, uint32 cSlots = k_cDefaultSlots, uint32 cubSlot = k_cubDefaultSlot );
+	~CCaptureWriter();
+
+	CCaptureWriter( const CCaptureWriter & ) = delete;
+	CCaptureWriter &operator=( const CCaptureWriter & ) = delete;
+
+	void Start();
+	// drains whatever is still queued and stops the writer thread. This joins the thread, so it
+	// must not be called with the loader lock held, except with bProcessExit set from
+	// DLL_PROCESS_DETACH: the thread has been killed by then and the queue is drained inline.
+	void Stop( bool bProcessExit = false ) noexcept;
+
+	uint64 Submit( ENetDirection eDirection, uint64 ullConnection, const uint8 *pubData, uint32 cubData ) noexcept;
+
+	// asks the writer thread to commit the sink once it has written everything queued so far,
+	// safe to call from any thread
+	void RequestCommit() noexcept;
+
+	const CCaptureQueue &GetQueue() const noexcept { return m_Queue; }
+
+public:
+	static constexpr uint32 k_cDefaultSlots = 4096;
+	static constexpr uint32 k_cubDefaultSlot = 16 * 1024;
+
+private:
+	void ThreadMain() noexcept;
+	bool Drain() noexcept;
+
+private:
+	CCaptureQueue m_Queue;
+	ICaptureSink *m_pSink;
+
+	std::thread m_Thread;
+
+	// the module reference the writer thread holds while it runs
+	void *m_hModule;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCond;
+
+	std::atomic<bool> m_bRunning;
+	std::atomic<bool> m_bWriterIdle;
+	std::atomic<bool> m_bCommitRequested;
+	bool m_bStopped;
+
+};
+
+
+#endif // !NETHOOK_CAPTUREWRITER_H_
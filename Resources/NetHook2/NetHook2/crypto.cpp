@@ -1,6 +1,7 @@
 #include "crypto.h"
 
 #include "logger.h"
+#include "log.h"
 #include "csimplescan.h"
 #include "steamclient.h"
 
@@ -29,46 +30,42 @@ static_assert(offsetof(MsgInfo_t, pchMsgName) == 16, "Wrong offset of MsgInfo_t:
 
 typedef std::pair<EMsg, MsgInfo_t *> MsgPair;
 
-CCrypto::CCrypto() noexcept
-	: Encrypt_Detour( nullptr )
+void CCrypto::AddFunctions( CSimpleScan *pScan )
 {
-	CSimpleScan steamClientScan( STEAMCLIENT_DLL );
-
-
-	SymmetricEncryptChosenIVFn pEncrypt = nullptr;
-	const bool bEncrypt = steamClientScan.FindFunction(
+	static constexpr SigScanPattern encryptSig(
 #ifdef X64BITS
-		"\x48\x83\xEC\x58\x8B\x84\x24\xCC\xCC\xCC\xCC\xC6\x44\x24",
-		"xxxxxxx????xxx",
+		"48 83 EC 58 8B 84 24 ?? ?? ?? ?? C6 44 24"
 #else
-		"\x55\x8B\xEC\x6A\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75\xCC\xFF\x75",
-		"xxxx?xx?xx?xx?xx?xx?xx?xx?xx",
+		"55 8B EC 6A ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75"
 #endif
-		(void **)&pEncrypt
 	);
 
-	Encrypt_Orig = pEncrypt;
-
-	g_pLogger->LogConsole( "CCrypto::SymmetricEncryptChosenIV = 0x%p\n", Encrypt_Orig );
-
-	const bool bPchMsgNameFromEMsg = steamClientScan.FindFunction(
+	static constexpr SigScanPattern msgNameSig(
 #ifdef X64BITS
-		"\x48\x89\x5C\x24\xCC\x57\x48\x83\xEC\x20\x8B\xD9\xE8",
-		"xxxx?xxxxxxxx",
+		"48 89 5C 24 ?? 57 48 83 EC 20 8B D9 E8"
 #else
-		"\x55\x8B\xEC\x51\x56\xE8\x00\x00\x00\x00\x8B\x00\x00\x00\x00\x00\x8B\xF0",
-		"xxxxxx????x?????xx",
+		"55 8B EC 51 56 E8 ?? ?? ?? ?? 8B ?? ?? ?? ?? ?? 8B F0"
 #endif
-		(void**)&PchMsgNameFromEMsg
 	);
 
-	if (bPchMsgNameFromEMsg)
+	pScan->AddFunction( encryptSig, (void **)&Encrypt_Orig );
+	pScan->AddFunction( msgNameSig, (void **)&PchMsgNameFromEMsg );
+}
+
+CCrypto::CCrypto() noexcept
+	: Encrypt_Detour( nullptr )
+{
+	const bool bEncrypt = ( Encrypt_Orig != nullptr );
+
+	g_pLogger->LogConsole( "CCrypto::SymmetricEncryptChosenIV = 0x%p\n", Encrypt_Orig );
+
+	if ( PchMsgNameFromEMsg != nullptr )
 	{
 		g_pLogger->LogConsole( "PchMsgNameFromEMsg = 0x%p\n", PchMsgNameFromEMsg);
 	}
 	else
 	{
-		g_pLogger->LogConsole( "Unable to find PchMsgNameFromEMsg.\n" );
+		NETHOOK_LOG_WARNING( "Unable to find PchMsgNameFromEMsg.\n" );
 	}
 
 	SymmetricEncryptChosenIVFn encrypt = CCrypto::SymmetricEncryptChosenIV;
@@ -82,7 +79,7 @@ CCrypto::CCrypto() noexcept
 	}
 	else
 	{
-		g_pLogger->LogConsole( "Unable to hook SymmetricEncryptChosenIV: Func scan failed.\n" );
+		NETHOOK_LOG_WARNING( "Unable to hook SymmetricEncryptChosenIV: Func scan failed.\n" );
 	}
 }
 
@@ -8,6 +8,8 @@
 #include "csimpledetour.h"
 #include <map>
 
+class CSimpleScan;
+
 #undef GetMessage
 
 typedef bool(__cdecl *SymmetricEncryptChosenIVFn)(const uint8*, uint32, const uint8*, uint32, uint8*, uint32*, const uint8*, uint32);
@@ -29,6 +31,9 @@ public:
 	CCrypto() noexcept;
 	~CCrypto();
 
+	// queues the functions to hook, they have to be found before CCrypto is created
+	static void AddFunctions( CSimpleScan *pScan );
+
 	const char* GetMessage( EMsg eMsg, uint8 serverType );
 
 	CSimpleDetour* Encrypt_Detour;
@@ -2,9 +2,17 @@
 
 #include "csimplescan.h"
 #include <assert.h>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "log.h"
 
 #define CREATEINTERFACE_PROCNAME	"CreateInterface"
 
+// held while a scanner reads or rewrites its cache file, scanners of other modules may share it
+static std::mutex s_CacheMutex;
+
 // load/unload components
 //class CSysModule;
 
@@ -40,10 +48,12 @@ CSimpleScan::CSimpleScan() noexcept
 {
 	m_bInterfaceSet = false;
 	m_Interface = nullptr;
+	m_cThreads = 1;
 }
 
 CSimpleScan::CSimpleScan( const char *filename ) noexcept
 {
+	m_cThreads = 1;
 	SetDLL( filename );
 }
 
@@ -51,9 +61,7 @@ bool CSimpleScan::SetDLL( const char *filename ) noexcept
 {
 	m_Interface = Sys_GetFactory( filename );
 
-	CSigScan::sigscan_dllfunc = m_Interface;
-
-	if (!CSigScan::GetDllMemInfo())
+	if ( !m_Module.Init( ( void * )m_Interface ) )
 	{
 		m_bInterfaceSet = false;
 	}
@@ -71,7 +79,7 @@ bool CSimpleScan::FindFunction( const char * sig, const char *mask, void **func
 		return false;
 
 	
-	m_Signature.Init( ( unsigned char * )sig, ( char * )mask, strlen( mask ) );
+	m_Signature.Init( m_Module, ( unsigned char * )sig, ( char * )mask, strlen( mask ) );
 
 	if ( !m_Signature.is_set )
 		return false;
@@ -80,3 +88,186 @@ bool CSimpleScan::FindFunction( const char * sig, const char *mask, void **func
 
 	return true;
 }
+
+void CSimpleScan::AddFunction( const SigScanPattern &pattern, void **func )
+{
+	*func = nullptr;
+
+	Function_t function;
+	function.m_pSignature.reset( new CSigScan );
+	function.m_pSignature->Prepare( pattern );
+	function.m_pFunc = func;
+
+	m_Functions.push_back( std::move( function ) );
+}
+
+static bool IsSameBuild( const SigScanFingerprint &left, const SigScanFingerprint &right ) noexcept
+{
+	return left.size == right.size && left.stamp == right.stamp && left.hash == right.hash;
+}
+
+size_t CSimpleScan::FindFunctions()
+{
+	size_t cFound = 0;
+
+	if ( m_bInterfaceSet )
+	{
+		const std::string &modulePath = m_Module.GetPath();
+		const SigScanFingerprint &fingerprint = m_Module.GetFingerprint();
+
+		std::vector<CacheEntry_t> cache;
+
+		if ( !m_CacheFile.empty() )
+		{
+			std::lock_guard<std::mutex> lock( s_CacheMutex );
+			this->LoadCache( &cache );
+		}
+
+		std::vector<CSigScan *> signatures;
+		signatures.reserve( m_Functions.size() );
+
+		for ( const Function_t &function : m_Functions )
+		{
+			CSigScan *pSignature = function.m_pSignature.get();
+			const unsigned long long ullKey = pSignature->GetKey();
+
+			bool bCached = false;
+
+			for ( const CacheEntry_t &entry : cache )
+			{
+				if ( entry.m_ullKey == ullKey && IsSameBuild( entry.m_Fingerprint, fingerprint ) && entry.m_ModulePath == modulePath )
+				{
+					bCached = pSignature->MatchOffset( m_Module, static_cast<size_t>( entry.m_ullOffset ) );
+					break;
+				}
+			}
+
+			if ( bCached )
+				cFound++;
+			else
+				signatures.push_back( pSignature );
+		}
+
+		const size_t cCached = cFound;
+
+		// only what the cache didn't know is scanned for
+		if ( !signatures.empty() )
+			cFound += CSigScan::FindSignatures( m_Module, signatures.data(), signatures.size(), m_cThreads );
+
+		NETHOOK_LOG_DEBUG( "Found %u of %u functions, %u of them remembered from an earlier run\n",
+			static_cast<uint32>( cFound ), static_cast<uint32>( m_Functions.size() ), static_cast<uint32>( cCached ) );
+
+		for ( const Function_t &function : m_Functions )
+		{
+			if ( function.m_pSignature->is_set )
+				*function.m_pFunc = function.m_pSignature->sig_addr;
+		}
+
+		if ( !m_CacheFile.empty() && cFound != cCached )
+		{
+			// read again, so what other scanners saved since is kept
+			std::lock_guard<std::mutex> lock( s_CacheMutex );
+
+			cache.clear();
+			this->LoadCache( &cache );
+
+			// entries for other builds of this module are dropped, other modules are left alone
+			std::vector<CacheEntry_t> updated;
+
+			for ( const CacheEntry_t &entry : cache )
+			{
+				if ( entry.m_ModulePath != modulePath || IsSameBuild( entry.m_Fingerprint, fingerprint ) )
+					updated.push_back( entry );
+			}
+
+			for ( CSigScan *pSignature : signatures )
+			{
+				if ( !pSignature->is_set )
+					continue;
+
+				CacheEntry_t entry;
+				entry.m_Fingerprint = fingerprint;
+				entry.m_ullKey = pSignature->GetKey();
+				entry.m_ullOffset = static_cast<unsigned char *>( pSignature->sig_addr ) - m_Module.GetBaseAddr();
+				entry.m_ModulePath = modulePath;
+
+				// a stale offset for the same signature is replaced
+				for ( size_t i = 0; i < updated.size(); i++ )
+				{
+					if ( updated[ i ].m_ullKey == entry.m_ullKey && updated[ i ].m_ModulePath == modulePath )
+					{
+						updated.erase( updated.begin() + i );
+						break;
+					}
+				}
+
+				updated.push_back( entry );
+			}
+
+			this->SaveCache( updated );
+		}
+	}
+
+	m_Functions.clear();
+
+	return cFound;
+}
+
+void CSimpleScan::SetCacheFile( const char *filename )
+{
+	m_CacheFile = filename;
+}
+
+// One entry per line: module size, PE time stamp, header hash, signature key, offset and the
+// module path, all but the path in hex. Lines that don't parse are skipped, so a damaged file
+// costs a scan and nothing else.
+void CSimpleScan::LoadCache( std::vector<CacheEntry_t> *pEntries ) const
+{
+	FILE *pFile = fopen( m_CacheFile.c_str(), "r" );
+
+	if ( pFile == nullptr )
+		return;
+
+	char szLine[ 1024 ];
+
+	while ( fgets( szLine, sizeof( szLine ), pFile ) != nullptr )
+	{
+		CacheEntry_t entry;
+		int cchFields = 0;
+
+		if ( sscanf( szLine, "%llx %llx %llx %llx %llx %n", &entry.m_Fingerprint.size, &entry.m_Fingerprint.stamp,
+			&entry.m_Fingerprint.hash, &entry.m_ullKey, &entry.m_ullOffset, &cchFields ) != 5 || cchFields == 0 )
+		{
+			continue;
+		}
+
+		entry.m_ModulePath = szLine + cchFields;
+
+		while ( !entry.m_ModulePath.empty() && ( entry.m_ModulePath.back() == '\n' || entry.m_ModulePath.back() == '\r' ) )
+			entry.m_ModulePath.pop_back();
+
+		if ( !entry.m_ModulePath.empty() )
+			pEntries->push_back( entry );
+	}
+
+	fclose( pFile );
+}
+
+void CSimpleScan::SaveCache( const std::vector<CacheEntry_t> &entries ) const
+{
+	FILE *pFile = fopen( m_CacheFile.c_str(), "w" );
+
+	if ( pFile == nullptr )
+	{
+		NETHOOK_LOG_WARNING( "Unable to write signature cache %s\n", m_CacheFile.c_str() );
+		return;
+	}
+
+	for ( const CacheEntry_t &entry : entries )
+	{
+		fprintf( pFile, "%llx %llx %llx %llx %llx %s\n", entry.m_Fingerprint.size, entry.m_Fingerprint.stamp,
+			entry.m_Fingerprint.hash, entry.m_ullKey, entry.m_ullOffset, entry.m_ModulePath.c_str() );
+	}
+
+	fclose( pFile );
+}
@@ -1,10 +1,16 @@
 #ifndef CSIMPLESCAN_H
 #define CSIMPLESCAN_H
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "sigscan.h"
 
 #include "steam/steamtypes.h"
 
+// Finds functions in a single module by their signatures. Every scanner keeps its own module,
+// scanners of different modules can run at the same time on different threads.
 class CSimpleScan
 {
 
@@ -15,12 +21,50 @@ public:
 	bool SetDLL( const char *filename ) noexcept;
 	bool FindFunction( const char *sig, const char *mask, void **func ) noexcept;
 
+	// Queues a signature for FindFunctions, which finds all of them in a single pass over the
+	// module. func is set to nullptr until then, and stays so when the signature isn't found.
+	// The pattern isn't copied and has to stay around until FindFunctions returns.
+	void AddFunction( const SigScanPattern &pattern, void **func );
+	// returns how many of the queued functions were found, the queue is emptied either way
+	size_t FindFunctions();
+
+	// how many threads FindFunctions scans with, the calling one included
+	void SetThreads( size_t cThreads ) noexcept { m_cThreads = cThreads; }
+
+	// Where FindFunctions remembers the offsets it found, for the same build of the module.
+	// Remembered offsets are checked against their signature before they are used, functions
+	// that aren't where they were are scanned for.
+	void SetCacheFile( const char *filename );
+
 private:
+	struct Function_t
+	{
+		std::unique_ptr<CSigScan> m_pSignature;
+		void **m_pFunc;
+	};
+
+	// a line of the cache file
+	struct CacheEntry_t
+	{
+		SigScanFingerprint m_Fingerprint;
+		unsigned long long m_ullKey;
+		unsigned long long m_ullOffset;
+		std::string m_ModulePath;
+	};
+
+	void LoadCache( std::vector<CacheEntry_t> *pEntries ) const;
+	void SaveCache( const std::vector<CacheEntry_t> &entries ) const;
+
 	bool m_bInterfaceSet;
 
 	CreateInterfaceFn m_Interface;
+	CSigScanModule m_Module;
 	CSigScan m_Signature;
 
+	std::vector<Function_t> m_Functions;
+	std::string m_CacheFile;
+	size_t m_cThreads;
+
 };
 
 #endif //CSIMPLESCAN_H
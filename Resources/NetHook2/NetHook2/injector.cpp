@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <memory>
 
+#include "logger.h"
 #include "nh2_string.h"
 #include "sedebug.h"
 #include "steamclient.h"
@@ -52,6 +53,9 @@ BOOL InjectEjection(const HWND hWindow, const int iSteamProcessID, const char *
 // rundll32.exe C:\Path\To\NetHook2.dll,Eject
 // rundll32.exe C:\Path\To\NetHook2.dll,Eject <process ID>
 // rundll32.exe C:\Path\To\NetHook2.dll,Eject <process name>
+// rundll32.exe C:\Path\To\NetHook2.dll,Commit
+// rundll32.exe C:\Path\To\NetHook2.dll,Commit <process ID>
+// rundll32.exe C:\Path\To\NetHook2.dll,Commit <process name>
 //
 
 #ifdef X64BITS
@@ -68,6 +72,13 @@ __declspec(dllexport) void CALLBACK Inject(HWND hWindow, HINSTANCE hInstance, LP
 #endif
 __declspec(dllexport) void CALLBACK Eject(HWND hWindow, HINSTANCE hInstance, LPSTR lpszCommandLine, int nCmdShow);
 
+#ifdef X64BITS
+#pragma comment(linker, "/EXPORT:Commit=?Commit@@YAXPEAUHWND__@@PEAUHINSTANCE__@@PEADH@Z")
+#else
+#pragma comment(linker, "/EXPORT:Commit=?Commit@@YGXPAUHWND__@@PAUHINSTANCE__@@PADH@Z")
+#endif
+__declspec(dllexport) void CALLBACK Commit(HWND hWindow, HINSTANCE hInstance, LPSTR lpszCommandLine, int nCmdShow);
+
 typedef enum {
 	k_ESteamProcessSearchErrorNone = 0,
 	k_ESteamProcessSearchErrorCouldNotFindSteam,
@@ -229,6 +240,44 @@ void CALLBACK Eject( HWND hWindow, HINSTANCE hInstance, LPSTR lpszCommandLine, i
 	CloseHandle( hSeDebugToken );
 }
 
+void CALLBACK Commit( HWND hWindow, HINSTANCE hInstance, LPSTR lpszCommandLine, int nCmdShow )
+{
+	HANDLE hSeDebugToken = NULL;
+
+	int iSteamProcessID = -1;
+	ESteamProcessSearchError eError = GetSteamProcessID( hWindow, lpszCommandLine, &iSteamProcessID );
+
+	// see Eject
+	if ( eError == k_ESteamProcessSearchErrorCouldNotFindSteam || eError == k_ESteamProcessSearchErrorCouldNotFindProcessWithSuppliedName || eError == k_ESteamProcessSearchErrorTargetProcessDoesNotHaveSteamClientDllLoaded )
+	{
+		hSeDebugToken = SeDebugAcquire();
+		if ( hSeDebugToken == NULL )
+		{
+			MessageBoxA( hWindow, "Unable to acquire SeDebug privilege. Make sure you're running as Administrator (elevated).", "NetHook2", MB_OK | MB_ICONASTERISK );
+			return;
+		}
+		eError = GetSteamProcessID( hWindow, lpszCommandLine, &iSteamProcessID );
+	}
+
+	if ( eError != k_ESteamProcessSearchErrorNone )
+	{
+		MessageBoxA( hWindow, NameFromESteamProcessSearchError( eError ), "NetHook2", MB_OK | MB_ICONASTERISK );
+		CloseHandle( hSeDebugToken );
+		return;
+	}
+
+	char szCommitEvent[64];
+	sprintf_s( szCommitEvent, sizeof( szCommitEvent ), NETHOOK_COMMIT_EVENT_FORMAT, static_cast<unsigned long>( iSteamProcessID ) );
+
+	SafeHandle hCommitEvent = MakeSafeHandle( OpenEventA( EVENT_MODIFY_STATE, FALSE, szCommitEvent ) );
+	if ( hCommitEvent == NULL || !SetEvent( hCommitEvent.get() ) )
+	{
+		MessageBoxA( hWindow, "Unable to commit: This instance of Steam does not have NetHook2 loaded.", "NetHook2", MB_OK | MB_ICONASTERISK );
+	}
+
+	CloseHandle( hSeDebugToken );
+}
+
 //
 // Process Helpers
 //
@@ -370,13 +419,17 @@ BOOL TryParseInt(const char * szStringIn, int * pIntOut)
 // Code Cave
 //
 typedef HMODULE (WINAPI *GetModuleHandleAPtr)(LPCSTR);
+typedef FARPROC (WINAPI *GetProcAddressPtr)(HMODULE, LPCSTR);
 typedef BOOL (WINAPI *FreeLibraryPtr)(HMODULE);
+typedef void (WINAPI *ShutdownPtr)();
 
 struct EjectParams
 {
 	GetModuleHandleAPtr GetModuleHandleA;
+	GetProcAddressPtr GetProcAddress;
 	FreeLibraryPtr FreeLibrary;
 	char szModuleName[MAX_PATH];
+	char szShutdownName[16];
 };
 
 //
@@ -389,6 +442,18 @@ static DWORD WINAPI _Eject(LPVOID lpThreadParameter)
 {
 	struct EjectParams * pParams = (struct EjectParams *)lpThreadParameter;
 	HMODULE hModule = pParams->GetModuleHandleA(pParams->szModuleName);
+	if (hModule == NULL)
+	{
+		return 1;
+	}
+
+	// Shut NetHook2 down outside of the loader lock first, so it can wait for its own threads.
+	ShutdownPtr pShutdown = (ShutdownPtr)pParams->GetProcAddress(hModule, pParams->szShutdownName);
+	if (pShutdown != NULL)
+	{
+		pShutdown();
+	}
+
 	pParams->FreeLibrary(hModule);
 
 	return 0;
@@ -481,7 +546,9 @@ BOOL InjectEjection(const HWND hWindow, const int iSteamProcessID, const char *
 
 	params.FreeLibrary = (FreeLibraryPtr)GetProcAddress(hKernel32Module, "FreeLibrary");
 	params.GetModuleHandleA = (GetModuleHandleAPtr)GetProcAddress(hKernel32Module, "GetModuleHandleA");
+	params.GetProcAddress = (GetProcAddressPtr)GetProcAddress(hKernel32Module, "GetProcAddress");
 	strncpy_s(params.szModuleName, szModuleName, sizeof(params.szModuleName));
+	strncpy_s(params.szShutdownName, "Shutdown", sizeof(params.szShutdownName));
 
 	BOOL bWritten = WriteProcessMemory(hSteamProcess.get(), pEjectParams.get(), &params, sizeof(params), NULL);
 	if (!bWritten)
@@ -513,7 +580,8 @@ BOOL InjectEjection(const HWND hWindow, const int iSteamProcessID, const char *
 		return false;
 	}
 
-	if (WaitForSingleObject(hRemoteThread, 5000 /* milliseconds */) == WAIT_TIMEOUT)
+	// Shutdown writes out everything still queued for the capture before the module goes away.
+	if (WaitForSingleObject(hRemoteThread, 30000 /* milliseconds */) == WAIT_TIMEOUT)
 	{
 		MessageBoxA(hWindow, "Injection timed out.", "NetHook2", MB_OK | MB_ICONASTERISK);
 		return false;
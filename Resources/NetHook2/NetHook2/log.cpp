@@ -0,0 +1,143 @@
+
+#include "log.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+
+std::atomic<int> g_nLogLevel( k_ELogLevelInfo );
+
+static std::atomic<CLogSink *> s_pLogSink( nullptr );
+
+
+static uint64 LogTimestamp() noexcept
+{
+	return static_cast<uint64>( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+
+CLogSink::CLogSink( LogOutputFn pfnOutput, uint32 cLinesPerSecond, uint32 cubBuffer )
+	: m_pfnOutput( pfnOutput ),
+	  m_cLinesPerSecond( cLinesPerSecond ),
+	  m_ullLastOutput( 0 ),
+	  m_ullWindowStart( 0 ),
+	  m_cWindowLines( 0 ),
+	  m_cSuppressed( 0 )
+{
+	// never grows past this, so logging doesn't allocate
+	m_Buffer.reserve( cubBuffer );
+}
+
+void CLogSink::Write( ELogLevel eLevel, const char *pchText, uint32 cchText )
+{
+	const uint64 ullNow = LogTimestamp();
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if ( ullNow - m_ullWindowStart >= 1000ull * 1000 * 1000 )
+	{
+		m_ullWindowStart = ullNow;
+		m_cWindowLines = 0;
+	}
+
+	if ( eLevel < k_ELogLevelWarning && m_cLinesPerSecond != 0 && m_cWindowLines >= m_cLinesPerSecond )
+	{
+		m_cSuppressed++;
+		return;
+	}
+
+	m_cWindowLines++;
+
+	if ( m_cSuppressed != 0 )
+	{
+		char szSuppressed[ 64 ];
+		const int cchSuppressed = snprintf( szSuppressed, sizeof( szSuppressed ), "(%u messages suppressed)\n", m_cSuppressed );
+
+		Append( szSuppressed, static_cast<uint32>( cchSuppressed ) );
+		m_cSuppressed = 0;
+	}
+
+	Append( pchText, cchText );
+
+	if ( eLevel >= k_ELogLevelWarning || ullNow - m_ullLastOutput >= k_ullFlushInterval )
+	{
+		OutputLocked();
+		m_ullLastOutput = ullNow;
+	}
+}
+
+void CLogSink::Flush()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	OutputLocked();
+	m_ullLastOutput = LogTimestamp();
+}
+
+void CLogSink::Append( const char *pchText, uint32 cchText )
+{
+	if ( m_Buffer.size() + cchText > m_Buffer.capacity() )
+		OutputLocked();
+
+	// only happens for a buffer smaller than a single message
+	if ( cchText > m_Buffer.capacity() )
+	{
+		m_pfnOutput( pchText, cchText );
+		return;
+	}
+
+	m_Buffer.insert( m_Buffer.end(), pchText, pchText + cchText );
+}
+
+void CLogSink::OutputLocked()
+{
+	if ( m_Buffer.empty() )
+		return;
+
+	m_pfnOutput( m_Buffer.data(), static_cast<uint32>( m_Buffer.size() ) );
+	m_Buffer.clear();
+}
+
+
+void LogSetSink( CLogSink *pSink ) noexcept
+{
+	s_pLogSink.store( pSink );
+}
+
+void LogSetLevel( ELogLevel eLevel ) noexcept
+{
+	g_nLogLevel.store( static_cast<int>( eLevel ), std::memory_order_relaxed );
+}
+
+void LogWrite( ELogLevel eLevel, const char *szFmt, ... )
+{
+	va_list args;
+	va_start( args, szFmt );
+	LogWriteV( eLevel, szFmt, args );
+	va_end( args );
+}
+
+void LogWriteV( ELogLevel eLevel, const char *szFmt, va_list args )
+{
+	CLogSink *pSink = s_pLogSink.load();
+
+	if ( pSink == nullptr || !LogIsEnabled( eLevel ) )
+		return;
+
+	char szLine[ k_cchLogLineMax ];
+	int cchLine = vsnprintf( szLine, sizeof( szLine ), szFmt, args );
+
+	if ( cchLine <= 0 )
+		return;
+
+	if ( static_cast<uint32>( cchLine ) >= sizeof( szLine ) )
+	{
+		static const char k_szTruncated[] = "...\n";
+
+		memcpy( szLine + sizeof( szLine ) - sizeof( k_szTruncated ), k_szTruncated, sizeof( k_szTruncated ) );
+		cchLine = sizeof( szLine ) - 1;
+	}
+
+	pSink->Write( eLevel, szLine, static_cast<uint32>( cchLine ) );
+}
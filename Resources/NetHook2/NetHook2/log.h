@@ -0,0 +1,115 @@
+
+#ifndef NETHOOK_LOG_H_
+#define NETHOOK_LOG_H_
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Leveled logging
+//
+// NETHOOK_LOG_DEBUG( "fmt", ... ) and friends format the message on the calling thread's stack
+// in a single pass and hand it to the installed CLogSink. Messages below
+// NETHOOK_LOG_COMPILED_LEVEL are compiled out along with their arguments, messages below the
+// runtime level cost a single relaxed load.
+
+#include <atomic>
+#include <cstdarg>
+#include <mutex>
+#include <vector>
+
+#include "steam/steamtypes.h"
+
+
+enum ELogLevel
+{
+	k_ELogLevelDebug = 0,
+	k_ELogLevelInfo = 1,
+	k_ELogLevelWarning = 2,
+	k_ELogLevelError = 3,
+	k_ELogLevelNone = 4,
+};
+
+// debug messages are compiled in by default so they can be turned on from nethook.cfg,
+// define this as k_ELogLevelInfo to drop them from the build
+#ifndef NETHOOK_LOG_COMPILED_LEVEL
+	#define NETHOOK_LOG_COMPILED_LEVEL k_ELogLevelDebug
+#endif
+
+// longer messages are truncated
+constexpr uint32 k_cchLogLineMax = 1024;
+
+
+typedef void (*LogOutputFn)( const char *pchText, uint32 cchText );
+
+// Collects messages and hands them to pfnOutput in batches: right away for warnings and
+// errors, otherwise once k_ullFlushInterval has passed or on the next Flush(), which the
+// owner is expected to call periodically. Beyond cLinesPerSecond messages in a second all but
+// warnings and errors are dropped, the number of dropped messages is reported with the next
+// message that gets through.
+class CLogSink
+{
+
+public:
+	CLogSink( LogOutputFn pfnOutput, uint32 cLinesPerSecond = k_cDefaultLinesPerSecond, uint32 cubBuffer = k_cubDefaultBuffer );
+
+	CLogSink( const CLogSink & ) = delete;
+	CLogSink &operator=( const CLogSink & ) = delete;
+
+	void Write( ELogLevel eLevel, const char *pchText, uint32 cchText );
+	void Flush();
+
+public:
+	static constexpr uint32 k_cDefaultLinesPerSecond = 200;
+	static constexpr uint32 k_cubDefaultBuffer = 16 * 1024;
+
+	// in steady clock nanoseconds
+	static constexpr uint64 k_ullFlushInterval = 50ull * 1000 * 1000;
+
+private:
+	void Append( const char *pchText, uint32 cchText );
+	void OutputLocked();
+
+private:
+	LogOutputFn m_pfnOutput;
+	uint32 m_cLinesPerSecond;
+
+	std::mutex m_Mutex;
+
+	std::vector<char> m_Buffer;
+	uint64 m_ullLastOutput;
+
+	uint64 m_ullWindowStart;
+	uint32 m_cWindowLines;
+	uint32 m_cSuppressed;
+
+};
+
+
+extern std::atomic<int> g_nLogLevel;
+
+void LogSetSink( CLogSink *pSink ) noexcept;
+void LogSetLevel( ELogLevel eLevel ) noexcept;
+
+inline bool LogIsEnabled( ELogLevel eLevel ) noexcept
+{
+	return static_cast<int>( eLevel ) >= g_nLogLevel.load( std::memory_order_relaxed );
+}
+
+void LogWrite( ELogLevel eLevel, const char *szFmt, ... );
+void LogWriteV( ELogLevel eLevel, const char *szFmt, va_list args );
+
+
+#define NETHOOK_LOG( eLevel, ... ) \
+	do \
+	{ \
+		if ( ( eLevel ) >= NETHOOK_LOG_COMPILED_LEVEL && LogIsEnabled( eLevel ) ) \
+			LogWrite( ( eLevel ), __VA_ARGS__ ); \
+	} while ( 0 )
+
+#define NETHOOK_LOG_DEBUG( ... ) NETHOOK_LOG( k_ELogLevelDebug, __VA_ARGS__ )
+#define NETHOOK_LOG_INFO( ... ) NETHOOK_LOG( k_ELogLevelInfo, __VA_ARGS__ )
+#define NETHOOK_LOG_WARNING( ... ) NETHOOK_LOG( k_ELogLevelWarning, __VA_ARGS__ )
+#define NETHOOK_LOG_ERROR( ... ) NETHOOK_LOG( k_ELogLevelError, __VA_ARGS__ )
+
+
+#endif // !NETHOOK_LOG_H_
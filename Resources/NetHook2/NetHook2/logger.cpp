@@ -6,15 +6,58 @@
 #include <sstream>
 
 #include "crypto.h"
+#include "captureconfig.h"
+#include "capturesink.h"
+#include "capturewriter.h"
+#include "capturejobs.h"
+#include "capturefilter.h"
+#include "log.h"
 #include "zip.h"
-#include "binaryreader.h"
 
-#include "steammessages_base.pb.h"
+
+static const char *GetCaptureMsgName( EMsg eMsg )
+{
+	if ( g_pCrypto == nullptr )
+		return nullptr;
+
+	return g_pCrypto->GetMessage( eMsg, 0xFF );
+}
+
+static VOID CALLBACK OnCommitRequested( PVOID pvWriter, BOOLEAN bTimedOut )
+{
+	static_cast<CCaptureWriter *>( pvWriter )->RequestCommit();
+}
+
+static VOID CALLBACK OnLogFlushTimer( PVOID pvLogSink, BOOLEAN bTimedOut )
+{
+	static_cast<CLogSink *>( pvLogSink )->Flush();
+}
+
+static void OutputToConsole( const char *pchText, uint32 cchText )
+{
+	HANDLE hOutput = GetStdHandle( STD_OUTPUT_HANDLE );
+
+	DWORD numWritten = 0;
+	WriteFile( hOutput, pchText, cchText, &numWritten, nullptr );
+}
 
 
 CLogger::CLogger() noexcept
+	: m_pLogSink( new CLogSink( OutputToConsole ) ),
+	  m_hLogFlushTimer( nullptr ),
+	  m_pFilter( nullptr ),
+	  m_pJobSink( nullptr ),
+	  m_pMultiSink( nullptr ),
+	  m_hCommitEvent( nullptr ),
+	  m_hCommitWait( nullptr ),
+	  m_bShutdown( false )
 {
-	m_uiMsgNum = 0;
+	LogSetSink( m_pLogSink );
+
+	// picks up whatever is still buffered after a burst of messages
+	if ( !CreateTimerQueueTimer( &m_hLogFlushTimer, nullptr, OnLogFlushTimer, m_pLogSink, 100, 100, WT_EXECUTEDEFAULT ) )
+		m_hLogFlushTimer = nullptr;
+
 	char tempName[ MAX_PATH ];
 	GetModuleFileName( nullptr, tempName, MAX_PATH );
 
@@ -34,198 +77,201 @@ CLogger::CLogger() noexcept
 
 	// create the session log directory
 	CreateDirectoryA( m_LogDir.c_str(), nullptr );
-}
-
-
-void CLogger::LogConsole( const char *szFmt, ... )
-{
-	va_list args;
-	va_start( args, szFmt );
-
-	int buffSize = _vscprintf( szFmt, args ) + 1;
 
-	if ( buffSize <= 1 )
-		return;
-
-	char *szBuff = new char[ buffSize ];
-	memset( szBuff, 0, buffSize );
+	CCaptureConfig config;
+	config.Load( ( m_RootDir + "nethook.cfg" ).c_str() );
 
-	const int len = vsprintf_s( szBuff, buffSize, szFmt, args );
+	LogSetLevel( config.m_eLogLevel );
+	CZip::SetBackend( config.m_eInflateBackend );
 
-	szBuff[ buffSize - 1 ] = 0;
+	if ( !config.m_FilterRules.IsEmpty() )
+		m_pFilter = new CCaptureFilter( config.m_FilterRules );
 
-	HANDLE hOutput = GetStdHandle( STD_OUTPUT_HANDLE );
+	if ( config.m_eFormat == ECaptureFormat::k_eCaptureFormatDump )
+	{
+		m_pOutputSink = new CDumpDirectorySink( m_LogDir.c_str(), GetCaptureMsgName );
+	}
+	else if ( config.m_eFormat == ECaptureFormat::k_eCaptureFormatRing )
+	{
+		const std::string ringPath = m_LogDir + "flight.nhring";
+		CCaptureRingSink *pRingSink = new CCaptureRingSink( ringPath.c_str(), config.m_cubRing, GetCaptureMsgName );
 
-	DWORD numWritten = 0;
-	WriteFile( hOutput, szBuff, len, &numWritten, nullptr );
+		if ( pRingSink->Open() )
+			this->LogConsole( "Flight recorder: keeping the last %llu MB of traffic in %s\n", config.m_cubRing / ( 1024 * 1024 ), ringPath.c_str() );
+		else
+			NETHOOK_LOG_ERROR( "Unable to create flight recorder ring %s\n", ringPath.c_str() );
 
-	delete [] szBuff;
-}
+		m_pOutputSink = pRingSink;
+	}
+	else
+	{
+		const std::string capturePath = m_LogDir + "capture";
+		CCaptureFileSink *pFileSink = new CCaptureFileSink( capturePath.c_str(), config.m_cubSegmentMax, GetCaptureMsgName );
+		pFileSink->SetCompression( config.m_eCompression, config.m_cubBlock );
+		pFileSink->SetCommitPolicy( config.m_cCommitRecords, config.m_cCommitIntervalMs, config.m_bCommitSync );
 
-void CLogger::DeleteFile( const char *szFileName, bool bSession )
-{
-	std::string outputFile = ( bSession ? m_LogDir : m_RootDir );
-	outputFile += szFileName;
+		if ( !pFileSink->Open() )
+			NETHOOK_LOG_ERROR( "Unable to create capture file %s\n", CaptureSegmentPath( capturePath.c_str(), 0 ).c_str() );
 
-	DeleteFileA( outputFile.c_str() );
-}
+		m_pOutputSink = pFileSink;
+	}
 
-void CLogger::LogNetMessage( ENetDirection eDirection, const uint8 *pData, uint32 cubData )
-{
-	EMsg eMsg = (EMsg)*(uint16*)pData;
-	eMsg = (EMsg)((int)eMsg & (~0x80000000));
+	ICaptureSink *pExpandedSink = m_pOutputSink;
 
-	if ( eMsg == EMsg::k_EMsgMulti )
+	// sits behind the Multi expansion, most replies arrive inside Multis
+	if ( config.m_cLatencyReportSeconds != 0 )
 	{
-		this->MultiplexMulti( eDirection, pData, cubData );
-		return;
+		m_pJobSink = new CJobLatencySink( m_pOutputSink, ( m_LogDir + "latency.txt" ).c_str(), GetCaptureMsgName );
+		m_pJobSink->SetReportInterval( config.m_cLatencyReportSeconds );
+
+		pExpandedSink = m_pJobSink;
 	}
 
-	this->LogSessionData( eDirection, pData, cubData );
-}
+	ICaptureSink *pWriterSink = pExpandedSink;
 
-void CLogger::LogSessionData( ENetDirection eDirection, const uint8 *pData, uint32 cubData )
-{
-	std::string fullFile = m_LogDir;
+	// otherwise Multis are captured as they are, for nhcapexpand to take apart later
+	if ( config.m_bExpandMultis )
+	{
+		m_pMultiSink = new CMultiExpandSink( pExpandedSink, m_pFilter );
+		m_pMultiSink->SetLimits( config.m_cMultiMaxDepth, config.m_cubMultiMaxExpanded );
 
-	const char *outFile = GetFileNameBase( eDirection, (EMsg)*(uint16*)pData );
-	fullFile += outFile;
+		pWriterSink = m_pMultiSink;
+	}
 
-	std::string fullFileTmp = fullFile + ".tmp";
-	std::string fullFileFinal = fullFile + ".bin";
-	HANDLE hFile = CreateFile( fullFileTmp.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+	// the hooks only copy messages into the capture queue, everything else happens on the writer thread
+	m_pCaptureWriter = new CCaptureWriter( pWriterSink );
 
-	DWORD numBytes = 0;
-	WriteFile( hFile, pData, cubData, &numBytes, nullptr );
+	m_pCaptureWriter->Start();
 
-	CloseHandle( hFile );
+	char szCommitEvent[ 64 ];
+	sprintf_s( szCommitEvent, sizeof( szCommitEvent ), NETHOOK_COMMIT_EVENT_FORMAT, GetCurrentProcessId() );
 
-	MoveFile( fullFileTmp.c_str(), fullFileFinal.c_str() );
+	// commit requests are handled on a thread pool thread, which only has to poke the writer
+	m_hCommitEvent = CreateEventA( nullptr, FALSE, FALSE, szCommitEvent );
 
-	this->LogConsole( "Wrote %d bytes to %s\n", cubData, outFile );
+	if ( m_hCommitEvent == nullptr || !RegisterWaitForSingleObject( &m_hCommitWait, m_hCommitEvent, OnCommitRequested, m_pCaptureWriter, INFINITE, WT_EXECUTEDEFAULT ) )
+		m_hCommitWait = nullptr;
 }
 
-HANDLE CLogger::OpenFile( const char *szFileName, bool bSession )
+CLogger::~CLogger()
 {
-	std::string outputFile = ( bSession ? m_LogDir : m_RootDir );
-	outputFile += szFileName;
+	Shutdown( false );
 
-	return CreateFile( outputFile.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
-}
+	delete m_pCaptureWriter;
+	delete m_pMultiSink;
+	delete m_pJobSink;
+	delete m_pOutputSink;
+	delete m_pFilter;
 
-void CLogger::CloseFile( HANDLE hFile ) noexcept
-{
-	CloseHandle( hFile );
+	LogSetSink( nullptr );
+
+	m_pLogSink->Flush();
+	delete m_pLogSink;
 }
 
-void CLogger::LogOpenFile( HANDLE hFile, const char *szFmt, ... )
+void CLogger::Shutdown( bool bProcessExit ) noexcept
 {
-	va_list args;
-	va_start( args, szFmt );
+	if ( m_bShutdown )
+		return;
 
-	int buffSize = _vscprintf( szFmt, args ) + 1;
+	m_bShutdown = true;
 
-	if ( buffSize <= 1 )
-		return;
+	// the pool threads have been killed along with the process, there is no callback left to wait for
+	HANDLE hCompletionEvent = bProcessExit ? nullptr : INVALID_HANDLE_VALUE;
 
-	char *szBuff = new char[ buffSize ];
-	memset( szBuff, 0, buffSize );
+	if ( m_hCommitWait != nullptr )
+		UnregisterWaitEx( m_hCommitWait, hCompletionEvent );
 
-	const int len = vsprintf_s( szBuff, buffSize, szFmt, args );
+	if ( m_hCommitEvent != nullptr )
+		CloseHandle( m_hCommitEvent );
 
-	szBuff[ buffSize - 1 ] = 0;
+	m_hCommitWait = nullptr;
+	m_hCommitEvent = nullptr;
 
-	SetFilePointer( hFile, 0, nullptr, FILE_END );
+	m_pCaptureWriter->Stop( bProcessExit );
 
-	DWORD numBytes = 0;
-	WriteFile( hFile, szBuff, len, &numBytes, nullptr );
+	if ( m_pJobSink != nullptr )
+		m_pJobSink->WriteReport();
 
-	delete [] szBuff;
-}
+	if ( m_hLogFlushTimer != nullptr )
+		DeleteTimerQueueTimer( nullptr, m_hLogFlushTimer, hCompletionEvent );
 
-const char *CLogger::GetFileNameBase( ENetDirection eDirection, EMsg eMsg, uint8 serverType )
-{
-	static char szFileName[MAX_PATH];
-
-	sprintf_s(
-		szFileName, sizeof( szFileName ),
-		"%03u_%s_%d_%s",
-		++m_uiMsgNum,
-		( eDirection == ENetDirection::k_eNetIncoming ? "in" : "out" ),
-		static_cast<int>( eMsg ),
-		g_pCrypto->GetMessage( eMsg, serverType )
-	);
-
-	return szFileName;
+	m_hLogFlushTimer = nullptr;
 }
 
-void CLogger::MultiplexMulti( ENetDirection eDirection, const uint8 *pData, uint32 cubData )
-{
-	struct ProtoHdr 
-	{
-		EMsg msg;
-		int headerLength;
-	};
-
 
-	const ProtoHdr *pProtoHdr = (ProtoHdr*) pData;
+void CLogger::LogConsole( const char *szFmt, ... )
+{
+	if ( !LogIsEnabled( k_ELogLevelInfo ) )
+		return;
 
-	g_pLogger->LogConsole("Multi: msg %d length %d\n", (static_cast<int>(pProtoHdr->msg) & (~0x80000000)), pProtoHdr->headerLength );
+	va_list args;
+	va_start( args, szFmt );
+	LogWriteV( k_ELogLevelInfo, szFmt, args );
+	va_end( args );
+}
 
-	CMsgProtoBufHeader protoheader;
-	protoheader.ParseFromArray( pData + 8, pProtoHdr->headerLength );
+void CLogger::DeleteFile( const char *szFileName, bool bSession )
+{
+	std::string outputFile = ( bSession ? m_LogDir : m_RootDir );
+	outputFile += szFileName;
 
-	g_pLogger->LogConsole("MultiProto\n");
+	DeleteFileA( outputFile.c_str() );
+}
 
-	CMsgMulti multi;
-	multi.ParseFromArray( pData + 8 + pProtoHdr->headerLength, cubData - 8 - pProtoHdr->headerLength );
+void CLogger::LogNetMessage( ENetDirection eDirection, const uint8 *pData, uint32 cubData, uint64 ullConnection )
+{
+	// rejected messages never reach the queue
+	if ( m_pFilter != nullptr && !m_pFilter->ShouldCapture( pData, cubData ) )
+		return;
 
-	g_pLogger->LogConsole("MultiMsg: %d %d\n", multi.size_unzipped(), multi.message_body().length() );
+	m_pCaptureWriter->Submit( eDirection, ullConnection, pData, cubData );
+}
 
-	uint8 *pMsgData = nullptr;
-	uint32 cubMsgData = 0;
-	bool bDecomp = false;
+HANDLE CLogger::OpenFile( const char *szFileName, bool bSession )
+{
+	std::string outputFile = ( bSession ? m_LogDir : m_RootDir );
+	outputFile += szFileName;
 
-	if ( multi.has_size_unzipped() && multi.size_unzipped() != 0 )
-	{
-		// decompress our data
+	return CreateFile( outputFile.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+}
 
-		uint8 *pDecompressed = new uint8[ multi.size_unzipped() ];
-		uint8 *pCompressed = (uint8 *)( multi.message_body().c_str() );
-		const uint32 cubCompressed = multi.message_body().length();
+void CLogger::CloseFile( HANDLE hFile ) noexcept
+{
+	CloseHandle( hFile );
+}
 
-		g_pLogger->LogConsole("decomp: %x comp: %x cubcomp: %d unzipped: %d\n", pDecompressed, pCompressed, cubCompressed, multi.size_unzipped());
+void CLogger::LogOpenFile( HANDLE hFile, const char *szFmt, ... )
+{
+	char szBuff[ k_cchLogLineMax ];
+	char *pchBuff = szBuff;
 
-		const bool bZip = CZip::Inflate( pCompressed, cubCompressed, pDecompressed, multi.size_unzipped() );
+	va_list args;
+	va_start( args, szFmt );
 
-		if ( !bZip )
-		{
-			delete [] pDecompressed;
+	// formats straight into the stack buffer, only lines that don't fit are formatted twice
+	va_list argsRetry;
+	va_copy( argsRetry, args );
 
-			g_pLogger->LogConsole("Unable to decompress buffer\n");
-			return;
-		}
+	int len = vsnprintf( szBuff, sizeof( szBuff ), szFmt, args );
 
-		pMsgData = pDecompressed;
-		cubMsgData = multi.size_unzipped();
-		bDecomp = bZip;
-	}
-	else
+	if ( len >= static_cast<int>( sizeof( szBuff ) ) )
 	{
-		pMsgData = (uint8 *)( multi.message_body().c_str() );
-		cubMsgData = multi.message_body().length();
+		pchBuff = new char[ len + 1 ];
+		len = vsnprintf( pchBuff, len + 1, szFmt, argsRetry );
 	}
 
-	CBinaryReader reader( pMsgData, cubMsgData );
+	va_end( argsRetry );
+	va_end( args );
 
-	while ( reader.GetSizeLeft() > 0 )
+	if ( len > 0 )
 	{
-		const uint32 cubPayload = reader.Read<uint32>();
-		const uint8 *pPayload = reader.ReadBytes( cubPayload );
+		SetFilePointer( hFile, 0, nullptr, FILE_END );
 
-		this->LogNetMessage( eDirection, pPayload, cubPayload );
+		DWORD numBytes = 0;
+		WriteFile( hFile, pchBuff, len, &numBytes, nullptr );
 	}
 
-	if ( bDecomp )
-		delete [] pMsgData;
+	if ( pchBuff != szBuff )
+		delete [] pchBuff;
 }
@@ -10,40 +10,61 @@
 #include "steam/steamtypes.h"
 #include "steam/emsg.h"
 
+#include "capture.h"
+
 #ifdef DeleteFile
 #undef DeleteFile
 #endif
 
-enum class ENetDirection
-{
-	k_eNetIncoming,
-	k_eNetOutgoing,
-};
+// signalled by "rundll32 NetHook2.dll,Commit" to commit the capture of the process with this id
+#define NETHOOK_COMMIT_EVENT_FORMAT "Local\\NetHook2Commit%lu"
+
+class CCaptureWriter;
+class CMultiExpandSink;
+class CJobLatencySink;
+class CCaptureFilter;
+class CLogSink;
 
 class CLogger
 {
 
 public:
 	CLogger() noexcept;
+	~CLogger();
+
+	// stops the capture writer and commits what it captured, see CCaptureWriter::Stop
+	void Shutdown( bool bProcessExit ) noexcept;
 
+	// progress at info level, failures go through NETHOOK_LOG_WARNING or NETHOOK_LOG_ERROR
 	void LogConsole( const char *szFmt, ... );
-	void LogNetMessage( ENetDirection eDirection, const uint8 *pData, uint32 cubData );
-	void LogSessionData( ENetDirection eDirection, const uint8 *pData, uint32 cubData );
+	void LogNetMessage( ENetDirection eDirection, const uint8 *pData, uint32 cubData, uint64 ullConnection = 0 );
 	void LogOpenFile( HANDLE hFile, const char *szFmt, ... );
 
 	HANDLE OpenFile( const char *szFileName, bool bSession );
 	void CloseFile( HANDLE hFile) noexcept;
 	void DeleteFile( const char *szFileName, bool bSession );
 
-private:
-	const char *GetFileNameBase( ENetDirection eDirection, EMsg eMsg, uint8 serverType = 0xFF );
-	void MultiplexMulti( ENetDirection eDirection, const uint8 *pData, uint32 cubData );
+	// the nethook directory, which holds the session directories
+	const std::string &GetRootDir() const noexcept { return m_RootDir; }
 
 private:
 	std::string m_RootDir;
 	std::string m_LogDir;
 
-	uint32 m_uiMsgNum;
+	CLogSink *m_pLogSink;
+	HANDLE m_hLogFlushTimer;
+
+	CCaptureFilter *m_pFilter;
+
+	ICaptureSink *m_pOutputSink;
+	CJobLatencySink *m_pJobSink;
+	CMultiExpandSink *m_pMultiSink;
+	CCaptureWriter *m_pCaptureWriter;
+
+	HANDLE m_hCommitEvent;
+	HANDLE m_hCommitWait;
+
+	bool m_bShutdown;
 
 };
 
@@ -6,6 +6,7 @@
 #include "net.h"
 
 #include "logger.h"
+#include "log.h"
 #include "csimplescan.h"
 #include "steamclient.h"
 
@@ -17,42 +18,36 @@ namespace NetHook
 BBuildAndAsyncSendFrameFn BBuildAndAsyncSendFrame_Orig = nullptr;
 RecvPktFn RecvPkt_Orig = nullptr;
 
-CNet::CNet() noexcept
-	: m_RecvPktDetour(nullptr),
-	  m_BuildDetour(nullptr)
+void CNet::AddFunctions(CSimpleScan *pScan)
 {
-	CSimpleScan steamClientScan(STEAMCLIENT_DLL);
-
-	BBuildAndAsyncSendFrameFn pBuildFunc = nullptr;
-	const bool bFoundBuildFunc = steamClientScan.FindFunction(
+	static constexpr SigScanPattern buildAndAsyncSendFrameSig(
 #ifdef X64BITS
-		"\x48\x8B\xC4\x55\x48\x8D\x68\x00\x48\x81\xEC\x00\x00\x00\x00\x48\x89\x70\x00\x49\x8B\xF0\x48\x89\x78\x00\x4C\x89\x60",
-		"xxxxxxx?xxx????xxx?xxxxxx?xxx",
+		"48 8B C4 55 48 8D 68 ?? 48 81 EC ?? ?? ?? ?? 48 89 70 ?? 49 8B F0 48 89 78 ?? 4C 89 60"
 #else
-		"\x55\x8B\xEC\x83\xEC\x64\xA1\x00\x00\x00\x00\x53\x8B\xD9\x57",
-		"xxxxxxx????xxxx",
+		"55 8B EC 83 EC 64 A1 ?? ?? ?? ?? 53 8B D9 57"
 #endif
-		(void**)&pBuildFunc
 	);
 
-	BBuildAndAsyncSendFrame_Orig = pBuildFunc;
-
-	g_pLogger->LogConsole("CWebSocketConnection::BBuildAndAsyncSendFrame = 0x%p\n", BBuildAndAsyncSendFrame_Orig);
-
-	RecvPktFn pRecvPktFunc = nullptr;
-	const bool bFoundRecvPktFunc = steamClientScan.FindFunction(
+	static constexpr SigScanPattern recvPktSig(
 #ifdef X64BITS
-		"\x48\x8B\xC4\x55\x48\x8D\xA8\xCC\xCC\xCC\xCC\x48\x81\xEC\xCC\xCC\xCC\xCC\x48\x89\x58\x08\x48\x8B",
-		"xxxxxxx????xxx????xxxxxx",
+		"48 8B C4 55 48 8D A8 ?? ?? ?? ?? 48 81 EC ?? ?? ?? ?? 48 89 58 08 48 8B"
 #else
-		"\x55\x8B\xEC\x81\xEC\x00\x04\x00\x00\xA1\x00\x00\x00\x00\x56\x57\x8B\xF9",
-		"xxxxx?x??x????xxxx",
+		"55 8B EC 81 EC ?? 04 ?? ?? A1 ?? ?? ?? ?? 56 57 8B F9"
 #endif
-		(void**)&pRecvPktFunc
 	);
 
-	RecvPkt_Orig = pRecvPktFunc;
+	pScan->AddFunction(buildAndAsyncSendFrameSig, (void**)&BBuildAndAsyncSendFrame_Orig);
+	pScan->AddFunction(recvPktSig, (void**)&RecvPkt_Orig);
+}
 
+CNet::CNet() noexcept
+	: m_RecvPktDetour(nullptr),
+	  m_BuildDetour(nullptr)
+{
+	const bool bFoundBuildFunc = (BBuildAndAsyncSendFrame_Orig != nullptr);
+	const bool bFoundRecvPktFunc = (RecvPkt_Orig != nullptr);
+
+	g_pLogger->LogConsole("CWebSocketConnection::BBuildAndAsyncSendFrame = 0x%p\n", BBuildAndAsyncSendFrame_Orig);
 	g_pLogger->LogConsole("CCMInterface::RecvPkt = 0x%p\n", RecvPkt_Orig);
 
 
@@ -67,7 +62,7 @@ CNet::CNet() noexcept
 	}
 	else
 	{
-		g_pLogger->LogConsole("Unable to hook CWebSocketConnection::BBuildAndAsyncSendFrame: func scan failed.\n");
+		NETHOOK_LOG_WARNING("Unable to hook CWebSocketConnection::BBuildAndAsyncSendFrame: func scan failed.\n");
 	}
 
 	if (bFoundRecvPktFunc)
@@ -81,7 +76,7 @@ CNet::CNet() noexcept
 	}
 	else
 	{
-		g_pLogger->LogConsole("Unable to hook CCMInterface::RecvPkt: func scan failed.\n");
+		NETHOOK_LOG_WARNING("Unable to hook CCMInterface::RecvPkt: func scan failed.\n");
 	}
 
 }
@@ -113,11 +108,11 @@ bool CNet::BBuildAndAsyncSendFrame(
 {
 	if (eWebSocketOpCode == EWebSocketOpCode::k_eWebSocketOpCode_Binary)
 	{
-		g_pLogger->LogNetMessage(ENetDirection::k_eNetOutgoing, pubData, cubData);
+		g_pLogger->LogNetMessage(ENetDirection::k_eNetOutgoing, pubData, cubData, reinterpret_cast<uintp>(webSocketConnection));
 	}
 	else
 	{
-		g_pLogger->LogConsole("Sending websocket frame with opcode %d (%s), ignoring\n",
+		NETHOOK_LOG_DEBUG("Sending websocket frame with opcode %d (%s), ignoring\n",
 			eWebSocketOpCode, EWebSocketOpCodeToName(eWebSocketOpCode)
 		);
 	}
@@ -132,7 +127,7 @@ void CNet::RecvPkt(
 #endif
 	CNetPacket *pPacket)
 {
-	g_pLogger->LogNetMessage(ENetDirection::k_eNetIncoming, pPacket->m_pubData, pPacket->m_cubData);
+	g_pLogger->LogNetMessage(ENetDirection::k_eNetIncoming, pPacket->m_pubData, pPacket->m_cubData, pPacket->m_hConnection);
 
 	(*RecvPkt_Orig)(cmConnection, pPacket);
 }
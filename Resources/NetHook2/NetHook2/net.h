@@ -12,6 +12,8 @@
 #include "csimpledetour.h"
 
 
+class CSimpleScan;
+
 namespace NetHook
 {
 
@@ -25,6 +27,9 @@ public:
 	CNet() noexcept;
 	~CNet();
 
+	// queues the functions to hook, they have to be found before CNet is created
+	static void AddFunctions(CSimpleScan *pScan);
+
 
 public:
 	// CWebSocketConnection::BBuildAndAsyncSendFrame(EWebSocketOpCode, uchar const*, int)
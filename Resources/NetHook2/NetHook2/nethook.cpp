@@ -1,10 +1,14 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "logger.h"
 #include "crypto.h"
 #include "net.h"
 #include "steamclient.h"
+#include "csimplescan.h"
 
 #include "nh2_string.h"
 
@@ -46,6 +50,37 @@ void PrintVersionInfo()
 	}
 }
 
+// Unhooks everything and stops the capture writer. The hooks go first so nothing new is
+// queued, and crypto last since the writer looks message names up through it.
+void ShutdownNetHook( bool bProcessExit )
+{
+	delete g_pNet;
+	g_pNet = NULL;
+
+	if (g_pLogger != NULL)
+	{
+		g_pLogger->Shutdown( bProcessExit );
+	}
+
+	delete g_pCrypto;
+	g_pCrypto = NULL;
+
+	delete g_pLogger;
+	g_pLogger = NULL;
+}
+
+// Called by the Eject code cave right before it frees the module. Unlike DllMain this doesn't
+// run under the loader lock, so it can wait for the capture writer to finish.
+#ifdef X64BITS
+#pragma comment(linker, "/EXPORT:Shutdown=?Shutdown@@YAXXZ")
+#else
+#pragma comment(linker, "/EXPORT:Shutdown=?Shutdown@@YGXXZ")
+#endif
+__declspec(dllexport) void WINAPI Shutdown()
+{
+	ShutdownNetHook( false );
+}
+
 BOOL WINAPI DllMain( HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved )
 {
 	if (IsRunDll32())
@@ -65,16 +100,27 @@ BOOL WINAPI DllMain( HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved )
 
 		PrintVersionInfo();
 
+		// every signature is found in the same pass over steamclient
+		{
+			CSimpleScan steamClientScan( STEAMCLIENT_DLL );
+			steamClientScan.SetCacheFile( ( g_pLogger->GetRootDir() + "sigcache.txt" ).c_str() );
+			steamClientScan.SetThreads( std::min<size_t>( std::thread::hardware_concurrency(), 8 ) );
+
+			CCrypto::AddFunctions( &steamClientScan );
+			NetHook::CNet::AddFunctions( &steamClientScan );
+
+			steamClientScan.FindFunctions();
+		}
+
 		g_pCrypto = new CCrypto();
 		g_pNet = new NetHook::CNet();
 
 	}
 	else if ( fdwReason == DLL_PROCESS_DETACH )
 	{
-		delete g_pNet;
-		delete g_pCrypto;
-
-		delete g_pLogger;
+		// lpvReserved is set when the whole process is exiting. Otherwise we're being freed, and
+		// Shutdown has normally taken everything down already.
+		ShutdownNetHook( lpvReserved != NULL );
 
 		if (g_bOwnsConsole)
 		{
@@ -1,68 +1,152 @@
 
 #include "sigscan.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef WIN32
+    #include <thread>
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+    #define SIGSCAN_SSE2
+    #include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
  
-/* There is no ANSI ustrncpy */
-unsigned char* ustrncpy(unsigned char *dest, const unsigned char *src, int len) noexcept {
-    while(len--)
-        dest[len] = src[len];
- 
-    return dest;
+/* What CSigScan points at while it has no signature */
+static const SigScanPattern noPattern;
+
+/* 64 bit FNV-1a */
+static unsigned long long HashBytes(const void *data, size_t len, unsigned long long hash = 0xCBF29CE484222325ull) noexcept {
+    const unsigned char *bytes = (const unsigned char*)data;
+
+    for(size_t i = 0;i < len;i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+#ifdef SIGSCAN_SSE2
+static unsigned int LowestBit(unsigned int bits) noexcept {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return index;
+#else
+    return __builtin_ctz(bits);
+#endif
 }
+#endif
  
 /* //////////////////////////////////////
-    CSigScan Class
+    CSigScanModule Class
     ////////////////////////////////////// */
-unsigned char* CSigScan::base_addr;
-size_t CSigScan::base_len;
-void *(*CSigScan::sigscan_dllfunc)(const char *pName, int *pReturnCode);
- 
-/* Initialize the Signature Object */
-int CSigScan::Init(const unsigned char *sig, const char *mask, size_t len) {
-    is_set = 0;
- 
-    sig_len = len;
+#ifndef WIN32
+/* Looks for the loaded object that contains addr, see CSigScanModule::Init */
+struct SigScanModuleSearch {
+    const unsigned char *addr;
+    unsigned char *end;
+    std::vector<SigScanRange> ranges;
+    unsigned long long hash;
+};
 
-	if ( sig_str )
-		delete[] sig_str;
+static int FindModuleSegments(struct dl_phdr_info *info, size_t /* size */, void *data) {
+    SigScanModuleSearch *search = (SigScanModuleSearch*)data;
+    bool contains = false;
 
-    sig_str = new unsigned char[sig_len];
-    ustrncpy(sig_str, sig, sig_len);
- 
-	if ( sig_mask )
-		delete[] sig_mask;
+    for(ElfW(Half) i = 0;i < info->dlpi_phnum;i++) {
+        const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+        const unsigned char *start = (const unsigned char*)(info->dlpi_addr + phdr.p_vaddr);
 
-    sig_mask = new char[sig_len + 1];
-    strncpy_s(sig_mask, sig_len + 1, mask, sig_len);
- 
-    if(!base_addr)
-        return 2; // GetDllMemInfo() Failed
- 
-    if((sig_addr = FindSignature()) == nullptr)
-        return 1; // FindSignature() Failed
- 
-    is_set = 1;
-    // SigScan Successful!
+        if(phdr.p_type == PT_LOAD && search->addr >= start && search->addr < start + phdr.p_memsz)
+            contains = true;
+    }
 
-	return 0;
+    if(!contains)
+        return 0;
+
+    search->hash = HashBytes(info->dlpi_phdr, info->dlpi_phnum * sizeof(ElfW(Phdr)));
+
+    for(ElfW(Half) i = 0;i < info->dlpi_phnum;i++) {
+        const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+
+        /* The build-id changes with every build that changes anything */
+        if(phdr.p_type == PT_NOTE) {
+            const unsigned char *note = (const unsigned char*)(info->dlpi_addr + phdr.p_vaddr);
+            const unsigned char *notesEnd = note + phdr.p_memsz;
+
+            while(notesEnd - note >= (ptrdiff_t)sizeof(ElfW(Nhdr))) {
+                const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr)*)note;
+                const unsigned char *desc = note + sizeof(ElfW(Nhdr)) + ((nhdr->n_namesz + 3) & ~3);
+
+                if(desc + nhdr->n_descsz > notesEnd)
+                    break;
+
+                if(nhdr->n_type == NT_GNU_BUILD_ID)
+                    search->hash = HashBytes(desc, nhdr->n_descsz, search->hash);
+
+                note = desc + ((nhdr->n_descsz + 3) & ~3);
+            }
+        }
+
+        if(phdr.p_type != PT_LOAD)
+            continue;
+
+        unsigned char *start = (unsigned char*)(info->dlpi_addr + phdr.p_vaddr);
+
+        if(start + phdr.p_memsz > search->end)
+            search->end = start + phdr.p_memsz;
+
+        if(phdr.p_flags & PF_X) {
+            SigScanRange range = { start, (size_t)phdr.p_memsz };
+            search->ranges.push_back(range);
+        }
+    }
+
+    return 1;
 }
- 
-/* Destructor frees sig-string allocated memory */
-CSigScan::~CSigScan(void) {
-    delete[] sig_str;
-    delete[] sig_mask;
+#endif
+
+/* Add a range to code_ranges, joined with the previous one when they touch */
+void CSigScanModule::AddCodeRange(unsigned char *addr, size_t len) {
+    if(len == 0)
+        return;
+
+    if(!code_ranges.empty() && code_ranges.back().addr + code_ranges.back().len == addr) {
+        code_ranges.back().len += len;
+        return;
+    }
+
+    SigScanRange range = { addr, len };
+    code_ranges.push_back(range);
 }
  
-/* Get base address of the server module (base_addr) and get its ending offset (base_len) */
-bool CSigScan::GetDllMemInfo(void) noexcept {
-    void *pAddr = (void*)sigscan_dllfunc;
+/* Get base address of the module (base_addr), its ending offset (base_len) and the
+   executable ranges in between (code_ranges) */
+bool CSigScanModule::Init(const void *pAddr) noexcept {
     base_addr = nullptr;
     base_len = 0;
+    code_ranges.clear();
+    module_path.clear();
+    module_fingerprint = SigScanFingerprint();
  
     #ifdef WIN32
     MEMORY_BASIC_INFORMATION mem = { };
  
     if(!pAddr)
-        return false; // GetDllMemInfo failed!pAddr
+        return false; // Init failed!pAddr
  
     if(!VirtualQuery(pAddr, &mem, sizeof(mem)))
         return false;
@@ -74,50 +158,569 @@ bool CSigScan::GetDllMemInfo(void) noexcept {
  
     if(pe->Signature != IMAGE_NT_SIGNATURE) {
         base_addr = nullptr;
-        return false; // GetDllMemInfo failedpe points to a bad location
+        return false; // Init failedpe points to a bad location
     }
  
     base_len = (size_t)pe->OptionalHeader.SizeOfImage;
+
+    /* Data, resources and relocations can't hold a function */
+    const IMAGE_SECTION_HEADER *section = IMAGE_FIRST_SECTION(pe);
+
+    for(WORD i = 0;i < pe->FileHeader.NumberOfSections;i++, section++) {
+        if(!(section->Characteristics & IMAGE_SCN_MEM_EXECUTE) || section->VirtualAddress >= base_len)
+            continue;
+
+        size_t len = section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+
+        if(len > base_len - section->VirtualAddress)
+            len = base_len - section->VirtualAddress;
+
+        AddCodeRange(base_addr + section->VirtualAddress, len);
+    }
+
+    /* Section headers nobody can make sense of, fall back to the whole image */
+    if(code_ranges.empty())
+        AddCodeRange(base_addr, base_len);
+
+    /* The loader rewrites parts of the optional header, these fields it leaves alone */
+    unsigned long long hash = HashBytes(&pe->FileHeader, sizeof(pe->FileHeader));
+    hash = HashBytes(&pe->OptionalHeader.AddressOfEntryPoint, sizeof(pe->OptionalHeader.AddressOfEntryPoint), hash);
+    hash = HashBytes(&pe->OptionalHeader.CheckSum, sizeof(pe->OptionalHeader.CheckSum), hash);
+    hash = HashBytes(IMAGE_FIRST_SECTION(pe), pe->FileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER), hash);
+
+    module_fingerprint.size = base_len;
+    module_fingerprint.stamp = pe->FileHeader.TimeDateStamp;
+    module_fingerprint.hash = hash;
+
+    char path[MAX_PATH];
+    const DWORD pathLen = GetModuleFileNameA((HMODULE)base_addr, path, sizeof(path));
+
+    if(pathLen != 0 && pathLen < sizeof(path))
+        module_path.assign(path, pathLen);
  
     #else
  
     Dl_info info;
-    struct stat buf;
  
-    if(!dladdr(pAddr, &info))
+    if(!pAddr || !dladdr(pAddr, &info))
         return false;
  
-    if(!info.dli_fbase || !info.dli_fname)
+    if(!info.dli_fbase)
         return false;
- 
-    if(stat(info.dli_fname, &buf) != 0)
+
+    /* The size of the file on disk says nothing about the loaded image, the program headers of
+       the loaded object do */
+    SigScanModuleSearch search;
+    search.addr = (const unsigned char*)pAddr;
+    search.end = nullptr;
+    search.hash = 0;
+
+    if(!dl_iterate_phdr(FindModuleSegments, &search) || search.ranges.empty())
         return false;
  
     base_addr = (unsigned char*)info.dli_fbase;
-    base_len = buf.st_size;
+    base_len = search.end - base_addr;
+
+    for(size_t i = 0;i < search.ranges.size();i++)
+        AddCodeRange(search.ranges[i].addr, search.ranges[i].len);
+
+    module_fingerprint.size = base_len;
+    module_fingerprint.hash = search.hash;
+
+    if(info.dli_fname)
+        module_path = info.dli_fname;
     #endif
  
     return true;
 }
+
+/* A block of memory as a module of a single code range */
+bool CSigScanModule::Init(const void *pAddr, size_t len) noexcept {
+    base_addr = nullptr;
+    base_len = 0;
+    code_ranges.clear();
+    module_path.clear();
+    module_fingerprint = SigScanFingerprint();
+
+    if(!pAddr || !len)
+        return false;
+
+    base_addr = (unsigned char*)pAddr;
+    base_len = len;
+
+    AddCodeRange(base_addr, base_len);
+
+    module_fingerprint.size = base_len;
+    return true;
+}
+
+/* //////////////////////////////////////
+    CSigScan Class
+    ////////////////////////////////////// */
+
+CSigScan::CSigScan(void) noexcept : sig(&noPattern), is_set(0), sig_addr(nullptr) {
+}
+ 
+/* Parse the signature and mask into sig_owned */
+void CSigScan::SetSignature(const unsigned char *sigStr, const char *mask, size_t len) {
+    if(len > SigScanPattern::maxLen) {
+        SetSignature(noPattern);
+        return;
+    }
+
+    sig_owned.reset(new SigScanPattern(sigStr, mask, len));
+    SetSignature(*sig_owned);
+}
+
+void CSigScan::SetSignature(const SigScanPattern &pattern) noexcept {
+    is_set = 0;
+    sig_addr = nullptr;
+    sig = &pattern;
+}
+
+/* Initialize the Signature Object */
+int CSigScan::Init(const CSigScanModule &module, const unsigned char *sigStr, const char *mask, size_t len) {
+    SetSignature(sigStr, mask, len);
+
+    return Init(module, *sig);
+}
+
+int CSigScan::Init(const CSigScanModule &module, const SigScanPattern &pattern) noexcept {
+    SetSignature(pattern);
+ 
+    if(!module.IsSet())
+        return 2; // CSigScanModule::Init() Failed
+ 
+    if((sig_addr = FindSignature(module)) == nullptr)
+        return 1; // FindSignature() Failed
+ 
+    is_set = 1;
+    // SigScan Successful!
+
+	return 0;
+}
+
+/* Initialize the Signature Object for FindSignatures() */
+void CSigScan::Prepare(const unsigned char *sigStr, const char *mask, size_t len) {
+    SetSignature(sigStr, mask, len);
+}
+
+void CSigScan::Prepare(const SigScanPattern &pattern) noexcept {
+    SetSignature(pattern);
+}
  
-/* Scan for the signature in memory then return the starting position's address */
-void* CSigScan::FindSignature(void) noexcept {
-    const unsigned char *pBasePtr = base_addr;
-    const unsigned char *pEndPtr = base_addr+base_len;
+/* Check the signature at the module's base address + offset, which has to be within one of its
+   code ranges */
+bool CSigScan::MatchOffset(const CSigScanModule &module, size_t offset) noexcept {
+    const std::vector<SigScanRange> &code_ranges = module.GetCodeRanges();
+
+    is_set = 0;
+    sig_addr = nullptr;
+
+    if(!module.IsSet() || sig->len == 0 || offset > module.GetLength())
+        return false;
+
+    unsigned char *pAddr = module.GetBaseAddr() + offset;
+
+    for(size_t i = 0;i < code_ranges.size();i++) {
+        const SigScanRange &range = code_ranges[i];
+
+        if(pAddr < range.addr || pAddr - range.addr > (ptrdiff_t)range.len || range.len - (pAddr - range.addr) < sig->len)
+            continue;
+
+        if(!MatchAt(pAddr))
+            return false;
+
+        sig_addr = pAddr;
+        is_set = 1;
+        return true;
+    }
+
+    return false;
+}
+
+unsigned long long CSigScan::GetKey(void) const noexcept {
+    return HashBytes(sig->cmp, sig->len, HashBytes(sig->bytes, sig->len));
+}
+
+/* Compare the masked signature against memory at pAddr, which has to be readable for sig->len bytes */
+bool CSigScan::MatchAt(const unsigned char *pAddr) const noexcept {
     size_t i = 0;
+
+#ifdef SIGSCAN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    for(;i + 16 <= sig->len;i += 16) {
+        const __m128i data = _mm_loadu_si128((const __m128i*)(pAddr + i));
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(sig->bytes + i));
+        const __m128i cmp = _mm_loadu_si128((const __m128i*)(sig->cmp + i));
+
+        /* Checked bytes that differ */
+        const __m128i diff = _mm_and_si128(_mm_xor_si128(data, bytes), cmp);
+
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF)
+            return false;
+    }
+#endif
+
+    for(;i < sig->len;i++) {
+        if((pAddr[i] ^ sig->bytes[i]) & sig->cmp[i])
+            return false;
+    }
+
+    return true;
+}
  
-    while(pBasePtr < pEndPtr) {
-        for(i = 0;i < sig_len;i++) {
-            if((sig_mask[i] != '?') && (sig_str[i] != pBasePtr[i]))
-                break;
+/* Scan the executable ranges for the signature, lowest address first */
+void* CSigScan::FindSignature(const CSigScanModule &module) noexcept {
+    const std::vector<SigScanRange> &code_ranges = module.GetCodeRanges();
+
+    for(size_t i = 0;i < code_ranges.size();i++) {
+        void *pAddr = FindSignatureIn(code_ranges[i]);
+
+        if(pAddr)
+            return pAddr;
+    }
+
+    return nullptr;
+}
+
+/* Scan for the signature in memory then return the starting position's address. Only addresses
+   where the anchor bytes match are compared in full. */
+void* CSigScan::FindSignatureIn(const SigScanRange &range) noexcept {
+    if(sig->len == 0 || range.len < sig->len)
+        return nullptr;
+
+    const unsigned char *pBasePtr = range.addr;
+    /* The last address the signature fits at */
+    const unsigned char *pLastPtr = range.addr + range.len - sig->len;
+
+    /* Nothing to anchor on when every byte is ignored */
+    if(!sig->cmp[sig->anchor1])
+        return (void*)pBasePtr;
+
+#ifdef SIGSCAN_SSE2
+    const __m128i anchor1 = _mm_set1_epi8((char)sig->bytes[sig->anchor1]);
+    const __m128i anchor2 = _mm_set1_epi8((char)sig->bytes[sig->anchor2]);
+
+    /* 16 start addresses at a time, each compared at both anchors */
+    while(pLastPtr - pBasePtr >= 15) {
+        const __m128i block1 = _mm_loadu_si128((const __m128i*)(pBasePtr + sig->anchor1));
+        const __m128i block2 = _mm_loadu_si128((const __m128i*)(pBasePtr + sig->anchor2));
+
+        unsigned int candidates = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block1, anchor1), _mm_cmpeq_epi8(block2, anchor2)));
+
+        while(candidates) {
+            const unsigned char *pCandidate = pBasePtr + LowestBit(candidates);
+
+            if(MatchAt(pCandidate))
+                return (void*)pCandidate;
+
+            candidates &= candidates - 1;
         }
- 
-        // If 'i' reached the end, we know we have a match!
-        if(i == sig_len)
+
+        pBasePtr += 16;
+    }
+#endif
+
+    /* The rest, or all of it without SSE2, is left to memchr on the first anchor */
+    while(pBasePtr <= pLastPtr) {
+        const unsigned char *pAnchor = (const unsigned char*)memchr(pBasePtr + sig->anchor1, sig->bytes[sig->anchor1], pLastPtr - pBasePtr + 1);
+
+        if(!pAnchor)
+            break;
+
+        pBasePtr = pAnchor - sig->anchor1;
+
+        if(MatchAt(pBasePtr))
             return (void*)pBasePtr;
- 
+
         pBasePtr++;
     }
  
     return nullptr;
 }
+
+static const size_t noSig = (size_t)-1;
+static const size_t noChunk = (size_t)-1;
+
+/* With up to this many different anchor bytes a block of 16 bytes is checked for all of them
+   with SSE2, past that every byte is looked up in a table */
+static const size_t maxVectorAnchors = 8;
+
+/* A part of a code range, the signatures starting at offsets [from, to) into it */
+struct SigScanChunk {
+    size_t range;
+    size_t from;
+    size_t to;
+};
+
+/* Everything a FindSignatures call shares with the threads helping it. Chunks are handed out
+   in address order to whichever thread asks next, the calling thread included, and the call
+   returns once every chunk that was handed out is done. A helper that only gets to run after
+   that, as threads started while the loader lock is held do, finds nothing left to scan and
+   lets go of its reference to the job without touching the signatures. */
+struct SigScanJob {
+    CSigScan **sigs;
+    size_t count;
+
+    /* The signatures waiting on each byte value, as linked lists of indices into sigs */
+    size_t firstSig[256];
+    std::vector<size_t> nextSig;
+    unsigned char anchorBytes[256];
+    size_t numAnchorBytes;
+    size_t maxSigLen;
+    /* Whether each signature is scanned for, rather than settled up front */
+    std::vector<char> anchored;
+
+    std::vector<SigScanRange> ranges;
+    std::vector<SigScanChunk> chunks;
+
+    /* The lowest match of each signature within each chunk, chunk * count + signature */
+    std::vector<const unsigned char*> matches;
+    /* For each signature, the lowest chunk it was found in so far. Chunks past it leave the
+       signature alone. */
+    std::unique_ptr<std::atomic<size_t>[]> firstChunk;
+
+    std::atomic<size_t> nextChunk;
+    size_t doneChunks;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    /* Scan chunks until none are left */
+    void Run() noexcept {
+        for(;;) {
+            const size_t chunk = nextChunk.fetch_add(1);
+
+            if(chunk >= chunks.size())
+                return;
+
+            ScanChunk(chunk);
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if(++doneChunks == chunks.size())
+                done.notify_all();
+        }
+    }
+
+    void ScanChunk(size_t chunk) noexcept;
+};
+
+/* Every byte of a chunk is looked at once, whatever the number of signatures. Each signature
+   waits on the byte at its first anchor: where one of those bytes turns up, the signatures
+   waiting on it are compared at the address that puts their anchor there. Bytes are visited in
+   order, so the first match of every signature is also its lowest address in the chunk. The
+   bytes past the end of the chunk that signatures starting in it reach into are scanned too,
+   so chunks overlap by the longest signature less one byte. */
+void SigScanJob::ScanChunk(size_t chunk) noexcept {
+    const SigScanChunk &part = chunks[chunk];
+    const SigScanRange &range = ranges[part.range];
+
+    size_t waiting = 0;
+
+    for(size_t i = 0;i < count;i++) {
+        if(anchored[i] && firstChunk[i].load() > chunk)
+            waiting++;
+    }
+
+    if(waiting == 0)
+        return;
+
+    /* Compare the signatures waiting on the byte at pAnchor, false once all of them are found */
+    auto checkAnchor = [&](const unsigned char *pAnchor) -> bool {
+        const size_t offset = pAnchor - range.addr;
+
+        for(size_t i = firstSig[*pAnchor];i != noSig;i = nextSig[i]) {
+            const CSigScan *scan = sigs[i];
+            const SigScanPattern &pattern = *scan->sig;
+            const unsigned char *&match = matches[chunk * count + i];
+
+            if(match || offset < pattern.anchor1)
+                continue;
+
+            const size_t start = offset - pattern.anchor1;
+
+            if(start < part.from || start >= part.to || pattern.len > range.len - start || firstChunk[i].load() < chunk)
+                continue;
+
+            const unsigned char *pCandidate = pAnchor - pattern.anchor1;
+
+            if(pCandidate[pattern.anchor2] == pattern.bytes[pattern.anchor2] && scan->MatchAt(pCandidate)) {
+                match = pCandidate;
+
+                size_t first = firstChunk[i].load();
+
+                while(chunk < first && !firstChunk[i].compare_exchange_weak(first, chunk)) {}
+
+                if(--waiting == 0)
+                    return false;
+            }
+        }
+
+        return true;
+    };
+
+    const unsigned char *pBasePtr = range.addr + part.from;
+    const unsigned char *pEndPtr = range.addr + (range.len - part.to < maxSigLen - 1 ? range.len : part.to + maxSigLen - 1);
+
+#ifdef SIGSCAN_SSE2
+    if(numAnchorBytes <= maxVectorAnchors) {
+        __m128i anchors[maxVectorAnchors];
+
+        for(size_t i = 0;i < numAnchorBytes;i++)
+            anchors[i] = _mm_set1_epi8((char)anchorBytes[i]);
+
+        while(pEndPtr - pBasePtr >= 16) {
+            const __m128i block = _mm_loadu_si128((const __m128i*)pBasePtr);
+            __m128i hits = _mm_cmpeq_epi8(block, anchors[0]);
+
+            for(size_t i = 1;i < numAnchorBytes;i++)
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, anchors[i]));
+
+            unsigned int candidates = (unsigned int)_mm_movemask_epi8(hits);
+
+            while(candidates) {
+                if(!checkAnchor(pBasePtr + LowestBit(candidates)))
+                    return;
+
+                candidates &= candidates - 1;
+            }
+
+            pBasePtr += 16;
+        }
+    }
+#endif
+
+    for(;pBasePtr < pEndPtr;pBasePtr++) {
+        if(firstSig[*pBasePtr] != noSig && !checkAnchor(pBasePtr))
+            return;
+    }
+}
+
+#ifdef WIN32
+static void CALLBACK RunSigScanJob(PTP_CALLBACK_INSTANCE instance, PVOID context) {
+    std::shared_ptr<SigScanJob> *job = (std::shared_ptr<SigScanJob>*)context;
+
+    (*job)->Run();
+    delete job;
+}
+#endif
+
+size_t CSigScan::FindSignatures(const CSigScanModule &module, CSigScan **sigs, size_t count, size_t threads) {
+    /* Chunks are no smaller than this, splitting further costs more than it saves */
+    const size_t minChunkLen = 1024 * 1024;
+
+    std::shared_ptr<SigScanJob> job = std::make_shared<SigScanJob>();
+    job->sigs = sigs;
+    job->count = count;
+    job->nextSig.assign(count, noSig);
+    job->anchored.assign(count, 0);
+    job->numAnchorBytes = 0;
+    job->maxSigLen = 1;
+    job->ranges = module.GetCodeRanges();
+    job->firstChunk.reset(new std::atomic<size_t>[count]);
+    job->nextChunk = 0;
+    job->doneChunks = 0;
+
+    size_t found = 0;
+
+    for(size_t i = 0;i < 256;i++)
+        job->firstSig[i] = noSig;
+
+    for(size_t i = 0;i < count;i++) {
+        CSigScan *scan = sigs[i];
+        const SigScanPattern &pattern = *scan->sig;
+
+        scan->is_set = 0;
+        scan->sig_addr = nullptr;
+        job->firstChunk[i] = noChunk;
+
+        if(pattern.len == 0)
+            continue;
+
+        /* Nothing to anchor on when every byte is ignored */
+        if(!pattern.cmp[pattern.anchor1]) {
+            scan->sig_addr = scan->FindSignature(module);
+            scan->is_set = scan->sig_addr ? 1 : 0;
+            found += scan->is_set;
+            continue;
+        }
+
+        const unsigned char anchor = pattern.bytes[pattern.anchor1];
+
+        if(job->firstSig[anchor] == noSig)
+            job->anchorBytes[job->numAnchorBytes++] = anchor;
+
+        job->nextSig[i] = job->firstSig[anchor];
+        job->firstSig[anchor] = i;
+        job->anchored[i] = 1;
+
+        if(pattern.len > job->maxSigLen)
+            job->maxSigLen = pattern.len;
+    }
+
+    if(job->numAnchorBytes == 0)
+        return found;
+
+    if(threads == 0)
+        threads = 1;
+
+    /* A few chunks per thread, so one that ends up with a slow chunk holds up the rest less */
+    for(size_t r = 0;r < job->ranges.size();r++) {
+        const size_t rangeLen = job->ranges[r].len;
+        size_t chunkLen = rangeLen;
+
+        if(threads > 1) {
+            chunkLen = rangeLen / (threads * 4) + 1;
+
+            if(chunkLen < minChunkLen)
+                chunkLen = minChunkLen;
+        }
+
+        for(size_t from = 0;from < rangeLen;from += chunkLen) {
+            SigScanChunk chunk = { r, from, (rangeLen - from > chunkLen) ? from + chunkLen : rangeLen };
+            job->chunks.push_back(chunk);
+        }
+    }
+
+    job->matches.assign(job->chunks.size() * count, nullptr);
+
+    if(threads > job->chunks.size())
+        threads = job->chunks.size();
+
+    for(size_t i = 1;i < threads;i++) {
+#ifdef WIN32
+        /* Idle pool threads are past their start up, so they can help even inside DllMain */
+        std::shared_ptr<SigScanJob> *context = new std::shared_ptr<SigScanJob>(job);
+
+        if(!TrySubmitThreadpoolCallback(RunSigScanJob, context, nullptr))
+            delete context;
+#else
+        std::thread([job]() { job->Run(); }).detach();
+#endif
+    }
+
+    job->Run();
+
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+
+        while(job->doneChunks != job->chunks.size())
+            job->done.wait(lock);
+    }
+
+    for(size_t i = 0;i < count;i++) {
+        const size_t chunk = job->firstChunk[i].load();
+
+        if(chunk == noChunk)
+            continue;
+
+        sigs[i]->sig_addr = (void*)job->matches[chunk * count + i];
+        sigs[i]->is_set = 1;
+        found++;
+    }
+
+    return found;
+}
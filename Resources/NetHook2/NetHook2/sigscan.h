@@ -3,56 +3,238 @@
 
 #include <stdio.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #ifdef _WIN32
 	#define WIN32_LEAN_AND_MEAN
 	#include <windows.h>
 #else
 	#include <dlfcn.h>
 	#include <sys/types.h>
-	#include <sys/stat.h> 
+	#include <link.h>
 #endif
 
+/* A range of memory the signatures are looked for in */
+struct SigScanRange {
+    unsigned char *addr;
+    size_t len;
+};
+
+/* Tells builds of a module apart without reading all of it */
+struct SigScanFingerprint {
+    /* The length of the loaded image */
+    unsigned long long size;
+    /* The PE link time, 0 for ELF */
+    unsigned long long stamp;
+    /* Of the PE file and section headers, or of the ELF program headers and build-id */
+    unsigned long long hash;
+};
+
+/* A signature written the way IDA shows it, such as "48 8B C4 ?? 55", with "?" or "??" for
+   each ignored byte. Declared constexpr the string is parsed while compiling, and a malformed
+   one fails to compile, so nothing is left to do when the module is scanned. */
+struct SigScanPattern {
+    static const size_t maxLen = 64;
+
+    /* The signature, 0 where a byte is ignored */
+    unsigned char bytes[maxLen];
+    /* 0xFF where the byte is checked and 0 where it is ignored */
+    unsigned char cmp[maxLen];
+    size_t len;
+    /* The offsets of the two checked bytes least likely to show up in code, candidates are
+       only verified where both of them match */
+    size_t anchor1;
+    size_t anchor2;
+
+    constexpr SigScanPattern(void) noexcept
+        : bytes(), cmp(), len(0), anchor1(0), anchor2(0) {}
+
+    constexpr SigScanPattern(const char *ida)
+        : bytes(), cmp(), len(0), anchor1(0), anchor2(0) {
+        for(size_t i = 0;ida[i];) {
+            if(ida[i] == ' ') {
+                i++;
+                continue;
+            }
+
+            if(len == maxLen)
+                throw "signature is too long";
+
+            if(ida[i] == '?') {
+                i += (ida[i + 1] == '?') ? 2 : 1;
+            }
+            else {
+                bytes[len] = (unsigned char)((HexDigit(ida[i]) << 4) | HexDigit(ida[i + 1]));
+                cmp[len] = 0xFF;
+                i += 2;
+            }
+
+            if(ida[i] != ' ' && ida[i] != '\0')
+                throw "signature bytes have to be separated by spaces";
+
+            len++;
+        }
+
+        PickAnchors();
+    }
+
+    /* The old style of signature, '?' in mask ignores the byte and anything else checks it.
+       len has to be at most maxLen. */
+    constexpr SigScanPattern(const unsigned char *sig, const char *mask, size_t sigLen) noexcept
+        : bytes(), cmp(), len(sigLen), anchor1(0), anchor2(0) {
+        for(size_t i = 0;i < len;i++) {
+            cmp[i] = (mask[i] == '?') ? 0x00 : 0xFF;
+            bytes[i] = (unsigned char)(sig[i] & cmp[i]);
+        }
+
+        PickAnchors();
+    }
+
+private:
+    static constexpr unsigned char HexDigit(char c) {
+        return (c >= '0' && c <= '9') ? (unsigned char)(c - '0')
+            : (c >= 'A' && c <= 'F') ? (unsigned char)(c - 'A' + 10)
+            : (c >= 'a' && c <= 'f') ? (unsigned char)(c - 'a' + 10)
+            : throw "signature bytes have to be two hex digits";
+    }
+
+    /* How common byte is in x86 and x64 code, 0 for rare bytes */
+    static constexpr size_t Commonness(unsigned char byte) noexcept {
+        /* Bytes that are everywhere in code, most common first */
+        constexpr unsigned char common[] = {
+            0x00, 0xFF, 0x48, 0x8B, 0x89, 0xCC, 0x24, 0xE8, 0x4C, 0x44, 0x0F, 0x8D, 0x85, 0x01,
+            0xC0, 0x83, 0x08, 0x10, 0x20, 0x74, 0x75, 0x45, 0x4D, 0x49, 0x41, 0xC3, 0x5C, 0x55,
+            0x57, 0x56, 0x53, 0xEC, 0x90
+        };
+
+        for(size_t i = 0;i < sizeof(common);i++) {
+            if(common[i] == byte)
+                return sizeof(common) - i;
+        }
+
+        return 0;
+    }
+
+    /* Pick the two checked bytes least likely to appear in code as anchors */
+    constexpr void PickAnchors(void) noexcept {
+        size_t common1 = 0, common2 = 0;
+        bool found1 = false, found2 = false;
+
+        for(size_t i = 0;i < len;i++) {
+            if(!cmp[i])
+                continue;
+
+            const size_t common = Commonness(bytes[i]);
+
+            if(!found1 || common < common1) {
+                anchor2 = anchor1;
+                common2 = common1;
+                found2 = found1;
+
+                anchor1 = i;
+                common1 = common;
+                found1 = true;
+            }
+            else if(!found2 || common < common2) {
+                anchor2 = i;
+                common2 = common;
+                found2 = true;
+            }
+        }
+
+        /* A single checked byte is its own second anchor */
+        if(!found2)
+            anchor2 = anchor1;
+    }
+};
+
+/* A loaded module signatures are looked for in. Each one keeps its own ranges, so any number
+   of them can be scanned at the same time, from as many threads. */
+class CSigScanModule {
+private:
+    /* Base Address of the module in memory */
+    unsigned char *base_addr;
+    /* The length to the module's ending address */
+    size_t base_len;
+    /* The executable sections of the module, the only parts of it that are scanned */
+    std::vector<SigScanRange> code_ranges;
+    /* The file the module was loaded from, and which build of it it is */
+    std::string module_path;
+    SigScanFingerprint module_fingerprint;
+
+    void AddCodeRange(unsigned char *addr, size_t len);
+
+public:
+    CSigScanModule(void) noexcept : base_addr(nullptr), base_len(0), module_fingerprint() {}
+
+    /* Look up the module that contains addr, such as a function it exports, and get its base
+       address, ending offset and the executable ranges in between */
+    bool Init(const void *addr) noexcept;
+    /* Treat a block of memory that isn't a loaded module, such as an image read from disk, as
+       a module whose code is all of it */
+    bool Init(const void *addr, size_t len) noexcept;
+    bool IsSet(void) const noexcept { return base_addr != nullptr; }
+
+    unsigned char *GetBaseAddr(void) const noexcept { return base_addr; }
+    size_t GetLength(void) const noexcept { return base_len; }
+    const std::vector<SigScanRange> &GetCodeRanges(void) const noexcept { return code_ranges; }
+    const std::string &GetPath(void) const noexcept { return module_path; }
+    const SigScanFingerprint &GetFingerprint(void) const noexcept { return module_fingerprint; }
+};
+
+struct SigScanJob;
+
 class CSigScan {
+    friend struct SigScanJob;
+
 private:
     /* Private Variables */
-    /* Base Address of the server module in memory */
-    static unsigned char *base_addr;
-    /* The length to the module's ending address */
-    static size_t base_len;
- 
-    /* The signature to scan for */
-    unsigned char *sig_str;
-    /* A mask to ignore certain bytes in the signature such as addresses
-       The mask should be as long as all the bytes in the signature string
-       Use '?' to ignore a byte and 'x' to check it
+    /* The signature to scan for, either the caller's or sig_owned */
+    const SigScanPattern *sig;
+    /* A signature given to Init() as a string and a mask
+       Use '?' in the mask to ignore a byte and 'x' to check it
        Example: "xxx????xx" - The first 3 bytes are checked, then the next 4 are
        ignored, then the last 2 are checked */
-    char *sig_mask;
-    /* The length of sig_str and sig_mask (not including a terminating null for sig_mask) */
-    size_t sig_len;
+    std::unique_ptr<SigScanPattern> sig_owned;
  
     /* Private Functions */
-    void* FindSignature(void) noexcept;
+    bool MatchAt(const unsigned char *pAddr) const noexcept;
+    void* FindSignature(const CSigScanModule &module) noexcept;
+    void* FindSignatureIn(const SigScanRange &range) noexcept;
+    void SetSignature(const unsigned char *sigStr, const char *mask, size_t len);
+    void SetSignature(const SigScanPattern &pattern) noexcept;
  
 public:
     /* Public Variables */
  
-    /* sigscan_dllfunc is a pointer of something that resides inside the gamedll so we can get
-       the base address of it. From a SourceMM plugin, just set this to ismm->serverFactory(0)
-       in Load(). From a Valve Server Plugin, you must set this to an actual factory returned
-       from gameServerFactory and hope that a SourceMM plugin did not override it. */
-    static void *(*sigscan_dllfunc)(const char *pName, int *pReturnCode);
- 
     /* If the scan was successful or not */
     char is_set;
     /* Starting address of the found function */
     void *sig_addr;
  
-    CSigScan(void) noexcept : sig_str(nullptr), sig_mask(nullptr), sig_len(0), sig_addr(nullptr), is_set(0) {}
-	~CSigScan(void);
+    CSigScan(void) noexcept;
+
+    /* Scan module for the signature. Signatures longer than SigScanPattern::maxLen are never
+       found. */
+    int Init(const CSigScanModule &module, const unsigned char *sigStr, const char *mask, size_t len);
+    /* The pattern is not copied, it has to stay around for as long as this object does */
+    int Init(const CSigScanModule &module, const SigScanPattern &pattern) noexcept;
+
+    /* Scan for several signatures set up with Prepare() in a single pass over the module, each
+       one ends up with the same is_set and sig_addr Init() would have given it. Returns how
+       many were found. With threads over 1 the code ranges are split into chunks which that
+       many threads, the calling one included, scan at the same time; the result is the same. */
+    void Prepare(const unsigned char *sigStr, const char *mask, size_t len);
+    void Prepare(const SigScanPattern &pattern) noexcept;
+    static size_t FindSignatures(const CSigScanModule &module, CSigScan **sigs, size_t count, size_t threads = 1);
 
-    static bool GetDllMemInfo(void) noexcept;
-    int Init(const unsigned char *sig, const char *mask, size_t len);
+    /* Check the signature at a single offset into the module, such as one found by an earlier
+       scan, setting is_set and sig_addr like Init() would on a match */
+    bool MatchOffset(const CSigScanModule &module, size_t offset) noexcept;
+    /* Identifies the signature and mask, for remembering where they were found */
+    unsigned long long GetKey(void) const noexcept;
 };
  
 /* Sigscanned member functions are casted to member function pointers of this class
@@ -12,6 +12,13 @@ enum class EMsg
 	k_EMsgMulti = 1,
 
 	k_EMsgRemoteSysID = 128,
+	k_EMsgServiceMethod = 146,
+	k_EMsgServiceMethodResponse = 147,
+	k_EMsgServiceMethodCallFromClient = 151,
+	k_EMsgServiceMethodSendToClient = 152,
+	k_EMsgClientServiceMethodLegacy = 5594,
+	k_EMsgClientServiceMethodLegacyResponse = 5595,
+	k_EMsgServiceMethodCallFromClientNonAuthed = 9804,
 	k_EMsgFileXferRequest = 1200,
 	k_EMsgFileXferResponse = 1201,
 	k_EMsgFileXferData = 1202,
@@ -1,37 +1,453 @@
 
 #include "zip.h"
-#include "logger.h"
+
+#include <atomic>
+#include <vector>
 
 #include "zlib.h"
 
+#ifdef NETHOOK_ZIP_ZLIBNG
+	#include "zlib-ng.h"
+#endif
 
-bool CZip::Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed )
+#ifdef NETHOOK_ZIP_LIBDEFLATE
+	#include "libdeflate.h"
+#endif
+
+
+struct ZipStreamPool_t
+{
+	~ZipStreamPool_t()
+	{
+		for ( std::vector<IZipStream *> &freeStreams : m_FreeStreams )
+		{
+			for ( IZipStream *pStream : freeStreams )
+				delete pStream;
+		}
+	}
+
+	// indexed by the backend that handed the streams out
+	std::vector<IZipStream *> m_FreeStreams[ k_EZipBackendCount ];
+};
+
+static thread_local ZipStreamPool_t t_ZipStreamPool;
+
+
+static IZipStream *AcquireStream( IZipBackend *pBackend, const uint8 *pCompressed, uint32 cubCompressed )
 {
-	z_stream zstrm;
+	std::vector<IZipStream *> &freeStreams = t_ZipStreamPool.m_FreeStreams[ pBackend->GetType() ];
 
-	zstrm.zalloc = Z_NULL;
-	zstrm.zfree = Z_NULL;
-	zstrm.opaque = Z_NULL;
-	zstrm.avail_in = 0;
-	zstrm.next_in = Z_NULL;
+	while ( !freeStreams.empty() )
+	{
+		IZipStream *pStream = freeStreams.back();
+		freeStreams.pop_back();
 
-	int ret = inflateInit2( &zstrm, 16 );
+		if ( pStream->Reset( pCompressed, cubCompressed ) )
+			return pStream;
+
+		delete pStream;
+	}
+
+	IZipStream *pStream = pBackend->CreateStream();
+
+	if ( !pStream->Reset( pCompressed, cubCompressed ) )
+	{
+		delete pStream;
+		return nullptr;
+	}
+
+	return pStream;
+}
+
+static void ReleaseStream( EZipBackend eBackend, IZipStream *pStream )
+{
+	std::vector<IZipStream *> &freeStreams = t_ZipStreamPool.m_FreeStreams[ eBackend ];
+
+	if ( freeStreams.size() < CZip::k_cMaxPooledStreams )
+		freeStreams.push_back( pStream );
+	else
+		delete pStream;
+}
 
-	if ( ret != Z_OK )
+// whole buffer decoding for the streaming backends
+static bool InflateWithStream( IZipBackend *pBackend, const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed, uint32 *pcubWritten )
+{
+	IZipStream *pStream = AcquireStream( pBackend, pCompressed, cubCompressed );
+
+	if ( pStream == nullptr )
 		return false;
 
-	zstrm.avail_in = cubCompressed;
-	zstrm.next_in = (Bytef *)pCompressed;
+	EZipStatus eStatus = k_EZipStatusMore;
+	uint32 cubWritten = 0;
+
+	while ( eStatus == k_EZipStatusMore && cubWritten < cubDecompressed )
+	{
+		uint32 cubInflated = 0;
+		eStatus = pStream->Inflate( pDecompressed + cubWritten, cubDecompressed - cubWritten, &cubInflated );
+
+		cubWritten += cubInflated;
+	}
+
+	ReleaseStream( pBackend->GetType(), pStream );
+
+	*pcubWritten = cubWritten;
+	return eStatus == k_EZipStatusDone;
+}
+
+
+class CZlibStream : public IZipStream
+{
+
+public:
+	CZlibStream() noexcept
+		: m_bInitialized( false )
+	{
+		m_Stream.zalloc = Z_NULL;
+		m_Stream.zfree = Z_NULL;
+		m_Stream.opaque = Z_NULL;
+		m_Stream.avail_in = 0;
+		m_Stream.next_in = Z_NULL;
+	}
+
+	~CZlibStream()
+	{
+		if ( m_bInitialized )
+			inflateEnd( &m_Stream );
+	}
+
+	bool Reset( const uint8 *pCompressed, uint32 cubCompressed ) override
+	{
+		if ( m_bInitialized )
+		{
+			if ( inflateReset( &m_Stream ) != Z_OK )
+				return false;
+		}
+		else
+		{
+			// gzip only, the window size comes from the stream
+			if ( inflateInit2( &m_Stream, 16 ) != Z_OK )
+				return false;
+
+			m_bInitialized = true;
+		}
+
+		m_Stream.avail_in = cubCompressed;
+		m_Stream.next_in = (Bytef *)pCompressed;
+
+		return true;
+	}
+
+	EZipStatus Inflate( uint8 *pOut, uint32 cubOut, uint32 *pcubWritten ) override
+	{
+		m_Stream.avail_out = cubOut;
+		m_Stream.next_out = pOut;
 
-	zstrm.avail_out = cubDecompressed;
-	zstrm.next_out = pDecompressed;
+		const int ret = inflate( &m_Stream, Z_NO_FLUSH );
 
-	ret = inflate( &zstrm, Z_NO_FLUSH );
+		*pcubWritten = cubOut - m_Stream.avail_out;
+
+		switch ( ret )
+		{
+		case Z_OK:
+			return k_EZipStatusMore;
+
+		case Z_STREAM_END:
+			return k_EZipStatusDone;
+
+		// no progress was possible, with output space left that means the input ran out
+		case Z_BUF_ERROR:
+			return ( cubOut != 0 ? k_EZipStatusTruncated : k_EZipStatusMore );
+
+		default:
+			return k_EZipStatusCorrupt;
+		}
+	}
+
+private:
+	z_stream m_Stream;
+	bool m_bInitialized;
+
+};
+
+class CZlibBackend : public IZipBackend
+{
+
+public:
+	EZipBackend GetType() const override { return k_EZipBackendZlib; }
+
+	bool Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed, uint32 *pcubWritten ) override
+	{
+		return InflateWithStream( this, pCompressed, cubCompressed, pDecompressed, cubDecompressed, pcubWritten );
+	}
+
+	IZipStream *CreateStream() override { return new CZlibStream; }
+
+};
+
+static CZlibBackend s_ZlibBackend;
+
+
+#ifdef NETHOOK_ZIP_ZLIBNG
+
+class CZlibNgStream : public IZipStream
+{
+
+public:
+	CZlibNgStream() noexcept
+		: m_bInitialized( false )
+	{
+		m_Stream.zalloc = nullptr;
+		m_Stream.zfree = nullptr;
+		m_Stream.opaque = nullptr;
+		m_Stream.avail_in = 0;
+		m_Stream.next_in = nullptr;
+	}
+
+	~CZlibNgStream()
+	{
+		if ( m_bInitialized )
+			zng_inflateEnd( &m_Stream );
+	}
+
+	bool Reset( const uint8 *pCompressed, uint32 cubCompressed ) override
+	{
+		if ( m_bInitialized )
+		{
+			if ( zng_inflateReset( &m_Stream ) != Z_OK )
+				return false;
+		}
+		else
+		{
+			if ( zng_inflateInit2( &m_Stream, 16 ) != Z_OK )
+				return false;
+
+			m_bInitialized = true;
+		}
+
+		m_Stream.avail_in = cubCompressed;
+		m_Stream.next_in = pCompressed;
+
+		return true;
+	}
+
+	EZipStatus Inflate( uint8 *pOut, uint32 cubOut, uint32 *pcubWritten ) override
+	{
+		m_Stream.avail_out = cubOut;
+		m_Stream.next_out = pOut;
+
+		const int ret = zng_inflate( &m_Stream, Z_NO_FLUSH );
+
+		*pcubWritten = cubOut - m_Stream.avail_out;
+
+		switch ( ret )
+		{
+		case Z_OK:
+			return k_EZipStatusMore;
+
+		case Z_STREAM_END:
+			return k_EZipStatusDone;
+
+		case Z_BUF_ERROR:
+			return ( cubOut != 0 ? k_EZipStatusTruncated : k_EZipStatusMore );
+
+		default:
+			return k_EZipStatusCorrupt;
+		}
+	}
+
+private:
+	zng_stream m_Stream;
+	bool m_bInitialized;
+
+};
+
+class CZlibNgBackend : public IZipBackend
+{
 
-	inflateEnd( &zstrm );
+public:
+	EZipBackend GetType() const override { return k_EZipBackendZlibNg; }
 
-	if ( ret != Z_STREAM_END )
+	bool Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed, uint32 *pcubWritten ) override
+	{
+		return InflateWithStream( this, pCompressed, cubCompressed, pDecompressed, cubDecompressed, pcubWritten );
+	}
+
+	IZipStream *CreateStream() override { return new CZlibNgStream; }
+
+};
+
+static CZlibNgBackend s_ZlibNgBackend;
+
+#endif // NETHOOK_ZIP_ZLIBNG
+
+
+#ifdef NETHOOK_ZIP_LIBDEFLATE
+
+struct LibdeflateDecompressor_t
+{
+	~LibdeflateDecompressor_t()
+	{
+		if ( m_pDecompressor != nullptr )
+			libdeflate_free_decompressor( m_pDecompressor );
+	}
+
+	libdeflate_decompressor *m_pDecompressor;
+};
+
+// decompressors aren't thread safe, but cheap to keep one per thread
+static thread_local LibdeflateDecompressor_t t_LibdeflateDecompressor;
+
+class CLibdeflateBackend : public IZipBackend
+{
+
+public:
+	EZipBackend GetType() const override { return k_EZipBackendLibdeflate; }
+
+	bool Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed, uint32 *pcubWritten ) override
+	{
+		if ( t_LibdeflateDecompressor.m_pDecompressor == nullptr )
+			t_LibdeflateDecompressor.m_pDecompressor = libdeflate_alloc_decompressor();
+
+		if ( t_LibdeflateDecompressor.m_pDecompressor == nullptr )
+			return false;
+
+		size_t cubWritten = 0;
+
+		if ( libdeflate_gzip_decompress( t_LibdeflateDecompressor.m_pDecompressor, pCompressed, cubCompressed, pDecompressed, cubDecompressed, &cubWritten ) != LIBDEFLATE_SUCCESS )
+			return false;
+
+		*pcubWritten = static_cast<uint32>( cubWritten );
+		return true;
+	}
+
+	// libdeflate can't stream, streams come from the best of the others
+	IZipStream *CreateStream() override
+	{
+#ifdef NETHOOK_ZIP_ZLIBNG
+		return s_ZlibNgBackend.CreateStream();
+#else
+		return s_ZlibBackend.CreateStream();
+#endif
+	}
+
+	bool PrefersWholeBuffer() const override { return true; }
+
+};
+
+static CLibdeflateBackend s_LibdeflateBackend;
+
+#endif // NETHOOK_ZIP_LIBDEFLATE
+
+
+static IZipBackend *GetBackendInstance( EZipBackend eBackend ) noexcept
+{
+	switch ( eBackend )
+	{
+	case k_EZipBackendZlib:
+		return &s_ZlibBackend;
+
+#ifdef NETHOOK_ZIP_ZLIBNG
+	case k_EZipBackendZlibNg:
+		return &s_ZlibNgBackend;
+#endif
+
+#ifdef NETHOOK_ZIP_LIBDEFLATE
+	case k_EZipBackendLibdeflate:
+		return &s_LibdeflateBackend;
+#endif
+
+	default:
+		return nullptr;
+	}
+}
+
+#if defined( NETHOOK_ZIP_LIBDEFLATE )
+	static std::atomic<IZipBackend *> s_pZipBackend( &s_LibdeflateBackend );
+#elif defined( NETHOOK_ZIP_ZLIBNG )
+	static std::atomic<IZipBackend *> s_pZipBackend( &s_ZlibNgBackend );
+#else
+	static std::atomic<IZipBackend *> s_pZipBackend( &s_ZlibBackend );
+#endif
+
+
+bool CZip::Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed )
+{
+	uint32 cubWritten = 0;
+	return GetBackend()->Inflate( pCompressed, cubCompressed, pDecompressed, cubDecompressed, &cubWritten );
+}
+
+bool CZip::IsBackendAvailable( EZipBackend eBackend ) noexcept
+{
+	return GetBackendInstance( eBackend ) != nullptr;
+}
+
+const char *CZip::GetBackendName( EZipBackend eBackend ) noexcept
+{
+	switch ( eBackend )
+	{
+	case k_EZipBackendZlib:
+		return "zlib";
+
+	case k_EZipBackendZlibNg:
+		return "zlib-ng";
+
+	case k_EZipBackendLibdeflate:
+		return "libdeflate";
+
+	default:
+		return "unknown";
+	}
+}
+
+bool CZip::SetBackend( EZipBackend eBackend ) noexcept
+{
+	IZipBackend *pBackend = GetBackendInstance( eBackend );
+
+	if ( pBackend == nullptr )
 		return false;
 
+	s_pZipBackend.store( pBackend );
 	return true;
 }
+
+IZipBackend *CZip::GetBackend() noexcept
+{
+	return s_pZipBackend.load( std::memory_order_relaxed );
+}
+
+
+CZipInflater::CZipInflater() noexcept
+	: m_pStream( nullptr ),
+	  m_eBackend( k_EZipBackendZlib )
+{
+}
+
+CZipInflater::~CZipInflater()
+{
+	if ( m_pStream != nullptr )
+		ReleaseStream( m_eBackend, m_pStream );
+}
+
+bool CZipInflater::Begin( const uint8 *pCompressed, uint32 cubCompressed )
+{
+	if ( m_pStream != nullptr )
+	{
+		if ( m_pStream->Reset( pCompressed, cubCompressed ) )
+			return true;
+
+		delete m_pStream;
+		m_pStream = nullptr;
+	}
+
+	IZipBackend *pBackend = CZip::GetBackend();
+
+	m_pStream = AcquireStream( pBackend, pCompressed, cubCompressed );
+	m_eBackend = pBackend->GetType();
+
+	return m_pStream != nullptr;
+}
+
+EZipStatus CZipInflater::Inflate( uint8 *pOut, uint32 cubOut, uint32 *pcubWritten )
+{
+	return m_pStream->Inflate( pOut, cubOut, pcubWritten );
+}
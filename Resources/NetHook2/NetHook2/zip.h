@@ -6,14 +6,113 @@
 #include "steam/steamtypes.h"
 
 
+enum EZipStatus
+{
+	// all the output space was used, call again for more
+	k_EZipStatusMore,
+	k_EZipStatusDone,
+	// the compressed data ended before the end of the stream
+	k_EZipStatusTruncated,
+	k_EZipStatusCorrupt,
+};
+
+enum EZipBackend
+{
+	k_EZipBackendZlib,
+	// only in builds with NETHOOK_ZIP_ZLIBNG
+	k_EZipBackendZlibNg,
+	// only in builds with NETHOOK_ZIP_LIBDEFLATE, decodes whole buffers only
+	k_EZipBackendLibdeflate,
+
+	k_EZipBackendCount
+};
+
+
+// A piecewise gzip decoder, see CZipInflater.
+class IZipStream
+{
+
+public:
+	virtual ~IZipStream() {}
+
+	// starts a new stream, false if this one can't be reused
+	virtual bool Reset( const uint8 *pCompressed, uint32 cubCompressed ) = 0;
+	virtual EZipStatus Inflate( uint8 *pOut, uint32 cubOut, uint32 *pcubWritten ) = 0;
+
+};
+
+// A gzip implementation. Backends are stateless, per thread state lives in the streams and
+// in whatever the backend keeps thread local, so one instance serves every thread.
+class IZipBackend
+{
+
+public:
+	virtual ~IZipBackend() {}
+
+	virtual EZipBackend GetType() const = 0;
+
+	// decodes a whole gzip stream into at most cubDecompressed bytes
+	virtual bool Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed, uint32 *pcubWritten ) = 0;
+
+	virtual IZipStream *CreateStream() = 0;
+
+	// whole buffer decoding is faster enough to be worth sizing the output up front
+	virtual bool PrefersWholeBuffer() const { return false; }
+
+};
+
+
+// gzip decompression. zlib's inflate state (about 7 KB plus a 32 KB window) takes two heap
+// allocations to set up, so streams are pooled per thread and only reset between uses.
+//
+// zlib is always built in. zlib-ng and libdeflate are picked up when their defines are set and
+// the fastest of them is the default, SetBackend() overrides that.
 class CZip
 {
 
 public:
 	static bool Inflate( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed );
 
+	static bool IsBackendAvailable( EZipBackend eBackend ) noexcept;
+	static const char *GetBackendName( EZipBackend eBackend ) noexcept;
+
+	// meant to be called before anything is decompressed, streams already handed out keep the
+	// backend they came from
+	static bool SetBackend( EZipBackend eBackend ) noexcept;
+	static IZipBackend *GetBackend() noexcept;
+
+public:
+	// streams kept around per thread and backend, more than this many in use at once are freed
+	// on release
+	static constexpr uint32 k_cMaxPooledStreams = 4;
+
 };
 
 
-#endif // !NETHOOK_ZIP_H_
+// Decompresses a gzip stream piecewise into whatever output space the caller has. Holds on to a
+// pooled stream from the first Begin() until it is destroyed.
+class CZipInflater
+{
 
+public:
+	CZipInflater() noexcept;
+	~CZipInflater();
+
+	CZipInflater( const CZipInflater & ) = delete;
+	CZipInflater &operator=( const CZipInflater & ) = delete;
+
+	// the compressed data has to stay valid until Inflate() stops returning k_EZipStatusMore
+	bool Begin( const uint8 *pCompressed, uint32 cubCompressed );
+
+	// writes up to cubOut bytes, *pcubWritten may be less even when more is to come
+	EZipStatus Inflate( uint8 *pOut, uint32 cubOut, uint32 *pcubWritten );
+
+private:
+	IZipStream *m_pStream;
+	// the backend m_pStream goes back to
+	EZipBackend m_eBackend;
+
+};
+
+
+#endif // !NETHOOK_ZIP_H_
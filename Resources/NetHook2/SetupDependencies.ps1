@@ -1,3 +1,9 @@
+param (
+    # Build the optional Multi decoders into NetHook2, see readme.md
+    [switch]$ZlibNg,
+    [switch]$Libdeflate
+)
+
 if (!$env:DevEnvDir) {
     $vsWhere = Join-Path -Path ${env:ProgramFiles(x86)} -ChildPath 'Microsoft Visual Studio\Installer\vswhere.exe'
     $vsInstallDir = (. $vsWhere -latest -products * -requires Microsoft.VisualStudio.Component.VC.Tools.x86.x64 -property installationPath) |
@@ -55,4 +61,16 @@ else {
 # DO need to call this
 . $vcpkg integrate install
 
+# Picked up by NetHook2.vcxproj, which then installs the vcpkg feature and defines NETHOOK_ZIP_*
+$zipProps = Join-Path -Path $PSScriptRoot -ChildPath 'NetHook2\ZipBackends.props'
+@"
+<?xml version="1.0" encoding="utf-8"?>
+<Project xmlns="http://schemas.microsoft.com/developer/msbuild/2003">
+  <PropertyGroup>
+    <NetHookZipZlibNg>$($ZlibNg.IsPresent.ToString().ToLower())</NetHookZipZlibNg>
+    <NetHookZipLibdeflate>$($Libdeflate.IsPresent.ToString().ToLower())</NetHookZipLibdeflate>
+  </PropertyGroup>
+</Project>
+"@ | Set-Content -Path $zipProps -Encoding UTF8
+
 # todo: compile or download protoc and generate steammessages_base.pb.{h|cpp}
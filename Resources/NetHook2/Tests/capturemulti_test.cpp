@@ -0,0 +1,411 @@
+
+// capturemulti_test: feeds CaptureParseMulti, CCaptureMultiReader, CCaptureMultiInflater and
+// CCaptureMultiExpander well formed, zero length, truncated and malformed Multis.
+//
+// usage: capturemulti_test
+
+#include <string>
+#include <vector>
+
+#include "capturemulti.h"
+#include "captureproto.h"
+#include "nhtestzip.h"
+
+
+static void AppendVarint( std::vector<uint8> *pOut, uint64 ullValue )
+{
+	while ( ullValue >= 0x80 )
+	{
+		pOut->push_back( static_cast<uint8>( ullValue | 0x80 ) );
+		ullValue >>= 7;
+	}
+
+	pOut->push_back( static_cast<uint8>( ullValue ) );
+}
+
+static void AppendBytes( std::vector<uint8> *pOut, const std::vector<uint8> &bytes )
+{
+	pOut->insert( pOut->end(), bytes.begin(), bytes.end() );
+}
+
+// a CMsgMulti, without size_unzipped when cubUnzipped is 0
+static std::vector<uint8> BuildMultiBody( uint32 cubUnzipped, const std::vector<uint8> &body )
+{
+	std::vector<uint8> multi;
+
+	if ( cubUnzipped != 0 )
+	{
+		AppendVarint( &multi, ( 1 << 3 ) | k_EWireTypeVarint );
+		AppendVarint( &multi, cubUnzipped );
+	}
+
+	AppendVarint( &multi, ( 2 << 3 ) | k_EWireTypeLengthDelimited );
+	AppendVarint( &multi, body.size() );
+	AppendBytes( &multi, body );
+
+	return multi;
+}
+
+// a protobuf message of the given EMsg, with an empty CMsgProtoBufHeader
+static std::vector<uint8> BuildMessage( EMsg eMsg, const std::vector<uint8> &body )
+{
+	const uint32 rgunHeader[ 2 ] = { static_cast<uint32>( eMsg ) | k_EMsgProtoMask, 0 };
+
+	std::vector<uint8> message( reinterpret_cast<const uint8 *>( rgunHeader ), reinterpret_cast<const uint8 *>( rgunHeader + 2 ) );
+	AppendBytes( &message, body );
+
+	return message;
+}
+
+// uint32 length prefixed children, the layout of message_body
+static std::vector<uint8> BuildChildren( const std::vector<std::vector<uint8>> &children )
+{
+	std::vector<uint8> body;
+
+	for ( const std::vector<uint8> &child : children )
+	{
+		const uint32 cubChild = static_cast<uint32>( child.size() );
+		body.insert( body.end(), reinterpret_cast<const uint8 *>( &cubChild ), reinterpret_cast<const uint8 *>( &cubChild + 1 ) );
+		AppendBytes( &body, child );
+	}
+
+	return body;
+}
+
+static std::vector<std::vector<uint8>> SampleChildren()
+{
+	std::vector<std::vector<uint8>> children;
+
+	for ( uint32 i = 0; i < 20; i++ )
+		children.push_back( BuildMessage( EMsg::k_EMsgClientHeartBeat, std::vector<uint8>( i * 37, static_cast<uint8>( i ) ) ) );
+
+	// zero length children are legal, if pointless
+	children.push_back( std::vector<uint8>() );
+	children.push_back( BuildMessage( EMsg::k_EMsgClientLogOnResponse, std::vector<uint8>( 100000, 0x5A ) ) );
+
+	return children;
+}
+
+template <typename Reader>
+static std::vector<std::vector<uint8>> ReadAll( Reader *pReader )
+{
+	std::vector<std::vector<uint8>> children;
+	const uint8 *pubChild;
+	uint32 cubChild;
+
+	while ( pReader->Next( &pubChild, &cubChild ) )
+		children.emplace_back( pubChild, pubChild + cubChild );
+
+	return children;
+}
+
+
+static void TestParseMulti()
+{
+	CaptureMulti_t multi;
+
+	// a zero length CMsgMulti is all defaults
+	NH_CHECK( CaptureParseMulti( nullptr, 0, &multi ) );
+	NH_CHECK( multi.m_cubUnzipped == 0 && multi.m_cubBody == 0 );
+
+	// as is an empty message_body
+	std::vector<uint8> data = BuildMultiBody( 0, std::vector<uint8>() );
+	NH_CHECK( CaptureParseMulti( data.data(), static_cast<uint32>( data.size() ), &multi ) );
+	NH_CHECK( multi.m_cubUnzipped == 0 && multi.m_cubBody == 0 );
+
+	const std::vector<uint8> body = BuildChildren( SampleChildren() );
+	data = BuildMultiBody( 123456, body );
+
+	NH_CHECK( CaptureParseMulti( data.data(), static_cast<uint32>( data.size() ), &multi ) );
+	NH_CHECK( multi.m_cubUnzipped == 123456 );
+	NH_CHECK( multi.m_cubBody == body.size() && memcmp( multi.m_pubBody, body.data(), body.size() ) == 0 );
+
+	// every prefix that doesn't end between two fields is malformed
+	const size_t cubFirstField = 1 + 3;
+
+	for ( size_t cubPrefix = 0; cubPrefix < data.size(); cubPrefix++ )
+	{
+		const bool bParsed = CaptureParseMulti( data.data(), static_cast<uint32>( cubPrefix ), &multi );
+		NH_CHECK( bParsed == ( cubPrefix == 0 || cubPrefix == cubFirstField ) );
+	}
+
+	// unknown fields of every wire type are skipped, and the last message_body wins
+	std::vector<uint8> withUnknown;
+	AppendVarint( &withUnknown, ( 3 << 3 ) | k_EWireTypeVarint );
+	AppendVarint( &withUnknown, 1ull << 40 );
+	AppendVarint( &withUnknown, ( 4 << 3 ) | k_EWireTypeFixed32 );
+	AppendBytes( &withUnknown, { 1, 2, 3, 4 } );
+	AppendVarint( &withUnknown, ( 5 << 3 ) | k_EWireTypeFixed64 );
+	AppendBytes( &withUnknown, { 1, 2, 3, 4, 5, 6, 7, 8 } );
+	AppendBytes( &withUnknown, BuildMultiBody( 0, { 9, 9, 9 } ) );
+	AppendVarint( &withUnknown, ( 6 << 3 ) | k_EWireTypeLengthDelimited );
+	AppendVarint( &withUnknown, 2 );
+	AppendBytes( &withUnknown, { 7, 7 } );
+	AppendBytes( &withUnknown, BuildMultiBody( 0, body ) );
+
+	NH_CHECK( CaptureParseMulti( withUnknown.data(), static_cast<uint32>( withUnknown.size() ), &multi ) );
+	NH_CHECK( multi.m_cubBody == body.size() && memcmp( multi.m_pubBody, body.data(), body.size() ) == 0 );
+
+	// size_unzipped sent as bytes is an unknown field to the generated parser as well
+	std::vector<uint8> wrongType;
+	AppendVarint( &wrongType, ( 1 << 3 ) | k_EWireTypeLengthDelimited );
+	AppendVarint( &wrongType, 1 );
+	wrongType.push_back( 0x7F );
+
+	NH_CHECK( CaptureParseMulti( wrongType.data(), static_cast<uint32>( wrongType.size() ), &multi ) );
+	NH_CHECK( multi.m_cubUnzipped == 0 );
+
+	// field 0, groups, unknown wire types and message_body running past the end
+	const std::vector<std::vector<uint8>> malformed =
+	{
+		{ 0x00, 0x01 },
+		{ ( 7 << 3 ) | 3, ( 7 << 3 ) | 4 },
+		{ ( 7 << 3 ) | 6 },
+		{ ( 2 << 3 ) | k_EWireTypeLengthDelimited, 0x05, 1, 2, 3, 4 },
+		{ ( 2 << 3 ) | k_EWireTypeLengthDelimited, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F },
+		{ ( 1 << 3 ) | k_EWireTypeVarint, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 },
+	};
+
+	for ( const std::vector<uint8> &bytes : malformed )
+		NH_CHECK( !CaptureParseMulti( bytes.data(), static_cast<uint32>( bytes.size() ), &multi ) );
+}
+
+static void TestReader()
+{
+	// nothing at all
+	CCaptureMultiReader empty( nullptr, 0 );
+	NH_CHECK( ReadAll( &empty ).empty() );
+	NH_CHECK( !empty.IsTruncated() );
+
+	const std::vector<std::vector<uint8>> children = SampleChildren();
+	const std::vector<uint8> body = BuildChildren( children );
+
+	CCaptureMultiReader reader( body.data(), static_cast<uint32>( body.size() ) );
+	NH_CHECK( ReadAll( &reader ) == children );
+	NH_CHECK( !reader.IsTruncated() );
+	NH_CHECK( reader.GetSizeLeft() == 0 );
+
+	// cut anywhere but between two children, including in the middle of a length prefix
+	size_t cubComplete = 0;
+	size_t cComplete = 0;
+
+	for ( size_t cubPrefix = 0; cubPrefix <= body.size(); cubPrefix++ )
+	{
+		while ( cComplete < children.size() && cubComplete + sizeof( uint32 ) + children[ cComplete ].size() <= cubPrefix )
+			cubComplete += sizeof( uint32 ) + children[ cComplete++ ].size();
+
+		CCaptureMultiReader truncated( body.data(), static_cast<uint32>( cubPrefix ) );
+		const std::vector<std::vector<uint8>> read = ReadAll( &truncated );
+
+		NH_CHECK( read.size() == cComplete );
+		NH_CHECK( truncated.IsTruncated() == ( cubPrefix != cubComplete ) );
+	}
+
+	// a length prefix claiming all of the address space
+	const std::vector<uint8> huge = { 0xFF, 0xFF, 0xFF, 0xFF, 1, 2, 3 };
+	CCaptureMultiReader hugeReader( huge.data(), static_cast<uint32>( huge.size() ) );
+
+	NH_CHECK( ReadAll( &hugeReader ).empty() );
+	NH_CHECK( hugeReader.IsTruncated() );
+}
+
+static void TestInflater()
+{
+	const std::vector<std::vector<uint8>> children = SampleChildren();
+	const std::vector<uint8> body = BuildChildren( children );
+	const std::vector<uint8> compressed = TestGzip( body );
+
+	// a small window, so children are assembled over several inflate calls
+	CCaptureMultiInflater inflater( 1024 );
+
+	NH_CHECK( inflater.Begin( compressed.data(), static_cast<uint32>( compressed.size() ), static_cast<uint32>( body.size() ) ) );
+	NH_CHECK( ReadAll( &inflater ) == children );
+	NH_CHECK( !inflater.IsTruncated() && !inflater.IsCorrupt() );
+
+	// the same inflater again, without a size hint
+	NH_CHECK( inflater.Begin( compressed.data(), static_cast<uint32>( compressed.size() ) ) );
+	NH_CHECK( ReadAll( &inflater ) == children );
+
+	// an empty body
+	const std::vector<uint8> compressedEmpty = TestGzip( std::vector<uint8>() );
+
+	NH_CHECK( inflater.Begin( compressedEmpty.data(), static_cast<uint32>( compressedEmpty.size() ) ) );
+	NH_CHECK( ReadAll( &inflater ).empty() );
+	NH_CHECK( !inflater.IsTruncated() && !inflater.IsCorrupt() );
+
+	// a body cut short before it was compressed, in a length prefix and in a child
+	for ( size_t cubCut : { body.size() - children.back().size() - 2, body.size() - 1000 } )
+	{
+		const std::vector<uint8> compressedCut = TestGzip( std::vector<uint8>( body.begin(), body.begin() + cubCut ) );
+
+		NH_CHECK( inflater.Begin( compressedCut.data(), static_cast<uint32>( compressedCut.size() ) ) );
+		NH_CHECK( ReadAll( &inflater ).size() == children.size() - 1 );
+		NH_CHECK( inflater.IsTruncated() && !inflater.IsCorrupt() );
+	}
+
+	// compressed data cut short, after the gzip header at least
+	for ( size_t cubCut = 10; cubCut < compressed.size(); cubCut += 7 )
+	{
+		if ( inflater.Begin( compressed.data(), static_cast<uint32>( cubCut ) ) )
+		{
+			const std::vector<std::vector<uint8>> read = ReadAll( &inflater );
+
+			// cut in the gzip trailer all of the children are there, but it still has to be noticed
+			NH_CHECK( read.size() <= children.size() );
+			NH_CHECK( inflater.IsTruncated() || inflater.IsCorrupt() );
+
+			for ( size_t i = 0; i < read.size(); i++ )
+				NH_CHECK( read[ i ] == children[ i ] );
+		}
+	}
+
+	// damaged compressed data may hand out children, but has to be flagged
+	std::vector<uint8> damaged = compressed;
+
+	for ( size_t i = compressed.size() / 2; i < compressed.size() / 2 + 16; i++ )
+		damaged[ i ] ^= 0xA5;
+
+	if ( inflater.Begin( damaged.data(), static_cast<uint32>( damaged.size() ) ) )
+	{
+		ReadAll( &inflater );
+		NH_CHECK( inflater.IsTruncated() || inflater.IsCorrupt() );
+	}
+
+	// not gzip at all
+	const std::vector<uint8> garbage( 100, 0x42 );
+
+	if ( inflater.Begin( garbage.data(), static_cast<uint32>( garbage.size() ) ) )
+	{
+		NH_CHECK( ReadAll( &inflater ).empty() );
+		NH_CHECK( inflater.IsCorrupt() );
+	}
+
+	// children over the limit are skipped without being buffered
+	CCaptureMultiInflater limited( 1024, 50000 );
+
+	NH_CHECK( limited.Begin( compressed.data(), static_cast<uint32>( compressed.size() ) ) );
+	NH_CHECK( ReadAll( &limited ).size() == children.size() - 1 );
+	NH_CHECK( limited.GetSkippedChildren() == 1 );
+	NH_CHECK( !limited.IsTruncated() );
+}
+
+static CaptureFrame_t MakeFrame( const std::vector<uint8> &data )
+{
+	CaptureFrame_t frame = {};
+	frame.m_ullSequence = 42;
+	frame.m_pubData = data.data();
+	frame.m_cubData = static_cast<uint32>( data.size() );
+
+	return frame;
+}
+
+static void TestExpander()
+{
+	const std::vector<std::vector<uint8>> children = SampleChildren();
+	const std::vector<uint8> body = BuildChildren( children );
+
+	CCaptureMultiExpander expander;
+	CaptureFrame_t child;
+
+	// a Multi inside a compressed Multi, next to the same children again
+	const std::vector<uint8> inner = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, body ) );
+	std::vector<std::vector<uint8>> outerChildren = children;
+	outerChildren.push_back( inner );
+
+	const std::vector<uint8> outerBody = BuildChildren( outerChildren );
+	const std::vector<uint8> outer = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( static_cast<uint32>( outerBody.size() ), TestGzip( outerBody ) ) );
+
+	NH_CHECK( expander.Begin( MakeFrame( outer ) ) );
+
+	uint32 cChildren = 0;
+
+	while ( expander.Next( &child ) )
+	{
+		NH_CHECK( child.m_ullSequence == 42 );
+		NH_CHECK( std::vector<uint8>( child.m_pubData, child.m_pubData + child.m_cubData ) == children[ cChildren % children.size() ] );
+		cChildren++;
+	}
+
+	NH_CHECK( cChildren == 2 * children.size() );
+	NH_CHECK( expander.GetStats().m_cMalformed == 0 && expander.GetStats().m_cTruncated == 0 );
+
+	// an empty Multi, one with nothing but the header, and one without a CMsgMulti at all
+	for ( const std::vector<uint8> &empty : { BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, std::vector<uint8>() ) ), BuildMessage( EMsg::k_EMsgMulti, std::vector<uint8>() ) } )
+	{
+		NH_CHECK( expander.Begin( MakeFrame( empty ) ) );
+		NH_CHECK( !expander.Next( &child ) );
+		NH_CHECK( expander.GetStats().m_cMalformed == 0 && expander.GetStats().m_cTruncated == 0 );
+	}
+
+	// shorter than the proto header, a negative header length, one past the end of the frame
+	std::vector<uint8> badHeader = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, body ) );
+	int32 nHeaderLength = -1;
+	memcpy( &badHeader[ 4 ], &nHeaderLength, sizeof( nHeaderLength ) );
+
+	std::vector<uint8> longHeader = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, body ) );
+	nHeaderLength = static_cast<int32>( longHeader.size() );
+	memcpy( &longHeader[ 4 ], &nHeaderLength, sizeof( nHeaderLength ) );
+
+	for ( const std::vector<uint8> &malformed : { std::vector<uint8>( 7, 0 ), badHeader, longHeader } )
+	{
+		NH_CHECK( !expander.Begin( MakeFrame( malformed ) ) );
+		NH_CHECK( !expander.Next( &child ) );
+		NH_CHECK( expander.GetStats().m_cMalformed == 1 );
+	}
+
+	// the frame cut at every length, in the header, the CMsgMulti and the children
+	const std::vector<uint8> plain = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, body ) );
+
+	for ( size_t cubCut = 0; cubCut < plain.size(); cubCut += ( cubCut < 64 ? 1 : 997 ) )
+	{
+		const std::vector<uint8> cut( plain.begin(), plain.begin() + cubCut );
+
+		if ( expander.Begin( MakeFrame( cut ) ) )
+		{
+			while ( expander.Next( &child ) )
+				;
+		}
+
+		// cut right after the proto header it is an empty Multi
+		const CaptureMultiStats_t &stats = expander.GetStats();
+		NH_CHECK( stats.m_cMalformed + stats.m_cTruncated == ( cubCut == 8 ? 0u : 1u ) );
+	}
+
+	// a malformed Multi nested in a good one is counted and skipped, its siblings come through
+	std::vector<std::vector<uint8>> withBad = children;
+	withBad.insert( withBad.begin() + 3, BuildMessage( EMsg::k_EMsgMulti, { ( 2 << 3 ) | k_EWireTypeLengthDelimited, 0x7F } ) );
+
+	const std::vector<uint8> withBadFrame = BuildMessage( EMsg::k_EMsgMulti, BuildMultiBody( 0, BuildChildren( withBad ) ) );
+
+	NH_CHECK( expander.Begin( MakeFrame( withBadFrame ) ) );
+
+	cChildren = 0;
+
+	while ( expander.Next( &child ) )
+		cChildren++;
+
+	NH_CHECK( cChildren == children.size() );
+	NH_CHECK( expander.GetStats().m_cMalformed == 1 );
+}
+
+
+int main()
+{
+	TestParseMulti();
+	TestReader();
+
+	for ( int eBackend = 0; eBackend < k_EZipBackendCount; eBackend++ )
+	{
+		if ( !CZip::IsBackendAvailable( static_cast<EZipBackend>( eBackend ) ) )
+			continue;
+
+		printf( "inflating with %s\n", CZip::GetBackendName( static_cast<EZipBackend>( eBackend ) ) );
+
+		CZip::SetBackend( static_cast<EZipBackend>( eBackend ) );
+
+		TestInflater();
+		TestExpander();
+	}
+
+	return TestResult( "capturemulti_test" );
+}
@@ -0,0 +1,151 @@
+
+// captureproto_bench: proto headers decoded per second by CaptureParseProtoHeader, for every
+// field and for the job fields alone, and by the generated CMsgProtoBufHeader parser it
+// replaced on the capture path.
+//
+// usage: captureproto_bench [headers]
+
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "steammessages_base.pb.h"
+
+#include "captureproto.h"
+#include "nhtest.h"
+
+
+// what headers usually carry: the steam id and session, job ids on calls and their responses,
+// a method name on service calls, the result on responses and the odd extra field
+static std::vector<std::string> BuildHeaders( uint32 cHeaders )
+{
+	static const char *const k_rgszMethods[] = { "Player.GetGameBadgeLevels#1", "FriendMessages.GetActiveMessageSessions#1", "Community.GetApps#1", "Econ.GetInventoryItemsWithDescriptions#1" };
+
+	std::mt19937_64 random( 4 );
+	std::vector<std::string> headers;
+
+	for ( uint32 i = 0; i < cHeaders; i++ )
+	{
+		CMsgProtoBufHeader header;
+
+		header.set_steamid( 76561197960265728ull + random() % 100000000 );
+		header.set_client_sessionid( static_cast<int32>( random() ) );
+
+		switch ( random() % 4 )
+		{
+		case 0:
+			header.set_jobid_source( random() );
+			header.set_target_job_name( k_rgszMethods[ random() % 4 ] );
+			break;
+
+		case 1:
+			header.set_jobid_target( random() );
+			header.set_eresult( 1 );
+			break;
+
+		default:
+			break;
+		}
+
+		if ( random() % 8 == 0 )
+			header.set_routing_appid( static_cast<uint32>( random() % 2000000 ) );
+
+		if ( random() % 8 == 0 )
+			header.set_realm( 1 );
+
+		headers.push_back( header.SerializeAsString() );
+	}
+
+	return headers;
+}
+
+template <typename Decode>
+static void Run( const char *szDecoder, uint32 cHeaders, Decode decode )
+{
+	bool bFirst = true;
+	uint64 ullFirstSum = 0;
+
+	const double flBestMs = TestBestOfMs( 5, [&]
+	{
+		const uint64 ullSum = decode();
+
+		NH_CHECK( bFirst || ullSum == ullFirstSum );
+		bFirst = false;
+		ullFirstSum = ullSum;
+	} );
+
+	printf( "  %-20s %8.2f ms  %7.2f M headers/s\n", szDecoder, flBestMs, cHeaders / flBestMs / 1000.0 );
+}
+
+
+int main( int argc, char **argv )
+{
+	const uint32 cHeaders = argc > 1 ? static_cast<uint32>( atoi( argv[ 1 ] ) ) : 1000000;
+	const std::vector<std::string> headers = BuildHeaders( cHeaders );
+
+	size_t cubHeaders = 0;
+
+	for ( const std::string &header : headers )
+		cubHeaders += header.size();
+
+	printf( "%u headers, %.1f bytes each\n", cHeaders, static_cast<double>( cubHeaders ) / cHeaders );
+
+	// every decoder has to see the same job ids
+	uint64 ullExpected = 0;
+
+	for ( const std::string &bytes : headers )
+	{
+		CMsgProtoBufHeader header;
+		NH_CHECK( header.ParseFromString( bytes ) );
+		ullExpected += header.jobid_source() + header.jobid_target();
+	}
+
+	Run( "all fields", cHeaders, [&]
+	{
+		uint64 ullSum = 0;
+		CaptureProtoHeader_t header;
+
+		for ( const std::string &bytes : headers )
+		{
+			if ( CaptureParseProtoHeader( reinterpret_cast<const uint8 *>( bytes.data() ), static_cast<uint32>( bytes.size() ), k_EProtoHeaderFieldAll, &header ) )
+				ullSum += header.m_jobIDSource + header.m_jobIDTarget;
+		}
+
+		NH_CHECK( ullSum == ullExpected );
+		return ullSum;
+	} );
+
+	Run( "job fields", cHeaders, [&]
+	{
+		uint64 ullSum = 0;
+		CaptureProtoHeader_t header;
+
+		for ( const std::string &bytes : headers )
+		{
+			if ( CaptureParseProtoHeader( reinterpret_cast<const uint8 *>( bytes.data() ), static_cast<uint32>( bytes.size() ), k_EProtoHeaderFieldJobs, &header ) )
+				ullSum += header.m_jobIDSource + header.m_jobIDTarget;
+		}
+
+		NH_CHECK( ullSum == ullExpected );
+		return ullSum;
+	} );
+
+	// one message reused, as the generated parser was used before
+	Run( "CMsgProtoBufHeader", cHeaders, [&]
+	{
+		uint64 ullSum = 0;
+		CMsgProtoBufHeader header;
+
+		for ( const std::string &bytes : headers )
+		{
+			if ( header.ParseFromArray( bytes.data(), static_cast<int>( bytes.size() ) ) )
+				ullSum += header.jobid_source() + header.jobid_target();
+		}
+
+		NH_CHECK( ullSum == ullExpected );
+		return ullSum;
+	} );
+
+	return TestResult( "captureproto_bench" );
+}
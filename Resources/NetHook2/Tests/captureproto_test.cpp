@@ -0,0 +1,215 @@
+
+// captureproto_test: checks CaptureParseProtoHeader against the generated CMsgProtoBufHeader
+// parser on random headers with any mix of fields, repeated fields, fields with the wrong wire
+// type, and on every truncation and random corruption of them.
+//
+// usage: captureproto_test
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/stubs/logging.h>
+
+#include "steammessages_base.pb.h"
+
+#include "captureproto.h"
+#include "nhtest.h"
+
+
+static std::string RandomString( std::mt19937_64 *pRandom, size_t cchMax )
+{
+	std::string value( ( *pRandom )() % ( cchMax + 1 ), '\0' );
+
+	for ( char &ch : value )
+		ch = static_cast<char>( 'a' + ( *pRandom )() % 26 );
+
+	return value;
+}
+
+// every field set with a chance of one in three, the ones CaptureParseProtoHeader decodes and
+// the ones it skips alike
+static std::string RandomHeader( std::mt19937_64 *pRandom )
+{
+	auto chance = [pRandom] { return ( *pRandom )() % 3 == 0; };
+
+	CMsgProtoBufHeader header;
+
+	if ( chance() ) header.set_steamid( ( *pRandom )() );
+	if ( chance() ) header.set_client_sessionid( static_cast<int32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_routing_appid( static_cast<uint32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_jobid_source( ( *pRandom )() );
+	if ( chance() ) header.set_jobid_target( ( *pRandom )() );
+	if ( chance() ) header.set_target_job_name( RandomString( pRandom, 40 ) );
+	if ( chance() ) header.set_eresult( static_cast<int32>( ( *pRandom )() ) );
+
+	if ( chance() ) header.set_error_message( RandomString( pRandom, 20 ) );
+	if ( chance() ) header.set_ip( static_cast<uint32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_auth_account_flags( static_cast<uint32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_transport_error( static_cast<int32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_messageid( ( *pRandom )() );
+	if ( chance() ) header.set_trace_tag( ( *pRandom )() );
+	if ( chance() ) header.set_seq_num( static_cast<int32>( ( *pRandom )() ) );
+	if ( chance() ) header.set_is_from_external_source( true );
+	if ( chance() ) header.set_wg_token( RandomString( pRandom, 20 ) );
+	if ( chance() ) header.set_realm( static_cast<uint32>( ( *pRandom )() % 4 ) );
+
+	while ( chance() )
+		header.add_forward_to_sysid( static_cast<uint32>( ( *pRandom )() ) );
+
+	return header.SerializeAsString();
+}
+
+// both parsers on the same bytes, with every field or only some requested
+static void CheckAgainstProtobuf( const std::string &bytes, uint32 unFields )
+{
+	CMsgProtoBufHeader expected;
+	const bool bExpected = expected.ParseFromString( bytes );
+
+	CaptureProtoHeader_t header;
+	const bool bParsed = CaptureParseProtoHeader( reinterpret_cast<const uint8 *>( bytes.data() ), static_cast<uint32>( bytes.size() ), unFields, &header );
+
+	NH_CHECK( bParsed == bExpected );
+
+	if ( !bParsed || !bExpected )
+		return;
+
+	auto check = [&]( EProtoHeaderField eField, bool bHas, bool bEqual )
+	{
+		if ( ( unFields & eField ) == 0 )
+			return;
+
+		NH_CHECK( ( ( header.m_unPresent & eField ) != 0 ) == bHas );
+		NH_CHECK( bEqual );
+	};
+
+	NH_CHECK( ( header.m_unPresent & ~unFields ) == 0 );
+
+	check( k_EProtoHeaderFieldSteamID, expected.has_steamid(), header.m_ullSteamID == expected.steamid() );
+	check( k_EProtoHeaderFieldClientSessionID, expected.has_client_sessionid(), header.m_nClientSessionID == expected.client_sessionid() );
+	check( k_EProtoHeaderFieldRoutingAppID, expected.has_routing_appid(), header.m_unRoutingAppID == expected.routing_appid() );
+	check( k_EProtoHeaderFieldJobIDSource, expected.has_jobid_source(), header.m_jobIDSource == expected.jobid_source() );
+	check( k_EProtoHeaderFieldJobIDTarget, expected.has_jobid_target(), header.m_jobIDTarget == expected.jobid_target() );
+	check( k_EProtoHeaderFieldTargetJobName, expected.has_target_job_name(),
+		std::string( header.m_pchTargetJobName, header.m_cchTargetJobName ) == expected.target_job_name() );
+	check( k_EProtoHeaderFieldEResult, expected.has_eresult(), header.m_eResult == expected.eresult() );
+}
+
+static const uint32 k_rgunFieldMasks[] =
+{
+	k_EProtoHeaderFieldAll,
+	k_EProtoHeaderFieldJobs,
+	k_EProtoHeaderFieldSteamID | k_EProtoHeaderFieldEResult,
+	0,
+};
+
+static void TestRandomHeaders()
+{
+	std::mt19937_64 random( 1 );
+
+	for ( int i = 0; i < 20000; i++ )
+	{
+		std::string bytes = RandomHeader( &random );
+
+		// now and then the same fields again, the last one wins
+		if ( random() % 4 == 0 )
+			bytes += RandomHeader( &random );
+
+		for ( uint32 unFields : k_rgunFieldMasks )
+			CheckAgainstProtobuf( bytes, unFields );
+	}
+
+	// nothing at all is every default
+	CaptureProtoHeader_t header;
+	NH_CHECK( CaptureParseProtoHeader( nullptr, 0, k_EProtoHeaderFieldAll, &header ) );
+	NH_CHECK( header.m_unPresent == 0 );
+	NH_CHECK( header.m_jobIDSource == CMsgProtoBufHeader().jobid_source() && header.m_jobIDTarget == CMsgProtoBufHeader().jobid_target() );
+	NH_CHECK( header.m_eResult == CMsgProtoBufHeader().eresult() );
+}
+
+// the fields CaptureParseProtoHeader decodes, each with every other wire type. The generated
+// parser keeps those as unknown fields and leaves the field itself unset.
+static void TestWrongWireTypes()
+{
+	for ( uint32 unField : { 1u, 2u, 3u, 10u, 11u, 12u, 13u } )
+	{
+		for ( uint32 unWireType : { 0u, 1u, 2u, 5u } )
+		{
+			std::string bytes;
+			bytes += static_cast<char>( unField << 3 | unWireType );
+
+			switch ( unWireType )
+			{
+			case 0: bytes += "\x96\x01"; break;
+			case 1: bytes += std::string( 8, '\x11' ); break;
+			case 2: bytes += std::string( "\x03" "abc", 4 ); break;
+			case 5: bytes += std::string( 4, '\x22' ); break;
+			}
+
+			for ( uint32 unFields : k_rgunFieldMasks )
+				CheckAgainstProtobuf( bytes, unFields );
+		}
+	}
+}
+
+// every prefix of a header, and random bytes overwritten in it
+static void TestMalformed()
+{
+	std::mt19937_64 random( 2 );
+
+	for ( int i = 0; i < 2000; i++ )
+	{
+		const std::string bytes = RandomHeader( &random );
+
+		for ( size_t cubPrefix = 0; cubPrefix < bytes.size(); cubPrefix++ )
+			CheckAgainstProtobuf( bytes.substr( 0, cubPrefix ), k_EProtoHeaderFieldAll );
+
+		for ( int iCorruption = 0; iCorruption < 20 && !bytes.empty(); iCorruption++ )
+		{
+			std::string corrupt = bytes;
+
+			for ( uint32 cBytes = 1 + random() % 3; cBytes != 0; cBytes-- )
+				corrupt[ random() % corrupt.size() ] = static_cast<char>( random() );
+
+			// groups are where the two are allowed to differ
+			bool bGroup = false;
+			const uint8 *pubCursor = reinterpret_cast<const uint8 *>( corrupt.data() );
+			const uint8 *pubEnd = pubCursor + corrupt.size();
+
+			while ( pubCursor != pubEnd )
+			{
+				uint64 ullTag;
+
+				if ( !CaptureReadVarint( &pubCursor, pubEnd, &ullTag ) )
+					break;
+
+				const uint32 unWireType = static_cast<uint32>( ullTag & 7 );
+
+				if ( unWireType == 3 || unWireType == 4 )
+				{
+					bGroup = true;
+					break;
+				}
+
+				if ( !CaptureSkipField( &pubCursor, pubEnd, static_cast<EWireType>( unWireType ) ) )
+					break;
+			}
+
+			if ( !bGroup )
+				CheckAgainstProtobuf( corrupt, k_EProtoHeaderFieldAll );
+		}
+	}
+}
+
+
+int main()
+{
+	// corrupted strings aren't valid UTF-8, which the generated parser only complains about
+	google::protobuf::SetLogHandler( nullptr );
+
+	TestRandomHeaders();
+	TestWrongWireTypes();
+	TestMalformed();
+
+	return TestResult( "captureproto_test" );
+}
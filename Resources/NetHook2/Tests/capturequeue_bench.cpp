@@ -0,0 +1,230 @@
+
+// capturequeue_bench: heap allocations per message and time taken to push frames through the
+// capture queue, with a buffer allocated and freed for every frame larger than a slot the way
+// the queue did before it cached them, and with the buffer cache now. Runs a mix of message
+// sizes with the odd frame over k_cubMaxCachedBuffer, and a run of frames that are all over it.
+//
+// usage: capturequeue_bench [messages]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "capturequeue.h"
+#include "capturewriter.h"
+#include "nhtest.h"
+
+
+static std::atomic<uint64> g_cAllocations( 0 );
+
+void *operator new( size_t cub )
+{
+	g_cAllocations.fetch_add( 1, std::memory_order_relaxed );
+
+	if ( void *pv = malloc( cub != 0 ? cub : 1 ) )
+		return pv;
+
+	throw std::bad_alloc();
+}
+
+void *operator new[]( size_t cub )
+{
+	return operator new( cub );
+}
+
+void *operator new( size_t cub, const std::nothrow_t & ) noexcept
+{
+	g_cAllocations.fetch_add( 1, std::memory_order_relaxed );
+	return malloc( cub != 0 ? cub : 1 );
+}
+
+void *operator new[]( size_t cub, const std::nothrow_t & ) noexcept
+{
+	return operator new( cub, std::nothrow );
+}
+
+// the default operator delete frees what malloc returned
+
+// at most this many frames wait for the writer at a time
+constexpr uint32 k_cMaxFramesPerDrain = 8;
+
+// mostly messages that fit a slot, every 16th larger than one and now and then one over
+// k_cubMaxCachedBuffer, in a few sizes so the large buffer has to grow
+static std::vector<uint32> BuildMixedSizes( uint32 cMessages )
+{
+	std::mt19937 random( 15 );
+	std::vector<uint32> sizes;
+
+	for ( uint32 i = 0; i < cMessages; i++ )
+	{
+		if ( i % 1000 == 999 )
+			sizes.push_back( CCaptureQueue::k_cubMaxCachedBuffer + 1024 * 1024 + random() % ( 3 * 1024 * 1024 ) );
+		else if ( i % 16 == 15 )
+			sizes.push_back( CCaptureWriter::k_cubDefaultSlot + random() % ( 512 * 1024 ) );
+		else
+			sizes.push_back( 16 + random() % 2000 );
+	}
+
+	return sizes;
+}
+
+// what the queue did before: a buffer the exact size of every frame that doesn't fit a slot,
+// the rest copied round the same slots the queue has
+static uint64 RunUncached( uint8 *pubArena, const std::vector<uint32> &sizes, uint32 cFramesPerDrain, const uint8 *pubPayload )
+{
+	uint64 ullSlot = 0;
+	uint8 *rgpubPending[ k_cMaxFramesPerDrain ];
+	bool rgbOversized[ k_cMaxFramesPerDrain ];
+	uint32 cPending = 0;
+	uint64 ullSum = 0;
+
+	auto drain = [&]
+	{
+		for ( uint32 i = 0; i < cPending; i++ )
+		{
+			ullSum += rgpubPending[ i ][ 0 ];
+
+			if ( rgbOversized[ i ] )
+				delete [] rgpubPending[ i ];
+		}
+
+		cPending = 0;
+	};
+
+	for ( uint32 cubData : sizes )
+	{
+		rgbOversized[ cPending ] = cubData > CCaptureWriter::k_cubDefaultSlot;
+		rgpubPending[ cPending ] = rgbOversized[ cPending ] ? new uint8[ cubData ] : pubArena + ( ullSlot & ( CCaptureWriter::k_cDefaultSlots - 1 ) ) * CCaptureWriter::k_cubDefaultSlot;
+		ullSlot++;
+
+		memcpy( rgpubPending[ cPending ], pubPayload, cubData );
+
+		if ( ++cPending == cFramesPerDrain )
+			drain();
+	}
+
+	drain();
+	return ullSum;
+}
+
+static uint64 RunQueue( CCaptureQueue *pQueue, const std::vector<uint32> &sizes, uint32 cFramesPerDrain, const uint8 *pubPayload )
+{
+	uint32 cPending = 0;
+	uint64 ullSum = 0;
+
+	auto drain = [&]
+	{
+		CaptureFrame_t frame;
+
+		while ( pQueue->Peek( &frame ) )
+		{
+			ullSum += frame.m_pubData[ 0 ];
+			pQueue->Pop();
+		}
+
+		cPending = 0;
+	};
+
+	for ( uint32 cubData : sizes )
+	{
+		pQueue->Push( ENetDirection::k_eNetIncoming, 1, pubPayload, cubData );
+
+		if ( ++cPending == cFramesPerDrain )
+			drain();
+	}
+
+	drain();
+	return ullSum;
+}
+
+// allocations are counted on the first pass, from an empty cache, and the time is the best of
+// three passes
+template <typename Pass>
+static void Measure( const char *szWay, uint32 cMessages, Pass pass )
+{
+	double flBestMs = 0;
+	uint64 cAllocations = 0;
+
+	for ( int iRound = 0; iRound < 3; iRound++ )
+	{
+		const uint64 cAllocationsBefore = g_cAllocations.load();
+		const uint64 ullStart = CaptureTimestamp();
+		pass();
+		const double flMs = TestElapsedMs( ullStart );
+
+		if ( iRound == 0 )
+			cAllocations = g_cAllocations.load() - cAllocationsBefore;
+
+		if ( iRound == 0 || flMs < flBestMs )
+			flBestMs = flMs;
+	}
+
+	printf( "  %-10s %8llu allocations %8.4f per message %9.1f ms\n", szWay, static_cast<unsigned long long>( cAllocations ),
+		static_cast<double>( cAllocations ) / cMessages, flBestMs );
+}
+
+static void Run( const char *szStream, const std::vector<uint32> &sizes, uint32 cFramesPerDrain, const uint8 *pubPayload )
+{
+	uint64 cOversized = 0;
+	uint64 cubTotal = 0;
+
+	for ( uint32 cubData : sizes )
+	{
+		cubTotal += cubData;
+
+		if ( cubData > CCaptureWriter::k_cubDefaultSlot )
+			cOversized++;
+	}
+
+	printf( "%s: %zu messages, %llu larger than a slot, %.1f MB, %u at a time\n", szStream, sizes.size(),
+		static_cast<unsigned long long>( cOversized ), cubTotal / 1048576.0, cFramesPerDrain );
+
+	const uint32 cMessages = static_cast<uint32>( sizes.size() );
+
+	std::vector<uint8> arena( static_cast<size_t>( CCaptureWriter::k_cDefaultSlots ) * CCaptureWriter::k_cubDefaultSlot );
+	const uint64 ullExpected = RunUncached( arena.data(), sizes, cFramesPerDrain, pubPayload );
+
+	Measure( "uncached", cMessages, [&]
+	{
+		NH_CHECK( RunUncached( arena.data(), sizes, cFramesPerDrain, pubPayload ) == ullExpected );
+	} );
+
+	CCaptureQueue queue( CCaptureWriter::k_cDefaultSlots, CCaptureWriter::k_cubDefaultSlot );
+
+	Measure( "cached", cMessages, [&]
+	{
+		NH_CHECK( RunQueue( &queue, sizes, cFramesPerDrain, pubPayload ) == ullExpected );
+	} );
+
+	NH_CHECK( queue.GetNumOversized() == 3 * cOversized );
+	printf( "  %llu of %llu oversized frames needed a new buffer\n", static_cast<unsigned long long>( queue.GetNumOversizedAllocations() ),
+		static_cast<unsigned long long>( queue.GetNumOversized() ) );
+}
+
+
+int main( int argc, char **argv )
+{
+	const uint32 cMessages = argc > 1 ? static_cast<uint32>( atoi( argv[ 1 ] ) ) : 200000;
+
+	std::vector<uint8> payload( 8 * 1024 * 1024 );
+
+	for ( size_t i = 0; i < payload.size(); i++ )
+		payload[ i ] = static_cast<uint8>( i * 7 + i / 13 );
+
+	Run( "mixed", BuildMixedSizes( cMessages ), k_cMaxFramesPerDrain, payload.data() );
+
+	// frames of 5 to 7 MB, the way a run of large Multis arrives. The writer is done with each
+	// before the next, only one buffer over k_cubMaxCachedBuffer is kept.
+	std::vector<uint32> sizes;
+
+	for ( uint32 i = 0; i < std::max( 1u, cMessages / 1000 ); i++ )
+		sizes.push_back( 5 * 1024 * 1024 + ( i * 769 * 1024 ) % ( 2 * 1024 * 1024 ) );
+
+	Run( "over 4 MB", sizes, 1, payload.data() );
+
+	return TestResult( "capturequeue_bench" );
+}
@@ -0,0 +1,197 @@
+
+// capturering_test: writes records of random sizes into a small flight recorder ring from one
+// thread, lapping it over and over, while another takes snapshots of the file the way
+// nhring2nhcap does, and checks every snapshot holds an unbroken run of intact records. Also
+// checks the ring sizes CCaptureRing accepts.
+//
+// usage: capturering_test [scratch directory] [records]
+
+#include <atomic>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capturering.h"
+#include "nhtest.h"
+
+
+constexpr uint64 k_cubTestRing = 1024 * 1024;
+
+// every payload is a pattern derived from its sequence number
+static void FillPayload( uint64 ullSequence, uint8 *pubData, uint32 cubData )
+{
+	for ( uint32 i = 0; i < cubData; i++ )
+		pubData[ i ] = static_cast<uint8>( ullSequence * 13 + i * 7 + ( i >> 8 ) );
+}
+
+static bool CheckPayload( uint64 ullSequence, const std::vector<uint8> &payload )
+{
+	std::vector<uint8> expected( payload.size() );
+	FillPayload( ullSequence, expected.data(), static_cast<uint32>( expected.size() ) );
+
+	return payload == expected;
+}
+
+// mostly small messages, now and then one taking up a good part of the ring
+static uint32 RecordSize( std::mt19937 *pRandom )
+{
+	if ( ( *pRandom )() % 500 == 0 )
+		return 64 * 1024 + ( *pRandom )() % ( 256 * 1024 );
+
+	return ( *pRandom )() % 4000;
+}
+
+static void WriteRecords( CCaptureRing *pRing, uint32 cRecords )
+{
+	std::mt19937 random( 3 );
+	std::vector<uint8> payload;
+
+	for ( uint32 i = 0; i < cRecords; i++ )
+	{
+		payload.resize( RecordSize( &random ) );
+		FillPayload( i, payload.data(), static_cast<uint32>( payload.size() ) );
+
+		CaptureRecordHeader_t header = { };
+		header.m_ullSequence = i;
+		header.m_ullTimestamp = CaptureTimestamp();
+		header.m_unEMsg = i;
+		header.m_eType = k_ECaptureRecordMessage;
+
+		pRing->WriteRecord( header, payload.data(), static_cast<uint32>( payload.size() ) );
+	}
+}
+
+// reads a whole snapshot, returns the sequence of its newest record or -1 when it was empty
+static int64 CheckSnapshot( CCaptureRingReader *pReader, uint64 *pcRecords )
+{
+	const CaptureRingHeader_t &ringHeader = pReader->GetHeader();
+
+	NH_CHECK( ringHeader.m_cubData == k_cubTestRing );
+	NH_CHECK( ringHeader.m_ullTail <= ringHeader.m_ullHead && ringHeader.m_ullHead - ringHeader.m_ullTail <= ringHeader.m_cubData );
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+	ECaptureReadResult eResult;
+	int64 llLast = -1;
+
+	while ( ( eResult = pReader->ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+	{
+		NH_CHECK( header.m_eType == k_ECaptureRecordMessage );
+		NH_CHECK( header.m_unEMsg == static_cast<uint32>( header.m_ullSequence ) );
+		NH_CHECK( CheckPayload( header.m_ullSequence, payload ) );
+
+		// the ring only ever drops the oldest records, what is left has no gaps
+		NH_CHECK( llLast < 0 || header.m_ullSequence == static_cast<uint64>( llLast ) + 1 );
+
+		llLast = static_cast<int64>( header.m_ullSequence );
+		( *pcRecords )++;
+	}
+
+	NH_CHECK( eResult == ECaptureReadResult::k_eCaptureReadEnd );
+	return llLast;
+}
+
+static void TestConcurrentSnapshots( const std::string &directory, uint32 cRecords )
+{
+	const std::string path = directory + "/capturering_test.nhring";
+
+	CCaptureRing ring;
+	NH_CHECK( ring.Open( path.c_str(), k_cubTestRing ) );
+
+	std::atomic<bool> bWriting( true );
+
+	uint64 cSnapshots = 0;
+	uint64 cMissed = 0;
+	uint64 cRecordsRead = 0;
+
+	std::thread reader( [&]
+	{
+		int64 llNewest = -1;
+
+		while ( bWriting.load() )
+		{
+			CCaptureRingReader ringReader;
+
+			if ( !ringReader.Snapshot( path.c_str() ) )
+			{
+				cMissed++;
+				continue;
+			}
+
+			cSnapshots++;
+
+			// later snapshots never go back in time
+			const int64 llLast = CheckSnapshot( &ringReader, &cRecordsRead );
+			NH_CHECK( llLast < 0 || llLast >= llNewest );
+
+			if ( llLast > llNewest )
+				llNewest = llLast;
+		}
+	} );
+
+	const uint64 ullStart = CaptureTimestamp();
+
+	WriteRecords( &ring, cRecords );
+	bWriting.store( false );
+
+	reader.join();
+
+	const double flMs = TestElapsedMs( ullStart );
+
+	// once the writer is done the ring ends with its last record
+	CCaptureRingReader ringReader;
+	NH_CHECK( ringReader.Snapshot( path.c_str() ) );
+
+	uint64 cFinalRecords = 0;
+	NH_CHECK( CheckSnapshot( &ringReader, &cFinalRecords ) == static_cast<int64>( cRecords ) - 1 );
+	NH_CHECK( ringReader.GetHeader().m_ullHead == ring.GetHead() && ringReader.GetHeader().m_ullTail == ring.GetTail() );
+
+	ring.Close();
+	remove( path.c_str() );
+
+	printf( "%u records in %.0f ms, %.1f MB through a %llu KB ring, %llu snapshots with %llu records, %llu lapped, %llu records left at the end\n",
+		cRecords, flMs, ring.GetHead() / 1048576.0, static_cast<unsigned long long>( k_cubTestRing / 1024 ), static_cast<unsigned long long>( cSnapshots ),
+		static_cast<unsigned long long>( cRecordsRead ), static_cast<unsigned long long>( cMissed ), static_cast<unsigned long long>( cFinalRecords ) );
+}
+
+static void TestRingSizes( const std::string &directory )
+{
+	const std::string path = directory + "/capturering_test.nhring";
+
+	CCaptureRing ring;
+
+	// too small for even an empty record, or too large to map in one piece
+	NH_CHECK( !ring.Open( path.c_str(), CaptureRingRecordSpan( 0 ) - 8 ) );
+	NH_CHECK( !ring.Open( path.c_str(), k_cubCaptureMaxRing + 8 ) );
+
+	// a record larger than the ring is refused, one that fills it exactly isn't
+	NH_CHECK( ring.Open( path.c_str(), 64 * 1024 ) );
+
+	CaptureRecordHeader_t header = { };
+	header.m_eType = k_ECaptureRecordMessage;
+
+	std::vector<uint8> payload( 64 * 1024 );
+	NH_CHECK( !ring.WriteRecord( header, payload.data(), static_cast<uint32>( payload.size() ) ) );
+
+	payload.resize( 64 * 1024 - sizeof( CaptureRecordHeader_t ) );
+	NH_CHECK( ring.WriteRecord( header, payload.data(), static_cast<uint32>( payload.size() ) ) );
+	NH_CHECK( ring.WriteRecord( header, payload.data(), static_cast<uint32>( payload.size() ) ) );
+	NH_CHECK( ring.GetHead() - ring.GetTail() == 64 * 1024 );
+
+	ring.Close();
+	remove( path.c_str() );
+}
+
+
+int main( int argc, char **argv )
+{
+	const std::string directory = argc > 1 ? argv[ 1 ] : ".";
+	const uint32 cRecords = argc > 2 ? static_cast<uint32>( atoi( argv[ 2 ] ) ) : 200000;
+
+	TestRingSizes( directory );
+	TestConcurrentSnapshots( directory, cRecords );
+
+	return TestResult( "capturering_test" );
+}
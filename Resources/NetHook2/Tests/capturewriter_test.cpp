@@ -0,0 +1,283 @@
+
+// capturewriter_test: drives the capture queue, the writer thread and the file sink with
+// synthetic frames from several producer threads, the way the hooks do inside Steam.
+//
+// usage: capturewriter_test [scratch directory]
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capturesink.h"
+#include "capturewriter.h"
+#include "nhtest.h"
+
+
+constexpr uint32 k_cProducers = 4;
+constexpr uint32 k_cFramesPerProducer = 20000;
+
+// every payload is its EMsg, the producer and its frame number, then a pattern derived from both
+constexpr uint32 k_cubPayloadHeader = 3 * sizeof( uint32 );
+
+static uint32 FrameSize( uint32 unProducer, uint32 unFrame )
+{
+	// mostly small messages, with the occasional one far larger than a queue slot
+	if ( unFrame % 97 == 0 )
+		return 40 * 1024 + unProducer * 1000 + unFrame % 5000;
+
+	return k_cubPayloadHeader + ( unFrame * 31 + unProducer * 7 ) % 1500;
+}
+
+static void BuildFrame( uint32 unProducer, uint32 unFrame, std::vector<uint8> *pFrame )
+{
+	pFrame->resize( FrameSize( unProducer, unFrame ) );
+
+	const uint32 rgunHeader[ 3 ] = { static_cast<uint32>( EMsg::k_EMsgClientHeartBeat ) + unProducer, unProducer, unFrame };
+	memcpy( pFrame->data(), rgunHeader, sizeof( rgunHeader ) );
+
+	for ( size_t i = k_cubPayloadHeader; i < pFrame->size(); i++ )
+		( *pFrame )[ i ] = static_cast<uint8>( unFrame * 13 + unProducer + i );
+}
+
+static bool CheckFrame( const uint8 *pubData, uint32 cubData, uint32 *punProducer, uint32 *punFrame )
+{
+	if ( cubData < k_cubPayloadHeader )
+		return false;
+
+	uint32 rgunHeader[ 3 ];
+	memcpy( rgunHeader, pubData, sizeof( rgunHeader ) );
+
+	if ( rgunHeader[ 1 ] >= k_cProducers )
+		return false;
+
+	std::vector<uint8> expected;
+	BuildFrame( rgunHeader[ 1 ], rgunHeader[ 2 ], &expected );
+
+	if ( expected.size() != cubData || memcmp( expected.data(), pubData, cubData ) != 0 )
+		return false;
+
+	*punProducer = rgunHeader[ 1 ];
+	*punFrame = rgunHeader[ 2 ];
+	return true;
+}
+
+static void RunProducers( CCaptureWriter *pWriter )
+{
+	std::vector<std::thread> producers;
+
+	for ( uint32 unProducer = 0; unProducer < k_cProducers; unProducer++ )
+	{
+		producers.emplace_back( [pWriter, unProducer]
+		{
+			std::vector<uint8> frame;
+
+			for ( uint32 unFrame = 0; unFrame < k_cFramesPerProducer; unFrame++ )
+			{
+				BuildFrame( unProducer, unFrame, &frame );
+				pWriter->Submit( ENetDirection::k_eNetIncoming, unProducer + 1, frame.data(), static_cast<uint32>( frame.size() ) );
+			}
+		} );
+	}
+
+	for ( std::thread &producer : producers )
+		producer.join();
+}
+
+
+// checks every frame against what its producer submitted, and that each producer's frames
+// arrive in the order they were submitted
+class CCheckingSink : public ICaptureSink
+{
+
+public:
+	CCheckingSink()
+		: m_rgunNextFrame( k_cProducers, 0 )
+	{
+	}
+
+	void WriteFrame( const CaptureFrame_t &frame ) override
+	{
+		uint32 unProducer, unFrame;
+
+		if ( !CheckFrame( frame.m_pubData, frame.m_cubData, &unProducer, &unFrame ) || frame.m_ullConnection != unProducer + 1 )
+		{
+			m_cBadFrames++;
+			return;
+		}
+
+		if ( m_rgunNextFrame[ unProducer ] != unFrame || ( m_cFrames != 0 && frame.m_ullSequence <= m_ullLastSequence ) )
+			m_cOutOfOrder++;
+
+		m_rgunNextFrame[ unProducer ] = unFrame + 1;
+		m_ullLastSequence = frame.m_ullSequence;
+		m_cFrames++;
+	}
+
+	void Flush() override { m_cFlushes++; }
+	void Commit() override { m_cCommits++; }
+
+public:
+	std::vector<uint32> m_rgunNextFrame;
+	uint64 m_ullLastSequence = 0;
+	uint64 m_cFrames = 0;
+	uint64 m_cBadFrames = 0;
+	uint64 m_cOutOfOrder = 0;
+	uint64 m_cFlushes = 0;
+	std::atomic<uint32> m_cCommits { 0 };
+};
+
+
+static void TestProducers( uint32 cSlots )
+{
+	CCheckingSink sink;
+	CCaptureWriter writer( &sink, cSlots );
+
+	writer.Start();
+	RunProducers( &writer );
+	writer.Stop();
+
+	NH_CHECK( sink.m_cFrames == k_cProducers * k_cFramesPerProducer );
+	NH_CHECK( sink.m_cBadFrames == 0 );
+	NH_CHECK( sink.m_cOutOfOrder == 0 );
+	NH_CHECK( sink.m_cCommits == 1 );
+	NH_CHECK( writer.GetQueue().IsEmpty() );
+	NH_CHECK( writer.GetQueue().GetNumOversized() == k_cProducers * ( ( k_cFramesPerProducer + 96 ) / 97 ) );
+
+	printf( "%u slots: %llu frames, %llu stalls, %llu oversized buffers allocated\n", cSlots,
+		static_cast<unsigned long long>( sink.m_cFrames ),
+		static_cast<unsigned long long>( writer.GetQueue().GetNumStalls() ),
+		static_cast<unsigned long long>( writer.GetQueue().GetNumOversizedAllocations() ) );
+}
+
+static void TestCommitRequest()
+{
+	CCheckingSink sink;
+	CCaptureWriter writer( &sink );
+
+	writer.Start();
+
+	std::vector<uint8> frame;
+	BuildFrame( 0, 0, &frame );
+	writer.Submit( ENetDirection::k_eNetOutgoing, 1, frame.data(), static_cast<uint32>( frame.size() ) );
+
+	writer.RequestCommit();
+
+	for ( int i = 0; i < 500 && sink.m_cCommits == 0; i++ )
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+
+	NH_CHECK( sink.m_cCommits == 1 );
+
+	writer.Stop();
+
+	NH_CHECK( sink.m_cFrames == 1 );
+	NH_CHECK( sink.m_cCommits == 2 );
+
+	// stopping again doesn't commit again
+	writer.Stop();
+	NH_CHECK( sink.m_cCommits == 2 );
+}
+
+static void TestStopWithoutStart()
+{
+	CCheckingSink sink;
+	CCaptureWriter writer( &sink );
+
+	std::vector<uint8> frame;
+
+	for ( uint32 unFrame = 0; unFrame < 100; unFrame++ )
+	{
+		BuildFrame( 0, unFrame, &frame );
+		writer.Submit( ENetDirection::k_eNetIncoming, 1, frame.data(), static_cast<uint32>( frame.size() ) );
+	}
+
+	// nothing was drained yet, Stop does it on the calling thread
+	NH_CHECK( sink.m_cFrames == 0 );
+	writer.Stop();
+
+	NH_CHECK( sink.m_cFrames == 100 );
+	NH_CHECK( sink.m_cOutOfOrder == 0 );
+	NH_CHECK( sink.m_cCommits == 1 );
+}
+
+static void TestFileSink( const std::string &directory, ECaptureCodec eCodec )
+{
+	const std::string basePath = directory + "/capturewriter_test_" + std::to_string( eCodec );
+
+	{
+		CCaptureFileSink sink( basePath.c_str(), 256 * 1024 );
+		sink.SetCompression( eCodec, k_cubCaptureDefaultBlock );
+		sink.SetCommitPolicy( 1000, 0, false );
+
+		NH_CHECK( sink.Open() );
+
+		CCaptureWriter writer( &sink );
+		writer.Start();
+		RunProducers( &writer );
+		writer.Stop();
+	}
+
+	std::vector<uint32> rgunNextFrame( k_cProducers, 0 );
+	uint64 cRecords = 0;
+	uint64 cBadRecords = 0;
+	uint32 unSegment = 0;
+
+	for ( ;; )
+	{
+		const std::string segmentPath = CaptureSegmentPath( basePath.c_str(), unSegment );
+
+		CCaptureFileReader reader;
+
+		if ( !reader.Open( segmentPath.c_str() ) )
+			break;
+
+		CaptureRecordHeader_t header;
+		std::vector<uint8> payload;
+		ECaptureReadResult eResult;
+
+		while ( ( eResult = reader.ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+		{
+			uint32 unProducer, unFrame;
+
+			if ( !CheckFrame( payload.data(), static_cast<uint32>( payload.size() ), &unProducer, &unFrame ) || rgunNextFrame[ unProducer ] != unFrame )
+			{
+				cBadRecords++;
+				continue;
+			}
+
+			rgunNextFrame[ unProducer ] = unFrame + 1;
+			cRecords++;
+		}
+
+		NH_CHECK( eResult == ECaptureReadResult::k_eCaptureReadEnd );
+
+		reader.Close();
+		remove( segmentPath.c_str() );
+		remove( ( segmentPath.substr( 0, segmentPath.size() - strlen( ".nhcap" ) ) + ".nhidx" ).c_str() );
+
+		unSegment++;
+	}
+
+	NH_CHECK( unSegment > 1 );
+	NH_CHECK( cRecords == k_cProducers * k_cFramesPerProducer );
+	NH_CHECK( cBadRecords == 0 );
+}
+
+
+int main( int argc, char **argv )
+{
+	const std::string directory = argc > 1 ? argv[ 1 ] : ".";
+
+	TestProducers( CCaptureWriter::k_cDefaultSlots );
+	// small enough that the producers keep running into a full queue
+	TestProducers( 8 );
+
+	TestCommitRequest();
+	TestStopWithoutStart();
+
+	TestFileSink( directory, k_ECaptureCodecNone );
+	TestFileSink( directory, k_ECaptureCodecDeflate );
+
+	return TestResult( "capturewriter_test" );
+}
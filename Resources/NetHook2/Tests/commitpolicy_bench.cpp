@@ -0,0 +1,130 @@
+
+// commitpolicy_bench: messages per second written to a .nhcap capture through the writer thread
+// and CCaptureFileSink under each commit policy, from a commit with fsync for every message to
+// one a second without. Run it on the disk captures are normally written to.
+//
+// usage: commitpolicy_bench [scratch directory] [messages]
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "capturesink.h"
+#include "capturewriter.h"
+#include "nhtest.h"
+
+
+struct CommitPolicy_t
+{
+	const char *m_szName;
+	uint32 m_cRecords;
+	uint32 m_cMillisecondsInterval;
+	bool m_bSync;
+	// fsyncing every message is slow enough to only run a fraction of the messages
+	uint32 m_unDivisor;
+};
+
+static const CommitPolicy_t k_rgPolicies[] =
+{
+	{ "every message, sync", 1, 0, true, 50 },
+	{ "100 records, sync", 100, 0, true, 1 },
+	{ "1000 records, sync", 1000, 0, true, 1 },
+	{ "1000 records", 1000, 0, false, 1 },
+	{ "1 s, sync", 0, 1000, true, 1 },
+	{ "1 s", 0, 1000, false, 1 },
+};
+
+static void RemoveCapture( const std::string &basePath )
+{
+	for ( uint32 unSegment = 0; ; unSegment++ )
+	{
+		const std::string segmentPath = CaptureSegmentPath( basePath.c_str(), unSegment );
+
+		if ( remove( segmentPath.c_str() ) != 0 )
+			break;
+
+		remove( ( segmentPath.substr( 0, segmentPath.size() - strlen( ".nhcap" ) ) + ".nhidx" ).c_str() );
+	}
+}
+
+static uint64 CountRecords( const std::string &basePath )
+{
+	uint64 cRecords = 0;
+
+	for ( uint32 unSegment = 0; ; unSegment++ )
+	{
+		CCaptureFileReader reader;
+
+		if ( !reader.Open( CaptureSegmentPath( basePath.c_str(), unSegment ).c_str() ) )
+			break;
+
+		CaptureRecordHeader_t header;
+		std::vector<uint8> payload;
+
+		while ( reader.ReadRecord( &header, &payload ) == ECaptureReadResult::k_eCaptureReadOK )
+		{
+			if ( header.m_eType == k_ECaptureRecordMessage )
+				cRecords++;
+		}
+	}
+
+	return cRecords;
+}
+
+
+int main( int argc, char **argv )
+{
+	const std::string directory = argc > 1 ? argv[ 1 ] : ".";
+	const uint32 cMessages = argc > 2 ? static_cast<uint32>( atoi( argv[ 2 ] ) ) : 200000;
+
+	// about the size of a typical message, a little of it the same every time
+	std::vector<uint8> message( 600 );
+
+	for ( size_t i = 0; i < message.size(); i++ )
+		message[ i ] = static_cast<uint8>( i * 7 + i / 13 );
+
+	const uint32 unEMsg = static_cast<uint32>( EMsg::k_EMsgClientHeartBeat );
+	memcpy( message.data(), &unEMsg, sizeof( unEMsg ) );
+
+	printf( "%zu byte messages to %s\n", message.size(), directory.c_str() );
+
+	for ( const CommitPolicy_t &policy : k_rgPolicies )
+	{
+		const std::string basePath = directory + "/commitpolicy_bench";
+		const uint32 cPolicyMessages = std::max( 1u, cMessages / policy.m_unDivisor );
+
+		RemoveCapture( basePath );
+
+		double flMs;
+
+		{
+			CCaptureFileSink sink( basePath.c_str() );
+			sink.SetCommitPolicy( policy.m_cRecords, policy.m_cMillisecondsInterval, policy.m_bSync );
+
+			NH_CHECK( sink.Open() );
+
+			CCaptureWriter writer( &sink );
+
+			const uint64 ullStart = CaptureTimestamp();
+
+			writer.Start();
+
+			for ( uint32 i = 0; i < cPolicyMessages; i++ )
+				writer.Submit( ENetDirection::k_eNetIncoming, 1, message.data(), static_cast<uint32>( message.size() ) );
+
+			// drains the queue and commits what is left
+			writer.Stop();
+
+			flMs = TestElapsedMs( ullStart );
+		}
+
+		NH_CHECK( CountRecords( basePath ) == cPolicyMessages );
+		RemoveCapture( basePath );
+
+		printf( "  %-22s %8u messages %9.1f ms %10.0f messages/s\n", policy.m_szName, cPolicyMessages, flMs, cPolicyMessages * 1000.0 / flMs );
+	}
+
+	return TestResult( "commitpolicy_bench" );
+}
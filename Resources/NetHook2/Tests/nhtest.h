@@ -0,0 +1,60 @@
+#ifndef NETHOOK_NHTEST_H_
+#define NETHOOK_NHTEST_H_
+
+// Bare-bones checks shared by the tests in this directory. Every test is a standalone program
+// that reports each failed check and exits non-zero if there was any.
+
+#include <cstdio>
+
+#include "capture.h"
+
+
+static int g_cTestFailures = 0;
+
+#define NH_CHECK( expr ) \
+	do \
+	{ \
+		if ( !( expr ) ) \
+		{ \
+			fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr ); \
+			g_cTestFailures++; \
+		} \
+	} while ( 0 )
+
+inline int TestResult( const char *szName )
+{
+	if ( g_cTestFailures != 0 )
+		fprintf( stderr, "%s: %d checks failed\n", szName, g_cTestFailures );
+	else
+		printf( "%s: ok\n", szName );
+
+	return g_cTestFailures != 0 ? 1 : 0;
+}
+
+// wall time of a benchmark section in milliseconds
+inline double TestElapsedMs( uint64 ullStart )
+{
+	return static_cast<double>( CaptureTimestamp() - ullStart ) / 1000000.0;
+}
+
+// runs a benchmark section cRounds times and returns the fastest in milliseconds
+template <typename Section>
+double TestBestOfMs( int cRounds, Section section )
+{
+	double flBestMs = 0;
+
+	for ( int iRound = 0; iRound < cRounds; iRound++ )
+	{
+		const uint64 ullStart = CaptureTimestamp();
+		section();
+		const double flMs = TestElapsedMs( ullStart );
+
+		if ( iRound == 0 || flMs < flBestMs )
+			flBestMs = flMs;
+	}
+
+	return flBestMs;
+}
+
+
+#endif // !NETHOOK_NHTEST_H_
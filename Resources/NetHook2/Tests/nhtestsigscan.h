@@ -0,0 +1,30 @@
+#ifndef NETHOOK_NHTESTSIGSCAN_H_
+#define NETHOOK_NHTESTSIGSCAN_H_
+
+// Fixtures for the signature scanner tests.
+
+#include <cstddef>
+
+#include "sigscan.h"
+
+
+// the first match of pattern in the buffer found by comparing every offset byte by byte, what
+// CSigScan's results are checked against
+inline unsigned char *TestFindNaive( const unsigned char *pubData, size_t cubData, const SigScanPattern &pattern )
+{
+	for ( size_t ubOffset = 0; ubOffset + pattern.len <= cubData; ubOffset++ )
+	{
+		size_t i = 0;
+
+		while ( i < pattern.len && ( ( pubData[ ubOffset + i ] ^ pattern.bytes[ i ] ) & pattern.cmp[ i ] ) == 0 )
+			i++;
+
+		if ( i == pattern.len )
+			return const_cast<unsigned char *>( pubData + ubOffset );
+	}
+
+	return nullptr;
+}
+
+
+#endif // !NETHOOK_NHTESTSIGSCAN_H_
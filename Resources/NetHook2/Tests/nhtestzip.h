@@ -0,0 +1,36 @@
+#ifndef NETHOOK_NHTESTZIP_H_
+#define NETHOOK_NHTESTZIP_H_
+
+// Fixtures for the tests that build gzipped Multi bodies, kept apart from nhtest.h so the rest
+// don't have to link zlib.
+
+#include <vector>
+
+#include "zlib.h"
+
+#include "nhtest.h"
+
+
+// data as a gzip stream, the way Steam compresses the body of a Multi
+inline std::vector<uint8> TestGzip( const std::vector<uint8> &data )
+{
+	z_stream stream = {};
+	NH_CHECK( deflateInit2( &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) == Z_OK );
+
+	std::vector<uint8> compressed( deflateBound( &stream, static_cast<uLong>( data.size() ) ) + 32 );
+
+	stream.next_in = const_cast<Bytef *>( data.data() );
+	stream.avail_in = static_cast<uInt>( data.size() );
+	stream.next_out = compressed.data();
+	stream.avail_out = static_cast<uInt>( compressed.size() );
+
+	NH_CHECK( deflate( &stream, Z_FINISH ) == Z_STREAM_END );
+
+	compressed.resize( stream.total_out );
+	deflateEnd( &stream );
+
+	return compressed;
+}
+
+
+#endif // !NETHOOK_NHTESTZIP_H_
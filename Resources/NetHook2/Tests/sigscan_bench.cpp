@@ -0,0 +1,128 @@
+
+// sigscan_bench: time taken to find the signatures NetHook2 hooks in a 100 MB image, one Init
+// at a time and in a single FindSignatures pass on 1 to 16 threads. The image is the code of the
+// C++ runtime repeated, with the signatures planted near its end so every scan has to cover
+// nearly all of it.
+//
+// usage: sigscan_bench [image size in MB]
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <vector>
+
+#include "nhtest.h"
+#include "nhtestsigscan.h"
+
+
+// the x64 and x86 signatures from net.cpp and crypto.cpp
+static const SigScanPattern k_rgPatterns[] =
+{
+	SigScanPattern( "48 8B C4 55 48 8D 68 ?? 48 81 EC ?? ?? ?? ?? 48 89 70 ?? 49 8B F0 48 89 78 ?? 4C 89 60" ),
+	SigScanPattern( "48 8B C4 55 48 8D A8 ?? ?? ?? ?? 48 81 EC ?? ?? ?? ?? 48 89 58 08 48 8B" ),
+	SigScanPattern( "48 83 EC 58 8B 84 24 ?? ?? ?? ?? C6 44 24" ),
+	SigScanPattern( "48 89 5C 24 ?? 57 48 83 EC 20 8B D9 E8" ),
+	SigScanPattern( "55 8B EC 83 EC 64 A1 ?? ?? ?? ?? 53 8B D9 57" ),
+	SigScanPattern( "55 8B EC 81 EC ?? 04 ?? ?? A1 ?? ?? ?? ?? 56 57 8B F9" ),
+	SigScanPattern( "55 8B EC 6A ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75 ?? FF 75" ),
+	SigScanPattern( "55 8B EC 51 56 E8 ?? ?? ?? ?? 8B ?? ?? ?? ?? ?? 8B F0" ),
+};
+
+constexpr size_t k_cPatterns = sizeof( k_rgPatterns ) / sizeof( k_rgPatterns[ 0 ] );
+
+static std::vector<unsigned char> BuildImage( size_t cubImage )
+{
+	CSigScanModule runtime;
+	std::vector<unsigned char> code;
+
+	if ( runtime.Init( reinterpret_cast<const void *>( &std::terminate ) ) )
+	{
+		for ( const SigScanRange &range : runtime.GetCodeRanges() )
+			code.insert( code.end(), range.addr, range.addr + range.len );
+	}
+
+	NH_CHECK( !code.empty() );
+
+	std::vector<unsigned char> image( cubImage );
+
+	for ( size_t ubOffset = 0; !code.empty() && ubOffset < cubImage; ubOffset += code.size() )
+		memcpy( image.data() + ubOffset, code.data(), std::min( code.size(), cubImage - ubOffset ) );
+
+	// a few KB apart in the last pages, with random bytes where they don't care
+	std::mt19937 random( 5 );
+
+	for ( size_t iPattern = 0; iPattern < k_cPatterns; iPattern++ )
+	{
+		const SigScanPattern &pattern = k_rgPatterns[ iPattern ];
+		unsigned char *pubAt = image.data() + cubImage - ( k_cPatterns - iPattern ) * 4096 - 777;
+
+		for ( size_t i = 0; i < pattern.len; i++ )
+			pubAt[ i ] = pattern.cmp[ i ] != 0 ? pattern.bytes[ i ] : static_cast<unsigned char>( random() );
+	}
+
+	return image;
+}
+
+
+int main( int argc, char **argv )
+{
+	const size_t cubImage = ( argc > 1 ? static_cast<size_t>( atoi( argv[ 1 ] ) ) : 100 ) << 20;
+
+	const std::vector<unsigned char> image = BuildImage( cubImage );
+
+	CSigScanModule module;
+	NH_CHECK( module.Init( image.data(), image.size() ) );
+	NH_CHECK( module.GetCodeRanges().size() == 1 );
+
+	void *rgpExpected[ k_cPatterns ];
+
+	const double flNaiveMs = TestBestOfMs( 1, [&]
+	{
+		for ( size_t iPattern = 0; iPattern < k_cPatterns; iPattern++ )
+			rgpExpected[ iPattern ] = TestFindNaive( image.data(), image.size(), k_rgPatterns[ iPattern ] );
+	} );
+
+	for ( void *pExpected : rgpExpected )
+		NH_CHECK( pExpected != nullptr );
+
+	const double flInitMs = TestBestOfMs( 3, [&]
+	{
+		for ( size_t iPattern = 0; iPattern < k_cPatterns; iPattern++ )
+		{
+			CSigScan scan;
+			scan.Init( module, k_rgPatterns[ iPattern ] );
+
+			NH_CHECK( scan.is_set && scan.sig_addr == rgpExpected[ iPattern ] );
+		}
+	} );
+
+	printf( "%zu signatures over %zu MB\n", k_cPatterns, cubImage >> 20 );
+	printf( "  %-16s %8.1f ms\n", "byte by byte", flNaiveMs );
+	printf( "  %-16s %8.1f ms  %6.0f MB/s per signature\n", "Init each", flInitMs, k_cPatterns * ( cubImage >> 20 ) * 1000.0 / flInitMs );
+
+	for ( size_t cThreads : { 1, 2, 4, 8, 16 } )
+	{
+		const double flBatchMs = TestBestOfMs( 3, [&]
+		{
+			CSigScan rgScans[ k_cPatterns ];
+			CSigScan *rgpScans[ k_cPatterns ];
+
+			for ( size_t iPattern = 0; iPattern < k_cPatterns; iPattern++ )
+			{
+				rgScans[ iPattern ].Prepare( k_rgPatterns[ iPattern ] );
+				rgpScans[ iPattern ] = &rgScans[ iPattern ];
+			}
+
+			NH_CHECK( CSigScan::FindSignatures( module, rgpScans, k_cPatterns, cThreads ) == k_cPatterns );
+
+			for ( size_t iPattern = 0; iPattern < k_cPatterns; iPattern++ )
+				NH_CHECK( rgScans[ iPattern ].sig_addr == rgpExpected[ iPattern ] );
+		} );
+
+		printf( "  FindSignatures %2zu %7.1f ms  %6.0f MB/s\n", cThreads, flBatchMs, ( cubImage >> 20 ) * 1000.0 / flBatchMs );
+	}
+
+	return TestResult( "sigscan_bench" );
+}
@@ -0,0 +1,385 @@
+
+// sigscan_test: scans the code of this program and of the libraries it is linked against for
+// signatures cut out of that same code, and checks every result against a plain byte by byte
+// search. The modules are scanned from several threads at once, build with -fsanitize=thread
+// to check that they really share nothing. A synthetic image with signatures planted across the
+// edges of the chunks FindSignatures splits it into checks that 1 to 16 threads find exactly
+// what a serial scan does.
+//
+// usage: sigscan_test
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zlib.h"
+
+#include "nhtest.h"
+#include "nhtestsigscan.h"
+
+
+// the first match of pattern in the module's code, in the order CSigScan looks
+static void *FindNaive( const CSigScanModule &module, const SigScanPattern &pattern )
+{
+	for ( const SigScanRange &range : module.GetCodeRanges() )
+	{
+		if ( unsigned char *pubMatch = TestFindNaive( range.addr, range.len, pattern ) )
+			return pubMatch;
+	}
+
+	return nullptr;
+}
+
+// signatures cut from random places in the module's code, some with ignored bytes, and one in
+// every batch changed so it most likely matches nowhere
+static std::vector<SigScanPattern> CutPatterns( const CSigScanModule &module, std::mt19937 *pRandom, size_t cPatterns )
+{
+	std::vector<SigScanPattern> patterns;
+	const std::vector<SigScanRange> &ranges = module.GetCodeRanges();
+
+	while ( patterns.size() < cPatterns )
+	{
+		const SigScanRange &range = ranges[ ( *pRandom )() % ranges.size() ];
+		const size_t cubPattern = 4 + ( *pRandom )() % 28;
+
+		if ( range.len <= cubPattern )
+			continue;
+
+		const unsigned char *pubAt = range.addr + ( *pRandom )() % ( range.len - cubPattern );
+
+		unsigned char rgubPattern[ SigScanPattern::maxLen ];
+		char rgchMask[ SigScanPattern::maxLen ];
+
+		for ( size_t i = 0; i < cubPattern; i++ )
+		{
+			rgubPattern[ i ] = pubAt[ i ];
+			rgchMask[ i ] = ( *pRandom )() % 5 != 0 ? 'x' : '?';
+		}
+
+		if ( patterns.size() == cPatterns - 1 )
+		{
+			rgubPattern[ 0 ] ^= 0x5A;
+			rgchMask[ 0 ] = 'x';
+		}
+
+		patterns.emplace_back( rgubPattern, rgchMask, cubPattern );
+	}
+
+	return patterns;
+}
+
+// scans for a batch of patterns each way CSigScan offers, counting the results that differ from
+// the naive search
+static uint32 CheckPatterns( const CSigScanModule &module, const std::vector<SigScanPattern> &patterns, size_t cThreads )
+{
+	uint32 cMismatches = 0;
+
+	std::vector<CSigScan> scans( patterns.size() );
+	std::vector<CSigScan *> pScans;
+
+	for ( size_t i = 0; i < patterns.size(); i++ )
+	{
+		scans[ i ].Prepare( patterns[ i ] );
+		pScans.push_back( &scans[ i ] );
+	}
+
+	CSigScan::FindSignatures( module, pScans.data(), pScans.size(), cThreads );
+
+	for ( size_t i = 0; i < patterns.size(); i++ )
+	{
+		void *pExpected = FindNaive( module, patterns[ i ] );
+
+		if ( scans[ i ].sig_addr != pExpected || ( scans[ i ].is_set != 0 ) != ( pExpected != nullptr ) )
+			cMismatches++;
+
+		CSigScan single;
+		single.Init( module, patterns[ i ] );
+
+		if ( single.sig_addr != pExpected )
+			cMismatches++;
+
+		if ( pExpected != nullptr )
+		{
+			CSigScan cached;
+			cached.Prepare( patterns[ i ] );
+
+			if ( !cached.MatchOffset( module, static_cast<unsigned char *>( pExpected ) - module.GetBaseAddr() ) || cached.sig_addr != pExpected )
+				cMismatches++;
+		}
+	}
+
+	return cMismatches;
+}
+
+
+static void TestOwnModule()
+{
+	const void *pMain = reinterpret_cast<const void *>( &CutPatterns );
+
+	CSigScanModule module;
+	NH_CHECK( module.Init( pMain ) );
+	NH_CHECK( module.IsSet() );
+	NH_CHECK( !module.GetPath().empty() );
+	NH_CHECK( module.GetFingerprint().size == module.GetLength() );
+
+	// only the text segment is scanned, and it holds our own code
+	bool bContainsCode = false;
+
+	for ( const SigScanRange &range : module.GetCodeRanges() )
+	{
+		NH_CHECK( range.addr >= module.GetBaseAddr() && range.addr + range.len <= module.GetBaseAddr() + module.GetLength() );
+
+		if ( pMain >= range.addr && pMain < range.addr + range.len )
+			bContainsCode = true;
+	}
+
+	NH_CHECK( bContainsCode );
+	NH_CHECK( module.GetCodeRanges().size() < 4 );
+
+	// the same module finds the same fingerprint again, through any address in it
+	CSigScanModule again;
+	NH_CHECK( again.Init( module.GetCodeRanges().back().addr ) );
+	NH_CHECK( again.GetBaseAddr() == module.GetBaseAddr() );
+	NH_CHECK( memcmp( &again.GetFingerprint(), &module.GetFingerprint(), sizeof( SigScanFingerprint ) ) == 0 );
+
+	// the start of one of our own functions is found where it is, or at an identical copy before it
+	const unsigned char *pubFunction = static_cast<const unsigned char *>( pMain );
+	const SigScanPattern function( pubFunction, std::string( 24, 'x' ).c_str(), 24 );
+
+	CSigScan scan;
+	NH_CHECK( scan.Init( module, function ) == 0 );
+	NH_CHECK( scan.is_set && scan.sig_addr == FindNaive( module, function ) && scan.sig_addr <= pMain );
+
+	std::mt19937 random( 1 );
+
+	for ( size_t cThreads : { 1, 2, 4 } )
+		NH_CHECK( CheckPatterns( module, CutPatterns( module, &random, 64 ), cThreads ) == 0 );
+
+	// nothing is loaded at a heap address
+	std::vector<unsigned char> heap( 64 );
+	CSigScanModule none;
+
+	NH_CHECK( !none.Init( heap.data() ) );
+	NH_CHECK( !none.IsSet() );
+	NH_CHECK( !none.Init( nullptr ) );
+
+	CSigScan notFound;
+	NH_CHECK( notFound.Init( none, function ) != 0 );
+	NH_CHECK( !notFound.is_set && notFound.sig_addr == nullptr );
+}
+
+static void TestPatternStrings()
+{
+	static constexpr SigScanPattern k_Pattern( "48 8B ?? 55 ? c3" );
+
+	static_assert( k_Pattern.len == 6, "one byte per group" );
+	static_assert( k_Pattern.bytes[ 0 ] == 0x48 && k_Pattern.bytes[ 5 ] == 0xC3, "hex digits of either case" );
+	static_assert( k_Pattern.cmp[ 2 ] == 0 && k_Pattern.cmp[ 4 ] == 0 && k_Pattern.cmp[ 3 ] == 0xFF, "? and ?? are wildcards" );
+
+	// the anchors are checked bytes, and the rarest ones
+	NH_CHECK( k_Pattern.cmp[ k_Pattern.anchor1 ] == 0xFF && k_Pattern.cmp[ k_Pattern.anchor2 ] == 0xFF );
+	NH_CHECK( k_Pattern.anchor1 != k_Pattern.anchor2 );
+
+	const SigScanPattern fromMask( reinterpret_cast<const unsigned char *>( "\x48\x8B\x00\x55\x00\xC3" ), "xx?x?x", 6 );
+	NH_CHECK( memcmp( fromMask.bytes, k_Pattern.bytes, sizeof( k_Pattern.bytes ) ) == 0 );
+	NH_CHECK( memcmp( fromMask.cmp, k_Pattern.cmp, sizeof( k_Pattern.cmp ) ) == 0 );
+
+	// a string is only parsed at runtime when it isn't constexpr, and then throws on bad input
+	for ( const char *szBad : { "48 8", "48 8G", "488B", "48 8B55" } )
+	{
+		bool bThrown = false;
+
+		try
+		{
+			SigScanPattern bad( szBad );
+		}
+		catch ( const char * )
+		{
+			bThrown = true;
+		}
+
+		NH_CHECK( bThrown );
+	}
+}
+
+// one module per thread, all of them at once, through the public interface only
+static void TestModulesConcurrently()
+{
+	const void *rgpModules[] =
+	{
+		reinterpret_cast<const void *>( &CutPatterns ),
+		reinterpret_cast<const void *>( &inflate ),
+		reinterpret_cast<const void *>( &strlen ),
+		reinterpret_cast<const void *>( &std::terminate ),
+	};
+
+	std::atomic<uint32> cMismatches( 0 );
+	std::atomic<uint32> cFailedInits( 0 );
+	std::vector<std::thread> threads;
+
+	for ( uint32 unThread = 0; unThread < 4; unThread++ )
+	{
+		threads.emplace_back( [&, unThread]
+		{
+			CSigScanModule module;
+
+			if ( !module.Init( rgpModules[ unThread ] ) )
+			{
+				cFailedInits++;
+				return;
+			}
+
+			std::mt19937 random( unThread );
+
+			for ( int iRound = 0; iRound < 5; iRound++ )
+				cMismatches += CheckPatterns( module, CutPatterns( module, &random, 8 ), 2 );
+		} );
+	}
+
+	for ( std::thread &thread : threads )
+		thread.join();
+
+	NH_CHECK( cFailedInits == 0 );
+	NH_CHECK( cMismatches == 0 );
+}
+
+// where FindSignatures cuts a range into chunks for a number of threads
+static std::vector<size_t> ChunkEdges( size_t cubRange, size_t cThreads )
+{
+	std::vector<size_t> edges;
+
+	if ( cThreads < 2 )
+		return edges;
+
+	const size_t cubChunk = std::max<size_t>( cubRange / ( cThreads * 4 ) + 1, 1024 * 1024 );
+
+	for ( size_t ubEdge = cubChunk; ubEdge < cubRange; ubEdge += cubChunk )
+		edges.push_back( ubEdge );
+
+	return edges;
+}
+
+// random bytes with signatures planted just before, across and just after every chunk edge for
+// 1 to 16 threads, a second copy of some of them further on, some that match all over the image
+// and one that matches nowhere. Every thread count has to find the same first matches as Init.
+static void TestChunkBoundaries()
+{
+	const size_t cubImage = 32 * 1024 * 1024;
+	const size_t cubPattern = 24;
+
+	std::mt19937_64 random( 9 );
+	std::vector<unsigned char> image( cubImage );
+
+	for ( size_t ubOffset = 0; ubOffset < cubImage; ubOffset += sizeof( uint64 ) )
+	{
+		const uint64 ullRandom = random();
+		memcpy( image.data() + ubOffset, &ullRandom, sizeof( ullRandom ) );
+	}
+
+	std::vector<size_t> spots = { 0, cubImage - cubPattern };
+
+	for ( size_t cThreads = 2; cThreads <= 16; cThreads++ )
+	{
+		const std::vector<size_t> edges = ChunkEdges( cubImage, cThreads );
+
+		for ( size_t iEdge = 0; iEdge < 3 && iEdge < edges.size(); iEdge++ )
+		{
+			for ( size_t cubBefore : { cubPattern, cubPattern - 1, size_t( 3 ), size_t( 0 ) } )
+				spots.push_back( edges[ iEdge ] - cubBefore );
+		}
+	}
+
+	// keep planted signatures from overlapping where thread counts share an edge
+	std::sort( spots.begin(), spots.end() );
+	spots.erase( std::unique( spots.begin(), spots.end(), []( size_t ubLeft, size_t ubRight ) { return ubRight - ubLeft < cubPattern; } ), spots.end() );
+
+	std::vector<SigScanPattern> patterns;
+
+	for ( size_t ubSpot : spots )
+	{
+		unsigned char rgubPattern[ cubPattern ];
+		char rgchMask[ cubPattern ];
+
+		for ( size_t i = 0; i < cubPattern; i++ )
+		{
+			rgubPattern[ i ] = static_cast<unsigned char>( random() );
+			rgchMask[ i ] = random() % 4 != 0 ? 'x' : '?';
+		}
+
+		rgchMask[ 0 ] = 'x';
+		memcpy( image.data() + ubSpot, rgubPattern, cubPattern );
+		patterns.emplace_back( rgubPattern, rgchMask, cubPattern );
+	}
+
+	for ( size_t iPattern = 0; iPattern < patterns.size(); iPattern += 3 )
+	{
+		const size_t ubCopy = ( spots[ iPattern ] + cubImage / 2 ) % ( cubImage - cubPattern );
+		memcpy( image.data() + ubCopy, patterns[ iPattern ].bytes, cubPattern );
+	}
+
+	for ( const char *szMask : { "xx", "x?x", "xxx", "x??x?x" } )
+	{
+		const size_t ubAt = random() % ( cubImage - 8 );
+		patterns.emplace_back( image.data() + ubAt, szMask, strlen( szMask ) );
+	}
+
+	patterns.emplace_back( "01 02 03 04 05 06 07 08 09 0A 0B 0C" );
+
+	CSigScanModule module;
+	NH_CHECK( module.Init( image.data(), image.size() ) );
+
+	std::vector<void *> expected;
+
+	for ( const SigScanPattern &pattern : patterns )
+	{
+		CSigScan scan;
+		scan.Init( module, pattern );
+		expected.push_back( scan.sig_addr );
+	}
+
+	// the planted ones are where they were put, unless a later one overwrote them
+	for ( size_t iSpot = 0; iSpot < spots.size(); iSpot++ )
+		NH_CHECK( expected[ iSpot ] == nullptr || expected[ iSpot ] <= image.data() + spots[ iSpot ] );
+
+	NH_CHECK( expected.back() == nullptr );
+
+	for ( size_t cThreads = 1; cThreads <= 16; cThreads++ )
+	{
+		std::vector<CSigScan> scans( patterns.size() );
+		std::vector<CSigScan *> pScans;
+
+		for ( size_t i = 0; i < patterns.size(); i++ )
+		{
+			scans[ i ].Prepare( patterns[ i ] );
+			pScans.push_back( &scans[ i ] );
+		}
+
+		CSigScan::FindSignatures( module, pScans.data(), pScans.size(), cThreads );
+
+		uint32 cMismatches = 0;
+
+		for ( size_t i = 0; i < patterns.size(); i++ )
+		{
+			if ( scans[ i ].sig_addr != expected[ i ] || ( scans[ i ].is_set != 0 ) != ( expected[ i ] != nullptr ) )
+				cMismatches++;
+		}
+
+		NH_CHECK( cMismatches == 0 );
+	}
+}
+
+
+int main()
+{
+	TestOwnModule();
+	TestPatternStrings();
+	TestModulesConcurrently();
+	TestChunkBoundaries();
+
+	return TestResult( "sigscan_test" );
+}
@@ -0,0 +1,142 @@
+
+// varint_bench: varints decoded per second by CaptureReadVarint, by the byte at a time loop it
+// replaced and by libprotobuf's CodedInputStream, for a few mixes of varint lengths.
+//
+// usage: varint_bench [varints per mix]
+
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "captureproto.h"
+#include "nhtest.h"
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+
+
+// what CaptureReadVarint looked like before it decoded a word at a time
+static bool ReadVarintBytewise( const uint8 **ppubCursor, const uint8 *pubEnd, uint64 *pullValue ) noexcept
+{
+	uint64 ullValue = 0;
+
+	for ( uint32 unShift = 0; unShift < 64; unShift += 7 )
+	{
+		if ( *ppubCursor == pubEnd )
+			return false;
+
+		const uint8 ubByte = *( *ppubCursor )++;
+		ullValue |= static_cast<uint64>( ubByte & 0x7F ) << unShift;
+
+		if ( ( ubByte & 0x80 ) == 0 )
+		{
+			*pullValue = ullValue;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+struct VarintMix_t
+{
+	const char *m_szName;
+	// weights of 1 to 10 byte varints
+	uint32 m_rgunWeights[ 10 ];
+};
+
+static const VarintMix_t k_rgMixes[] =
+{
+	{ "1 byte", { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+	// tags and lengths, session ids, the occasional steam id, job id or negative eresult
+	{ "header", { 60, 15, 5, 2, 8, 0, 0, 0, 6, 4 } },
+	{ "5 byte", { 0, 0, 0, 0, 1, 0, 0, 0, 0, 0 } },
+	{ "9-10 byte", { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1 } },
+};
+
+static std::vector<uint8> BuildVarints( const VarintMix_t &mix, uint32 cVarints, uint64 *pullChecksum )
+{
+	std::mt19937_64 random( 3 );
+	std::discrete_distribution<uint32> lengths( std::begin( mix.m_rgunWeights ), std::end( mix.m_rgunWeights ) );
+
+	std::vector<uint8> buffer;
+	*pullChecksum = 0;
+
+	for ( uint32 i = 0; i < cVarints; i++ )
+	{
+		const uint32 cubVarint = lengths( random ) + 1;
+		const uint64 ullMin = cubVarint == 1 ? 0 : 1ull << ( 7 * ( cubVarint - 1 ) );
+		const uint64 ullValue = cubVarint == 10 ? ullMin | random() : ullMin + random() % ( ullMin == 0 ? 0x80 : ullMin * 127 );
+
+		uint8 rgubVarint[ 10 ];
+		const uint8 *pubVarintEnd = CodedOutputStream::WriteVarint64ToArray( ullValue, rgubVarint );
+
+		buffer.insert( buffer.end(), static_cast<const uint8 *>( rgubVarint ), pubVarintEnd );
+		*pullChecksum += ullValue;
+	}
+
+	return buffer;
+}
+
+template <typename Decode>
+static void Run( const char *szDecoder, uint32 cVarints, uint64 ullChecksum, Decode decode )
+{
+	const double flBestMs = TestBestOfMs( 5, [&] { NH_CHECK( decode() == ullChecksum ); } );
+
+	printf( "  %-12s %8.2f ms  %7.1f M varints/s\n", szDecoder, flBestMs, cVarints / flBestMs / 1000.0 );
+}
+
+
+int main( int argc, char **argv )
+{
+	const uint32 cVarints = argc > 1 ? static_cast<uint32>( atoi( argv[ 1 ] ) ) : 4000000;
+
+	for ( const VarintMix_t &mix : k_rgMixes )
+	{
+		uint64 ullChecksum;
+		const std::vector<uint8> buffer = BuildVarints( mix, cVarints, &ullChecksum );
+
+		const uint8 *pubBegin = buffer.data();
+		const uint8 *pubEnd = buffer.data() + buffer.size();
+
+		printf( "%s: %u varints, %.1f bytes each\n", mix.m_szName, cVarints, static_cast<double>( buffer.size() ) / cVarints );
+
+		Run( "word", cVarints, ullChecksum, [=]
+		{
+			const uint8 *pubCursor = pubBegin;
+			uint64 ullSum = 0, ullValue;
+
+			while ( CaptureReadVarint( &pubCursor, pubEnd, &ullValue ) )
+				ullSum += ullValue;
+
+			return ullSum;
+		} );
+
+		Run( "bytewise", cVarints, ullChecksum, [=]
+		{
+			const uint8 *pubCursor = pubBegin;
+			uint64 ullSum = 0, ullValue;
+
+			while ( ReadVarintBytewise( &pubCursor, pubEnd, &ullValue ) )
+				ullSum += ullValue;
+
+			return ullSum;
+		} );
+
+		Run( "protobuf", cVarints, ullChecksum, [=]
+		{
+			CodedInputStream stream( pubBegin, static_cast<int>( pubEnd - pubBegin ) );
+			uint64 ullSum = 0;
+			uint64_t ullValue;
+
+			while ( stream.ReadVarint64( &ullValue ) )
+				ullSum += ullValue;
+
+			return ullSum;
+		} );
+	}
+
+	return TestResult( "varint_bench" );
+}
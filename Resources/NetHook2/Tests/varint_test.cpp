@@ -0,0 +1,201 @@
+
+// varint_test: checks CaptureReadVarint against libprotobuf's CodedInputStream for every varint
+// length, at every distance from the end of the buffer, and on overlong, truncated and
+// non-canonical input.
+//
+// usage: varint_test
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include "captureproto.h"
+#include "nhtest.h"
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+
+
+// the bytes both decoders are given. Whatever follows the varint up to the end of the buffer is
+// filled with continuation bytes, so reading past the varint can't go unnoticed.
+static void CheckAgainstProtobuf( const std::vector<uint8> &varint, size_t cubTrailing )
+{
+	std::vector<uint8> buffer( varint );
+	buffer.resize( varint.size() + cubTrailing, 0xFF );
+
+	CodedInputStream stream( buffer.data(), static_cast<int>( buffer.size() ) );
+	uint64_t ullExpected = 0;
+	const bool bExpected = stream.ReadVarint64( &ullExpected );
+
+	const uint8 *pubCursor = buffer.data();
+	uint64 ullValue = 0;
+	const bool bDecoded = CaptureReadVarint( &pubCursor, buffer.data() + buffer.size(), &ullValue );
+
+	NH_CHECK( bDecoded == bExpected );
+
+	if ( bDecoded && bExpected )
+	{
+		NH_CHECK( ullValue == ullExpected );
+		NH_CHECK( pubCursor - buffer.data() == stream.CurrentPosition() );
+	}
+}
+
+static std::vector<uint8> Encode( uint64 ullValue )
+{
+	std::vector<uint8> varint( CodedOutputStream::VarintSize64( ullValue ) );
+	CodedOutputStream::WriteVarint64ToArray( ullValue, varint.data() );
+	return varint;
+}
+
+// every length from 1 to 10 bytes, with the smallest and largest value of each and random ones
+// in between, followed by anything from 0 to 16 more bytes
+static void TestRoundTrip()
+{
+	std::mt19937_64 random( 1 );
+
+	for ( uint32 cubVarint = 1; cubVarint <= 10; cubVarint++ )
+	{
+		const uint64 ullMin = cubVarint == 1 ? 0 : 1ull << ( 7 * ( cubVarint - 1 ) );
+		const uint64 ullMax = cubVarint == 10 ? ~0ull : ( 1ull << ( 7 * cubVarint ) ) - 1;
+
+		std::vector<uint64> values = { ullMin, ullMax, ullMin + 1, ullMax - 1 };
+
+		for ( int i = 0; i < 2000; i++ )
+			values.push_back( ullMin + random() % ( ullMax - ullMin + ( cubVarint == 10 ? 0 : 1 ) ) );
+
+		for ( uint64 ullValue : values )
+		{
+			const std::vector<uint8> varint = Encode( ullValue );
+			NH_CHECK( varint.size() == cubVarint );
+
+			for ( size_t cubTrailing = 0; cubTrailing <= 16; cubTrailing++ )
+			{
+				std::vector<uint8> buffer( varint );
+				buffer.resize( varint.size() + cubTrailing, 0xFF );
+
+				const uint8 *pubCursor = buffer.data();
+				uint64 ullDecoded = 0;
+
+				NH_CHECK( CaptureReadVarint( &pubCursor, buffer.data() + buffer.size(), &ullDecoded ) );
+				NH_CHECK( ullDecoded == ullValue );
+				NH_CHECK( pubCursor == buffer.data() + cubVarint );
+
+				CheckAgainstProtobuf( varint, cubTrailing );
+			}
+		}
+	}
+
+	// negative int32s are sign extended to 10 bytes on the wire
+	for ( int32 nValue : { -1, -2, -128, -1000000, INT32_MIN } )
+	{
+		const std::vector<uint8> varint = Encode( static_cast<uint64>( static_cast<int64>( nValue ) ) );
+		NH_CHECK( varint.size() == 10 );
+
+		for ( size_t cubTrailing = 0; cubTrailing <= 16; cubTrailing++ )
+			CheckAgainstProtobuf( varint, cubTrailing );
+	}
+}
+
+// runs out of data before the last byte, with and without room for a 10 byte read beyond
+static void TestTruncated()
+{
+	for ( uint32 cubVarint = 2; cubVarint <= 10; cubVarint++ )
+	{
+		const std::vector<uint8> varint = Encode( ~0ull >> ( 64 - std::min<uint32>( 64, 7 * cubVarint ) ) );
+
+		for ( size_t cubTruncated = 0; cubTruncated < varint.size(); cubTruncated++ )
+		{
+			const std::vector<uint8> truncated( varint.begin(), varint.begin() + cubTruncated );
+
+			const uint8 *pubCursor = truncated.data();
+			uint64 ullValue = 0;
+
+			NH_CHECK( !CaptureReadVarint( &pubCursor, truncated.data() + truncated.size(), &ullValue ) );
+
+			CheckAgainstProtobuf( truncated, 0 );
+		}
+	}
+}
+
+// 11 or more bytes, and the 10th byte carrying bits past the 64th
+static void TestOverlong()
+{
+	for ( size_t cubVarint = 11; cubVarint <= 20; cubVarint++ )
+	{
+		std::vector<uint8> varint( cubVarint, 0x80 );
+		varint.back() = 0x01;
+
+		for ( size_t cubTrailing = 0; cubTrailing <= 16; cubTrailing++ )
+		{
+			std::vector<uint8> buffer( varint );
+			buffer.resize( varint.size() + cubTrailing, 0x00 );
+
+			const uint8 *pubCursor = buffer.data();
+			uint64 ullValue = 0;
+
+			NH_CHECK( !CaptureReadVarint( &pubCursor, buffer.data() + buffer.size(), &ullValue ) );
+
+			CheckAgainstProtobuf( varint, cubTrailing );
+		}
+	}
+
+	for ( uint32 unLast = 0; unLast < 0x80; unLast++ )
+	{
+		std::vector<uint8> varint( 9, 0xFF );
+		varint.push_back( static_cast<uint8>( unLast ) );
+
+		for ( size_t cubTrailing = 0; cubTrailing <= 16; cubTrailing++ )
+			CheckAgainstProtobuf( varint, cubTrailing );
+	}
+}
+
+// non-canonical encodings, zero padded groups are legal and have to decode to the same value
+static void TestNonCanonical()
+{
+	for ( uint32 cubVarint = 2; cubVarint <= 10; cubVarint++ )
+	{
+		for ( uint32 unFirst : { 0x80u, 0xFFu, 0x81u } )
+		{
+			std::vector<uint8> varint( cubVarint, 0x80 );
+			varint.front() = static_cast<uint8>( unFirst );
+			varint.back() = 0x00;
+
+			for ( size_t cubTrailing = 0; cubTrailing <= 16; cubTrailing++ )
+				CheckAgainstProtobuf( varint, cubTrailing );
+		}
+	}
+}
+
+// every combination of the first two bytes, then random bytes, at every distance from the end
+static void TestArbitraryBytes()
+{
+	std::mt19937 random( 2 );
+	std::vector<uint8> bytes( 12 );
+
+	for ( uint32 unPrefix = 0; unPrefix < 0x10000; unPrefix++ )
+	{
+		bytes[ 0 ] = static_cast<uint8>( unPrefix );
+		bytes[ 1 ] = static_cast<uint8>( unPrefix >> 8 );
+
+		for ( size_t i = 2; i < bytes.size(); i++ )
+			bytes[ i ] = static_cast<uint8>( random() | ( random() % 4 != 0 ? 0x80 : 0 ) );
+
+		const size_t cubBuffer = 1 + unPrefix % bytes.size();
+		CheckAgainstProtobuf( std::vector<uint8>( bytes.begin(), bytes.begin() + cubBuffer ), 0 );
+	}
+}
+
+
+int main()
+{
+	TestRoundTrip();
+	TestTruncated();
+	TestOverlong();
+	TestNonCanonical();
+	TestArbitraryBytes();
+
+	return TestResult( "varint_test" );
+}
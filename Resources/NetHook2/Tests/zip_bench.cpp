@@ -0,0 +1,211 @@
+
+// zip_bench: time taken to decompress one gzipped message, for a few message sizes, with a zlib
+// stream set up and torn down for every message the way CZip::Inflate used to, and with the
+// pooled streams behind CZip::Inflate and CZipInflater now. Also times the setup on its own,
+// inflateInit2 and inflateEnd against the inflateReset a pooled stream gets.
+//
+// usage: zip_bench [MB decompressed per size]
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "zlib.h"
+
+#include "zip.h"
+#include "nhtestzip.h"
+
+
+// somewhat like a protobuf body: short tags and lengths, names from a small vocabulary and the
+// odd run of random bytes, which gzips to around a third
+static std::vector<uint8> BuildMessage( std::mt19937 *pRandom, uint32 cubMessage )
+{
+	static const char *const k_rgszWords[] = { "steam", "client", "persona", "state", "friend", "game", "app", "name", "rich", "presence" };
+
+	std::vector<uint8> message;
+
+	while ( message.size() < cubMessage )
+	{
+		message.push_back( static_cast<uint8>( ( *pRandom )() % 0x80 ) );
+
+		if ( ( *pRandom )() % 4 == 0 )
+		{
+			for ( int i = 0; i < 8; i++ )
+				message.push_back( static_cast<uint8>( ( *pRandom )() ) );
+		}
+		else
+		{
+			const char *szWord = k_rgszWords[ ( *pRandom )() % 10 ];
+			message.insert( message.end(), szWord, szWord + strlen( szWord ) );
+		}
+	}
+
+	message.resize( cubMessage );
+	return message;
+}
+
+// what CZip::Inflate did before streams were pooled
+static bool InflateUnpooled( const uint8 *pCompressed, uint32 cubCompressed, uint8 *pDecompressed, uint32 cubDecompressed )
+{
+	z_stream stream = {};
+
+	if ( inflateInit2( &stream, 16 ) != Z_OK )
+		return false;
+
+	stream.next_in = const_cast<uint8 *>( pCompressed );
+	stream.avail_in = cubCompressed;
+	stream.next_out = pDecompressed;
+	stream.avail_out = cubDecompressed;
+
+	const int ret = inflate( &stream, Z_FINISH );
+	inflateEnd( &stream );
+
+	return ret == Z_STREAM_END;
+}
+
+template <typename Decode>
+static void Run( const char *szWay, uint32 cMessages, Decode decode )
+{
+	const double flBestMs = TestBestOfMs( 5, [&] { NH_CHECK( decode() ); } );
+
+	printf( "  %-14s %8.3f us each\n", szWay, flBestMs * 1000.0 / cMessages );
+}
+
+
+int main( int argc, char **argv )
+{
+	const uint32 cubPerSize = ( argc > 1 ? static_cast<uint32>( atoi( argv[ 1 ] ) ) : 32 ) << 20;
+
+	std::mt19937 random( 7 );
+
+	{
+		const uint32 cStreams = 1000000;
+		const std::vector<uint8> body = TestGzip( BuildMessage( &random, 64 ) );
+
+		printf( "stream setup only, %u times\n", cStreams );
+
+		Run( "init and end", cStreams, [&]
+		{
+			for ( uint32 i = 0; i < cStreams; i++ )
+			{
+				z_stream stream = {};
+
+				if ( inflateInit2( &stream, 16 ) != Z_OK )
+					return false;
+
+				inflateEnd( &stream );
+			}
+
+			return true;
+		} );
+
+		z_stream pooled = {};
+		inflateInit2( &pooled, 16 );
+
+		// a reset stream that already inflated something, as they come out of the pool
+		uint8 rgubOut[ 64 ];
+		pooled.next_in = const_cast<uint8 *>( body.data() );
+		pooled.avail_in = static_cast<uInt>( body.size() );
+		pooled.next_out = rgubOut;
+		pooled.avail_out = sizeof( rgubOut );
+		NH_CHECK( inflate( &pooled, Z_FINISH ) == Z_STREAM_END );
+
+		Run( "reset", cStreams, [&]
+		{
+			for ( uint32 i = 0; i < cStreams; i++ )
+			{
+				if ( inflateReset( &pooled ) != Z_OK )
+					return false;
+			}
+
+			return true;
+		} );
+
+		inflateEnd( &pooled );
+	}
+
+	for ( uint32 cubMessage : { 256u, 2048u, 16384u, 131072u } )
+	{
+		const uint32 cMessages = std::max( 1u, cubPerSize / cubMessage );
+
+		// a few different messages, decompressed round robin
+		std::vector<std::vector<uint8>> messages;
+		std::vector<std::vector<uint8>> compressed;
+		uint64 cubCompressed = 0;
+
+		for ( int i = 0; i < 16; i++ )
+		{
+			messages.push_back( BuildMessage( &random, cubMessage ) );
+			compressed.push_back( TestGzip( messages.back() ) );
+			cubCompressed += compressed.back().size();
+		}
+
+		std::vector<uint8> out( cubMessage );
+
+		printf( "%u byte messages, %.0f bytes gzipped, %u of them\n", cubMessage, cubCompressed / 16.0, cMessages );
+
+		auto check = [&]( uint32 iMessage )
+		{
+			return memcmp( out.data(), messages[ iMessage % 16 ].data(), cubMessage ) == 0;
+		};
+
+		Run( "unpooled", cMessages, [&]
+		{
+			for ( uint32 i = 0; i < cMessages; i++ )
+			{
+				const std::vector<uint8> &body = compressed[ i % 16 ];
+
+				if ( !InflateUnpooled( body.data(), static_cast<uint32>( body.size() ), out.data(), cubMessage ) )
+					return false;
+			}
+
+			return check( cMessages - 1 );
+		} );
+
+		Run( "CZip::Inflate", cMessages, [&]
+		{
+			for ( uint32 i = 0; i < cMessages; i++ )
+			{
+				const std::vector<uint8> &body = compressed[ i % 16 ];
+
+				if ( !CZip::Inflate( body.data(), static_cast<uint32>( body.size() ), out.data(), cubMessage ) )
+					return false;
+			}
+
+			return check( cMessages - 1 );
+		} );
+
+		// a new inflater for every message, each one takes a stream from the pool and puts it back
+		Run( "CZipInflater", cMessages, [&]
+		{
+			for ( uint32 i = 0; i < cMessages; i++ )
+			{
+				const std::vector<uint8> &body = compressed[ i % 16 ];
+
+				CZipInflater inflater;
+
+				if ( !inflater.Begin( body.data(), static_cast<uint32>( body.size() ) ) )
+					return false;
+
+				uint32 cubWritten = 0;
+				EZipStatus eStatus = k_EZipStatusMore;
+
+				while ( eStatus == k_EZipStatusMore && cubWritten < cubMessage )
+				{
+					uint32 cubInflated = 0;
+					eStatus = inflater.Inflate( out.data() + cubWritten, cubMessage - cubWritten, &cubInflated );
+					cubWritten += cubInflated;
+				}
+
+				if ( eStatus != k_EZipStatusDone || cubWritten != cubMessage )
+					return false;
+			}
+
+			return check( cMessages - 1 );
+		} );
+	}
+
+	return TestResult( "zip_bench" );
+}
@@ -0,0 +1,240 @@
+
+// zipbackend_bench: how fast every zip backend in the build decodes a corpus of compressed Multi
+// bodies, whole and a child at a time through CCaptureMultiInflater. The corpus is every
+// compressed Multi in the given captures, or synthetic Multis when there are none.
+//
+// usage: zipbackend_bench [capture segment.nhcap ...]
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "capturefile.h"
+#include "capturemulti.h"
+#include "nhtestzip.h"
+
+
+struct CorpusMulti_t
+{
+	std::vector<uint8> m_Body;
+	uint32 m_cubUnzipped;
+};
+
+// what every decoder has to agree on
+struct CorpusResult_t
+{
+	uint64 m_cChildren;
+	uint64 m_cubChildren;
+	uint64 m_ullChecksum;
+};
+
+static void AddMulti( std::vector<CorpusMulti_t> *pCorpus, const uint8 *pubData, uint32 cubData )
+{
+	struct ProtoHdr
+	{
+		uint32 msg;
+		int headerLength;
+	};
+
+	ProtoHdr protoHdr;
+
+	if ( cubData < sizeof( protoHdr ) )
+		return;
+
+	memcpy( &protoHdr, pubData, sizeof( protoHdr ) );
+
+	if ( protoHdr.headerLength < 0 || static_cast<uint32>( protoHdr.headerLength ) > cubData - sizeof( protoHdr ) )
+		return;
+
+	const uint32 cubHeader = sizeof( protoHdr ) + protoHdr.headerLength;
+	CaptureMulti_t multi;
+
+	if ( !CaptureParseMulti( pubData + cubHeader, cubData - cubHeader, &multi ) || multi.m_cubUnzipped == 0 )
+		return;
+
+	CorpusMulti_t corpusMulti;
+	corpusMulti.m_Body.assign( multi.m_pubBody, multi.m_pubBody + multi.m_cubBody );
+	corpusMulti.m_cubUnzipped = multi.m_cubUnzipped;
+
+	pCorpus->push_back( std::move( corpusMulti ) );
+}
+
+static void LoadCapture( std::vector<CorpusMulti_t> *pCorpus, const char *szPath )
+{
+	CCaptureFileReader reader;
+
+	if ( !reader.Open( szPath ) )
+	{
+		fprintf( stderr, "can't open %s\n", szPath );
+		return;
+	}
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+
+	while ( reader.ReadRecord( &header, &payload ) == ECaptureReadResult::k_eCaptureReadOK )
+	{
+		if ( header.m_eType == k_ECaptureRecordMessage && header.m_unEMsg == static_cast<uint32>( EMsg::k_EMsgMulti ) )
+			AddMulti( pCorpus, payload.data(), static_cast<uint32>( payload.size() ) );
+	}
+}
+
+// mostly a handful of small messages, now and then a burst of many or one large one, the way
+// Steam batches them around logon
+static void BuildSyntheticCorpus( std::vector<CorpusMulti_t> *pCorpus )
+{
+	static const char *const k_rgszWords[] = { "steam", "client", "persona", "state", "friend", "game", "app", "name", "rich", "presence", "depot", "manifest" };
+
+	std::mt19937 random( 11 );
+
+	for ( int iMulti = 0; iMulti < 2000; iMulti++ )
+	{
+		const uint32 unKind = random() % 20;
+		const uint32 cChildren = unKind == 0 ? 100 + random() % 400 : 2 + random() % 12;
+
+		std::vector<uint8> body;
+
+		for ( uint32 iChild = 0; iChild < cChildren; iChild++ )
+		{
+			const uint32 cubChild = unKind == 1 && iChild == 0 ? 64 * 1024 + random() % ( 448 * 1024 ) : 24 + random() % 400;
+
+			std::vector<uint8> child;
+			const uint32 rgunHeader[ 2 ] = { ( static_cast<uint32>( EMsg::k_EMsgClientHeartBeat ) + static_cast<uint32>( random() % 64 ) ) | k_EMsgProtoMask, 4 };
+			child.insert( child.end(), reinterpret_cast<const uint8 *>( rgunHeader ), reinterpret_cast<const uint8 *>( rgunHeader + 2 ) );
+
+			while ( child.size() < cubChild )
+			{
+				child.push_back( static_cast<uint8>( random() % 0x80 ) );
+
+				if ( random() % 4 == 0 )
+				{
+					for ( int i = 0; i < 8; i++ )
+						child.push_back( static_cast<uint8>( random() ) );
+				}
+				else
+				{
+					const char *szWord = k_rgszWords[ random() % 12 ];
+					child.insert( child.end(), szWord, szWord + strlen( szWord ) );
+				}
+			}
+
+			child.resize( cubChild );
+
+			body.insert( body.end(), reinterpret_cast<const uint8 *>( &cubChild ), reinterpret_cast<const uint8 *>( &cubChild + 1 ) );
+			body.insert( body.end(), child.begin(), child.end() );
+		}
+
+		CorpusMulti_t corpusMulti;
+		corpusMulti.m_Body = TestGzip( body );
+		corpusMulti.m_cubUnzipped = static_cast<uint32>( body.size() );
+
+		pCorpus->push_back( std::move( corpusMulti ) );
+	}
+}
+
+static void AddChild( CorpusResult_t *pResult, const uint8 *pubChild, uint32 cubChild )
+{
+	pResult->m_cChildren++;
+	pResult->m_cubChildren += cubChild;
+	pResult->m_ullChecksum = pResult->m_ullChecksum * 31 + cubChild + ( cubChild != 0 ? pubChild[ 0 ] + pubChild[ cubChild - 1 ] * 7u : 0 );
+}
+
+// inflates every body into a buffer of size_unzipped, then walks the children
+static CorpusResult_t InflateWhole( IZipBackend *pBackend, const std::vector<CorpusMulti_t> &corpus )
+{
+	CorpusResult_t result = {};
+	std::vector<uint8> unzipped;
+
+	for ( const CorpusMulti_t &multi : corpus )
+	{
+		unzipped.resize( multi.m_cubUnzipped );
+		uint32 cubWritten = 0;
+
+		if ( !pBackend->Inflate( multi.m_Body.data(), static_cast<uint32>( multi.m_Body.size() ), unzipped.data(), multi.m_cubUnzipped, &cubWritten ) )
+			continue;
+
+		CCaptureMultiReader reader( unzipped.data(), cubWritten );
+		const uint8 *pubChild;
+		uint32 cubChild;
+
+		while ( reader.Next( &pubChild, &cubChild ) )
+			AddChild( &result, pubChild, cubChild );
+	}
+
+	return result;
+}
+
+// the way the capture pipeline expands Multis
+static CorpusResult_t InflateChildren( const std::vector<CorpusMulti_t> &corpus )
+{
+	CorpusResult_t result = {};
+	CCaptureMultiInflater inflater;
+
+	for ( const CorpusMulti_t &multi : corpus )
+	{
+		if ( !inflater.Begin( multi.m_Body.data(), static_cast<uint32>( multi.m_Body.size() ), multi.m_cubUnzipped ) )
+			continue;
+
+		const uint8 *pubChild;
+		uint32 cubChild;
+
+		while ( inflater.Next( &pubChild, &cubChild ) )
+			AddChild( &result, pubChild, cubChild );
+	}
+
+	return result;
+}
+
+static void CheckResult( const CorpusResult_t &result, const CorpusResult_t &expected )
+{
+	NH_CHECK( result.m_cChildren == expected.m_cChildren && result.m_cubChildren == expected.m_cubChildren && result.m_ullChecksum == expected.m_ullChecksum );
+}
+
+
+int main( int argc, char **argv )
+{
+	std::vector<CorpusMulti_t> corpus;
+
+	for ( int iArg = 1; iArg < argc; iArg++ )
+		LoadCapture( &corpus, argv[ iArg ] );
+
+	const bool bSynthetic = corpus.empty();
+
+	if ( bSynthetic )
+		BuildSyntheticCorpus( &corpus );
+
+	uint64 cubCompressed = 0;
+	uint64 cubUnzipped = 0;
+
+	for ( const CorpusMulti_t &multi : corpus )
+	{
+		cubCompressed += multi.m_Body.size();
+		cubUnzipped += multi.m_cubUnzipped;
+	}
+
+	printf( "%zu %s Multis, %.1f MB gzipped, %.1f MB unzipped\n", corpus.size(), bSynthetic ? "synthetic" : "captured",
+		cubCompressed / 1048576.0, cubUnzipped / 1048576.0 );
+
+	CZip::SetBackend( k_EZipBackendZlib );
+	const CorpusResult_t expected = InflateWhole( CZip::GetBackend(), corpus );
+
+	printf( "%llu children\n", static_cast<unsigned long long>( expected.m_cChildren ) );
+
+	for ( int iBackend = 0; iBackend < k_EZipBackendCount; iBackend++ )
+	{
+		const EZipBackend eBackend = static_cast<EZipBackend>( iBackend );
+
+		if ( !CZip::SetBackend( eBackend ) )
+			continue;
+
+		IZipBackend *pBackend = CZip::GetBackend();
+
+		const double flWholeMs = TestBestOfMs( 3, [&] { CheckResult( InflateWhole( pBackend, corpus ), expected ); } );
+		const double flChildrenMs = TestBestOfMs( 3, [&] { CheckResult( InflateChildren( corpus ), expected ); } );
+
+		printf( "  %-10s whole %8.1f ms %7.1f MB/s   children %8.1f ms %7.1f MB/s\n", CZip::GetBackendName( eBackend ),
+			flWholeMs, cubUnzipped / 1048.576 / flWholeMs, flChildrenMs, cubUnzipped / 1048.576 / flChildrenMs );
+	}
+
+	return TestResult( "zipbackend_bench" );
+}
@@ -0,0 +1,151 @@
+
+// nhcap2bin: explodes a segmented .nhcap capture into the NNN_<in|out>_<emsg>_<name>.bin
+// directory layout that NetHookAnalyzer2 loads.
+//
+// usage: nhcap2bin <capture.0000.nhcap> [output directory]
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+	#include <direct.h>
+	#include <sys/utime.h>
+	#define utime _utime
+	#define utimbuf _utimbuf
+#else
+	#include <sys/stat.h>
+	#include <utime.h>
+#endif
+
+#include "capturefile.h"
+
+
+static bool MakeDirectory( const char *szPath )
+{
+#ifdef _WIN32
+	return _mkdir( szPath ) == 0 || errno == EEXIST;
+#else
+	return mkdir( szPath, 0755 ) == 0 || errno == EEXIST;
+#endif
+}
+
+static std::string GetDirectory( const std::string &path )
+{
+	const size_t iSeparator = path.find_last_of( "/\\" );
+
+	if ( iSeparator == std::string::npos )
+		return std::string( "." );
+
+	return path.substr( 0, iSeparator );
+}
+
+int main( int argc, char **argv )
+{
+	if ( argc < 2 )
+	{
+		fprintf( stderr, "usage: %s <capture.0000.nhcap> [output directory]\n", argv[ 0 ] );
+		return 1;
+	}
+
+	std::string basePath;
+
+	if ( !CaptureBasePathFromSegment( argv[ 1 ], &basePath ) )
+	{
+		fprintf( stderr, "%s does not look like a capture segment\n", argv[ 1 ] );
+		return 1;
+	}
+
+	const std::string outputDir = ( argc >= 3 ? std::string( argv[ 2 ] ) : GetDirectory( basePath ) );
+
+	if ( !MakeDirectory( outputDir.c_str() ) )
+	{
+		fprintf( stderr, "Unable to create %s\n", outputDir.c_str() );
+		return 1;
+	}
+
+	std::unordered_map<uint32, std::string> msgNames;
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+
+	uint32 cSegments = 0;
+	uint64 cMessages = 0;
+
+	for ( uint32 unSegment = 0; ; unSegment++ )
+	{
+		const std::string segmentPath = CaptureSegmentPath( basePath.c_str(), unSegment );
+
+		CCaptureFileReader reader;
+
+		if ( !reader.Open( segmentPath.c_str() ) )
+			break;
+
+		cSegments++;
+
+		const CaptureFileHeader_t &fileHeader = reader.GetHeader();
+		ECaptureReadResult eResult;
+
+		while ( ( eResult = reader.ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+		{
+			if ( header.m_eType == k_ECaptureRecordMsgName )
+			{
+				msgNames[ header.m_unEMsg ] = std::string( payload.begin(), payload.end() );
+				continue;
+			}
+
+			if ( header.m_eType != k_ECaptureRecordMessage )
+				continue;
+
+			const auto itName = msgNames.find( header.m_unEMsg );
+
+			char szFileName[ 512 ];
+			snprintf(
+				szFileName, sizeof( szFileName ),
+				"%s/%03llu_%s_%u_%s.bin",
+				outputDir.c_str(),
+				static_cast<unsigned long long>( header.m_ullSequence ),
+				( header.m_eDirection == static_cast<uint8>( ENetDirection::k_eNetIncoming ) ? "in" : "out" ),
+				header.m_unEMsg,
+				( itName != msgNames.end() ? itName->second.c_str() : "" )
+			);
+
+			FILE *pFile = fopen( szFileName, "wb" );
+
+			if ( pFile == nullptr )
+			{
+				fprintf( stderr, "Unable to create %s\n", szFileName );
+				return 1;
+			}
+
+			fwrite( payload.data(), 1, payload.size(), pFile );
+			fclose( pFile );
+
+			// NetHookAnalyzer2 takes the message time from the file's modification time
+			const uint64 ullElapsed = ( header.m_ullTimestamp - fileHeader.m_ullTimestampBase ) / 1000;
+			const uint64 ullWallClock = ( fileHeader.m_ullWallClockBase + ullElapsed ) / 1000000;
+
+			struct utimbuf times;
+			times.actime = static_cast<time_t>( ullWallClock );
+			times.modtime = static_cast<time_t>( ullWallClock );
+			utime( szFileName, &times );
+
+			cMessages++;
+		}
+
+		if ( eResult == ECaptureReadResult::k_eCaptureReadCorrupt )
+			fprintf( stderr, "%s: stopping at damaged record at offset %llu\n", segmentPath.c_str(), static_cast<unsigned long long>( reader.Tell() ) );
+	}
+
+	if ( cSegments == 0 )
+	{
+		fprintf( stderr, "Unable to open %s\n", argv[ 1 ] );
+		return 1;
+	}
+
+	printf( "Wrote %llu messages from %u segment(s) to %s\n", static_cast<unsigned long long>( cMessages ), cSegments, outputDir.c_str() );
+	return 0;
+}
@@ -0,0 +1,540 @@
+
+// nhcapexpand: rewrites a segmented .nhcap capture with every Multi replaced by the messages it
+// holds, for captures taken with expand_multis = off.
+//
+// usage: nhcapexpand <capture.0000.nhcap> <output base path> [options]
+//
+//   --threads <count>          worker threads, all cores by default
+//   --compression <codec>      none, deflate (default) or zstd for the output
+//   --max-depth <count>        Multi nesting levels to expand, see multi_max_depth
+//   --max-size <bytes>         most data one Multi may expand to, see multi_max_size
+//
+// Records are read in batches and expanded on a pool of worker threads, each with its own
+// CCaptureMultiExpander. Workers take batches from their own queue and steal from the others
+// when it runs dry, finished batches wait in a reorder buffer until everything before them has
+// been written, so the output is in capture order. Children take the place of their Multi and
+// messages are renumbered from 1. A Multi that can't be expanded and gives no children at all is
+// written out as it was, and the tool exits with 2 after naming them.
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capturefile.h"
+#include "capturemulti.h"
+
+
+// a batch is handed to the pool once it holds this many records or payload bytes
+constexpr uint32 k_cRecordsPerBatch = 1024;
+constexpr size_t k_cubPerBatch = 4 * 1024 * 1024;
+
+// batches read ahead of the writer, per worker thread
+constexpr uint32 k_cBatchesInFlightPerThread = 4;
+
+
+struct BatchRecord_t
+{
+	CaptureRecordHeader_t m_Header;
+	// into the batch's payload buffer
+	size_t m_ubPayload;
+};
+
+struct Batch_t
+{
+	uint64 m_iBatch;
+
+	std::vector<BatchRecord_t> m_Records;
+	std::vector<uint8> m_Payloads;
+
+	// filled in by the worker
+	std::vector<BatchRecord_t> m_Expanded;
+	std::vector<uint8> m_ExpandedPayloads;
+
+	uint64 m_cMultis;
+	CaptureMultiStats_t m_Stats;
+	// input sequence numbers of the Multis kept as they were
+	std::vector<uint64> m_KeptMultis;
+};
+
+
+static void AddRecord( std::vector<BatchRecord_t> *pRecords, std::vector<uint8> *pPayloads, const CaptureRecordHeader_t &header, const uint8 *pubData, uint32 cubData )
+{
+	BatchRecord_t record;
+	record.m_Header = header;
+	record.m_Header.m_cubData = cubData;
+	record.m_ubPayload = pPayloads->size();
+
+	pRecords->push_back( record );
+	pPayloads->insert( pPayloads->end(), pubData, pubData + cubData );
+}
+
+static void ExpandBatch( CCaptureMultiExpander *pExpander, Batch_t *pBatch )
+{
+	for ( const BatchRecord_t &record : pBatch->m_Records )
+	{
+		const uint8 *pubPayload = pBatch->m_Payloads.data() + record.m_ubPayload;
+
+		if ( record.m_Header.m_eType != k_ECaptureRecordMessage || record.m_Header.m_unEMsg != static_cast<uint32>( EMsg::k_EMsgMulti ) )
+		{
+			AddRecord( &pBatch->m_Expanded, &pBatch->m_ExpandedPayloads, record.m_Header, pubPayload, record.m_Header.m_cubData );
+			continue;
+		}
+
+		CaptureFrame_t frame = { };
+		frame.m_pubData = pubPayload;
+		frame.m_cubData = record.m_Header.m_cubData;
+
+		pBatch->m_cMultis++;
+
+		const bool bBegun = pExpander->Begin( frame );
+		uint32 cChildren = 0;
+
+		if ( bBegun )
+		{
+			CaptureFrame_t child;
+
+			while ( pExpander->Next( &child ) )
+			{
+				cChildren++;
+
+				const uint32 unRawEMsg = CaptureGetRawEMsg( child.m_pubData, child.m_cubData );
+
+				CaptureRecordHeader_t header = record.m_Header;
+				header.m_unEMsg = unRawEMsg & ~k_EMsgProtoMask;
+				header.m_unFlags = ( ( unRawEMsg & k_EMsgProtoMask ) != 0 ? k_ECaptureRecordFlagProto : 0 );
+
+				AddRecord( &pBatch->m_Expanded, &pBatch->m_ExpandedPayloads, header, child.m_pubData, child.m_cubData );
+			}
+		}
+
+		const CaptureMultiStats_t &stats = pExpander->GetStats();
+
+		// nothing came out of it, the Multi itself is better than losing the message altogether
+		if ( !bBegun || ( cChildren == 0 && ( stats.m_cMalformed != 0 || stats.m_cCorrupt != 0 || stats.m_cTruncated != 0 ) ) )
+		{
+			AddRecord( &pBatch->m_Expanded, &pBatch->m_ExpandedPayloads, record.m_Header, pubPayload, record.m_Header.m_cubData );
+			pBatch->m_KeptMultis.push_back( record.m_Header.m_ullSequence );
+		}
+
+		pBatch->m_Stats.m_cMalformed += stats.m_cMalformed;
+		pBatch->m_Stats.m_cTruncated += stats.m_cTruncated;
+		pBatch->m_Stats.m_cCorrupt += stats.m_cCorrupt;
+		pBatch->m_Stats.m_cSkippedChildren += stats.m_cSkippedChildren;
+		pBatch->m_Stats.m_cTooDeep += stats.m_cTooDeep;
+		pBatch->m_Stats.m_bBudgetExceeded |= stats.m_bBudgetExceeded;
+	}
+
+	// the input isn't needed anymore, the writer only looks at the expanded records
+	std::vector<BatchRecord_t>().swap( pBatch->m_Records );
+	std::vector<uint8>().swap( pBatch->m_Payloads );
+}
+
+
+// Work stealing pool with a reorder buffer on the way out.
+class CExpandPool
+{
+
+public:
+	CExpandPool( uint32 cThreads, uint32 cMaxDepth, uint64 cubMaxExpanded );
+	~CExpandPool();
+
+	// blocks while too many batches are waiting to be written
+	void Submit( Batch_t *pBatch );
+
+	// the batches in the order they were submitted, nullptr once Finish() was called and
+	// everything has been handed out
+	Batch_t *TakeFinished();
+	void Finish();
+
+private:
+	struct Worker_t
+	{
+		std::mutex m_Mutex;
+		std::deque<Batch_t *> m_Batches;
+	};
+
+	void WorkerMain( uint32 iWorker );
+	Batch_t *TakeWork( uint32 iWorker );
+
+private:
+	uint32 m_cMaxDepth;
+	uint64 m_cubMaxExpanded;
+
+	std::vector<std::unique_ptr<Worker_t>> m_Workers;
+	std::vector<std::thread> m_Threads;
+	uint32 m_iNextWorker;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkCond;
+	std::condition_variable m_FinishedCond;
+	std::condition_variable m_SpaceCond;
+
+	// below here guarded by m_Mutex
+	uint64 m_cQueued;
+	uint64 m_cInFlight;
+	uint64 m_cMaxInFlight;
+	uint64 m_cSubmitted;
+	uint64 m_iNextFinished;
+	std::map<uint64, Batch_t *> m_Finished;
+	bool m_bFinishing;
+	bool m_bStopping;
+
+};
+
+CExpandPool::CExpandPool( uint32 cThreads, uint32 cMaxDepth, uint64 cubMaxExpanded )
+	: m_cMaxDepth( cMaxDepth ),
+	  m_cubMaxExpanded( cubMaxExpanded ),
+	  m_iNextWorker( 0 ),
+	  m_cQueued( 0 ),
+	  m_cInFlight( 0 ),
+	  m_cMaxInFlight( static_cast<uint64>( cThreads ) * k_cBatchesInFlightPerThread ),
+	  m_cSubmitted( 0 ),
+	  m_iNextFinished( 0 ),
+	  m_bFinishing( false ),
+	  m_bStopping( false )
+{
+	for ( uint32 iWorker = 0; iWorker < cThreads; iWorker++ )
+		m_Workers.emplace_back( new Worker_t );
+
+	for ( uint32 iWorker = 0; iWorker < cThreads; iWorker++ )
+		m_Threads.emplace_back( &CExpandPool::WorkerMain, this, iWorker );
+}
+
+CExpandPool::~CExpandPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_bStopping = true;
+	}
+
+	m_WorkCond.notify_all();
+
+	for ( std::thread &thread : m_Threads )
+		thread.join();
+
+	for ( const auto &finished : m_Finished )
+		delete finished.second;
+
+	for ( const std::unique_ptr<Worker_t> &pWorker : m_Workers )
+	{
+		for ( Batch_t *pBatch : pWorker->m_Batches )
+			delete pBatch;
+	}
+}
+
+void CExpandPool::Submit( Batch_t *pBatch )
+{
+	{
+		std::unique_lock<std::mutex> lock( m_Mutex );
+		m_SpaceCond.wait( lock, [ this ] { return m_cInFlight < m_cMaxInFlight; } );
+
+		pBatch->m_iBatch = m_cSubmitted++;
+		m_cInFlight++;
+	}
+
+	// round robin, stealing evens out whatever that gets wrong
+	Worker_t &worker = *m_Workers[ m_iNextWorker ];
+	m_iNextWorker = ( m_iNextWorker + 1 ) % m_Workers.size();
+
+	{
+		std::lock_guard<std::mutex> lock( worker.m_Mutex );
+		worker.m_Batches.push_back( pBatch );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_cQueued++;
+	}
+
+	m_WorkCond.notify_one();
+}
+
+Batch_t *CExpandPool::TakeFinished()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	m_FinishedCond.wait( lock, [ this ] { return m_Finished.count( m_iNextFinished ) != 0 || ( m_bFinishing && m_iNextFinished == m_cSubmitted ); } );
+
+	const auto itFinished = m_Finished.find( m_iNextFinished );
+
+	if ( itFinished == m_Finished.end() )
+		return nullptr;
+
+	Batch_t *pBatch = itFinished->second;
+
+	m_Finished.erase( itFinished );
+	m_iNextFinished++;
+	m_cInFlight--;
+
+	m_SpaceCond.notify_one();
+	return pBatch;
+}
+
+void CExpandPool::Finish()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_bFinishing = true;
+	}
+
+	m_FinishedCond.notify_all();
+}
+
+void CExpandPool::WorkerMain( uint32 iWorker )
+{
+	CCaptureMultiExpander expander( m_cMaxDepth, m_cubMaxExpanded );
+
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			m_WorkCond.wait( lock, [ this ] { return m_cQueued != 0 || m_bStopping; } );
+
+			if ( m_cQueued == 0 )
+				return;
+
+			// claims one batch, which is in some worker's queue by now
+			m_cQueued--;
+		}
+
+		Batch_t *pBatch = this->TakeWork( iWorker );
+
+		ExpandBatch( &expander, pBatch );
+
+		{
+			std::lock_guard<std::mutex> lock( m_Mutex );
+			m_Finished.emplace( pBatch->m_iBatch, pBatch );
+		}
+
+		m_FinishedCond.notify_all();
+	}
+}
+
+Batch_t *CExpandPool::TakeWork( uint32 iWorker )
+{
+	// our own queue first, then the others starting with our neighbour
+	for ( uint32 iOffset = 0; ; iOffset = ( iOffset + 1 ) % m_Workers.size() )
+	{
+		Worker_t &worker = *m_Workers[ ( iWorker + iOffset ) % m_Workers.size() ];
+
+		std::lock_guard<std::mutex> lock( worker.m_Mutex );
+
+		if ( !worker.m_Batches.empty() )
+		{
+			// oldest first, the writer is waiting for it
+			Batch_t *pBatch = worker.m_Batches.front();
+			worker.m_Batches.pop_front();
+
+			return pBatch;
+		}
+	}
+}
+
+
+static void PrintUsage( const char *szName )
+{
+	fprintf( stderr, "usage: %s <capture.0000.nhcap> <output base path> [--threads <count>] [--compression none|deflate|zstd] [--max-depth <count>] [--max-size <bytes>]\n", szName );
+}
+
+int main( int argc, char **argv )
+{
+	if ( argc < 3 )
+	{
+		PrintUsage( argv[ 0 ] );
+		return 1;
+	}
+
+	std::string basePath;
+
+	if ( !CaptureBasePathFromSegment( argv[ 1 ], &basePath ) )
+	{
+		fprintf( stderr, "%s does not look like a capture segment\n", argv[ 1 ] );
+		return 1;
+	}
+
+	uint32 cThreads = std::thread::hardware_concurrency();
+	ECaptureCodec eCompression = k_ECaptureCodecDeflate;
+	uint32 cMaxDepth = CCaptureMultiExpander::k_cDefaultMaxDepth;
+	uint64 cubMaxExpanded = CCaptureMultiExpander::k_cubDefaultMaxExpanded;
+
+	for ( int iArg = 3; iArg < argc; iArg += 2 )
+	{
+		const char *szOption = argv[ iArg ];
+		const char *szValue = ( iArg + 1 < argc ? argv[ iArg + 1 ] : "" );
+
+		bool bValid = true;
+
+		if ( strcmp( szOption, "--threads" ) == 0 )
+		{
+			bValid = CaptureParseCount( szValue, &cThreads ) && cThreads != 0;
+		}
+		else if ( strcmp( szOption, "--compression" ) == 0 )
+		{
+			if ( strcmp( szValue, "none" ) == 0 )
+				eCompression = k_ECaptureCodecNone;
+			else if ( strcmp( szValue, "deflate" ) == 0 )
+				eCompression = k_ECaptureCodecDeflate;
+			else if ( strcmp( szValue, "zstd" ) == 0 )
+				eCompression = k_ECaptureCodecZstd;
+			else
+				bValid = false;
+
+			// zstd is optional at build time
+			bValid = bValid && CaptureCodecAvailable( eCompression );
+		}
+		else if ( strcmp( szOption, "--max-depth" ) == 0 )
+		{
+			bValid = CaptureParseCount( szValue, &cMaxDepth ) && cMaxDepth != 0;
+		}
+		else if ( strcmp( szOption, "--max-size" ) == 0 )
+		{
+			bValid = CaptureParseSize( szValue, &cubMaxExpanded ) && cubMaxExpanded != 0;
+		}
+		else
+		{
+			bValid = false;
+		}
+
+		if ( !bValid )
+		{
+			fprintf( stderr, "Invalid option %s %s\n", szOption, szValue );
+			PrintUsage( argv[ 0 ] );
+			return 1;
+		}
+	}
+
+	if ( cThreads == 0 )
+		cThreads = 1;
+
+	CCaptureFileReader reader;
+
+	if ( !reader.Open( CaptureSegmentPath( basePath.c_str(), 0 ).c_str() ) )
+	{
+		fprintf( stderr, "Unable to open %s\n", argv[ 1 ] );
+		return 1;
+	}
+
+	CCaptureFileWriter writer( argv[ 2 ] );
+	writer.SetCompression( eCompression );
+
+	if ( !writer.Open( reader.GetHeader().m_ullTimestampBase, reader.GetHeader().m_ullWallClockBase ) )
+	{
+		fprintf( stderr, "Unable to create %s\n", CaptureSegmentPath( argv[ 2 ], 0 ).c_str() );
+		return 1;
+	}
+
+	CExpandPool pool( cThreads, cMaxDepth, cubMaxExpanded );
+
+	uint64 cMessages = 0;
+	uint64 cMultis = 0;
+	CaptureMultiStats_t stats = { };
+	std::vector<uint64> keptMultis;
+	bool bWriteFailed = false;
+
+	// writes the batches in order while the main thread keeps reading
+	std::thread writerThread( [ & ]
+	{
+		Batch_t *pBatch;
+
+		while ( ( pBatch = pool.TakeFinished() ) != nullptr )
+		{
+			for ( const BatchRecord_t &record : pBatch->m_Expanded )
+			{
+				CaptureRecordHeader_t header = record.m_Header;
+
+				if ( header.m_eType == k_ECaptureRecordMessage )
+					header.m_ullSequence = ++cMessages;
+
+				if ( !bWriteFailed && !writer.WriteRecord( header, pBatch->m_ExpandedPayloads.data() + record.m_ubPayload, header.m_cubData ) )
+				{
+					fprintf( stderr, "Unable to write to %s\n", argv[ 2 ] );
+					bWriteFailed = true;
+				}
+			}
+
+			cMultis += pBatch->m_cMultis;
+			stats.m_cMalformed += pBatch->m_Stats.m_cMalformed;
+			stats.m_cTruncated += pBatch->m_Stats.m_cTruncated;
+			stats.m_cCorrupt += pBatch->m_Stats.m_cCorrupt;
+			stats.m_cSkippedChildren += pBatch->m_Stats.m_cSkippedChildren;
+			stats.m_cTooDeep += pBatch->m_Stats.m_cTooDeep;
+			stats.m_bBudgetExceeded |= pBatch->m_Stats.m_bBudgetExceeded;
+			keptMultis.insert( keptMultis.end(), pBatch->m_KeptMultis.begin(), pBatch->m_KeptMultis.end() );
+
+			delete pBatch;
+		}
+	} );
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+
+	Batch_t *pBatch = new Batch_t();
+	uint32 cSegments = 0;
+
+	for ( uint32 unSegment = 0; ; unSegment++ )
+	{
+		if ( unSegment != 0 && !reader.Open( CaptureSegmentPath( basePath.c_str(), unSegment ).c_str() ) )
+			break;
+
+		cSegments++;
+
+		ECaptureReadResult eResult;
+
+		while ( ( eResult = reader.ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+		{
+			if ( header.m_eType == k_ECaptureRecordPadding )
+				continue;
+
+			AddRecord( &pBatch->m_Records, &pBatch->m_Payloads, header, payload.data(), static_cast<uint32>( payload.size() ) );
+
+			if ( pBatch->m_Records.size() >= k_cRecordsPerBatch || pBatch->m_Payloads.size() >= k_cubPerBatch )
+			{
+				pool.Submit( pBatch );
+				pBatch = new Batch_t();
+			}
+		}
+
+		if ( eResult == ECaptureReadResult::k_eCaptureReadCorrupt )
+			fprintf( stderr, "%s: stopping at damaged record at offset %llu\n", CaptureSegmentPath( basePath.c_str(), unSegment ).c_str(), static_cast<unsigned long long>( reader.Tell() ) );
+	}
+
+	if ( !pBatch->m_Records.empty() )
+		pool.Submit( pBatch );
+	else
+		delete pBatch;
+
+	pool.Finish();
+	writerThread.join();
+
+	writer.Close();
+
+	if ( bWriteFailed )
+		return 1;
+
+	if ( stats.m_cMalformed != 0 || stats.m_cCorrupt != 0 || stats.m_cTruncated != 0 )
+		fprintf( stderr, "%u malformed, %u corrupt and %u truncated Multis\n", stats.m_cMalformed, stats.m_cCorrupt, stats.m_cTruncated );
+
+	if ( stats.m_cSkippedChildren != 0 || stats.m_cTooDeep != 0 || stats.m_bBudgetExceeded )
+		fprintf( stderr, "Dropped %u oversized children and %u Multis nested too deeply%s\n", stats.m_cSkippedChildren, stats.m_cTooDeep, ( stats.m_bBudgetExceeded ? ", some Multis expanded past --max-size" : "" ) );
+
+	printf( "Expanded %llu Multis from %u segment(s) into %llu messages in %s\n", static_cast<unsigned long long>( cMultis ), cSegments, static_cast<unsigned long long>( cMessages ), CaptureSegmentPath( argv[ 2 ], 0 ).c_str() );
+
+	if ( keptMultis.empty() )
+		return 0;
+
+	fprintf( stderr, "Kept %zu Multi(s) that could not be expanded as they were, input sequence", keptMultis.size() );
+
+	for ( size_t iKept = 0; iKept < keptMultis.size() && iKept < 32; iKept++ )
+		fprintf( stderr, "%s %llu", ( iKept != 0 ? "," : "" ), static_cast<unsigned long long>( keptMultis[ iKept ] ) );
+
+	fprintf( stderr, "%s\n", ( keptMultis.size() > 32 ? " and more" : "" ) );
+	return 2;
+}
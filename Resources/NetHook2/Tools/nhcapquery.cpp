@@ -0,0 +1,291 @@
+
+// nhcapquery: lists the messages of a segmented .nhcap capture that match a filter, using the
+// .nhidx sidecar index of each segment instead of reading the capture. Segments without an
+// index, or with one older than the segment, are scanned once and get their index rebuilt.
+//
+// usage: nhcapquery <capture.0000.nhcap> [options]
+//
+//   --emsg <number|name>       only messages of this EMsg
+//   --seq <first>[-<last>]     only messages with a sequence number in this range
+//   --from <minutes>           only messages at least this long after the capture started
+//   --to <minutes>             only messages before this long after the capture started
+//
+// e.g. every ClientLogOnResponse after minute 40: nhcapquery capture.0000.nhcap --emsg ClientLogOnResponse --from 40
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "capturefile.h"
+#include "captureindex.h"
+
+#ifdef _WIN32
+	#define CaptureFileSeek _fseeki64
+	#define CaptureFileTell _ftelli64
+#else
+	#define CaptureFileSeek fseeko
+	#define CaptureFileTell ftello
+#endif
+
+
+static bool GetFileSize( const char *szPath, uint64 *pcubFile )
+{
+	FILE *pFile = fopen( szPath, "rb" );
+
+	if ( pFile == nullptr )
+		return false;
+
+	const bool bSeek = CaptureFileSeek( pFile, 0, SEEK_END ) == 0;
+	const int64 cubFile = CaptureFileTell( pFile );
+
+	fclose( pFile );
+
+	*pcubFile = static_cast<uint64>( cubFile );
+	return bSeek && cubFile >= 0;
+}
+
+// scans the segment and writes its index, like the capture writer would have
+static bool RebuildIndex( const std::string &segmentPath, const std::string &indexPath )
+{
+	CCaptureFileReader reader;
+
+	if ( !reader.Open( segmentPath.c_str() ) )
+		return false;
+
+	CCaptureIndexBuilder builder;
+	builder.Reset( reader.GetHeader().m_ullTimestampBase, reader.GetHeader().m_ullWallClockBase );
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+
+	uint64 ullOffset = reader.Tell();
+	ECaptureReadResult eResult;
+
+	while ( ( eResult = reader.ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+	{
+		builder.AddRecord( header, payload.data(), ullOffset );
+		ullOffset = reader.Tell();
+	}
+
+	if ( eResult == ECaptureReadResult::k_eCaptureReadCorrupt )
+		fprintf( stderr, "%s: indexing stopped at damaged record at offset %llu\n", segmentPath.c_str(), static_cast<unsigned long long>( ullOffset ) );
+
+	return builder.Save( indexPath.c_str(), ullOffset );
+}
+
+static bool LoadIndex( const std::string &segmentPath, const std::string &indexPath, CCaptureIndex *pIndex )
+{
+	uint64 cubSegment = 0;
+
+	if ( pIndex->Load( indexPath.c_str() ) && GetFileSize( segmentPath.c_str(), &cubSegment ) && cubSegment == pIndex->GetHeader().m_cubSegment )
+		return true;
+
+	return RebuildIndex( segmentPath, indexPath ) && pIndex->Load( indexPath.c_str() );
+}
+
+static bool ParseSequence( const char *szValue, char **pszEnd, uint64 *pullSequence )
+{
+	if ( *szValue < '0' || *szValue > '9' )
+		return false;
+
+	errno = 0;
+	*pullSequence = strtoull( szValue, pszEnd, 10 );
+
+	return errno != ERANGE;
+}
+
+// "<first>" or "<first>-<last>"
+static bool ParseSequenceRange( const char *szValue, uint64 *pullFirst, uint64 *pullLast )
+{
+	char *szEnd = nullptr;
+
+	if ( !ParseSequence( szValue, &szEnd, pullFirst ) )
+		return false;
+
+	*pullLast = *pullFirst;
+
+	if ( *szEnd == '-' && !ParseSequence( szEnd + 1, &szEnd, pullLast ) )
+		return false;
+
+	return *szEnd == '\0' && *pullFirst <= *pullLast;
+}
+
+// minutes since the capture started, in nanoseconds
+static bool ParseMinutes( const char *szValue, uint64 *pullTime )
+{
+	char *szEnd = nullptr;
+	const double flMinutes = strtod( szValue, &szEnd );
+
+	if ( szEnd == szValue || *szEnd != '\0' || !( flMinutes >= 0.0 && flMinutes * 60e9 < 1.8e19 ) )
+		return false;
+
+	*pullTime = static_cast<uint64>( flMinutes * 60e9 );
+	return true;
+}
+
+static void PrintUsage( const char *szName )
+{
+	fprintf( stderr, "usage: %s <capture.0000.nhcap> [--emsg <number|name>] [--seq <first>[-<last>]] [--from <minutes>] [--to <minutes>]\n", szName );
+}
+
+int main( int argc, char **argv )
+{
+	if ( argc < 2 )
+	{
+		PrintUsage( argv[ 0 ] );
+		return 1;
+	}
+
+	std::string basePath;
+
+	if ( !CaptureBasePathFromSegment( argv[ 1 ], &basePath ) )
+	{
+		fprintf( stderr, "%s does not look like a capture segment\n", argv[ 1 ] );
+		return 1;
+	}
+
+	const char *szEMsg = nullptr;
+	uint64 ullFirstSequence = 0;
+	uint64 ullLastSequence = UINT64_MAX;
+	uint64 ullFrom = 0;
+	uint64 ullTo = UINT64_MAX;
+
+	for ( int iArg = 2; iArg < argc; iArg += 2 )
+	{
+		const char *szOption = argv[ iArg ];
+		const bool bHasValue = ( iArg + 1 < argc );
+		const char *szValue = ( bHasValue ? argv[ iArg + 1 ] : "" );
+
+		bool bValid = bHasValue;
+
+		if ( strcmp( szOption, "--emsg" ) == 0 )
+		{
+			szEMsg = szValue;
+			bValid = bValid && *szValue != '\0';
+		}
+		else if ( strcmp( szOption, "--seq" ) == 0 )
+		{
+			bValid = bValid && ParseSequenceRange( szValue, &ullFirstSequence, &ullLastSequence );
+		}
+		else if ( strcmp( szOption, "--from" ) == 0 )
+		{
+			bValid = bValid && ParseMinutes( szValue, &ullFrom );
+		}
+		else if ( strcmp( szOption, "--to" ) == 0 )
+		{
+			bValid = bValid && ParseMinutes( szValue, &ullTo );
+		}
+		else
+		{
+			bValid = false;
+		}
+
+		if ( !bValid )
+		{
+			fprintf( stderr, "Invalid option %s %s\n", szOption, szValue );
+			PrintUsage( argv[ 0 ] );
+			return 1;
+		}
+	}
+
+	printf( "%-10s %12s  %-3s  %-6s  %-40s %10s  %s\n", "sequence", "time", "dir", "emsg", "name", "bytes", "location" );
+
+	// names are only stored in the index of segments that saw the name, hang on to the
+	// number once we found it
+	uint32 unEMsg = 0;
+
+	if ( szEMsg != nullptr )
+	{
+		char *szEnd = nullptr;
+		unEMsg = static_cast<uint32>( strtoul( szEMsg, &szEnd, 10 ) );
+
+		if ( *szEnd != '\0' )
+			unEMsg = 0;
+	}
+
+	std::vector<uint32> entries;
+
+	uint32 cSegments = 0;
+	uint64 cMatches = 0;
+
+	for ( uint32 unSegment = 0; ; unSegment++ )
+	{
+		const std::string segmentPath = CaptureSegmentPath( basePath.c_str(), unSegment );
+		const std::string indexPath = CaptureIndexPath( basePath.c_str(), unSegment );
+
+		CCaptureIndex index;
+
+		if ( !LoadIndex( segmentPath, indexPath, &index ) )
+			break;
+
+		cSegments++;
+
+		// every segment carries the clock bases of the capture's first one
+		const uint64 ullTimestampBase = index.GetHeader().m_ullTimestampBase;
+
+		uint32 iFirst = index.LowerBoundSequence( ullFirstSequence );
+		uint32 iEnd = ( ullLastSequence == UINT64_MAX ? index.GetNumEntries() : index.LowerBoundSequence( ullLastSequence + 1 ) );
+
+		if ( ullFrom != 0 && index.LowerBoundTimestamp( ullTimestampBase + ullFrom ) > iFirst )
+			iFirst = index.LowerBoundTimestamp( ullTimestampBase + ullFrom );
+
+		if ( ullTo != UINT64_MAX && index.LowerBoundTimestamp( ullTimestampBase + ullTo ) < iEnd )
+			iEnd = index.LowerBoundTimestamp( ullTimestampBase + ullTo );
+
+		if ( iFirst >= iEnd )
+			continue;
+
+		if ( szEMsg != nullptr )
+		{
+			if ( unEMsg == 0 )
+				unEMsg = index.FindMsgByName( szEMsg );
+
+			if ( unEMsg == 0 )
+				continue;
+
+			index.FindMsg( unEMsg, iFirst, iEnd, &entries );
+		}
+		else
+		{
+			entries.clear();
+
+			for ( uint32 iEntry = iFirst; iEntry < iEnd; iEntry++ )
+				entries.push_back( iEntry );
+		}
+
+		for ( uint32 iEntry : entries )
+		{
+			const CaptureIndexEntry_t &entry = index.GetEntry( iEntry );
+
+			uint32 cchName = 0;
+			const char *pchName = index.GetMsgName( entry.m_unEMsg, &cchName );
+
+			printf(
+				"%-10llu %12.3f  %-3s  %-6u  %-40.*s %10u  %s@%llu\n",
+				static_cast<unsigned long long>( entry.m_ullSequence ),
+				( entry.m_ullTimestamp - ullTimestampBase ) / 1e9,
+				( entry.m_eDirection == static_cast<uint8>( ENetDirection::k_eNetIncoming ) ? "in" : "out" ),
+				entry.m_unEMsg,
+				static_cast<int>( cchName ), ( pchName != nullptr ? pchName : "" ),
+				entry.m_cubData,
+				segmentPath.c_str(),
+				static_cast<unsigned long long>( entry.m_ullOffset )
+			);
+
+			cMatches++;
+		}
+	}
+
+	if ( cSegments == 0 )
+	{
+		fprintf( stderr, "Unable to open %s\n", argv[ 1 ] );
+		return 1;
+	}
+
+	fprintf( stderr, "%llu matching message(s) in %u segment(s)\n", static_cast<unsigned long long>( cMatches ), cSegments );
+	return 0;
+}
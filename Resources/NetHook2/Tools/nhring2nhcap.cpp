@@ -0,0 +1,67 @@
+
+// nhring2nhcap: takes a snapshot of a flight recorder ring, which may still be written to by
+// a live NetHook, and saves the records it holds as a regular .nhcap capture.
+//
+// usage: nhring2nhcap <flight.nhring> <output base path>
+//
+// the output is written to <output base path>.0000.nhcap and onwards
+
+#include <cstdio>
+#include <vector>
+
+#include "capturefile.h"
+#include "capturering.h"
+
+
+int main( int argc, char **argv )
+{
+	if ( argc < 3 )
+	{
+		fprintf( stderr, "usage: %s <flight.nhring> <output base path>\n", argv[ 0 ] );
+		return 1;
+	}
+
+	CCaptureRingReader reader;
+
+	if ( !reader.Snapshot( argv[ 1 ] ) )
+	{
+		fprintf( stderr, "Unable to take a consistent snapshot of %s\n", argv[ 1 ] );
+		return 1;
+	}
+
+	const CaptureRingHeader_t &ringHeader = reader.GetHeader();
+
+	CCaptureFileWriter writer( argv[ 2 ] );
+	writer.SetCompression( k_ECaptureCodecDeflate );
+
+	if ( !writer.Open( ringHeader.m_ullTimestampBase, ringHeader.m_ullWallClockBase ) )
+	{
+		fprintf( stderr, "Unable to create %s\n", CaptureSegmentPath( argv[ 2 ], 0 ).c_str() );
+		return 1;
+	}
+
+	CaptureRecordHeader_t header;
+	std::vector<uint8> payload;
+
+	uint64 cRecords = 0;
+	ECaptureReadResult eResult;
+
+	while ( ( eResult = reader.ReadRecord( &header, &payload ) ) == ECaptureReadResult::k_eCaptureReadOK )
+	{
+		if ( !writer.WriteRecord( header, payload.data(), static_cast<uint32>( payload.size() ) ) )
+		{
+			fprintf( stderr, "Unable to write to %s\n", argv[ 2 ] );
+			return 1;
+		}
+
+		cRecords++;
+	}
+
+	if ( eResult == ECaptureReadResult::k_eCaptureReadCorrupt )
+		fprintf( stderr, "%s: stopping at a damaged record\n", argv[ 1 ] );
+
+	writer.Close();
+
+	printf( "Wrote %llu records to %s\n", static_cast<unsigned long long>( cRecords ), CaptureSegmentPath( argv[ 2 ], 0 ).c_str() );
+	return 0;
+}